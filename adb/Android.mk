@@ -66,7 +66,7 @@ LOCAL_CFLAGS += -O2 -g -DADB_HOST=1  -Wall -Wno-unused-parameter
 LOCAL_CFLAGS += -D_XOPEN_SOURCE -D_GNU_SOURCE -DSH_HISTORY
 LOCAL_MODULE := adb
 
-LOCAL_STATIC_LIBRARIES := libzipfile libunz $(EXTRA_STATIC_LIBS)
+LOCAL_STATIC_LIBRARIES := libzipfile libunz libmincrypt $(EXTRA_STATIC_LIBS)
 ifeq ($(USE_SYSDEPS_WIN32),)
 	LOCAL_STATIC_LIBRARIES += libcutils
 endif
@@ -134,11 +134,11 @@ LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT_SBIN)
 LOCAL_UNSTRIPPED_PATH := $(TARGET_ROOT_OUT_SBIN_UNSTRIPPED)
 
 ifeq ($(TARGET_SIMULATOR),true)
-  LOCAL_STATIC_LIBRARIES := libcutils
+  LOCAL_STATIC_LIBRARIES := libcutils libmincrypt
   LOCAL_LDLIBS += -lpthread
   include $(BUILD_HOST_EXECUTABLE)
 else
-  LOCAL_STATIC_LIBRARIES := libcutils libc
+  LOCAL_STATIC_LIBRARIES := libcutils libc libmincrypt
   include $(BUILD_EXECUTABLE)
 endif
 
@@ -128,19 +128,72 @@ void  adb_trace_init(void)
 }
 
 
+/* apackets carry a MAX_PAYLOAD buffer, which is large enough that
+** the allocator would hand every one of them back to the system.
+** keep a few recently released packets around for reuse instead.
+*/
+#define APACKET_CACHE_MAX  16
+
+ADB_MUTEX_DEFINE( apacket_lock );
+static apacket*  apacket_cache;
+static int       apacket_cache_count;
+
 apacket *get_apacket(void)
 {
-    apacket *p = malloc(sizeof(apacket));
-    if(p == 0) fatal("failed to allocate an apacket");
+    apacket *p;
+
+    adb_mutex_lock(&apacket_lock);
+    p = apacket_cache;
+    if(p != 0) {
+        apacket_cache = p->next;
+        apacket_cache_count--;
+    }
+    adb_mutex_unlock(&apacket_lock);
+
+    if(p == 0) {
+        p = malloc(sizeof(apacket));
+        if(p == 0) fatal("failed to allocate an apacket");
+    }
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
     return p;
 }
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&apacket_lock);
+    if(apacket_cache_count < APACKET_CACHE_MAX) {
+        p->next = apacket_cache;
+        apacket_cache = p;
+        apacket_cache_count++;
+        p = 0;
+    }
+    adb_mutex_unlock(&apacket_lock);
+
     free(p);
 }
 
+/* the largest payload we are willing to accept from our peer. on the
+** host, ADB_MAX_PAYLOAD can lower it (down to the original 4096 bytes)
+** to compare transfer rates against the version 1 protocol.
+*/
+static unsigned local_max_payload(void)
+{
+#if ADB_HOST
+    const char*  env = getenv("ADB_MAX_PAYLOAD");
+
+    if (env != NULL) {
+        unsigned  max = strtoul(env, NULL, 0);
+
+        if (max < MAX_PAYLOAD_V1)
+            max = MAX_PAYLOAD_V1;
+        if (max > MAX_PAYLOAD)
+            max = MAX_PAYLOAD;
+        return max;
+    }
+#endif
+    return MAX_PAYLOAD;
+}
+
 void handle_online(void)
 {
     D("adb: online\n");
@@ -199,13 +252,47 @@ void print_packet(const char *label, apacket *p)
 }
 #endif
 
-static void send_ready(unsigned local, unsigned remote, atransport *t)
+/* the number of A_WRTEs we let each stream have in flight. on the
+** host, ADB_WRITE_WINDOW overrides it; 1 gives the original lockstep
+** behaviour.
+*/
+static unsigned local_write_window(void)
+{
+#if ADB_HOST
+    const char*  env = getenv("ADB_WRITE_WINDOW");
+
+    if (env != NULL) {
+        unsigned  window = strtoul(env, NULL, 0);
+
+        if (window < 1)
+            window = 1;
+        if (window > WRITE_WINDOW_MAX)
+            window = WRITE_WINDOW_MAX;
+        return window;
+    }
+#endif
+    return WRITE_WINDOW_DEFAULT;
+}
+
+/* acknowledge 'acked' A_WRTEs. a single write (or an A_OPEN, when
+** 'acked' is 0) is acknowledged with an empty A_OKAY as always; with a
+** write window, several writes may be acknowledged at once, and the
+** count is then sent as a 32-bit little endian payload.
+*/
+void send_ready(unsigned local, unsigned remote, unsigned acked, atransport *t)
 {
     D("Calling send_ready \n");
     apacket *p = get_apacket();
     p->msg.command = A_OKAY;
     p->msg.arg0 = local;
     p->msg.arg1 = remote;
+    if(acked > 1) {
+        p->data[0] = acked;
+        p->data[1] = acked >> 8;
+        p->data[2] = acked >> 16;
+        p->data[3] = acked >> 24;
+        p->msg.data_length = 4;
+    }
     send_packet(p, t);
 }
 
@@ -225,9 +312,9 @@ static void send_connect(atransport *t)
     apacket *cp = get_apacket();
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = A_VERSION;
-    cp->msg.arg1 = MAX_PAYLOAD;
-    snprintf((char*) cp->data, sizeof cp->data, "%s::",
-            HOST ? "host" : adb_device_banner);
+    cp->msg.arg1 = local_max_payload();
+    snprintf((char*) cp->data, MAX_PAYLOAD_V1, "%s::window=%u",
+            HOST ? "host" : adb_device_banner, local_write_window());
     cp->msg.data_length = strlen((char*) cp->data) + 1;
     send_packet(cp, t);
 #if ADB_HOST
@@ -255,6 +342,30 @@ static char *connection_state_name(atransport *t)
     }
 }
 
+/* the last field of the banner is informational for older peers. we
+** use it for a ';' separated list of "name=value" features.
+*/
+static void parse_banner_features(char *features, atransport *t)
+{
+    char *feature, *next;
+
+    t->write_window = 1;
+
+    for(feature = features; feature != NULL; feature = next) {
+        next = strchr(feature, ';');
+        if(next) *next++ = 0;
+
+        if(!strncmp(feature, "window=", 7)) {
+            unsigned window = strtoul(feature + 7, NULL, 10);
+            unsigned local = local_write_window();
+
+            t->write_window = (window < local) ? window : local;
+            if(t->write_window < 1) t->write_window = 1;
+        }
+    }
+    D("parse_banner: write window %d\n", t->write_window);
+}
+
 void parse_banner(char *banner, atransport *t)
 {
     char *type, *product, *end;
@@ -268,9 +379,10 @@ void parse_banner(char *banner, atransport *t)
         product = "";
     }
 
-        /* remove trailing ':' */
+        /* remove trailing ':' and pick up the features after it */
     end = strchr(product, ':');
-    if(end) *end = 0;
+    if(end) *end++ = 0;
+    parse_banner_features(end, t);
 
         /* save product name in device structure */
     if (t->product == NULL) {
@@ -319,6 +431,9 @@ void handle_packet(apacket *p, atransport *t)
             if(HOST) send_connect(t);
         } else {
             t->connection_state = CS_OFFLINE;
+            t->protocol_version = A_VERSION_MIN;
+            t->max_payload = MAX_PAYLOAD_V1;
+            t->write_window = 1;
             handle_offline(t);
             send_packet(p, t);
         }
@@ -330,6 +445,22 @@ void handle_packet(apacket *p, atransport *t)
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
+
+            /* both sides advertise the largest payload they accept,
+            ** so the smaller of the two is safe in either direction.
+            ** older peers always advertise MAX_PAYLOAD_V1.
+            */
+        t->protocol_version = (p->msg.arg0 < A_VERSION) ? p->msg.arg0 : A_VERSION;
+        t->max_payload = local_max_payload();
+        if(p->msg.arg1 < t->max_payload) {
+            t->max_payload = p->msg.arg1;
+        }
+        if(t->max_payload < MAX_PAYLOAD_V1) {
+            t->max_payload = MAX_PAYLOAD_V1;
+        }
+        D("adb: protocol version %08x, max payload %d\n",
+          t->protocol_version, t->max_payload);
+
         parse_banner((char*) p->data, t);
         handle_online();
         if(!HOST) send_connect(t);
@@ -345,7 +476,7 @@ void handle_packet(apacket *p, atransport *t)
             } else {
                 s->peer = create_remote_socket(p->msg.arg0, t);
                 s->peer->peer = s;
-                send_ready(s->id, s->peer->id, t);
+                send_ready(s->id, s->peer->id, 0, t);
                 s->ready(s);
             }
         }
@@ -357,6 +488,17 @@ void handle_packet(apacket *p, atransport *t)
                 if(s->peer == 0) {
                     s->peer = create_remote_socket(p->msg.arg0, t);
                     s->peer->peer = s;
+                } else {
+                        /* return the credits for the acknowledged writes */
+                    unsigned acked = 1;
+                    if(p->msg.data_length >= 4) {
+                        acked = p->data[0] | (p->data[1] << 8) |
+                                (p->data[2] << 16) | (p->data[3] << 24);
+                    }
+                    s->peer->write_credits += acked;
+                    if(s->peer->write_credits > t->write_window) {
+                        s->peer->write_credits = t->write_window;
+                    }
                 }
                 s->ready(s);
             }
@@ -375,11 +517,19 @@ void handle_packet(apacket *p, atransport *t)
         if(t->connection_state != CS_OFFLINE) {
             if((s = find_local_socket(p->msg.arg1))) {
                 unsigned rid = p->msg.arg0;
+                asocket *peer = s->peer;
                 p->len = p->msg.data_length;
 
+                    /* if the write can't be delivered right away, it is
+                    ** acknowledged by the peer's ready() once the local
+                    ** socket has drained its queue, together with any
+                    ** other writes that arrived in the meantime.
+                    */
+                if(peer) peer->writes_owed++;
                 if(s->enqueue(s, p) == 0) {
                     D("Enqueue the socket\n");
-                    send_ready(s->id, rid, t);
+                    send_ready(s->id, rid, peer ? peer->writes_owed : 1, t);
+                    if(peer) peer->writes_owed = 0;
                 }
                 return;
             }
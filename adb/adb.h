@@ -19,7 +19,8 @@
 
 #include <limits.h>
 
-#define MAX_PAYLOAD 4096
+#define MAX_PAYLOAD_V1  (4*1024)    // maxdata of A_VERSION_MIN peers
+#define MAX_PAYLOAD     (256*1024)  // largest maxdata we advertise
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -28,12 +29,16 @@
 #define A_CLSE 0x45534c43
 #define A_WRTE 0x45545257
 
-#define A_VERSION 0x01000000        // ADB protocol version
+#define WRITE_WINDOW_DEFAULT 8      // A_WRTEs a stream may have in flight
+#define WRITE_WINDOW_MAX     64
+
+#define A_VERSION_MIN 0x01000000    // First ADB protocol version
+#define A_VERSION 0x01000001        // ADB protocol version (negotiated maxdata)
 
 #define ADB_VERSION_MAJOR 1         // Used for help/version information
 #define ADB_VERSION_MINOR 0         // Used for help/version information
 
-#define ADB_SERVER_VERSION    22    // Increment this when we want to force users to start a new adb server
+#define ADB_SERVER_VERSION    23    // Increment this when we want to force users to start a new adb server
 
 typedef struct amessage amessage;
 typedef struct apacket apacket;
@@ -120,6 +125,14 @@ struct asocket {
         */
     void (*close)(asocket *s);
 
+        /* windowed flow control, only used by remote asockets:
+        ** the number of A_WRTEs we may still send before waiting
+        ** for an A_OKAY, and the number of A_WRTEs received from
+        ** the remote side that we have not acknowledged yet
+        */
+    unsigned write_credits;
+    unsigned writes_owed;
+
         /* socket-type-specific extradata */
     void *extra;
 
@@ -176,6 +189,17 @@ struct atransport
     int connection_state;
     transport_type type;
 
+        /* negotiated in the CONNECT exchange: the protocol version and
+        ** the largest payload both ends agreed to accept
+        */
+    unsigned protocol_version;
+    unsigned max_payload;
+
+        /* A_WRTEs a stream may have outstanding, advertised as
+        ** "window=<n>" in the CONNECT banner. 1 for older peers.
+        */
+    unsigned write_window;
+
         /* usb handle or socket fd as needed */
     usb_handle *usb;
     int sfd;
@@ -228,6 +252,7 @@ asocket *create_local_socket(int fd);
 asocket *create_local_service_socket(const char *destination);
 
 asocket *create_remote_socket(unsigned id, atransport *t);
+void send_ready(unsigned local, unsigned remote, unsigned acked, atransport *t);
 void connect_to_remote(asocket *s, const char *destination);
 void connect_to_smartsocket(asocket *s);
 
@@ -76,8 +76,10 @@ static fdevent list_pending = {
 static fdevent **fd_table = 0;
 static int fd_table_max = 0;
 
-#ifdef CRAPTASTIC
-//HAVE_EPOLL
+/* epoll is used wherever the platform has it. define FDEVENT_USE_SELECT
+** to build the portable select() backend instead.
+*/
+#if defined(HAVE_EPOLL) && !defined(FDEVENT_USE_SELECT)
 
 #include <sys/epoll.h>
 
@@ -85,7 +87,7 @@ static int epoll_fd = -1;
 
 static void fdevent_init()
 {
-        /* XXX: what's a good size for the passed in hint? */
+        /* the size is only a hint, the kernel grows the set as needed */
     epoll_fd = epoll_create(256);
 
     if(epoll_fd < 0) {
@@ -99,33 +101,21 @@ static void fdevent_init()
 
 static void fdevent_connect(fdevent *fde)
 {
-    struct epoll_event ev;
-
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
-
-#if 0
-    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-        perror("epoll_ctl() failed\n");
-        exit(1);
-    }
-#endif
+        /* nothing to do until we are told which events to
+        ** watch for, see fdevent_update()
+        */
 }
 
 static void fdevent_disconnect(fdevent *fde)
 {
     struct epoll_event ev;
 
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
-
-        /* technically we only need to delete if we
-        ** were actively monitoring events, but let's
-        ** be aggressive and do it anyway, just in case
-        ** something's out of sync
+        /* only fds that are watching events are in the epoll set.
+        ** this must happen before the fd is closed.
         */
+    if((fde->state & FDE_EVENTMASK) == 0) return;
+
+    memset(&ev, 0, sizeof(ev));
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev);
 }
 
@@ -191,7 +181,10 @@ static void fdevent_process()
 
     for(i = 0; i < n; i++) {
         struct epoll_event *ev = events + i;
+        unsigned wanted;
+
         fde = ev->data.ptr;
+        wanted = fde->state & FDE_EVENTMASK;
 
         if(ev->events & EPOLLIN) {
             fde->events |= FDE_READ;
@@ -200,8 +193,13 @@ static void fdevent_process()
             fde->events |= FDE_WRITE;
         }
         if(ev->events & (EPOLLERR | EPOLLHUP)) {
-            fde->events |= FDE_ERROR;
+                /* epoll always reports these. do what select() does
+                ** and make the fd readable/writable, so the callback
+                ** sees the EOF or error on its next read or write.
+                */
+            fde->events |= wanted & (FDE_READ | FDE_WRITE | FDE_ERROR);
         }
+        fde->events &= wanted;
         if(fde->events) {
             if(fde->state & FDE_PENDING) continue;
             fde->state |= FDE_PENDING;
@@ -337,7 +335,7 @@ static void fdevent_register(fdevent *fde)
         if(fd_table == 0) {
             FATAL("could not expand fd_table to %d entries\n", fd_table_max);
         }
-        memset(fd_table + oldmax, 0, sizeof(int) * (fd_table_max - oldmax));
+        memset(fd_table + oldmax, 0, sizeof(fdevent*) * (fd_table_max - oldmax));
     }
 
     fd_table[fde->fd] = fde;
@@ -32,9 +32,19 @@
 #include "file_sync_service.h"
 
 
-static unsigned total_bytes;
+static long long total_bytes;
 static long long start_time;
 
+/* guards the byte count and the work queue of parallel copies */
+ADB_MUTEX_DEFINE( sync_lock );
+
+static void add_bytes(unsigned count)
+{
+    adb_mutex_lock(&sync_lock);
+    total_bytes += count;
+    adb_mutex_unlock(&sync_lock);
+}
+
 static long long NOW()
 {
     struct timeval tv;
@@ -57,8 +67,8 @@ static void END()
     if (t == 0)  /* prevent division by 0 :-) */
         t = 1000000;
 
-    fprintf(stderr,"%lld KB/s (%d bytes in %lld.%03llds)\n",
-            ((((long long) total_bytes) * 1000000LL) / t) / 1024LL,
+    fprintf(stderr,"%lld KB/s (%lld bytes in %lld.%03llds)\n",
+            ((total_bytes * 1000000LL) / t) / 1024LL,
             total_bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL);
 }
 
@@ -148,22 +158,6 @@ int sync_readtime(int fd, const char *path, unsigned *timestamp)
     return 0;
 }
 
-static int sync_start_readtime(int fd, const char *path)
-{
-    syncmsg msg;
-    int len = strlen(path);
-
-    msg.req.id = ID_STAT;
-    msg.req.namelen = htoll(len);
-
-    if(writex(fd, &msg.req, sizeof(msg.req)) ||
-       writex(fd, path, len)) {
-        return -1;
-    }
-
-    return 0;
-}
-
 static int sync_finish_readtime(int fd, unsigned int *timestamp,
                                 unsigned int *mode, unsigned int *size)
 {
@@ -237,7 +231,7 @@ static int write_data_file(int fd, const char *path, syncsendbuf *sbuf)
             err = -1;
             break;
         }
-        total_bytes += ret;
+        add_bytes(ret);
     }
 
     adb_close(lfd);
@@ -263,7 +257,7 @@ static int write_data_buffer(int fd, char* file_buffer, int size, syncsendbuf *s
             break;
         }
         total += count;
-        total_bytes += count;
+        add_bytes(count);
     }
 
     return err;
@@ -288,18 +282,376 @@ static int write_data_link(int fd, const char *path, syncsendbuf *sbuf)
     if(ret)
         return -1;
 
-    total_bytes += len + 1;
+    add_bytes(len + 1);
 
     return 0;
 }
 #endif
 
-static int sync_send(int fd, const char *lpath, const char *rpath,
-                     unsigned mtime, mode_t mode, int verifyApk)
+/* write a request header and its path with a single write, so that
+** pipelined requests don't stall behind Nagle's algorithm on the way to
+** the adb server.
+*/
+static int sync_write_request(int fd, unsigned id, const char *path,
+                              const char *suffix)
+{
+    char buf[sizeof(syncmsg) + 1024 + 64];
+    syncmsg *msg = (syncmsg *)buf;
+    int len = strlen(path);
+    int slen = strlen(suffix);
+
+    if(len > 1024 || slen > 64) return -1;
+
+    msg->req.id = id;
+    msg->req.namelen = htoll(len + slen);
+    memcpy(buf + sizeof(msg->req), path, len);
+    memcpy(buf + sizeof(msg->req) + len, suffix, slen);
+
+    return writex(fd, buf, sizeof(msg->req) + len + slen);
+}
+
+/* --- delta pushes ---
+**
+** a regular file of SYNC_DELTA_MIN bytes or more that already exists on
+** the device is sent as a delta: SIGN fetches the weak and strong (SHA-1)
+** checksums of the blocks of the remote file, the weak checksum is rolled
+** along the local file one byte at a time, and whatever matches a remote
+** block goes out as a COPY of it instead of as DATA.
+*/
+
+#define SYNC_DELTA_MIN  (1024*1024)
+
+static int sync_delta = -1;
+
+/* older devices drop the connection on a SIGN request, so ask once on a
+** connection of our own. ADB_SYNC_DELTA=0 turns delta pushes off.
+*/
+static void sync_delta_probe(void)
 {
+    const char *env = getenv("ADB_SYNC_DELTA");
     syncmsg msg;
-    int len, r;
-    syncsendbuf *sbuf = &send_buffer;
+    int fd;
+
+    if(sync_delta >= 0) return;
+    sync_delta = 0;
+
+    if(env != NULL && !strcmp(env, "0")) return;
+
+    fd = adb_connect("sync:");
+    if(fd < 0) return;
+
+    if(!sync_write_request(fd, ID_SIGN, "", "") &&
+       !readx(fd, &msg.sigs, sizeof(msg.sigs)) && msg.sigs.id == ID_SIGS) {
+        sync_delta = 1;
+        sync_quit(fd);
+    }
+    adb_close(fd);
+}
+
+typedef struct syncdelta syncdelta;
+
+struct syncdelta
+{
+    int fd;
+    syncsendbuf *sbuf;
+
+    unsigned blocksize;
+    unsigned count;
+    unsigned lastlen;
+    syncsig *sigs;
+    int *head;
+    int *next;
+    unsigned mask;
+
+    unsigned run_offset;
+    unsigned run_size;
+    long long sent;
+};
+
+static unsigned delta_hash(syncdelta *d, unsigned weak)
+{
+    return (weak ^ (weak >> 13)) & d->mask;
+}
+
+static unsigned delta_block_len(syncdelta *d, unsigned k)
+{
+    return (k == d->count - 1) ? d->lastlen : d->blocksize;
+}
+
+static int delta_is_block(syncdelta *d, unsigned k, unsigned weak,
+                          const uint8_t *digest, unsigned len)
+{
+    return d->sigs[k].weak == weak && delta_block_len(d, k) == len &&
+           !memcmp(d->sigs[k].strong, digest, SHA_DIGEST_SIZE);
+}
+
+/* find a remote block of length 'len' with the given checksums,
+** preferring the one right after the last block we matched so that
+** runs of identical blocks still coalesce into a single COPY.
+*/
+static int delta_match(syncdelta *d, unsigned weak,
+                       const unsigned char *p, unsigned len)
+{
+    uint8_t digest[SHA_DIGEST_SIZE];
+    int k;
+
+    for(k = d->head[delta_hash(d, weak)]; k >= 0; k = d->next[k]) {
+        if(d->sigs[k].weak == weak && delta_block_len(d, k) == len)
+            break;
+    }
+    if(k < 0)
+        return -1;
+
+    SHA(p, len, digest);
+
+    if(d->run_size > 0) {
+        unsigned prefer = (d->run_offset + d->run_size) / d->blocksize;
+        if(prefer < d->count && delta_is_block(d, prefer, weak, digest, len))
+            return prefer;
+    }
+    for(; k >= 0; k = d->next[k]) {
+        if(delta_is_block(d, k, weak, digest, len))
+            return k;
+    }
+    return -1;
+}
+
+static int delta_flush_run(syncdelta *d)
+{
+    syncmsg msg;
+
+    if(d->run_size == 0)
+        return 0;
+
+    msg.copy.id = ID_COPY;
+    msg.copy.offset = htoll(d->run_offset);
+    msg.copy.size = htoll(d->run_size);
+    d->run_size = 0;
+    return writex(d->fd, &msg.copy, sizeof(msg.copy));
+}
+
+static int delta_literal(syncdelta *d, unsigned char *p, unsigned len)
+{
+    if(len == 0)
+        return 0;
+    if(delta_flush_run(d))
+        return -1;
+    d->sent += len;
+    return write_data_buffer(d->fd, (char *) p, len, d->sbuf);
+}
+
+static int delta_copy(syncdelta *d, int k, unsigned len)
+{
+    unsigned offset = k * d->blocksize;
+
+    if(d->run_size > 0 && d->run_offset + d->run_size == offset) {
+        d->run_size += len;
+        return 0;
+    }
+    if(delta_flush_run(d))
+        return -1;
+    d->run_offset = offset;
+    d->run_size = len;
+    return 0;
+}
+
+/* stream the local file as DATA and COPY messages. the buffer holds the
+** unsent literal bytes (never more than SYNC_DATA_MAX) followed by at
+** least one block and the byte after it, until the end of the file.
+*/
+static int delta_stream(syncdelta *d, int lfd, const char *lpath)
+{
+    unsigned bs = d->blocksize;
+    unsigned bufsize = 2 * SYNC_DATA_MAX + 2 * bs;
+    unsigned char *buf = malloc(bufsize);
+    unsigned filled = 0, pos = 0, lit = 0;
+    unsigned a = 0, b = 0;
+    int have_sum = 0, eof = 0;
+    int k;
+
+    if(buf == NULL) {
+        fprintf(stderr,"out of memory\n");
+        return -1;
+    }
+
+    for(;;) {
+        if(!eof && filled <= pos + bs) {
+            memmove(buf, buf + lit, filled - lit);
+            filled -= lit;
+            pos -= lit;
+            lit = 0;
+            while(!eof && filled < bufsize) {
+                int r = adb_read(lfd, buf + filled, bufsize - filled);
+                if(r < 0 && errno == EINTR)
+                    continue;
+                if(r < 0)
+                    fprintf(stderr,"cannot read '%s': %s\n", lpath, strerror(errno));
+                if(r <= 0)
+                    eof = 1;
+                else
+                    filled += r;
+            }
+        }
+
+        if(filled - pos < bs) {
+                /* the tail might still be the short last remote block */
+            unsigned tail = filled - d->lastlen;
+            if(d->lastlen < bs && d->lastlen <= filled - pos &&
+               (k = delta_match(d, sync_weak_sum(buf + tail, d->lastlen),
+                                buf + tail, d->lastlen)) >= 0) {
+                if(delta_literal(d, buf + lit, tail - lit) ||
+                   delta_copy(d, k, d->lastlen))
+                    goto fail;
+                lit = filled;
+            }
+            break;
+        }
+
+        if(!have_sum) {
+            unsigned i;
+            a = b = 0;
+            for(i = 0; i < bs; i++) {
+                a += buf[pos + i];
+                b += (bs - i) * buf[pos + i];
+            }
+            have_sum = 1;
+        }
+
+        k = delta_match(d, (a & 0xffff) | (b << 16), buf + pos, bs);
+        if(k >= 0) {
+            if(delta_literal(d, buf + lit, pos - lit) ||
+               delta_copy(d, k, bs))
+                goto fail;
+            pos += bs;
+            lit = pos;
+            have_sum = 0;
+            continue;
+        }
+
+        if(pos + bs == filled) {
+                /* nothing left to roll in, the rest can only match
+                ** as the short last block */
+            pos++;
+            have_sum = 0;
+            continue;
+        }
+
+        a += buf[pos + bs] - buf[pos];
+        b += a - bs * buf[pos];
+        pos++;
+
+        if(pos - lit >= SYNC_DATA_MAX) {
+            if(delta_literal(d, buf + lit, SYNC_DATA_MAX))
+                goto fail;
+            lit += SYNC_DATA_MAX;
+        }
+    }
+
+    if(delta_literal(d, buf + lit, filled - lit) || delta_flush_run(d))
+        goto fail;
+
+    free(buf);
+    return 0;
+
+fail:
+    free(buf);
+    return -1;
+}
+
+/* push 'lpath' as a delta against the existing 'rpath'. returns 1 if
+** the file is better sent whole, in which case only the SIGN exchange
+** has happened, -1 on protocol failure, and 0 once everything but the
+** final DONE has been written.
+*/
+static int sync_send_delta(int fd, const char *lpath, const char *rpath,
+                           const char *suffix, syncsendbuf *sbuf)
+{
+    syncmsg msg;
+    syncdelta d;
+    long long size;
+    unsigned i;
+    int lfd, ret = -1;
+
+    if(sync_delta <= 0)
+        return 1;
+
+    lfd = adb_open(lpath, O_RDONLY);
+    if(lfd < 0)
+        return 1;
+    size = adb_lseek(lfd, 0, SEEK_END);
+    if(size < SYNC_DELTA_MIN || size > 0xffffffffLL ||
+       adb_lseek(lfd, 0, SEEK_SET) != 0) {
+        adb_close(lfd);
+        return 1;
+    }
+
+    memset(&d, 0, sizeof(d));
+    d.fd = fd;
+    d.sbuf = sbuf;
+
+    if(sync_write_request(fd, ID_SIGN, rpath, "") ||
+       readx(fd, &msg.sigs, sizeof(msg.sigs)) || msg.sigs.id != ID_SIGS)
+        goto done;
+
+    d.blocksize = ltohl(msg.sigs.blocksize);
+    d.count = ltohl(msg.sigs.count);
+    if(d.count == 0) {
+        ret = 1;
+        goto done;
+    }
+    if(d.blocksize == 0 || d.blocksize > SYNC_DATA_MAX ||
+       d.count != (ltohl(msg.sigs.size) + d.blocksize - 1) / d.blocksize)
+        goto done;
+    d.lastlen = ltohl(msg.sigs.size) - (d.count - 1) * d.blocksize;
+
+    for(d.mask = 1; d.mask < d.count; d.mask <<= 1)
+        ;
+    d.sigs = malloc(d.count * sizeof(syncsig));
+    d.next = malloc(d.count * sizeof(int));
+    d.head = malloc(d.mask * sizeof(int));
+    if(d.sigs == NULL || d.next == NULL || d.head == NULL) {
+        fprintf(stderr,"out of memory\n");
+        goto done;
+    }
+    if(readx(fd, d.sigs, d.count * sizeof(syncsig)))
+        goto done;
+
+    d.mask--;
+    for(i = 0; i <= d.mask; i++)
+        d.head[i] = -1;
+    for(i = d.count; i-- > 0; ) {
+        unsigned h;
+        d.sigs[i].weak = ltohl(d.sigs[i].weak);
+        h = delta_hash(&d, d.sigs[i].weak);
+        d.next[i] = d.head[h];
+        d.head[h] = i;
+    }
+
+    if(sync_write_request(fd, ID_DLTA, rpath, suffix) ||
+       delta_stream(&d, lfd, lpath))
+        goto done;
+
+    fprintf(stderr,"delta: %s: sent %lld of %lld bytes\n", lpath, d.sent, size);
+    ret = 0;
+
+done:
+    free(d.sigs);
+    free(d.next);
+    free(d.head);
+    adb_close(lfd);
+    return ret;
+}
+
+/* write a SEND request and the whole file to the sync service. the
+** status is read back separately by sync_send_status(), so that the
+** next file can already be on its way while the device finishes this one.
+*/
+static int sync_send_request(int fd, const char *lpath, const char *rpath,
+                             unsigned mtime, mode_t mode, int verifyApk,
+                             syncsendbuf *sbuf)
+{
+    syncmsg msg;
+    int len;
     char* file_buffer = NULL;
     int size = 0;
     char tmp[64];
@@ -308,7 +660,6 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     if(len > 1024) goto fail;
 
     snprintf(tmp, sizeof(tmp), ",%d", mode);
-    r = strlen(tmp);
 
     if (verifyApk) {
         int lfd;
@@ -367,11 +718,15 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
         }
     }
 
-    msg.req.id = ID_SEND;
-    msg.req.namelen = htoll(len + r);
+    if(!file_buffer && S_ISREG(mode)) {
+        int r = sync_send_delta(fd, lpath, rpath, tmp, sbuf);
+        if(r < 0)
+            goto fail;
+        if(r == 0)
+            goto done;
+    }
 
-    if(writex(fd, &msg.req, sizeof(msg.req)) ||
-       writex(fd, rpath, len) || writex(fd, tmp, r)) {
+    if(sync_write_request(fd, ID_SEND, rpath, tmp)) {
         free(file_buffer);
         goto fail;
     }
@@ -388,11 +743,26 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     else
         goto fail;
 
+done:
     msg.data.id = ID_DONE;
     msg.data.size = htoll(mtime);
     if(writex(fd, &msg.data, sizeof(msg.data)))
         goto fail;
 
+    return 0;
+
+fail:
+    fprintf(stderr,"protocol failure\n");
+    adb_close(fd);
+    return -1;
+}
+
+static int sync_send_status(int fd, const char *lpath, const char *rpath,
+                            syncsendbuf *sbuf)
+{
+    syncmsg msg;
+    int len;
+
     if(readx(fd, &msg.status, sizeof(msg.status)))
         return -1;
 
@@ -412,11 +782,17 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     }
 
     return 0;
+}
 
-fail:
-    fprintf(stderr,"protocol failure\n");
-    adb_close(fd);
-    return -1;
+static int sync_send(int fd, const char *lpath, const char *rpath,
+                     unsigned mtime, mode_t mode, int verifyApk)
+{
+    int r = sync_send_request(fd, lpath, rpath, mtime, mode, verifyApk,
+                              &send_buffer);
+    if(r)
+        return r;
+
+    return sync_send_status(fd, lpath, rpath, &send_buffer);
 }
 
 static int mkdirs(char *name)
@@ -438,24 +814,20 @@ static int mkdirs(char *name)
     return 0;
 }
 
-int sync_recv(int fd, const char *rpath, const char *lpath)
+static int sync_recv_request(int fd, const char *rpath)
+{
+    return sync_write_request(fd, ID_RECV, rpath, "");
+}
+
+static int sync_recv_data(int fd, const char *rpath, const char *lpath,
+                          syncsendbuf *sbuf)
 {
     syncmsg msg;
     int len;
     int lfd = -1;
-    char *buffer = send_buffer.data;
+    char *buffer = sbuf->data;
     unsigned id;
 
-    len = strlen(rpath);
-    if(len > 1024) return -1;
-
-    msg.req.id = ID_RECV;
-    msg.req.namelen = htoll(len);
-    if(writex(fd, &msg.req, sizeof(msg.req)) ||
-       writex(fd, rpath, len)) {
-        return -1;
-    }
-
     if(readx(fd, &msg.data, sizeof(msg.data))) {
         return -1;
     }
@@ -501,7 +873,7 @@ int sync_recv(int fd, const char *rpath, const char *lpath)
             return -1;
         }
 
-        total_bytes += len;
+        add_bytes(len);
     }
 
     adb_close(lfd);
@@ -527,6 +899,14 @@ remote_error:
     return 0;
 }
 
+int sync_recv(int fd, const char *rpath, const char *lpath)
+{
+    if(sync_recv_request(fd, rpath))
+        return -1;
+
+    return sync_recv_data(fd, rpath, lpath, &send_buffer);
+}
+
 
 
 /* --- */
@@ -598,6 +978,298 @@ copyinfo *mkcopyinfo(const char *spath, const char *dpath,
 }
 
 
+/* --- parallel copies ---
+**
+** directory pushes and pulls spread the file list over several sync
+** connections (ADB_SYNC_JOBS, default SYNC_JOBS_DEFAULT), each of which
+** keeps up to SYNC_PIPELINE_DEPTH files in flight: the next request is
+** written before the status or data of the previous one is read, so
+** small files no longer cost a round-trip each.
+*/
+
+#define SYNC_JOBS_DEFAULT    4
+#define SYNC_JOBS_MAX        16
+#define SYNC_PIPELINE_DEPTH  4
+#define SYNC_STAT_BATCH      256
+
+typedef struct syncjob syncjob;
+
+struct syncjob
+{
+    int fd;
+    int push;
+    int files;
+    int failed;
+    int done_fd;
+    syncsendbuf *sbuf;
+};
+
+static copyinfo *sync_queue;
+static int sync_failed;
+
+static int sync_jobs(void)
+{
+    const char *env = getenv("ADB_SYNC_JOBS");
+    int jobs = SYNC_JOBS_DEFAULT;
+
+    if(env != NULL)
+        jobs = atoi(env);
+    if(jobs < 1)
+        jobs = 1;
+    if(jobs > SYNC_JOBS_MAX)
+        jobs = SYNC_JOBS_MAX;
+    return jobs;
+}
+
+static copyinfo *sync_next_file(void)
+{
+    copyinfo *ci;
+
+    adb_mutex_lock(&sync_lock);
+    ci = sync_failed ? NULL : sync_queue;
+    if(ci != NULL)
+        sync_queue = ci->next;
+    adb_mutex_unlock(&sync_lock);
+    return ci;
+}
+
+static int sync_job_start(syncjob *job, copyinfo *ci)
+{
+    if(job->push) {
+        fprintf(stderr,"push: %s -> %s\n", ci->src, ci->dst);
+        return sync_send_request(job->fd, ci->src, ci->dst, ci->time,
+                                 ci->mode, 0 /* no verify APK */, job->sbuf);
+    } else {
+        fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
+        return sync_recv_request(job->fd, ci->src);
+    }
+}
+
+static int sync_job_finish(syncjob *job, copyinfo *ci)
+{
+    if(job->push)
+        return sync_send_status(job->fd, ci->src, ci->dst, job->sbuf);
+    else
+        return sync_recv_data(job->fd, ci->src, ci->dst, job->sbuf);
+}
+
+static void *sync_job_thread(void *_job)
+{
+    syncjob *job = _job;
+    copyinfo *inflight[SYNC_PIPELINE_DEPTH];
+    copyinfo *ci, *waiting = NULL;
+    int head = 0, count = 0;
+
+    for(;;) {
+        ci = waiting;
+        waiting = NULL;
+        if(ci == NULL && !job->failed && count < SYNC_PIPELINE_DEPTH)
+            ci = sync_next_file();
+
+            /* a delta push starts with a SIGN round-trip, which
+            ** has to wait until the pipeline has drained */
+        if(ci != NULL && count > 0 && job->push &&
+           sync_delta > 0 && ci->size >= SYNC_DELTA_MIN) {
+            waiting = ci;
+            ci = NULL;
+        }
+
+        if(ci != NULL) {
+            if(job->failed) {
+                free(ci);
+                continue;
+            }
+            if(sync_job_start(job, ci)) {
+                job->failed = 1;
+                free(ci);
+            } else {
+                inflight[(head + count++) % SYNC_PIPELINE_DEPTH] = ci;
+            }
+            continue;
+        }
+
+        if(count == 0)
+            break;
+
+            /* queue empty, pipeline full or draining: complete the oldest file */
+        ci = inflight[head];
+        head = (head + 1) % SYNC_PIPELINE_DEPTH;
+        count--;
+        if(!job->failed) {
+            if(sync_job_finish(job, ci))
+                job->failed = 1;
+            else
+                job->files++;
+        }
+        free(ci);
+    }
+
+    if(job->failed) {
+        adb_mutex_lock(&sync_lock);
+        sync_failed = 1;
+        adb_mutex_unlock(&sync_lock);
+    }
+
+    if(job->done_fd >= 0)
+        adb_write(job->done_fd, "", 1);
+    return 0;
+}
+
+/* copy every file of the list, freeing the entries as it goes. 'fd' is
+** the caller's sync connection, which is used as the first job and left
+** open; the extra connections are closed here. returns -1 if any job
+** failed.
+*/
+static int sync_copy_list(int fd, copyinfo *filelist, int push, int *copied)
+{
+    syncjob jobs[SYNC_JOBS_MAX];
+    adb_thread_t thread;
+    int done[2] = { -1, -1 };
+    int count = sync_jobs();
+    int i, started = 1;
+    int ret = 0;
+    char c;
+
+    sync_queue = filelist;
+    sync_failed = 0;
+
+    if(count > 1 && adb_socketpair(done)) {
+        count = 1;
+    }
+
+    for(i = 0; i < count; i++) {
+        jobs[i].fd = fd;
+        jobs[i].push = push;
+        jobs[i].files = 0;
+        jobs[i].failed = 0;
+        jobs[i].done_fd = -1;
+        jobs[i].sbuf = &send_buffer;
+        if(i == 0)
+            continue;
+
+        jobs[i].fd = adb_connect("sync:");
+        jobs[i].sbuf = malloc(sizeof(syncsendbuf));
+        if(jobs[i].fd < 0 || jobs[i].sbuf == NULL) {
+            if(jobs[i].fd >= 0)
+                adb_close(jobs[i].fd);
+            free(jobs[i].sbuf);
+            break;
+        }
+        jobs[i].done_fd = done[1];
+        if(adb_thread_create(&thread, sync_job_thread, &jobs[i])) {
+            adb_close(jobs[i].fd);
+            free(jobs[i].sbuf);
+            break;
+        }
+        started++;
+    }
+
+    sync_job_thread(&jobs[0]);
+
+    for(i = 1; i < started; i++) {
+        if(readx(done[0], &c, 1))
+            break;
+    }
+    if(done[0] >= 0) {
+        adb_close(done[0]);
+        adb_close(done[1]);
+    }
+
+    *copied = 0;
+    for(i = 0; i < started; i++) {
+        *copied += jobs[i].files;
+        if(jobs[i].failed) {
+            ret = -1;
+        } else if(i > 0) {
+            sync_quit(jobs[i].fd);
+            adb_close(jobs[i].fd);
+        }
+        if(i > 0)
+            free(jobs[i].sbuf);
+    }
+
+        /* whatever the jobs didn't get to after a failure */
+    while((filelist = sync_queue) != NULL) {
+        sync_queue = filelist->next;
+        free(filelist);
+    }
+
+    if(started > 1)
+        fprintf(stderr, "%d parallel sync connections\n", started);
+    return ret;
+}
+
+/* ask for the remote timestamp of every file in the list. the STAT
+** requests are written in batches, so that a large tree costs neither a
+** round-trip nor a packet per file, and at most SYNC_STAT_BATCH replies
+** are outstanding at once so the replies can't back up into our writes.
+*/
+static int sync_stat_list(int fd, copyinfo *filelist)
+{
+    char *batch = send_buffer.data;
+    copyinfo *ci, *sent = filelist;
+    int outstanding = 0;
+
+    for(ci = filelist; ci != 0; ci = ci->next) {
+        unsigned int timestamp, mode, size;
+
+        if(outstanding <= SYNC_STAT_BATCH / 2 && sent != 0) {
+            syncmsg msg;
+            int len = 0;
+
+            while(sent != 0 && outstanding < SYNC_STAT_BATCH) {
+                int namelen = strlen(sent->dst);
+                if(len + sizeof(msg.req) + namelen > SYNC_DATA_MAX)
+                    break;
+                msg.req.id = ID_STAT;
+                msg.req.namelen = htoll(namelen);
+                memcpy(batch + len, &msg.req, sizeof(msg.req));
+                len += sizeof(msg.req);
+                memcpy(batch + len, sent->dst, namelen);
+                len += namelen;
+                sent = sent->next;
+                outstanding++;
+            }
+            if(writex(fd, batch, len))
+                return -1;
+        }
+
+        if(sync_finish_readtime(fd, &timestamp, &mode, &size))
+            return -1;
+        outstanding--;
+
+        if(size == ci->size) {
+            /* for links, we cannot update the atime/mtime */
+            if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
+                (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
+                ci->flag = 1;
+        }
+    }
+
+    return 0;
+}
+
+/* drop the entries flagged by sync_stat_list() from the list */
+static int sync_skip_flagged(copyinfo **filelist)
+{
+    copyinfo **pci = filelist;
+    int skipped = 0;
+
+    while(*pci != 0) {
+        copyinfo *ci = *pci;
+        if(ci->flag) {
+            *pci = ci->next;
+            free(ci);
+            skipped++;
+        } else {
+            pci = &ci->next;
+        }
+    }
+
+    return skipped;
+}
+
+
 static int local_build_list(copyinfo **filelist,
                             const char *lpath, const char *rpath)
 {
@@ -673,7 +1345,7 @@ static int local_build_list(copyinfo **filelist,
 static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, int checktimestamps)
 {
     copyinfo *filelist = 0;
-    copyinfo *ci, *next;
+    copyinfo *ci;
     int pushed = 0;
     int skipped = 0;
 
@@ -697,36 +1369,21 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
         return -1;
     }
 
-    if(checktimestamps){
-        for(ci = filelist; ci != 0; ci = ci->next) {
-            if(sync_start_readtime(fd, ci->dst)) {
-                return 1;
-            }
-        }
-        for(ci = filelist; ci != 0; ci = ci->next) {
-            unsigned int timestamp, mode, size;
-            if(sync_finish_readtime(fd, &timestamp, &mode, &size))
-                return 1;
-            if(size == ci->size) {
-                /* for links, we cannot update the atime/mtime */
-                if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
-                    (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
-                    ci->flag = 1;
-            }
+    for(ci = filelist; ci != 0; ci = ci->next) {
+        if(S_ISREG(ci->mode) && ci->size >= SYNC_DELTA_MIN) {
+            sync_delta_probe();
+            break;
         }
     }
-    for(ci = filelist; ci != 0; ci = next) {
-        next = ci->next;
-        if(ci->flag == 0) {
-            fprintf(stderr,"push: %s -> %s\n", ci->src, ci->dst);
-            if(sync_send(fd, ci->src, ci->dst, ci->time, ci->mode, 0 /* no verify APK */)){
-                return 1;
-            }
-            pushed++;
-        } else {
-            skipped++;
+
+    if(checktimestamps){
+        if(sync_stat_list(fd, filelist)) {
+            return 1;
         }
-        free(ci);
+        skipped = sync_skip_flagged(&filelist);
+    }
+    if(sync_copy_list(fd, filelist, 1, &pushed)) {
+        return 1;
     }
 
     fprintf(stderr,"%d file%s pushed. %d file%s skipped.\n",
@@ -783,6 +1440,8 @@ int do_sync_push(const char *lpath, const char *rpath, int verifyApk)
             snprintf(tmp, tmplen, "%s/%s", rpath, name);
             rpath = tmp;
         }
+        if(!verifyApk && S_ISREG(st.st_mode) && st.st_size >= SYNC_DELTA_MIN)
+            sync_delta_probe();
         BEGIN();
         if(sync_send(fd, lpath, rpath, st.st_mtime, st.st_mode, verifyApk)) {
             return 1;
@@ -870,7 +1529,6 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
                                  int checktimestamps)
 {
     copyinfo *filelist = 0;
-    copyinfo *ci, *next;
     int pulled = 0;
     int skipped = 0;
 
@@ -899,36 +1557,14 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
 
 #if 0
     if (checktimestamps) {
-        for (ci = filelist; ci != 0; ci = ci->next) {
-            if (sync_start_readtime(fd, ci->dst)) {
-                return 1;
-            }
-        }
-        for (ci = filelist; ci != 0; ci = ci->next) {
-            unsigned int timestamp, mode, size;
-            if (sync_finish_readtime(fd, &timestamp, &mode, &size))
-                return 1;
-            if (size == ci->size) {
-                /* for links, we cannot update the atime/mtime */
-                if ((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
-                    (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
-                    ci->flag = 1;
-            }
+        if (sync_stat_list(fd, filelist)) {
+            return 1;
         }
+        skipped = sync_skip_flagged(&filelist);
     }
 #endif
-    for (ci = filelist; ci != 0; ci = next) {
-        next = ci->next;
-        if (ci->flag == 0) {
-            fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
-            if (sync_recv(fd, ci->src, ci->dst)) {
-                return 1;
-            }
-            pulled++;
-        } else {
-            skipped++;
-        }
-        free(ci);
+    if (sync_copy_list(fd, filelist, 0, &pulled)) {
+        return 1;
     }
 
     fprintf(stderr, "%d file%s pulled. %d file%s skipped.\n",
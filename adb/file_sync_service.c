@@ -20,8 +20,10 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <utime.h>
+#include <time.h>
 
 #include <errno.h>
 
@@ -31,6 +33,74 @@
 #include "adb.h"
 #include "file_sync_service.h"
 
+/* zero-copy data path: DATA payloads are spliced from the service
+** socket into the target file through a pipe (and the other way round
+** for RECV), so the file contents never cross into userspace. sockets
+** or filesystems that can't splice fall back to read()/write(), and
+** setting debug.adb.zerocopy to 0 forces that path for comparison.
+*/
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE  0x01
+#define SPLICE_F_MORE  0x04
+#endif
+
+typedef struct syncbuf syncbuf;
+
+struct syncbuf {
+    char *buffer;       /* SYNC_DATA_MAX bytes, for the copying path */
+    int pipe[2];        /* splice pipe, pipe[0] < 0 when copying */
+};
+
+static int sync_splice(int fd_in, int fd_out, size_t len)
+{
+#ifdef __NR_splice
+    return syscall(__NR_splice, fd_in, NULL, fd_out, NULL, len,
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void sync_zerocopy_off(syncbuf *sb)
+{
+    if(sb->pipe[0] >= 0) {
+        adb_close(sb->pipe[0]);
+        adb_close(sb->pipe[1]);
+    }
+    sb->pipe[0] = sb->pipe[1] = -1;
+}
+
+/* per-transfer cost counters, reported with the 'sync' trace tag */
+typedef struct {
+    long long wall_ns;
+    long long cpu_ns;
+} synccost;
+
+static long long sync_clock(clockid_t clock)
+{
+    struct timespec ts;
+    if(clock_gettime(clock, &ts)) return 0;
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sync_cost_start(synccost *c)
+{
+    c->wall_ns = sync_clock(CLOCK_MONOTONIC);
+    c->cpu_ns = sync_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void sync_cost_end(synccost *c, const char *what, const char *path,
+                          long long bytes, syncbuf *sb)
+{
+    long long wall = sync_clock(CLOCK_MONOTONIC) - c->wall_ns;
+    long long cpu = sync_clock(CLOCK_THREAD_CPUTIME_ID) - c->cpu_ns;
+
+    D("sync: %s '%s' (%s): %lld bytes, cpu %lld.%03lld ms, wall %lld.%03lld ms\n",
+      what, path, (sb->pipe[0] >= 0) ? "splice" : "copy", bytes,
+      cpu / 1000000, (cpu / 1000) % 1000, wall / 1000000, (wall / 1000) % 1000);
+}
+
 static int mkdirs(char *name)
 {
     int ret;
@@ -148,12 +218,72 @@ static int fail_errno(int s)
     return fail_message(s, strerror(errno));
 }
 
-static int handle_send_file(int s, char *path, mode_t mode, char *buffer)
+/* move 'len' bytes of DATA payload from the socket into the file through
+** the splice pipe. returns 0 on success, -1 if the socket failed, and 1
+** if writing the file failed (errno is set; the payload has still been
+** consumed). falls back to copying if the socket or file can't splice.
+*/
+static int splice_data(int s, int fd, unsigned len, syncbuf *sb)
+{
+    unsigned total = len;
+    int file_errno = 0;
+
+    while(len > 0) {
+        int in = sync_splice(s, sb->pipe[1], len);
+        if(in < 0 && errno == EINTR) continue;
+        if(in < 0 && (errno == EINVAL || errno == ENOSYS) && len == total) {
+            D("sync: socket can't splice, copying instead\n");
+            sync_zerocopy_off(sb);
+            if(readx(s, sb->buffer, len)) return -1;
+            if(writex(fd, sb->buffer, len)) return 1;
+            return 0;
+        }
+        if(in <= 0) return -1;
+        len -= in;
+
+            /* drain the pipe into the file. once the file has
+            ** failed, keep draining so the stream stays in sync.
+            */
+        while(in > 0) {
+            int out = -1;
+            if(file_errno == 0) {
+                out = sync_splice(sb->pipe[0], fd, in);
+                if(out < 0 && errno == EINTR) continue;
+                if(out < 0 && errno == EINVAL) {
+                    out = adb_read(sb->pipe[0], sb->buffer, in);
+                    if(out > 0 && writex(fd, sb->buffer, out)) {
+                        file_errno = errno;
+                    }
+                } else if(out <= 0) {
+                    file_errno = (out < 0) ? errno : EIO;
+                    continue;
+                }
+            } else {
+                out = adb_read(sb->pipe[0], sb->buffer, in);
+            }
+            if(out < 0 && errno == EINTR) continue;
+            if(out <= 0) return -1;
+            in -= out;
+        }
+    }
+
+    if(file_errno) {
+        errno = file_errno;
+        return 1;
+    }
+    return 0;
+}
+
+static int handle_send_file(int s, char *path, mode_t mode, syncbuf *sb)
 {
     syncmsg msg;
     unsigned int timestamp = 0;
+    long long bytes = 0;
+    synccost cost;
     int fd;
 
+    sync_cost_start(&cost);
+
     fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL, mode);
     if(fd < 0 && errno == ENOENT) {
         mkdirs(path);
@@ -187,22 +317,34 @@ static int handle_send_file(int s, char *path, mode_t mode, char *buffer)
             fail_message(s, "oversize data message");
             goto fail;
         }
-        if(readx(s, buffer, len))
-            goto fail;
-
-        if(fd < 0)
-            continue;
-        if(writex(fd, buffer, len)) {
-            adb_close(fd);
-            adb_unlink(path);
-            fd = -1;
-            if(fail_errno(s)) return -1;
+        bytes += len;
+
+        if(fd >= 0 && sb->pipe[0] >= 0) {
+            int r = splice_data(s, fd, len, sb);
+            if(r < 0)
+                goto fail;
+            if(r == 0)
+                continue;
+        } else {
+            if(readx(s, sb->buffer, len))
+                goto fail;
+
+            if(fd < 0)
+                continue;
+            if(!writex(fd, sb->buffer, len))
+                continue;
         }
+
+        adb_close(fd);
+        adb_unlink(path);
+        fd = -1;
+        if(fail_errno(s)) return -1;
     }
 
     if(fd >= 0) {
         struct utimbuf u;
         adb_close(fd);
+        sync_cost_end(&cost, "send", path, bytes, sb);
         u.actime = timestamp;
         u.modtime = timestamp;
         utime(path, &u);
@@ -222,8 +364,9 @@ fail:
 }
 
 #ifdef HAVE_SYMLINKS
-static int handle_send_link(int s, char *path, char *buffer)
+static int handle_send_link(int s, char *path, syncbuf *sb)
 {
+    char *buffer = sb->buffer;
     syncmsg msg;
     unsigned int len;
     int ret;
@@ -271,11 +414,14 @@ static int handle_send_link(int s, char *path, char *buffer)
 }
 #endif /* HAVE_SYMLINKS */
 
-static int do_send(int s, char *path, char *buffer)
+/* strip the ",<mode>" suffix of a SEND or DLTA path. returns nonzero
+** if the mode is that of a symbolic link.
+*/
+static int split_mode(char *path, mode_t *pmode)
 {
     char *tmp;
     mode_t mode;
-    int is_link, ret;
+    int is_link;
 
     tmp = strrchr(path,',');
     if(tmp) {
@@ -294,12 +440,23 @@ static int do_send(int s, char *path, char *buffer)
         is_link = 0;
     }
 
+    *pmode = mode;
+    return is_link;
+}
+
+static int do_send(int s, char *path, syncbuf *sb)
+{
+    mode_t mode;
+    int is_link, ret;
+
+    is_link = split_mode(path, &mode);
+
     adb_unlink(path);
 
 
 #ifdef HAVE_SYMLINKS
     if(is_link)
-        ret = handle_send_link(s, path, buffer);
+        ret = handle_send_link(s, path, sb);
     else {
 #else
     {
@@ -308,16 +465,57 @@ static int do_send(int s, char *path, char *buffer)
         mode |= ((mode >> 3) & 0070);
         mode |= ((mode >> 3) & 0007);
 
-        ret = handle_send_file(s, path, mode, buffer);
+        ret = handle_send_file(s, path, mode, sb);
     }
 
     return ret;
 }
 
-static int do_recv(int s, const char *path, char *buffer)
+/* send one DATA message for up to SYNC_DATA_MAX bytes of the file.
+** the payload is spliced into the pipe first so that we know its exact
+** size before writing the header. returns the payload size, 0 at the
+** end of the file, -1 if the file can't splice and -2 if the socket
+** failed.
+*/
+static int splice_chunk(int s, int fd, syncbuf *sb)
+{
+    syncmsg msg;
+    int r, len;
+
+    do {
+        r = sync_splice(fd, sb->pipe[1], SYNC_DATA_MAX);
+    } while(r < 0 && errno == EINTR);
+    if(r <= 0) return r;
+
+    msg.data.id = ID_DATA;
+    msg.data.size = htoll(r);
+    if(writex(s, &msg.data, sizeof(msg.data)))
+        return -2;
+
+    for(len = r; len > 0; ) {
+        int out = sync_splice(sb->pipe[0], s, len);
+        if(out < 0 && errno == EINTR) continue;
+        if(out < 0 && errno == EINVAL) {
+                /* the socket can't take spliced data */
+            out = adb_read(sb->pipe[0], sb->buffer, len);
+            if(out > 0 && writex(s, sb->buffer, out))
+                return -2;
+        }
+        if(out <= 0) return -2;
+        len -= out;
+    }
+    return r;
+}
+
+static int do_recv(int s, const char *path, syncbuf *sb)
 {
     syncmsg msg;
     int fd, r;
+    int zerocopy = (sb->pipe[0] >= 0);
+    long long bytes = 0;
+    synccost cost;
+
+    sync_cost_start(&cost);
 
     fd = adb_open(path, O_RDONLY);
     if(fd < 0) {
@@ -327,23 +525,44 @@ static int do_recv(int s, const char *path, char *buffer)
 
     msg.data.id = ID_DATA;
     for(;;) {
-        r = adb_read(fd, buffer, SYNC_DATA_MAX);
-        if(r <= 0) {
+        if(zerocopy) {
+            r = splice_chunk(s, fd, sb);
+            if(r == -2) {
+                adb_close(fd);
+                return -1;
+            }
+            if(r > 0) {
+                bytes += r;
+                continue;
+            }
+            if(r == 0) break;
+            if(errno == EINVAL && bytes == 0) {
+                    /* e.g. /proc files, read this one the usual way */
+                zerocopy = 0;
+                continue;
+            }
+        } else {
+            r = adb_read(fd, sb->buffer, SYNC_DATA_MAX);
+            if(r > 0) {
+                bytes += r;
+                msg.data.size = htoll(r);
+                if(writex(s, &msg.data, sizeof(msg.data)) ||
+                   writex(s, sb->buffer, r)) {
+                    adb_close(fd);
+                    return -1;
+                }
+                continue;
+            }
             if(r == 0) break;
-            if(errno == EINTR) continue;
-            r = fail_errno(s);
-            adb_close(fd);
-            return r;
-        }
-        msg.data.size = htoll(r);
-        if(writex(s, &msg.data, sizeof(msg.data)) ||
-           writex(s, buffer, r)) {
-            adb_close(fd);
-            return -1;
         }
+        if(errno == EINTR) continue;
+        r = fail_errno(s);
+        adb_close(fd);
+        return r;
     }
 
     adb_close(fd);
+    sync_cost_end(&cost, "recv", path, bytes, sb);
 
     msg.data.id = ID_DONE;
     msg.data.size = 0;
@@ -354,14 +573,227 @@ static int do_recv(int s, const char *path, char *buffer)
     return 0;
 }
 
+/* blocks are at least SYNC_BLOCK_MIN bytes, and grow with the square
+** root of the file size up to SYNC_DATA_MAX, which keeps the signature
+** list of a large image to a few hundred kilobytes.
+*/
+#define SYNC_BLOCK_MIN  2048
+#define SYNC_SIG_BATCH  64
+
+static unsigned sync_block_size(unsigned size)
+{
+    unsigned blocksize = SYNC_BLOCK_MIN;
+
+    while(blocksize < SYNC_DATA_MAX &&
+          (unsigned long long) blocksize * blocksize < size)
+        blocksize <<= 1;
+    return blocksize;
+}
+
+static int do_sign(int s, const char *path, syncbuf *sb)
+{
+    syncmsg msg;
+    syncsig sigs[SYNC_SIG_BATCH];
+    struct stat st;
+    unsigned blocksize = 0, count = 0, n = 0, i;
+    int fd;
+
+    fd = adb_open(path, O_RDONLY);
+    if(fd >= 0 && (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+                   st.st_size == 0 || st.st_size > 0xffffffffLL)) {
+        adb_close(fd);
+        fd = -1;
+    }
+    if(fd >= 0) {
+        blocksize = sync_block_size(st.st_size);
+        count = (st.st_size + blocksize - 1) / blocksize;
+    }
+
+    msg.sigs.id = ID_SIGS;
+    msg.sigs.blocksize = htoll(blocksize);
+    msg.sigs.count = htoll(count);
+    msg.sigs.size = htoll(fd >= 0 ? st.st_size : 0);
+    if(writex(s, &msg.sigs, sizeof(msg.sigs))) {
+        if(fd >= 0) adb_close(fd);
+        return -1;
+    }
+
+    for(i = 0; i < count; i++) {
+        unsigned char *p = (unsigned char *) sb->buffer;
+        int len = 0;
+
+        while(len < (int) blocksize) {
+            int r = adb_read(fd, p + len, blocksize - len);
+            if(r < 0 && errno == EINTR) continue;
+            if(r <= 0) break;
+            len += r;
+        }
+
+            /* a block we couldn't read just never matches */
+        sigs[n].weak = htoll(sync_weak_sum(p, len));
+        SHA(p, len, sigs[n].strong);
+        if(++n == SYNC_SIG_BATCH || i == count - 1) {
+            if(writex(s, sigs, n * sizeof(syncsig))) {
+                adb_close(fd);
+                return -1;
+            }
+            n = 0;
+        }
+    }
+
+    if(fd >= 0) adb_close(fd);
+    return 0;
+}
+
+static int copy_range(int old, int fd, unsigned offset, unsigned len, char *buffer)
+{
+    if(adb_lseek(old, offset, SEEK_SET) != (off_t) offset)
+        return -1;
+
+    while(len > 0) {
+        int r = adb_read(old, buffer, len > SYNC_DATA_MAX ? SYNC_DATA_MAX : len);
+        if(r < 0 && errno == EINTR) continue;
+        if(r == 0) errno = EINVAL;
+        if(r <= 0) return -1;
+        if(writex(fd, buffer, r)) return -1;
+        len -= r;
+    }
+    return 0;
+}
+
+/* rebuild a file from literal DATA and COPY messages against its old
+** contents. the new file is written next to the old one and renamed over
+** it once complete, so the blocks being copied stay in place meanwhile.
+*/
+static int handle_delta_file(int s, char *path, mode_t mode, syncbuf *sb)
+{
+    syncmsg msg;
+    unsigned int timestamp = 0;
+    long long bytes = 0;
+    char tmp[1040];
+    synccost cost;
+    int fd, old;
+
+    sync_cost_start(&cost);
+    snprintf(tmp, sizeof(tmp), "%s.adbdelta", path);
+
+    old = adb_open(path, O_RDONLY);
+    fd = -1;
+    if(old >= 0)
+        fd = adb_open_mode(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if(fd < 0) {
+        if(old >= 0) adb_close(old);
+        old = -1;
+        if(fail_errno(s))
+            return -1;
+    }
+
+    for(;;) {
+        unsigned int len;
+        int r = 0;
+
+        if(readx(s, &msg.data, sizeof(msg.data)))
+            goto fail;
+
+        if(msg.data.id == ID_DONE) {
+            timestamp = ltohl(msg.data.size);
+            break;
+        }
+        if(msg.data.id == ID_COPY) {
+            if(readx(s, &msg.copy.size, sizeof(msg.copy.size)))
+                goto fail;
+            len = ltohl(msg.copy.size);
+            bytes += len;
+            if(fd < 0)
+                continue;
+            r = copy_range(old, fd, ltohl(msg.copy.offset), len, sb->buffer);
+        } else if(msg.data.id == ID_DATA) {
+            len = ltohl(msg.data.size);
+            if(len > SYNC_DATA_MAX) {
+                fail_message(s, "oversize data message");
+                goto fail;
+            }
+            if(readx(s, sb->buffer, len))
+                goto fail;
+            if(fd < 0)
+                continue;
+            r = writex(fd, sb->buffer, len);
+        } else {
+            fail_message(s, "invalid data message");
+            goto fail;
+        }
+
+        if(r) {
+            adb_close(fd);
+            adb_close(old);
+            adb_unlink(tmp);
+            fd = old = -1;
+            if(fail_errno(s)) return -1;
+        }
+    }
+
+    if(fd >= 0) {
+        struct utimbuf u;
+        adb_close(fd);
+        adb_close(old);
+        sync_cost_end(&cost, "delta", path, bytes, sb);
+        u.actime = timestamp;
+        u.modtime = timestamp;
+        utime(tmp, &u);
+
+        if(rename(tmp, path)) {
+            adb_unlink(tmp);
+            return fail_errno(s);
+        }
+
+        msg.status.id = ID_OKAY;
+        msg.status.msglen = 0;
+        if(writex(s, &msg.status, sizeof(msg.status)))
+            return -1;
+    }
+    return 0;
+
+fail:
+    if(fd >= 0) {
+        adb_close(fd);
+        adb_close(old);
+        adb_unlink(tmp);
+    }
+    return -1;
+}
+
+static int do_delta(int s, char *path, syncbuf *sb)
+{
+    mode_t mode;
+
+    if(split_mode(path, &mode)) {
+        fail_message(s, "can't send a link as a delta");
+        return -1;
+    }
+
+    mode |= ((mode >> 3) & 0070);
+    mode |= ((mode >> 3) & 0007);
+
+    return handle_delta_file(s, path, mode, sb);
+}
+
 void file_sync_service(int fd, void *cookie)
 {
     syncmsg msg;
     char name[1025];
     unsigned namelen;
+    char value[PROPERTY_VALUE_MAX];
+    syncbuf sb;
+
+    sb.pipe[0] = sb.pipe[1] = -1;
+    sb.buffer = malloc(SYNC_DATA_MAX);
+    if(sb.buffer == 0) goto fail;
 
-    char *buffer = malloc(SYNC_DATA_MAX);
-    if(buffer == 0) goto fail;
+    property_get("debug.adb.zerocopy", value, "1");
+    if(strcmp(value, "0") && pipe(sb.pipe)) {
+        D("sync: no splice pipe: %s\n", strerror(errno));
+        sb.pipe[0] = sb.pipe[1] = -1;
+    }
 
     for(;;) {
         D("sync: waiting for command\n");
@@ -392,10 +824,16 @@ void file_sync_service(int fd, void *cookie)
             if(do_list(fd, name)) goto fail;
             break;
         case ID_SEND:
-            if(do_send(fd, name, buffer)) goto fail;
+            if(do_send(fd, name, &sb)) goto fail;
             break;
         case ID_RECV:
-            if(do_recv(fd, name, buffer)) goto fail;
+            if(do_recv(fd, name, &sb)) goto fail;
+            break;
+        case ID_SIGN:
+            if(do_sign(fd, name, &sb)) goto fail;
+            break;
+        case ID_DLTA:
+            if(do_delta(fd, name, &sb)) goto fail;
             break;
         case ID_QUIT:
             goto fail;
@@ -406,7 +844,8 @@ void file_sync_service(int fd, void *cookie)
     }
 
 fail:
-    if(buffer != 0) free(buffer);
+    sync_zerocopy_off(&sb);
+    if(sb.buffer != 0) free(sb.buffer);
     D("sync: done\n");
     adb_close(fd);
 }
@@ -17,6 +17,8 @@
 #ifndef _FILE_SYNC_SERVICE_H_
 #define _FILE_SYNC_SERVICE_H_
 
+#include <mincrypt/sha.h>
+
 #ifdef __powerpc__
 static inline unsigned __swap_uint32(unsigned x) 
 {
@@ -45,6 +47,10 @@ static inline unsigned __swap_uint32(unsigned x)
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_SIGN MKID('S','I','G','N')
+#define ID_SIGS MKID('S','I','G','S')
+#define ID_DLTA MKID('D','L','T','A')
+#define ID_COPY MKID('C','O','P','Y')
 
 typedef union {
     unsigned id;
@@ -73,8 +79,45 @@ typedef union {
         unsigned id;
         unsigned msglen;
     } status;    
+    struct {
+        unsigned id;
+        unsigned blocksize;
+        unsigned count;
+        unsigned size;
+    } sigs;
+    struct {
+        unsigned id;
+        unsigned offset;
+        unsigned size;
+    } copy;
 } syncmsg;
 
+/* delta pushes:
+**
+** SIGN <path> is answered with a SIGS header giving the block size, the
+** block count and the size of the existing file, followed by one syncsig
+** per block (count is 0 if there is no regular file to diff against).
+** DLTA <path,mode> then works like SEND, except that COPY messages may be
+** mixed with the DATA messages to reuse 'size' bytes of the old file
+** from 'offset'. devices that predate this fail SIGN as unknown.
+*/
+typedef struct {
+    unsigned weak;
+    unsigned char strong[SHA_DIGEST_SIZE];
+} syncsig;
+
+/* the rsync weak checksum, which file_sync_client.c rolls along the file */
+static inline unsigned sync_weak_sum(const unsigned char *p, unsigned len)
+{
+    unsigned a = 0, b = 0, i;
+
+    for(i = 0; i < len; i++) {
+        a += p[i];
+        b += (len - i) * p[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
 
 void file_sync_service(int fd, void *cookie);
 int do_sync_ls(const char *path);
@@ -288,8 +288,8 @@ static int create_subprocess(const char *cmd, const char *arg0, const char *arg1
 #if !ADB_HOST
 static void shell_service(int s, void *command)
 {
-    char    buffer[MAX_PAYLOAD];
-    char    buffer2[MAX_PAYLOAD];
+    char    buffer[MAX_PAYLOAD_V1];
+    char    buffer2[MAX_PAYLOAD_V1];
     struct pollfd ufds[2];
     int     fd, ret = 0;
     unsigned count = 0;
@@ -124,6 +124,25 @@ restart:
     adb_mutex_unlock(&socket_list_lock);
 }
 
+/* the largest payload that may be handed to this socket's peer. a
+** packet read from a local socket ends up in an A_WRTE on whichever
+** transport the socket pair is bound to, so it can't exceed what that
+** transport negotiated.
+*/
+static size_t get_max_payload(asocket *s)
+{
+    size_t max_payload = MAX_PAYLOAD;
+
+    if(s->transport && s->transport->max_payload < max_payload) {
+        max_payload = s->transport->max_payload;
+    }
+    if(s->peer && s->peer->transport &&
+       s->peer->transport->max_payload < max_payload) {
+        max_payload = s->peer->transport->max_payload;
+    }
+    return max_payload;
+}
+
 static int local_socket_enqueue(asocket *s, apacket *p)
 {
     D("LS(%d): enqueue %d\n", s->id, p->len);
@@ -299,7 +318,8 @@ static void local_socket_event_func(int fd, unsigned ev, void *_s)
     if(ev & FDE_READ){
         apacket *p = get_apacket();
         unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
+        const size_t max_payload = get_max_payload(s);
+        size_t avail = max_payload;
         int r;
         int is_eof = 0;
 
@@ -320,10 +340,10 @@ static void local_socket_event_func(int fd, unsigned ev, void *_s)
             break;
         }
 
-        if((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if((avail == max_payload) || (s->peer == 0)) {
             put_apacket(p);
         } else {
-            p->len = MAX_PAYLOAD - avail;
+            p->len = max_payload - avail;
 
             r = s->peer->enqueue(s->peer, p);
 
@@ -433,17 +453,23 @@ static int remote_socket_enqueue(asocket *s, apacket *p)
     p->msg.arg1 = s->id;
     p->msg.data_length = p->len;
     send_packet(p, s->transport);
+
+        /* keep going while the write window has room, the
+        ** A_OKAY for one of the writes will make us ready again
+        */
+    if(s->write_credits > 1) {
+        s->write_credits--;
+        return 0;
+    }
+    s->write_credits = 0;
     return 1;
 }
 
 static void remote_socket_ready(asocket *s)
 {
     D("Calling remote_socket_ready\n");
-    apacket *p = get_apacket();
-    p->msg.command = A_OKAY;
-    p->msg.arg0 = s->peer->id;
-    p->msg.arg1 = s->id;
-    send_packet(p, s->transport);
+    send_ready(s->peer->id, s->id, s->writes_owed, s->transport);
+    s->writes_owed = 0;
 }
 
 static void remote_socket_close(asocket *s)
@@ -488,6 +514,7 @@ asocket *create_remote_socket(unsigned id, atransport *t)
     s->ready = remote_socket_ready;
     s->close = remote_socket_close;
     s->transport = t;
+    s->write_credits = t->write_window;
 
     dis->func   = remote_socket_disconnect;
     dis->opaque = s;
@@ -502,7 +529,7 @@ void connect_to_remote(asocket *s, const char *destination)
     apacket *p = get_apacket();
     int len = strlen(destination) + 1;
 
-    if(len > (MAX_PAYLOAD-1)) {
+    if(len > (MAX_PAYLOAD_V1-1)) {
         fatal("destination oversized");
     }
 
@@ -0,0 +1,156 @@
+/* a simple benchmark program for the fdevent loop.
+ *
+ * it registers a large number of idle socketpairs, as a busy adb server
+ * does with its forwarded ports, jdwp and shell sockets, then bounces a
+ * single token between randomly chosen pairs and measures how long each
+ * event takes to be dispatched.  it also times registering and removing
+ * all the fds.
+ *
+ * build it against the backend to measure, for example:
+ *   gcc -O2 -DHAVE_EPOLL test_fdevent.c fdevent.c -o test_fdevent
+ *   gcc -O2 -DFDEVENT_USE_SELECT test_fdevent.c fdevent.c -o test_fdevent
+ *
+ * usage: test_fdevent [pairs] [events]
+ */
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "fdevent.h"
+
+typedef struct {
+    int        fds[2];
+    fdevent    fde;
+} pair;
+
+static pair*       pairs;
+static int         pair_count = 4000;
+static int         event_count = 100000;
+static int         events_seen;
+static long long   sent_at;
+static long long*  latencies;
+
+static void
+panic( const char*  msg )
+{
+    fprintf(stderr, "PANIC: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static long long
+now_ns( void )
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+compare_ll( const void*  a, const void*  b )
+{
+    long long  x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+static void
+send_token( void )
+{
+    pair*  p = &pairs[rand() % pair_count];
+    char   c = 'x';
+
+    sent_at = now_ns();
+    if (write(p->fds[1], &c, 1) != 1)
+        panic("could not send token");
+}
+
+static void
+report( void )
+{
+    long long  total = 0, start;
+    int        i;
+
+    qsort(latencies, event_count, sizeof(long long), compare_ll);
+    for (i = 0; i < event_count; i++)
+        total += latencies[i];
+
+    printf("%d fds, %d events: mean %lld ns, p50 %lld ns, p99 %lld ns\n",
+           pair_count, event_count, total / event_count,
+           latencies[event_count / 2], latencies[event_count * 99 / 100]);
+
+    start = now_ns();
+    for (i = 0; i < pair_count; i++)
+        fdevent_remove(&pairs[i].fde);
+    printf("removed %d fds in %lld us\n", pair_count, (now_ns() - start) / 1000);
+}
+
+static void
+pair_event_func( int  fd, unsigned  ev, void*  _p )
+{
+    char  c;
+
+    if (!(ev & FDE_READ))
+        return;
+
+    if (read(fd, &c, 1) != 1)
+        panic("could not read token");
+
+    latencies[events_seen++] = now_ns() - sent_at;
+    if (events_seen == event_count) {
+        report();
+        exit(0);
+    }
+    send_token();
+}
+
+int  main( int  argc, char**  argv )
+{
+    struct rlimit  rl;
+    long long      start;
+    int            i;
+
+    if (argc > 1)
+        pair_count = atoi(argv[1]);
+    if (argc > 2)
+        event_count = atoi(argv[2]);
+
+#ifdef FDEVENT_USE_SELECT
+    /* select() can't watch fds above FD_SETSIZE */
+    if (pair_count * 2 + 16 > FD_SETSIZE) {
+        pair_count = (FD_SETSIZE - 16) / 2;
+        fprintf(stderr, "select backend: limited to %d pairs\n", pair_count);
+    }
+#endif
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    pairs = calloc(pair_count, sizeof(pair));
+    latencies = calloc(event_count, sizeof(long long));
+    if (pairs == NULL || latencies == NULL)
+        panic("could not allocate tables");
+
+    for (i = 0; i < pair_count; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i].fds) < 0)
+            panic("could not create socketpair (raise the fd limit?)");
+    }
+
+    start = now_ns();
+    for (i = 0; i < pair_count; i++) {
+        fdevent_install(&pairs[i].fde, pairs[i].fds[0], pair_event_func, &pairs[i]);
+        fdevent_add(&pairs[i].fde, FDE_READ);
+    }
+    printf("registered %d fds in %lld us\n", pair_count, (now_ns() - start) / 1000);
+
+    send_token();
+    fdevent_loop();
+    return 0;
+}
@@ -0,0 +1,499 @@
+/* a simple benchmark program, measures the stream throughput of the ADB server.
+ *
+ * it plays the part of an emulator: it listens on an emulator console port,
+ * asks the ADB server to connect to it with "host:emulator:<port>", and
+ * answers the CONNECT exchange itself.  it then opens "bench:<bytes>"
+ * streams through the server and sends that many bytes back as WRITE
+ * messages, so the whole server data path (transport threads, remote and
+ * local sockets, flow control) is exercised without a real device.
+ *
+ * usage: test_throughput [-n bytes] [-m maxdata] [-w window] [-l ms,ms,...] [-p port]
+ *
+ * -m and -w set the maxdata and write window the fake device advertises
+ * in its CONNECT message; use -m 4096 -w 1 to measure the version 1
+ * protocol.  the server's own values can be lowered with ADB_MAX_PAYLOAD
+ * and ADB_WRITE_WINDOW when it is started.
+ *
+ * -l gives a list of one-way latencies to simulate: every message the
+ * server sends is only seen by the fake device that many milliseconds
+ * after it arrived.  one stream is measured per latency.
+ */
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <memory.h>
+
+#define A_SYNC 0x434e5953
+#define A_CNXN 0x4e584e43
+#define A_OPEN 0x4e45504f
+#define A_OKAY 0x59414b4f
+#define A_CLSE 0x45534c43
+#define A_WRTE 0x45545257
+
+#define A_VERSION 0x01000001
+#define MAX_PAYLOAD (256*1024)
+
+typedef struct {
+    unsigned command;
+    unsigned arg0;
+    unsigned arg1;
+    unsigned data_length;
+    unsigned data_check;
+    unsigned magic;
+} amessage;
+
+static unsigned  opt_maxdata = MAX_PAYLOAD;
+static unsigned  opt_window  = 8;
+static int       opt_port    = 5585;
+static long long opt_bytes   = 64*1024*1024;
+
+/* current simulated latency, in microseconds */
+static volatile long long  latency_us;
+
+static void
+panic( const char*  msg )
+{
+    fprintf(stderr, "PANIC: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static int
+unix_write( int  fd, const void*  _buf, int  len )
+{
+    const char*  buf = _buf;
+    int  result = 0;
+    while (len > 0) {
+        int  len2 = write(fd, buf, len);
+        if (len2 < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -1;
+        }
+        result += len2;
+        len -= len2;
+        buf += len2;
+    }
+    return  result;
+}
+
+static int
+unix_read( int  fd, void*  _buf, int  len )
+{
+    char*  buf = _buf;
+    int  result = 0;
+    while (len > 0) {
+        int  len2 = read(fd, buf, len);
+        if (len2 < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return -1;
+        }
+        if (len2 == 0)
+            return -1;
+        result += len2;
+        len -= len2;
+        buf += len2;
+    }
+    return  result;
+}
+
+static long long
+now_us( void )
+{
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/** fake device side
+ **/
+
+static int
+send_message( int  fd, unsigned  command, unsigned  arg0, unsigned  arg1,
+              const void*  data, unsigned  len )
+{
+    amessage              msg;
+    const unsigned char*  x = data;
+    unsigned              sum = 0, n;
+
+    for (n = 0; n < len; n++)
+        sum += x[n];
+
+    msg.command     = command;
+    msg.arg0        = arg0;
+    msg.arg1        = arg1;
+    msg.data_length = len;
+    msg.data_check  = sum;
+    msg.magic       = command ^ 0xffffffff;
+
+    if (unix_write(fd, &msg, sizeof(msg)) < 0)
+        return -1;
+    if (len > 0 && unix_write(fd, data, len) < 0)
+        return -1;
+    return 0;
+}
+
+static int
+recv_message( int  fd, amessage*  msg, unsigned char*  data, unsigned  size )
+{
+    if (unix_read(fd, msg, sizeof(*msg)) < 0)
+        return -1;
+    if (msg->data_length > MAX_PAYLOAD)
+        return -1;
+    while (msg->data_length > size) {
+        /* we never need large payloads, drop them */
+        unsigned char  junk[4096];
+        unsigned       len = msg->data_length - size;
+        if (len > sizeof junk)
+            len = sizeof junk;
+        if (unix_read(fd, junk, len) < 0)
+            return -1;
+        msg->data_length -= len;
+    }
+    if (msg->data_length > 0 && unix_read(fd, data, msg->data_length) < 0)
+        return -1;
+    return 0;
+}
+
+/* messages from the server go through a delay line before the device
+ * thread handles them, to simulate a link with latency.
+ */
+typedef struct delayed  delayed;
+struct delayed {
+    delayed*       next;
+    long long      due;
+    amessage       msg;
+    unsigned char  data[256];
+};
+
+static delayed*         delay_first;
+static delayed*         delay_last;
+static pthread_mutex_t  delay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   delay_cond = PTHREAD_COND_INITIALIZER;
+
+static void*
+reader_thread( void*  arg )
+{
+    int  fd = (int)(long)arg;
+
+    for (;;) {
+        delayed*  d = calloc(1, sizeof(*d));
+        int       ret;
+
+        if (d == NULL)
+            panic("could not allocate message");
+
+        /* on EOF, queue an empty message to stop the device thread */
+        ret = recv_message(fd, &d->msg, d->data, sizeof(d->data) - 1);
+        if (ret < 0)
+            memset(&d->msg, 0, sizeof(d->msg));
+        d->due = now_us() + latency_us;
+
+        pthread_mutex_lock(&delay_lock);
+        if (delay_last)
+            delay_last->next = d;
+        else
+            delay_first = d;
+        delay_last = d;
+        pthread_cond_signal(&delay_cond);
+        pthread_mutex_unlock(&delay_lock);
+
+        if (ret < 0)
+            break;
+    }
+    return NULL;
+}
+
+static delayed*
+next_message( void )
+{
+    delayed*   d;
+    long long  wait;
+
+    pthread_mutex_lock(&delay_lock);
+    while (delay_first == NULL)
+        pthread_cond_wait(&delay_cond, &delay_lock);
+    d = delay_first;
+    delay_first = d->next;
+    if (delay_first == NULL)
+        delay_last = NULL;
+    pthread_mutex_unlock(&delay_lock);
+
+    wait = d->due - now_us();
+    if (wait > 0)
+        usleep(wait);
+    return d;
+}
+
+static void*
+device_thread( void*  arg )
+{
+    int             fd = (int)(long)arg;
+    unsigned char*  data = malloc(MAX_PAYLOAD);
+    unsigned        maxdata = opt_maxdata;
+    unsigned        window = 1;
+    unsigned        credits = 0;
+    unsigned        remote_id = 0;
+    long long       left = 0;
+    char            banner[64];
+    pthread_t       reader;
+
+    if (data == NULL)
+        panic("could not allocate payload buffer");
+
+    memset(data, 0x5a, MAX_PAYLOAD);
+
+    if (pthread_create(&reader, NULL, reader_thread, arg) != 0)
+        panic("could not create reader thread");
+
+    for (;;) {
+        delayed*   d   = next_message();
+        amessage*  msg = &d->msg;
+        char*      str = (char*)d->data;
+
+        str[msg->data_length] = 0;
+
+        switch (msg->command) {
+        case 0:
+            free(d);
+            goto done;
+
+        case A_CNXN:
+            if (msg->arg1 < maxdata)
+                maxdata = msg->arg1;
+            window = 1;
+            if (strstr(str, "window=") != NULL) {
+                window = atoi(strstr(str, "window=") + 7);
+                if (window > opt_window)
+                    window = opt_window;
+                if (window < 1)
+                    window = 1;
+            }
+            snprintf(banner, sizeof banner, "device::window=%u", opt_window);
+            if (send_message(fd, A_CNXN, A_VERSION, opt_maxdata,
+                             banner, strlen(banner) + 1) < 0)
+                panic("could not send CONNECT");
+            break;
+
+        case A_OPEN:
+            if (strncmp(str, "bench:", 6) != 0 || remote_id != 0) {
+                send_message(fd, A_CLSE, 0, msg->arg0, NULL, 0);
+                break;
+            }
+            remote_id = msg->arg0;
+            left      = atoll(str + 6);
+            credits   = window;
+            send_message(fd, A_OKAY, 1, remote_id, NULL, 0);
+            break;
+
+        case A_OKAY:
+            if (remote_id == 0)
+                break;
+            if (msg->data_length >= 4)
+                credits += d->data[0] | (d->data[1] << 8) |
+                           (d->data[2] << 16) | (d->data[3] << 24);
+            else
+                credits += 1;
+            if (credits > window)
+                credits = window;
+            /* all writes acknowledged, we're done */
+            if (left == 0 && credits == window) {
+                send_message(fd, A_CLSE, 1, remote_id, NULL, 0);
+                remote_id = 0;
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        /* send as many writes as the window allows */
+        while (remote_id != 0 && left > 0 && credits > 0) {
+            unsigned  len = (left > maxdata) ? maxdata : (unsigned)left;
+            if (send_message(fd, A_WRTE, 1, remote_id, data, len) < 0)
+                panic("could not send WRITE");
+            left -= len;
+            credits--;
+        }
+        free(d);
+    }
+done:
+    close(fd);
+    free(data);
+    return NULL;
+}
+
+static int
+listen_device( int  port )
+{
+    struct sockaddr_in  addr;
+    int                 s, on = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    s = socket(PF_INET, SOCK_STREAM, 0);
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        panic("could not bind device port");
+    if (listen(s, 1) < 0)
+        panic("could not listen on device port");
+    return s;
+}
+
+/** client side
+ **/
+
+static int
+connect_server( void )
+{
+    struct sockaddr_in  server;
+    int                 s;
+
+    memset( &server, 0, sizeof(server) );
+    server.sin_family      = AF_INET;
+    server.sin_port        = htons(5037);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    s = socket( PF_INET, SOCK_STREAM, 0 );
+    if (connect( s, (struct sockaddr*) &server, sizeof(server) ) < 0)
+        panic( "could not connect to server" );
+    return s;
+}
+
+static void
+write_request( int  s, const char*  request )
+{
+    char  buffer[1024];
+    int   len;
+
+    len = snprintf( buffer, sizeof buffer, "%04x%s", (int)strlen(request), request );
+    if (unix_write(s, buffer, len) < 0)
+        panic( "could not send request" );
+}
+
+static int
+send_request( int  s, const char*  request )
+{
+    char  buffer[4];
+
+    write_request(s, request);
+    if (unix_read(s, buffer, 4) != 4)
+        panic( "could not read request status" );
+
+    return memcmp(buffer, "OKAY", 4) == 0 ? 0 : -1;
+}
+
+static void
+run_bench( int  latency_ms )
+{
+    char        request[64];
+    char*       buffer;
+    long long   total = 0, start, elapsed;
+    int         s;
+
+    latency_us = latency_ms * 1000LL;
+
+    /* the transport is offline until the CONNECT exchange is over */
+    snprintf(request, sizeof request, "host:transport:emulator-%d", opt_port - 1);
+    for (;;) {
+        s = connect_server();
+        if (send_request(s, request) == 0)
+            break;
+        close(s);
+        usleep(100*1000);
+    }
+
+    snprintf(request, sizeof request, "bench:%lld", opt_bytes);
+    if (send_request(s, request) < 0)
+        panic("could not open bench stream");
+
+    buffer = malloc(65536);
+    start  = now_us();
+    for (;;) {
+        int  len = read(s, buffer, 65536);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+        total += len;
+    }
+    elapsed = now_us() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    printf("maxdata=%u window=%u latency=%dms: %lld KB/s (%lld bytes in %lld.%03llds)\n",
+           opt_maxdata, opt_window, latency_ms,
+           (total * 1000000LL / elapsed) / 1024LL,
+           total, elapsed / 1000000LL, (elapsed % 1000000LL) / 1000LL);
+    if (total != opt_bytes)
+        fprintf(stderr, "short stream: %lld of %lld bytes\n", total, opt_bytes);
+
+    close(s);
+    free(buffer);
+}
+
+int  main( int  argc, char**  argv )
+{
+    int          ls, ds, s, c;
+    char         request[64];
+    const char*  latencies = "0";
+    pthread_t    thread;
+
+    while ((c = getopt(argc, argv, "n:m:w:l:p:")) != -1) {
+        switch (c) {
+        case 'n': opt_bytes   = atoll(optarg); break;
+        case 'm': opt_maxdata = strtoul(optarg, NULL, 0); break;
+        case 'w': opt_window  = strtoul(optarg, NULL, 0); break;
+        case 'l': latencies   = optarg; break;
+        case 'p': opt_port    = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n bytes] [-m maxdata] [-w window] "
+                            "[-l ms,ms,...] [-p port]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opt_maxdata < 4096 || opt_maxdata > MAX_PAYLOAD) {
+        fprintf(stderr, "maxdata must be between 4096 and %d\n", MAX_PAYLOAD);
+        return 1;
+    }
+    if (opt_window < 1)
+        opt_window = 1;
+
+    ls = listen_device(opt_port);
+
+    /* ask the server to connect to our fake emulator */
+    snprintf(request, sizeof request, "host:emulator:%d", opt_port);
+    s = connect_server();
+    write_request(s, request);  /* no reply for this one */
+    close(s);
+
+    ds = accept(ls, NULL, NULL);
+    if (ds < 0)
+        panic("could not accept server connection");
+    close(ls);
+    c = 1;
+    setsockopt(ds, IPPROTO_TCP, TCP_NODELAY, &c, sizeof(c));
+
+    if (pthread_create(&thread, NULL, device_thread, (void*)(long)ds) != 0)
+        panic("could not create device thread");
+
+    for (;;) {
+        run_bench(atoi(latencies));
+        latencies = strchr(latencies, ',');
+        if (latencies == NULL)
+            break;
+        latencies++;
+    }
+    return 0;
+}
@@ -239,6 +239,9 @@ int init_socket_transport(atransport *t, int s, int  port)
     t->sfd = s;
     t->sync_token = 1;
     t->connection_state = CS_OFFLINE;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
+    t->write_window = 1;
     t->type = kTransportLocal;
 
 #if ADB_HOST
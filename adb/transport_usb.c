@@ -119,6 +119,9 @@ void init_usb_transport(atransport *t, usb_handle *h)
     t->write_to_remote = remote_write;
     t->sync_token = 1;
     t->connection_state = CS_OFFLINE;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
+    t->write_window = 1;
     t->type = kTransportUsb;
     t->usb = h;
 
@@ -44,6 +44,9 @@
 /* usb scan debugging is waaaay too verbose */
 #define DBGX(x...)
 
+/* usbfs refuses bulk URBs larger than this */
+#define MAX_USBFS_BULK_SIZE (16 * 1024)
+
 static adb_mutex_t usb_lock = ADB_MUTEX_INITIALIZER;
 
 struct usb_handle
@@ -475,7 +478,7 @@ int usb_write(usb_handle *h, const void *_data, int len)
     }
 
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
 
         n = usb_bulk_write(h, data, xfer);
         if(n != xfer) {
@@ -503,7 +506,7 @@ int usb_read(usb_handle *h, void *_data, int len)
 
     D("++ usb_read ++\n");
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
 
         D("[ usb read %d fd = %d], fname=%s\n", xfer, h->desc, h->fname);
         n = usb_bulk_read(h, data, xfer);
@@ -79,31 +79,50 @@ static void *usb_open_thread(void *x)
     return 0;
 }
 
-int usb_write(usb_handle *h, const void *data, int len)
+/* the gadget driver rejects transfers larger than its bulk buffer,
+** so payloads negotiated above MAX_PAYLOAD_V1 are split up here.
+*/
+#define USB_BULK_MAX  4096
+
+int usb_write(usb_handle *h, const void *_data, int len)
 {
+    const char *data = _data;
     int n;
 
     D("[ write %d ]\n", len);
-    n = adb_write(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: n = %d, errno = %d (%s)\n",
-            n, errno, strerror(errno));
-        return -1;
+    while(len > 0) {
+        int xfer = (len > USB_BULK_MAX) ? USB_BULK_MAX : len;
+
+        n = adb_write(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: n = %d, errno = %d (%s)\n",
+                n, errno, strerror(errno));
+            return -1;
+        }
+        len -= xfer;
+        data += xfer;
     }
     D("[ done ]\n");
     return 0;
 }
 
-int usb_read(usb_handle *h, void *data, int len)
+int usb_read(usb_handle *h, void *_data, int len)
 {
+    char *data = _data;
     int n;
 
     D("[ read %d ]\n", len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: n = %d, errno = %d (%s)\n",
-            n, errno, strerror(errno));
-        return -1;
+    while(len > 0) {
+        int xfer = (len > USB_BULK_MAX) ? USB_BULK_MAX : len;
+
+        n = adb_read(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: n = %d, errno = %d (%s)\n",
+                n, errno, strerror(errno));
+            return -1;
+        }
+        len -= xfer;
+        data += xfer;
     }
     return 0;
 }
@@ -17,6 +17,8 @@
 #ifndef __CUTILS_CPU_INFO_H
 #define __CUTILS_CPU_INFO_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,6 +28,17 @@ extern "C" {
 ** The string is a static variable, so don't call free() on it.
 */
 extern const char* get_cpu_serial_number(void);
+
+/* vector instruction sets the CPU supports, see get_cpu_features() */
+enum {
+    CPU_FEATURE_SSE2    = 0x00000001,
+    CPU_FEATURE_NEON    = 0x00000002
+};
+
+/* returns the CPU_FEATURE_* bits of the CPU we're running on, which may be
+** fewer than the compiler was told to target.
+*/
+extern uint32_t get_cpu_features(void);
     
 #ifdef __cplusplus
 }
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2007 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Concurrent hash map.
+ *
+ * Same contract as Hashmap in cutils/hashmap.h, except that every call is
+ * thread safe on its own: there is no map-wide lock to take. Entries are
+ * kept inline in open-addressed tables, split into stripes that each have
+ * their own lock and grow on their own, a few entries at a time.
+ *
+ * Keys must not be NULL.
+ */
+
+#ifndef __HASHMAP2_H
+#define __HASHMAP2_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A concurrent hash map. */
+typedef struct Hashmap2 Hashmap2;
+
+/**
+ * Creates a new hash map. Returns NULL if memory allocation fails.
+ *
+ * @param initialCapacity number of expected entries
+ * @param hash function which hashes keys, such as hashmapIntHash
+ * @param equals function which compares keys for equality
+ */
+Hashmap2* hashmap2Create(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
+
+/**
+ * Frees the hash map. Does not free the keys or values themselves. No
+ * other thread may be using the map.
+ */
+void hashmap2Free(Hashmap2* map);
+
+/**
+ * Puts value for the given key in the map. Returns pre-existing value if
+ * any.
+ *
+ * If memory allocation fails, this function returns NULL, the map's size
+ * does not increase, and errno is set to ENOMEM.
+ */
+void* hashmap2Put(Hashmap2* map, void* key, void* value);
+
+/**
+ * Gets a value from the map. Returns NULL if no entry for the given key is
+ * found or if the value itself is NULL.
+ */
+void* hashmap2Get(Hashmap2* map, void* key);
+
+/**
+ * Returns true if the map contains an entry for the given key.
+ */
+bool hashmap2ContainsKey(Hashmap2* map, void* key);
+
+/**
+ * Gets the value for a key. If a value is not found, this function gets a
+ * value and creates an entry using the given callback, atomically: two
+ * threads memoizing the same key call it once.
+ *
+ * The callback runs with a stripe of the map locked, and must not use the
+ * map. If memory allocation fails, the callback is not called, this
+ * function returns NULL, and errno is set to ENOMEM.
+ */
+void* hashmap2Memoize(Hashmap2* map, void* key,
+        void* (*initialValue)(void* key, void* context), void* context);
+
+/**
+ * Removes an entry from the map. Returns the removed value or NULL if no
+ * entry was present.
+ */
+void* hashmap2Remove(Hashmap2* map, void* key);
+
+/**
+ * Gets the number of entries in this map. Other threads may change it
+ * at any time.
+ */
+size_t hashmap2Size(Hashmap2* map);
+
+/**
+ * Invokes the given callback on each entry in the map. Stops iterating if
+ * the callback returns false.
+ *
+ * Each stripe is locked while its entries are visited, so the callback
+ * must not use the map. Entries put or removed by other threads during
+ * the iteration may or may not be visited.
+ */
+void hashmap2ForEach(Hashmap2* map,
+        bool (*callback)(void* key, void* value, void* context),
+        void* context);
+
+/**
+ * For debugging.
+ */
+
+/**
+ * Gets current capacity, over all stripes.
+ */
+size_t hashmap2CurrentCapacity(Hashmap2* map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HASHMAP2_H */
@@ -42,6 +42,21 @@ int __android_log_bwrite(int32_t tag, const void *payload, size_t len);
 int __android_log_btwrite(int32_t tag, char type, const void *payload,
     size_t len);
 
+/*
+ * Turns buffered mode on, or off if size is 0. Text records are then kept
+ * in a buffer of size bytes per thread, and consecutive records with the
+ * same priority and tag are written out as one multi-line entry. A buffer
+ * is written when it is full, when a record of flush_prio or above comes
+ * in, when its thread exits, and at least every flush_ms milliseconds.
+ * Returns 0, or -1 if buffered mode is not available.
+ */
+int __android_log_set_buffered(size_t size, int flush_ms, int flush_prio);
+
+/*
+ * Writes out the records that all threads have buffered.
+ */
+void __android_log_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -147,6 +147,25 @@ int android_log_filterAndPrintLogLine(
     int fd,
     const AndroidLogEntry *entry);
 
+/**
+ * Has android_log_filterAndPrintLogLine collect lines in an output buffer
+ * of size bytes and write them out together when it is full, instead of
+ * making one write per line. 0 turns the buffer off.
+ *
+ * The caller must flush the buffer before the lines are needed, and before
+ * changing fd or freeing the format.
+ *
+ * Returns 0 on success and -1 on malloc error
+ */
+int android_log_setOutputBuffer(AndroidLogFormat *p_format, size_t size);
+
+/**
+ * Writes out the lines in the output buffer
+ *
+ * Returns count bytes written
+ */
+int android_log_flushOutputBuffer(AndroidLogFormat *p_format, int fd);
+
 
 #ifdef __cplusplus
 }
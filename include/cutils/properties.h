@@ -46,6 +46,15 @@ int property_set(const char *key, const char *value);
     
 int property_list(void (*propfn)(const char *key, const char *value, void *cookie), void *cookie);    
 
+/* property_set_batch: sets 'count' properties at once, which wakes
+** property waiters and runs property triggers once for the batch rather
+** than once per property. at most PROPERTY_BATCH_MAX properties per call.
+** returns 0 on success, < 0 on failure
+*/
+#define PROPERTY_BATCH_MAX  64
+
+int property_set_batch(const char **keys, const char **values, int count);
+
 
 #ifdef HAVE_SYSTEM_PROPERTY_SERVER
 /*
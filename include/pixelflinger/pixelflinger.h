@@ -73,6 +73,7 @@ enum GGLNames {
     GGL_AA                          = 0x80000001,
     GGL_W_LERP                      = 0x80000004,
     GGL_POINT_SMOOTH_NICE           = 0x80000005,
+    GGL_MULTITHREAD                 = 0x80000006,
 
     // buffers, pixel drawing/reading
     GGL_COLOR                       = 0x1800,
@@ -321,6 +322,34 @@ GGLint gglBitBlti(
         GGLint crop[4],
         GGLint where[4]);
 
+// statistics of the cache of generated scanline code, shared by all contexts
+typedef struct {
+    uint32_t    hits;
+    uint32_t    misses;
+    uint32_t    evictions;
+    uint32_t    compiles;
+    int64_t     compileTime;    // total, in nanoseconds
+    uint32_t    count;          // cached scanlines
+    uint32_t    size;           // bytes of cached code
+    uint32_t    budget;         // maximum bytes of cached code
+} GGLCodeCacheStats;
+
+ssize_t gglGetCodeCacheStats(GGLCodeCacheStats* stats);
+
+// evicts right away whatever doesn't fit in the new size
+ssize_t gglSetCodeCacheSize(size_t size);
+
+// Saves the generated scanlines to a file that gglLoadCodeCache() maps back,
+// in another process for instance, instead of generating them again.
+// GGL_CODE_CACHE_PATH is loaded when the first context is created.
+// The code in the file is executed as is, so it's only loaded from a
+// regular file owned by root or the caller, that only its owner can write.
+// A file saved by another build of pixelflinger is ignored.
+#define GGL_CODE_CACHE_PATH     "/data/system/pixelflinger.codecache"
+
+ssize_t gglSaveCodeCache(const char* path);
+ssize_t gglLoadCodeCache(const char* path);
+
 #ifdef __cplusplus
 };
 #endif
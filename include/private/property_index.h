@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Layout of the system property area shared between init, which is the
+** only writer, and every reader that maps the workspace.
+**
+** The first PA_INDEX_START bytes are the classic libc layout: the
+** prop_area header and toc, followed by the first PA_COUNT_MAX
+** prop_infos, so that the libc property functions keep working.
+**
+** After it comes a hash index of every property, followed by the
+** prop_infos that did not fit in the classic area. Slots of the index
+** hold the offset of a prop_info from the start of the area and are
+** probed linearly. Properties are never removed and a slot is only
+** written once, after its prop_info is complete, so readers need no
+** lock: a lookup costs a hash of the name and usually one compare.
+** Values are still read with the serial protocol of the libc.
+*/
+
+#ifndef _ANDROID_PROPERTY_INDEX_H_
+#define _ANDROID_PROPERTY_INDEX_H_
+
+#include <string.h>
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+/* (8 header words + 247 toc words) = 1020 bytes */
+/* 1024 bytes header and toc + 247 prop_infos @ 128 bytes = 32640 bytes */
+
+#define PA_COUNT_MAX  247
+#define PA_INFO_START 1024
+
+#define PROP_INDEX_MAGIC    0x58444e49
+#define PROP_INDEX_VERSION  0x00000001
+
+/* init sets pa->reserved[PA_RESERVED_INDEX] to PROP_INDEX_MAGIC once the
+** index is set up; older areas are only 32 KiB and leave it zero.
+*/
+#define PA_RESERVED_INDEX   0
+
+#define PA_INDEX_START      32768
+#define PA_INDEX_BUCKETS    2048
+#define PA_OVERFLOW_START   (PA_INDEX_START + 9216)
+#define PA_SIZE             131072
+#define PA_OVERFLOW_MAX     ((PA_SIZE - PA_OVERFLOW_START) / sizeof(prop_info))
+
+typedef struct prop_index prop_index;
+
+struct prop_index {
+    unsigned magic;
+    unsigned version;
+    unsigned volatile count;
+    unsigned buckets;
+    unsigned volatile slot[PA_INDEX_BUCKETS];
+};
+
+static inline unsigned prop_index_hash(const char *name)
+{
+    unsigned h = 2166136261U;
+
+    while(*name)
+        h = (h ^ (unsigned char) *name++) * 16777619U;
+    return h;
+}
+
+/* returns the index of a property area, or 0 if the area was set up by
+** an init that predates it. nothing past the header is read until the
+** area says it is big enough to hold an index.
+*/
+static inline prop_index *prop_area_index(prop_area *pa)
+{
+    prop_index *idx;
+
+    if(pa == 0 || pa->magic != PROP_AREA_MAGIC ||
+       pa->version != PROP_AREA_VERSION ||
+       pa->reserved[PA_RESERVED_INDEX] != PROP_INDEX_MAGIC)
+        return 0;
+
+    idx = (prop_index *) (((char *) pa) + PA_INDEX_START);
+    if(idx->magic != PROP_INDEX_MAGIC || idx->version != PROP_INDEX_VERSION)
+        return 0;
+    return idx;
+}
+
+/* the n-th property set, in order of creation */
+static inline prop_info *prop_index_nth(prop_area *pa, unsigned n)
+{
+    char *base = (char *) pa;
+
+    if(n < PA_COUNT_MAX)
+        return (prop_info *) (base + PA_INFO_START + n * sizeof(prop_info));
+    n -= PA_COUNT_MAX;
+    return (prop_info *) (base + PA_OVERFLOW_START + n * sizeof(prop_info));
+}
+
+static inline prop_info *prop_index_find(prop_area *pa, prop_index *idx,
+                                         const char *name)
+{
+    unsigned mask = idx->buckets - 1;
+    unsigned n = prop_index_hash(name) & mask;
+    unsigned off;
+
+    while((off = idx->slot[n]) != 0) {
+        prop_info *pi = (prop_info *) (((char *) pa) + off);
+        if(!strcmp(pi->name, name))
+            return pi;
+        n = (n + 1) & mask;
+    }
+    return 0;
+}
+
+/* messages to the property service: besides the libc's single
+** PROP_MSG_SETPROP, a connection may start with a PROP_MSG_SETPROPS
+** message, followed by up to PROP_BATCH_MAX - 1 more prop_msgs
+** until the client shuts down its side. the whole batch is applied
+** with a single wake-up of property waiters and trigger scan.
+*/
+#define PROP_MSG_SETPROPS   2
+#define PROP_BATCH_MAX      64  /* same as PROPERTY_BATCH_MAX */
+
+#endif
@@ -10,6 +10,7 @@ LOCAL_SRC_FILES:= \
 	property_service.c \
 	util.c \
 	parser.c \
+	helpers.c \
 	logo.c
 
 ifeq ($(strip $(INIT_BOOTCHART)),true)
@@ -36,3 +37,13 @@ LOCAL_CFLAGS := -DBOARD_USES_LIRC
 else
 LOCAL_CFLAGS :=
 endif
+
+# host tool converting the binary bootchart log to the text logs
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := bootchart_convert.c
+LOCAL_MODULE := bootchart_convert
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
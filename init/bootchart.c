@@ -31,17 +31,17 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "bootchart.h"
+#include "bootchart_format.h"
 
 #define VERSION         "0.8"
-#define SAMPLE_PERIOD   0.2
 #define LOG_ROOT        "/data/bootchart"
-#define LOG_STAT        LOG_ROOT"/proc_stat.log"
-#define LOG_PROCS       LOG_ROOT"/proc_ps.log"
-#define LOG_DISK        LOG_ROOT"/proc_diskstats.log"
+#define LOG_BIN         LOG_ROOT"/bootchart.bin"
 #define LOG_HEADER      LOG_ROOT"/header"
 #define LOG_ACCT        LOG_ROOT"/kernel_pacct"
+#define LOG_ACTIONS     LOG_ROOT"/init_actions.log"
 
 #define LOG_STARTFILE   "/data/bootchart-start"
 #define LOG_STOPFILE    "/data/bootchart-stop"
@@ -83,13 +83,6 @@ typedef struct {
     char  data[FILE_BUFF_SIZE];
 } FileBuffRec, *FileBuff;
 
-static void
-file_buff_open( FileBuff  buff, const char*  path )
-{
-    buff->count = 0;
-    buff->fd    = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0755);
-}
-
 static void
 file_buff_write( FileBuff  buff, const void*  src, int  len )
 {
@@ -181,131 +174,535 @@ open_log_file(int*  plogfd, const char*  logfile)
     }
 }
 
-static void
-do_log_uptime(FileBuff  log)
+
+static long long
+now_us( void )
 {
-    char  buff[65];
-    int   fd, ret, len;
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
 
-    fd = open("/proc/uptime",O_RDONLY);
-    if (fd >= 0) {
-        int  ret;
-        ret = unix_read(fd, buff, 64);
-        close(fd);
-        buff[64] = 0;
-        if (ret >= 0) {
-            long long  jiffies = 100LL*strtod(buff,NULL);
-            int        len;
-            snprintf(buff,sizeof(buff),"%lld\n",jiffies);
-            len = strlen(buff);
-            file_buff_write(log, buff, len);
-        }
+/* samples are kept in memory, in the format of bootchart_format.h, in a
+ * ring of chunks that bootchart_init() allocates and touches up front.
+ * nothing is written until bootchart_finish(), so that sampling neither
+ * allocates memory nor writes to the disks being charted. when the ring
+ * is full, its oldest chunk is dropped.
+ */
+#define RING_CHUNK_SIZE   (256*1024)
+#define RING_CHUNKS       32            /* 8 MB */
+#define MAX_PROCS         1024          /* per sample */
+#define MAX_DISKS         64
+#define PROC_SLOTS        4096          /* power of 2, > 2*MAX_PROCS */
+
+typedef struct {
+    BootchartChunkHeader  hdr;
+    unsigned char         data[RING_CHUNK_SIZE - sizeof(BootchartChunkHeader)];
+} RingChunkRec, *RingChunk;
+
+static RingChunk  ring;
+static int        ring_head;        /* oldest chunk */
+static int        ring_count;       /* chunks in use, the newest is current */
+static unsigned   ring_seq;         /* seq of the current chunk */
+static unsigned   ring_dropped;
+
+static RingChunk
+ring_current( void )
+{
+    return &ring[(ring_head + ring_count - 1) % RING_CHUNKS];
+}
+
+static RingChunk
+ring_next( void )
+{
+    RingChunk  chunk;
+
+    if (ring_count == RING_CHUNKS) {
+        ring_head = (ring_head + 1) % RING_CHUNKS;
+        ring_dropped++;
+    } else {
+        ring_count++;
+    }
+    chunk = ring_current();
+    chunk->hdr.used = 0;
+    chunk->hdr.seq  = ++ring_seq;
+    return chunk;
+}
+
+/* what the deltas of the next sample are against. 'gen' is the seq of
+ * the chunk the values were last encoded in; values from another chunk
+ * do not count, and are encoded in full instead.
+ */
+typedef struct {
+    int        pid;             /* 0 if the slot is free */
+    unsigned   gen;
+    unsigned   seen;            /* sample_no of the last sample it was in */
+    int        name_dirty;
+    char       comm[16];
+    char       name[BC_NAME_MAX];
+    long long  last[BC_PROC_FIELDS];
+} ProcStateRec, *ProcState;
+
+typedef struct {
+    unsigned   gen;
+    int        major, minor;
+    char       name[32];
+    long long  last[BC_DISK_FIELDS];
+} DiskStateRec, *DiskState;
+
+static ProcStateRec  proc_states[PROC_SLOTS];
+static int           proc_state_count;
+static DiskStateRec  disk_states[MAX_DISKS];
+static int           disk_state_count;
+static long long     cpu_last[BC_CPU_FIELDS];
+static unsigned      cpu_gen;
+static long long     time_last;
+static unsigned      time_gen;
+static unsigned      sample_no;
+
+/* the sample being taken */
+static long long     cur_cpu[BC_CPU_FIELDS];
+static struct {
+    DiskState  state;
+    long long  value[BC_DISK_FIELDS];
+} cur_disks[MAX_DISKS];
+static int           cur_disk_count;
+static struct {
+    ProcState  state;
+    long long  value[BC_PROC_FIELDS];
+} cur_procs[MAX_PROCS];
+static int           cur_proc_count;
+
+static unsigned char  sample_buff[sizeof(((RingChunk)0)->data)];
+
+static int        sample_period_ms;
+static long long  sample_next;
+static long long  sample_end;
+static long long  stop_check_next;
+
+static int        fd_stat = -1;
+static int        fd_disks = -1;
+static DIR*       dir_proc;
+
+static ProcState
+proc_state_lookup( int  pid )
+{
+    unsigned  n = ((unsigned)pid * 2654435761U) & (PROC_SLOTS - 1);
+
+    while (proc_states[n].pid != 0 && proc_states[n].pid != pid)
+        n = (n + 1) & (PROC_SLOTS - 1);
+    if (proc_states[n].pid == 0) {
+        memset(&proc_states[n], 0, sizeof(proc_states[n]));
+        proc_states[n].pid = pid;
+        proc_state_count++;
     }
+    return &proc_states[n];
 }
 
+/* forgets the pids that were not in the last sample, before the table
+ * gets too crowded. only called between samples, when no pointer into
+ * the table is held.
+ */
 static void
-do_log_ln(FileBuff  log)
+proc_states_prune( void )
 {
-    file_buff_write(log, "\n", 1);
+    static ProcStateRec  keep[MAX_PROCS];
+    int                  n, count = 0;
+
+    if (proc_state_count < PROC_SLOTS/2)
+        return;
+
+    for (n = 0; n < PROC_SLOTS; n++) {
+        if (proc_states[n].pid != 0 && proc_states[n].seen == sample_no &&
+            count < MAX_PROCS)
+            keep[count++] = proc_states[n];
+    }
+    memset(proc_states, 0, sizeof(proc_states));
+    proc_state_count = 0;
+    for (n = 0; n < count; n++)
+        *proc_state_lookup(keep[n].pid) = keep[n];
 }
 
+static DiskState
+disk_state_lookup( const char*  name, int  major, int  minor )
+{
+    DiskState  disk;
+    int        n;
+
+    for (n = 0; n < disk_state_count; n++) {
+        if (!strcmp(disk_states[n].name, name))
+            return &disk_states[n];
+    }
+    if (disk_state_count == MAX_DISKS)
+        return NULL;
+
+    disk = &disk_states[disk_state_count++];
+    snprintf(disk->name, sizeof(disk->name), "%s", name);
+    disk->major = major;
+    disk->minor = minor;
+    return disk;
+}
+
+/* reads a file of /proc that is kept open */
+static int
+proc_pread( int  fd, char*  buff, int  buffsize )
+{
+    int  len;
+
+    do { len = pread(fd, buff, buffsize-1, 0); } while (len < 0 && errno == EINTR);
+    buff[len > 0 ? len : 0] = 0;
+    return len;
+}
 
 static void
-do_log_file(FileBuff  log, const char*  procfile)
+sample_cpu( void )
 {
-    char   buff[1024];
-    int    fd;
+    char   buff[256];
+    char*  p = buff + 3;
+    int    n;
 
-    do_log_uptime(log);
+    memset(cur_cpu, 0, sizeof(cur_cpu));
+    if (proc_pread(fd_stat, buff, sizeof(buff)) <= 0 || strncmp(buff, "cpu ", 4))
+        return;
+    for (n = 0; n < BC_CPU_FIELDS; n++)
+        cur_cpu[n] = strtoll(p, &p, 10);
+}
 
-    /* append file content */
-    fd = open(procfile,O_RDONLY);
-    if (fd >= 0) {
-        close_on_exec(fd);
-        for (;;) {
-            int  ret;
-            ret = unix_read(fd, buff, sizeof(buff));
-            if (ret <= 0)
-                break;
-
-            file_buff_write(log, buff, ret);
-            if (ret < (int)sizeof(buff))
-                break;
+static void
+sample_disks( void )
+{
+    char   buff[4096];
+    char*  line = buff;
+
+    cur_disk_count = 0;
+    if (proc_pread(fd_disks, buff, sizeof(buff)) <= 0)
+        return;
+
+    while (*line && cur_disk_count < MAX_DISKS) {
+        char*  end = strchr(line, '\n');
+        char   name[32];
+        int    major, minor, pos, n;
+
+        if (end)
+            *end = 0;
+        if (sscanf(line, "%d %d %31s %n", &major, &minor, name, &pos) >= 3) {
+            DiskState  disk = disk_state_lookup(name, major, minor);
+            if (disk) {
+                char*  p = line + pos;
+                cur_disks[cur_disk_count].state = disk;
+                for (n = 0; n < BC_DISK_FIELDS; n++)
+                    cur_disks[cur_disk_count].value[n] = strtoll(p, &p, 10);
+                cur_disk_count++;
+            }
         }
-        close(fd);
+        if (!end)
+            break;
+        line = end + 1;
     }
+}
 
-    do_log_ln(log);
+/* parses a /proc/<pid>/stat line into the fields we keep. the comm is
+ * found from the last ')' since it may contain anything.
+ */
+static int
+parse_proc_stat( char*  buff, char*  comm, int  commsize, long long*  value )
+{
+    static const signed char  field_of[] = {
+        /* 4 */ BC_PROC_PPID, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        /* 14 */ BC_PROC_UTIME, BC_PROC_STIME, BC_PROC_CUTIME, BC_PROC_CSTIME,
+        /* 18 */ BC_PROC_PRIORITY, BC_PROC_NICE, BC_PROC_THREADS, -1,
+        /* 22 */ BC_PROC_STARTTIME, BC_PROC_VSIZE, BC_PROC_RSS,
+    };
+    char*  p1 = strchr(buff, '(');
+    char*  p2 = strrchr(buff, ')');
+    char*  p;
+    int    n, len;
+
+    if (p1 == NULL || p2 == NULL || p2 < p1 || p2[1] == 0)
+        return -1;
+
+    len = p2 - p1 - 1;
+    if (len >= commsize)
+        len = commsize - 1;
+    memcpy(comm, p1 + 1, len);
+    comm[len] = 0;
+
+    p = p2 + 2;
+    value[BC_PROC_STATE] = (unsigned char) *p++;
+    for (n = 0; n < (int)sizeof(field_of); n++) {
+        long long  v = strtoll(p, &p, 10);
+        if (field_of[n] >= 0)
+            value[(int)field_of[n]] = v;
+    }
+    return 0;
 }
 
 static void
-do_log_procs(FileBuff  log)
+sample_procs( void )
 {
-    DIR*  dir = opendir("/proc");
     struct dirent*  entry;
 
-    do_log_uptime(log);
+    cur_proc_count = 0;
+    proc_states_prune();
+    sample_no++;
 
-    while ((entry = readdir(dir)) != NULL) {
+    rewinddir(dir_proc);
+    while ((entry = readdir(dir_proc)) != NULL && cur_proc_count < MAX_PROCS) {
         /* only match numeric values */
-        char*  end;
-        int    pid = strtol( entry->d_name, &end, 10);
-        if (end != NULL && end > entry->d_name && *end == 0) {
-            char  filename[32];
-            char  buff[1024];
-            char  cmdline[1024];
-            int   len;
-            int   fd;
-
-            /* read command line and extract program name */
+        char*      end;
+        int        pid = strtol( entry->d_name, &end, 10);
+        char       filename[32];
+        char       buff[1024];
+        char       comm[16];
+        long long* value;
+        ProcState  state;
+
+        if (end == NULL || end == entry->d_name || *end != 0)
+            continue;
+
+        snprintf(filename,sizeof(filename),"/proc/%d/stat",pid);
+        if (proc_read(filename, buff, sizeof(buff)) <= 0)
+            continue;
+
+        value = cur_procs[cur_proc_count].value;
+        if (parse_proc_stat(buff, comm, sizeof(comm), value) < 0)
+            continue;
+
+        state = proc_state_lookup(pid);
+
+        /* a new process, or one that called exec() or changed its name:
+         * only then read its command line, and use its program name
+         * instead of the comm, which is truncated */
+        if (state->name[0] == 0 || strcmp(state->comm, comm) ||
+            state->last[BC_PROC_STARTTIME] != value[BC_PROC_STARTTIME]) {
+            char  cmdline[BC_NAME_MAX];
+
             snprintf(filename,sizeof(filename),"/proc/%d/cmdline",pid);
             proc_read(filename, cmdline, sizeof(cmdline));
+            snprintf(state->name, sizeof(state->name), "%s",
+                     cmdline[0] ? cmdline : comm);
+            strcpy(state->comm, comm);
+            state->name_dirty = 1;
+        }
+        state->seen = sample_no;
+        cur_procs[cur_proc_count++].state = state;
+    }
+}
 
-            /* read process stat line */
-            snprintf(filename,sizeof(filename),"/proc/%d/stat",pid);
-            fd = open(filename,O_RDONLY);
-            if (fd >= 0) {
-               len = unix_read(fd, buff, sizeof(buff)-1);
-               close(fd);
-               if (len > 0) {
-                    int  len2 = strlen(cmdline);
-                    if (len2 > 0) {
-                        /* we want to substitute the process name with its real name */
-                        const char*  p1;
-                        const char*  p2;
-                        buff[len] = 0;
-                        p1 = strchr(buff, '(');
-                        p2 = strchr(p1, ')');
-                        file_buff_write(log, buff, p1+1-buff);
-                        file_buff_write(log, cmdline, strlen(cmdline));
-                        file_buff_write(log, p2, strlen(p2));
-                    } else {
-                        /* no substitution */
-                        file_buff_write(log,buff,len);
-                    }
-               }
-            }
+static unsigned char*
+put_varint( unsigned char*  p, unsigned long long  v )
+{
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+static unsigned char*
+put_delta( unsigned char*  p, long long  delta )
+{
+    return put_varint(p, ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+}
+
+static unsigned char*
+put_string( unsigned char*  p, const char*  s )
+{
+    int  len = strlen(s);
+    p = put_varint(p, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static unsigned
+fields_mask( const long long*  last, const long long*  value, int  count, int  full )
+{
+    unsigned  mask = 0;
+    int       n;
+
+    for (n = 0; n < count; n++) {
+        if (value[n] != (full ? 0 : last[n]))
+            mask |= 1 << n;
+    }
+    return mask;
+}
+
+static unsigned char*
+put_fields( unsigned char*  p, unsigned  mask, const long long*  last,
+            const long long*  value, int  count, int  full )
+{
+    int  n;
+
+    for (n = 0; n < count; n++) {
+        if (mask & (1 << n))
+            p = put_delta(p, value[n] - (full ? 0 : last[n]));
+    }
+    return p;
+}
+
+/* encodes the sample against the values last encoded in the chunk of
+ * seq 'gen', without changing them. returns the length.
+ */
+static int
+encode_sample( unsigned char*  out, unsigned  gen, long long  now )
+{
+    unsigned char*  p = out;
+    unsigned        mask;
+    int             n, full;
+
+    *p++ = BC_REC_SAMPLE;
+    p = put_delta(p, now - (time_gen == gen ? time_last : 0));
+
+    full = (cpu_gen != gen);
+    mask = fields_mask(cpu_last, cur_cpu, BC_CPU_FIELDS, full);
+    *p++ = BC_REC_CPU;
+    p = put_varint(p, mask);
+    p = put_fields(p, mask, cpu_last, cur_cpu, BC_CPU_FIELDS, full);
+
+    for (n = 0; n < cur_disk_count; n++) {
+        DiskState  disk = cur_disks[n].state;
+
+        full = (disk->gen != gen);
+        mask = fields_mask(disk->last, cur_disks[n].value, BC_DISK_FIELDS, full);
+        if (mask == 0 && !full)
+            continue;
+        if (full)
+            mask |= BC_DISK_NAME;
+        *p++ = BC_REC_DISK;
+        p = put_varint(p, disk - disk_states);
+        p = put_varint(p, mask);
+        if (full) {
+            p = put_varint(p, disk->major);
+            p = put_varint(p, disk->minor);
+            p = put_string(p, disk->name);
         }
+        p = put_fields(p, mask, disk->last, cur_disks[n].value, BC_DISK_FIELDS, full);
+    }
+
+    for (n = 0; n < cur_proc_count; n++) {
+        ProcState  proc = cur_procs[n].state;
+
+        full = (proc->gen != gen);
+        mask = fields_mask(proc->last, cur_procs[n].value, BC_PROC_FIELDS, full);
+        if (full || proc->name_dirty)
+            mask |= BC_PROC_NAME;
+        if (full)
+            mask |= BC_PROC_FULL;
+        *p++ = BC_REC_PROC;
+        p = put_varint(p, proc->pid);
+        p = put_varint(p, mask);
+        if (mask & BC_PROC_NAME)
+            p = put_string(p, proc->name);
+        p = put_fields(p, mask, proc->last, cur_procs[n].value, BC_PROC_FIELDS, full);
+    }
+    return p - out;
+}
+
+/* makes the sample what the next one is encoded against */
+static void
+commit_sample( unsigned  gen, long long  now )
+{
+    int  n;
+
+    time_last = now;
+    time_gen  = gen;
+    memcpy(cpu_last, cur_cpu, sizeof(cpu_last));
+    cpu_gen = gen;
+    for (n = 0; n < cur_disk_count; n++) {
+        DiskState  disk = cur_disks[n].state;
+        memcpy(disk->last, cur_disks[n].value, sizeof(disk->last));
+        disk->gen = gen;
+    }
+    for (n = 0; n < cur_proc_count; n++) {
+        ProcState  proc = cur_procs[n].state;
+        memcpy(proc->last, cur_procs[n].value, sizeof(proc->last));
+        proc->gen = gen;
+        proc->name_dirty = 0;
+    }
+}
+
+static void
+do_sample( long long  now )
+{
+    RingChunk  chunk = ring_current();
+    int        len;
+
+    sample_cpu();
+    sample_disks();
+    sample_procs();
+
+    len = encode_sample(sample_buff, chunk->hdr.seq, now);
+    if (chunk->hdr.used + len > sizeof(chunk->data)) {
+        /* a new chunk starts with a sample encoded in full */
+        chunk = ring_next();
+        len   = encode_sample(sample_buff, chunk->hdr.seq, now);
+        if (len > (int)sizeof(chunk->data))
+            return;
+    }
+    memcpy(chunk->data + chunk->hdr.used, sample_buff, len);
+    chunk->hdr.used += len;
+    commit_sample(chunk->hdr.seq, now);
+}
+
+static void
+write_samples( void )
+{
+    BootchartBinHeader  header;
+    int                 fd, n;
+
+    fd = open(LOG_BIN, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    header.magic       = BOOTCHART_BIN_MAGIC;
+    header.version     = BOOTCHART_BIN_VERSION;
+    header.period_ms   = sample_period_ms;
+    header.chunk_count = ring_count;
+    header.dropped     = ring_dropped;
+    unix_write(fd, &header, sizeof(header));
+
+    for (n = 0; n < ring_count; n++) {
+        RingChunk  chunk = &ring[(ring_head + n) % RING_CHUNKS];
+        unix_write(fd, chunk, sizeof(chunk->hdr) + chunk->hdr.used);
     }
-    closedir(dir);
-    do_log_ln(log);
+    close(fd);
 }
 
-static FileBuffRec  log_stat[1];
-static FileBuffRec  log_procs[1];
-static FileBuffRec  log_disks[1];
+static FileBuffRec  log_actions[1] = { { 0, -1 } };
+
+static void
+close_samplers( void )
+{
+    free(ring);
+    ring = NULL;
+    if (fd_stat >= 0)
+        close(fd_stat);
+    if (fd_disks >= 0)
+        close(fd_disks);
+    if (dir_proc != NULL)
+        closedir(dir_proc);
+    fd_stat = fd_disks = -1;
+    dir_proc = NULL;
+}
 
 /* called to setup bootcharting */
 int   bootchart_init( void )
 {
     int  ret;
-    char buff[4];
-    int  timeout = 0, count = 0;
+    char buff[32];
+    int  timeout = 0, period = BOOTCHART_POLLING_MS;
+    long long  now;
 
     buff[0] = 0;
     proc_read( LOG_STARTFILE, buff, sizeof(buff) );
     if (buff[0] != 0) {
-        timeout = atoi(buff);
+        /* "<timeout> [<period in ms>]" */
+        char*  p;
+        timeout = strtol(buff, &p, 10);
+        if (*p == ' ' && atoi(p) > 0)
+            period = atoi(p);
     }
     else {
         /* when running with emulator, androidboot.bootchart=<timeout>
@@ -328,14 +725,30 @@ int   bootchart_init( void )
 
     if (timeout > BOOTCHART_MAX_TIME_SEC)
         timeout = BOOTCHART_MAX_TIME_SEC;
-
-    count = (timeout*1000 + BOOTCHART_POLLING_MS-1)/BOOTCHART_POLLING_MS;
+    if (period > BOOTCHART_MAX_POLLING_MS)
+        period = BOOTCHART_MAX_POLLING_MS;
+
+    /* allocate and touch the whole ring now, sampling must not fault */
+    ring = malloc(RING_CHUNKS * sizeof(RingChunkRec));
+    if (ring == NULL)
+        return -1;
+    memset(ring, 0, RING_CHUNKS * sizeof(RingChunkRec));
+
+    fd_stat  = open("/proc/stat", O_RDONLY);
+    fd_disks = open("/proc/diskstats", O_RDONLY);
+    dir_proc = opendir("/proc");
+    if (fd_stat < 0 || fd_disks < 0 || dir_proc == NULL) {
+        close_samplers();
+        return -1;
+    }
+    close_on_exec(fd_stat);
+    close_on_exec(fd_disks);
+    close_on_exec(dirfd(dir_proc));
 
     do {ret=mkdir(LOG_ROOT,0755);}while (ret < 0 && errno == EINTR);
 
-    file_buff_open(log_stat,  LOG_STAT);
-    file_buff_open(log_procs, LOG_PROCS);
-    file_buff_open(log_disks, LOG_DISK);
+    /* the actions that ran before are still buffered */
+    log_actions->fd = open(LOG_ACTIONS, O_WRONLY|O_CREAT|O_TRUNC, 0755);
 
     /* create kernel process accounting file */
     {
@@ -347,32 +760,72 @@ int   bootchart_init( void )
     }
 
     log_header();
-    return count;
+
+    ring_next();
+    now = now_us();
+    sample_period_ms = period;
+    sample_next      = now;
+    sample_end       = now + timeout*1000000LL;
+    stop_check_next  = now;
+    return period;
 }
 
-/* called each time you want to perform a bootchart sampling op */
+/* called from init's main loop, takes a sample if one is due. returns
+ * the number of ms until the next one, or -1 when bootcharting is over.
+ */
 int  bootchart_step( void )
 {
-    do_log_file(log_stat,   "/proc/stat");
-    do_log_file(log_disks,  "/proc/diskstats");
-    do_log_procs(log_procs);
+    long long  now = now_us();
+
+    if (now >= sample_end)
+        return -1;
 
     /* we stop when /data/bootchart-stop contains 1 */
-    {
+    if (now >= stop_check_next) {
         char  buff[2];
         if (proc_read(LOG_STOPFILE,buff,sizeof(buff)) > 0 && buff[0] == '1') {
             return -1;
         }
+        stop_check_next = now + 1000000LL;
     }
 
-    return 0;
+    /* sample a little early rather than sleep again for less than 1 ms */
+    if (now >= sample_next - 1000) {
+        do_sample(now);
+        sample_next += sample_period_ms*1000LL;
+        if (sample_next <= now)
+            sample_next = now + sample_period_ms*1000LL;
+    }
+
+    return (int)((sample_next - now + 999) / 1000);
 }
 
 void  bootchart_finish( void )
 {
     unlink( LOG_STOPFILE );
-    file_buff_done(log_stat);
-    file_buff_done(log_disks);
-    file_buff_done(log_procs);
+    write_samples();
+    file_buff_done(log_actions);
     acct(NULL);
+
+    close_samplers();
+}
+
+/* called by init each time an action completes, even before
+ * bootchart_init(). times are in microseconds of the monotonic clock,
+ * which is also the clock of /proc/uptime, so that the critical path
+ * of the boot can be drawn over the samples.
+ */
+void  bootchart_action( const char*  name, long long  start_us, long long  end_us )
+{
+    char  buff[128];
+    int   len;
+
+    len = snprintf(buff, sizeof(buff), "%lld %lld %s\n", start_us, end_us, name);
+    if (len >= (int)sizeof(buff))
+        len = sizeof(buff) - 1;
+
+    /* never write to the log before it is opened */
+    if (log_actions->fd < 0 && log_actions->count + len >= FILE_BUFF_SIZE)
+        return;
+    file_buff_write(log_actions, buff, len);
 }
@@ -26,8 +26,10 @@
 extern int   bootchart_init(void);
 extern int   bootchart_step(void);
 extern void  bootchart_finish(void);
+extern void  bootchart_action(const char *name, long long start_us, long long end_us);
 
-# define BOOTCHART_POLLING_MS   200   /* polling period in ms */
+# define BOOTCHART_POLLING_MS   10    /* default polling period in ms */
+# define BOOTCHART_MAX_POLLING_MS      1000  /* max polling period in ms */
 # define BOOTCHART_DEFAULT_TIME_SEC    (2*60)  /* default polling time in seconds */
 # define BOOTCHART_MAX_TIME_SEC        (10*60) /* max polling time in seconds */
 
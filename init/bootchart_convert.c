@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* a host tool that turns the binary log of init's bootchart code back
+ * into the proc_stat.log, proc_diskstats.log and proc_ps.log files that
+ * the bootchart tools read. grab-bootchart.sh runs it before making the
+ * tarball.
+ *
+ * usage: bootchart_convert <bootchart.bin> [<output directory>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bootchart_format.h"
+
+#define MAX_DISKS   256
+
+typedef struct {
+    int        present;     /* seen in the current chunk */
+    int        major, minor;
+    char       name[BC_NAME_MAX];
+    long long  value[BC_DISK_FIELDS];
+} Disk;
+
+typedef struct {
+    int        present;
+    char       name[BC_NAME_MAX];
+    long long  value[BC_PROC_FIELDS];
+} Proc;
+
+static Disk        disks[MAX_DISKS];
+static Proc*       procs;
+static int         procs_size;
+static long long   cpu[BC_CPU_FIELDS];
+static int*        sample_pids;
+static int         sample_pid_count;
+static int         sample_pid_size;
+static long long   sample_time;
+static int         in_sample;
+static int         sample_count;
+
+static FILE*       out_stat;
+static FILE*       out_disks;
+static FILE*       out_procs;
+
+static const unsigned char*  pos;
+static const unsigned char*  end;
+static int                   truncated;
+
+static void
+die( const char*  fmt, const char*  arg )
+{
+    fprintf(stderr, "bootchart_convert: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static unsigned long long
+get_varint( void )
+{
+    unsigned long long  v = 0;
+    int                 shift = 0;
+
+    while (pos < end) {
+        unsigned char  c = *pos++;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+        shift += 7;
+    }
+    truncated = 1;
+    return 0;
+}
+
+static long long
+get_delta( void )
+{
+    unsigned long long  v = get_varint();
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+static void
+get_string( char*  buff, int  size )
+{
+    int  len = (int)get_varint();
+
+    if (len > end - pos) {
+        truncated = 1;
+        len = end - pos;
+    }
+    if (len < size) {
+        memcpy(buff, pos, len);
+        buff[len] = 0;
+    } else {
+        memcpy(buff, pos, size - 1);
+        buff[size - 1] = 0;
+    }
+    pos += len;
+}
+
+static void
+get_fields( unsigned  mask, long long*  value, int  count )
+{
+    int  n;
+
+    for (n = 0; n < count; n++) {
+        if (mask & (1 << n))
+            value[n] += get_delta();
+    }
+}
+
+static Proc*
+proc_get( int  pid )
+{
+    if (pid < 0)
+        die("bad pid in %s", "sample");
+    if (pid >= procs_size) {
+        int  size = procs_size ? procs_size : 1024;
+        while (size <= pid)
+            size *= 2;
+        procs = realloc(procs, size * sizeof(Proc));
+        if (procs == NULL)
+            die("%s", strerror(errno));
+        memset(procs + procs_size, 0, (size - procs_size) * sizeof(Proc));
+        procs_size = size;
+    }
+    return &procs[pid];
+}
+
+/* writes the sample just decoded in the text format of the original
+ * bootchart logs: the uptime in jiffies, the content of the proc file,
+ * then an empty line.
+ */
+static void
+flush_sample( void )
+{
+    long long  jiffies = sample_time / 10000;
+    int        n;
+
+    if (!in_sample)
+        return;
+    in_sample = 0;
+    sample_count++;
+
+    fprintf(out_stat, "%lld\ncpu ", jiffies);
+    for (n = 0; n < BC_CPU_FIELDS; n++)
+        fprintf(out_stat, " %lld", cpu[n]);
+    fprintf(out_stat, "\n\n");
+
+    fprintf(out_disks, "%lld\n", jiffies);
+    for (n = 0; n < MAX_DISKS; n++) {
+        Disk*  d = &disks[n];
+        int    i;
+        if (!d->present)
+            continue;
+        fprintf(out_disks, "%4d %7d %s", d->major, d->minor, d->name);
+        for (i = 0; i < BC_DISK_FIELDS; i++)
+            fprintf(out_disks, " %lld", d->value[i]);
+        fprintf(out_disks, "\n");
+    }
+    fprintf(out_disks, "\n");
+
+    fprintf(out_procs, "%lld\n", jiffies);
+    for (n = 0; n < sample_pid_count; n++) {
+        Proc*       p = &procs[sample_pids[n]];
+        long long*  v = p->value;
+        fprintf(out_procs, "%d (%s) %c %lld 0 0 0 0 0 0 0 0 0 "
+                "%lld %lld %lld %lld %lld %lld %lld 0 %lld %lld %lld\n",
+                sample_pids[n], p->name, (char)v[BC_PROC_STATE], v[BC_PROC_PPID],
+                v[BC_PROC_UTIME], v[BC_PROC_STIME], v[BC_PROC_CUTIME],
+                v[BC_PROC_CSTIME], v[BC_PROC_PRIORITY], v[BC_PROC_NICE],
+                v[BC_PROC_THREADS], v[BC_PROC_STARTTIME], v[BC_PROC_VSIZE],
+                v[BC_PROC_RSS]);
+    }
+    fprintf(out_procs, "\n");
+    sample_pid_count = 0;
+}
+
+static void
+decode_chunk( const unsigned char*  data, unsigned  used )
+{
+    int  n;
+
+    /* nothing carries over from the previous chunk */
+    memset(cpu, 0, sizeof(cpu));
+    for (n = 0; n < MAX_DISKS; n++)
+        disks[n].present = 0;
+    for (n = 0; n < procs_size; n++)
+        procs[n].present = 0;
+    sample_time = 0;
+
+    pos = data;
+    end = data + used;
+    while (pos < end && !truncated) {
+        int       type = *pos++;
+        unsigned  mask;
+
+        switch (type) {
+        case BC_REC_SAMPLE:
+            flush_sample();
+            sample_time += get_delta();
+            in_sample = 1;
+            break;
+
+        case BC_REC_CPU:
+            mask = (unsigned)get_varint();
+            get_fields(mask, cpu, BC_CPU_FIELDS);
+            break;
+
+        case BC_REC_DISK: {
+            unsigned  slot = (unsigned)get_varint();
+            Disk*     d;
+
+            if (slot >= MAX_DISKS)
+                die("bad disk slot in %s", "sample");
+            d = &disks[slot];
+            mask = (unsigned)get_varint();
+            if (mask & BC_DISK_NAME) {
+                d->major = (int)get_varint();
+                d->minor = (int)get_varint();
+                get_string(d->name, sizeof(d->name));
+                memset(d->value, 0, sizeof(d->value));
+                d->present = 1;
+            }
+            get_fields(mask, d->value, BC_DISK_FIELDS);
+            break;
+        }
+
+        case BC_REC_PROC: {
+            int    pid = (int)get_varint();
+            Proc*  p   = proc_get(pid);
+
+            mask = (unsigned)get_varint();
+            if (mask & BC_PROC_NAME)
+                get_string(p->name, sizeof(p->name));
+            if (!p->present || (mask & BC_PROC_FULL)) {
+                memset(p->value, 0, sizeof(p->value));
+                p->present = 1;
+            }
+            get_fields(mask, p->value, BC_PROC_FIELDS);
+
+            if (sample_pid_count == sample_pid_size) {
+                sample_pid_size = sample_pid_size ? 2*sample_pid_size : 256;
+                sample_pids = realloc(sample_pids, sample_pid_size * sizeof(int));
+                if (sample_pids == NULL)
+                    die("%s", strerror(errno));
+            }
+            sample_pids[sample_pid_count++] = pid;
+            break;
+        }
+
+        default:
+            die("unknown record in %s", "chunk");
+        }
+    }
+    /* a sample never spans two chunks */
+    if (!truncated)
+        flush_sample();
+    in_sample = 0;
+    sample_pid_count = 0;
+}
+
+static FILE*
+open_log( const char*  dir, const char*  name )
+{
+    char   path[1024];
+    FILE*  f;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    f = fopen(path, "w");
+    if (f == NULL)
+        die("cannot create %s", path);
+    return f;
+}
+
+int  main( int  argc, char**  argv )
+{
+    const char*          dir = ".";
+    FILE*                in;
+    unsigned char*       file;
+    long                 size;
+    const unsigned char* p;
+    BootchartBinHeader   header;
+    unsigned             n;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: bootchart_convert <bootchart.bin> [<output directory>]\n");
+        return 1;
+    }
+    if (argc == 3)
+        dir = argv[2];
+
+    in = fopen(argv[1], "rb");
+    if (in == NULL)
+        die("cannot open %s", argv[1]);
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    file = malloc(size > 0 ? size : 1);
+    if (file == NULL || fread(file, 1, size, in) != (size_t)size)
+        die("cannot read %s", argv[1]);
+    fclose(in);
+
+    if (size < (long)sizeof(header))
+        die("%s is too short", argv[1]);
+    memcpy(&header, file, sizeof(header));
+    if (header.magic != BOOTCHART_BIN_MAGIC || header.version != BOOTCHART_BIN_VERSION)
+        die("%s is not a binary bootchart log", argv[1]);
+
+    out_stat  = open_log(dir, "proc_stat.log");
+    out_disks = open_log(dir, "proc_diskstats.log");
+    out_procs = open_log(dir, "proc_ps.log");
+
+    p = file + sizeof(header);
+    for (n = 0; n < header.chunk_count; n++) {
+        BootchartChunkHeader  chunk;
+
+        if (file + size - p < (long)sizeof(chunk)) {
+            fprintf(stderr, "bootchart_convert: truncated file, %d chunks missing\n",
+                    header.chunk_count - n);
+            break;
+        }
+        memcpy(&chunk, p, sizeof(chunk));
+        p += sizeof(chunk);
+        if (chunk.used > (unsigned long)(file + size - p)) {
+            fprintf(stderr, "bootchart_convert: chunk %u is truncated\n", chunk.seq);
+            chunk.used = file + size - p;
+        }
+        truncated = 0;
+        decode_chunk(p, chunk.used);
+        p += chunk.used;
+    }
+
+    fclose(out_stat);
+    fclose(out_disks);
+    fclose(out_procs);
+
+    printf("%d samples every %u ms", sample_count, header.period_ms);
+    if (header.dropped)
+        printf(", the oldest %u chunks were dropped", header.dropped);
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* the binary sample log written by init's bootchart code, and read back
+ * by bootchart_convert on the host to produce the text logs that the
+ * bootchart tools expect.
+ *
+ * the file is a BootchartBinHeader followed by chunk_count chunks, the
+ * oldest first. each chunk is a BootchartChunkHeader followed by 'used'
+ * bytes of records. all deltas are relative to the previous record of
+ * the same cpu, disk or pid *within the chunk*, so that init can drop
+ * the oldest chunks of its ring and every remaining chunk still decodes
+ * on its own.
+ *
+ * numbers are varints (7 bits per byte, low bits first), deltas are
+ * zigzag varints, strings are a varint length followed by the bytes.
+ *
+ *   BC_REC_SAMPLE  time_us delta
+ *   BC_REC_CPU     mask deltas
+ *   BC_REC_DISK    slot mask [major minor name] deltas
+ *   BC_REC_PROC    pid mask [name] deltas
+ *
+ * where the mask has a bit set for each field that changed, followed by
+ * one delta per bit set. the bracketed parts are present when the name
+ * bit of the mask is set, that is for a disk slot or a pid that is new
+ * in the chunk, or for a process whose name changed. a BC_REC_PROC with
+ * BC_PROC_FULL set in its mask starts the pid over from zero. records
+ * after a BC_REC_SAMPLE belong to that sample.
+ */
+
+#ifndef _BOOTCHART_FORMAT_H
+#define _BOOTCHART_FORMAT_H
+
+#include <stdint.h>
+
+#define BOOTCHART_BIN_MAGIC     0x54484342  /* "BCHT" */
+#define BOOTCHART_BIN_VERSION   1
+
+typedef struct {
+    uint32_t  magic;
+    uint32_t  version;
+    uint32_t  period_ms;     /* sampling period */
+    uint32_t  chunk_count;   /* chunks in the file */
+    uint32_t  dropped;       /* oldest chunks overwritten in the ring */
+    uint32_t  reserved;
+} BootchartBinHeader;
+
+typedef struct {
+    uint32_t  used;          /* bytes of records that follow */
+    uint32_t  seq;           /* chunk sequence number since start */
+} BootchartChunkHeader;
+
+enum {
+    BC_REC_SAMPLE = 1,
+    BC_REC_CPU,
+    BC_REC_DISK,
+    BC_REC_PROC,
+};
+
+/* the aggregate "cpu" line of /proc/stat:
+ * user nice system idle iowait irq softirq */
+#define BC_CPU_FIELDS     7
+
+/* the 11 counters of a /proc/diskstats line */
+#define BC_DISK_FIELDS    11
+#define BC_DISK_NAME      (1 << BC_DISK_FIELDS)   /* bit of the mask */
+
+/* the fields of /proc/<pid>/stat the bootchart tools use */
+enum {
+    BC_PROC_STATE = 0,
+    BC_PROC_PPID,
+    BC_PROC_UTIME,
+    BC_PROC_STIME,
+    BC_PROC_CUTIME,
+    BC_PROC_CSTIME,
+    BC_PROC_PRIORITY,
+    BC_PROC_NICE,
+    BC_PROC_THREADS,
+    BC_PROC_STARTTIME,
+    BC_PROC_VSIZE,
+    BC_PROC_RSS,
+    BC_PROC_FIELDS
+};
+#define BC_PROC_NAME      (1 << BC_PROC_FIELDS)   /* bit of the mask */
+/* the deltas are against zero rather than the pid's previous record:
+ * the pid is new in the chunk, or init forgot it and it came back */
+#define BC_PROC_FULL      (1 << (BC_PROC_FIELDS+1))
+
+#define BC_NAME_MAX       64
+
+#endif /* _BOOTCHART_FORMAT_H */
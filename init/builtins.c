@@ -136,7 +136,9 @@ int do_class_start(int nargs, char **args)
          * which are explicitly disabled.  They must
          * be started individually.
          */
+    service_start_concurrently(1);
     service_for_each_class(args[1], service_start_if_not_disabled);
+    service_start_concurrently(0);
     return 0;
 }
 
@@ -342,6 +344,15 @@ int do_restart(int nargs, char **args)
     return 0;
 }
 
+int do_sched(int nargs, char **args)
+{
+    if (!strcmp(args[1], "parallel"))
+        return set_parallel_scheduling(1);
+    if (!strcmp(args[1], "serial"))
+        return set_parallel_scheduling(0);
+    return -1;
+}
+
 int do_trigger(int nargs, char **args)
 {
     return 0;
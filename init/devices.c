@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 
 #include <fcntl.h>
 #include <dirent.h>
@@ -26,7 +27,11 @@
 #include <string.h>
 
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/poll.h>
+#include <limits.h>
+#include <pthread.h>
 #include <linux/netlink.h>
 #include <private/android_filesystem_config.h>
 #include <sys/time.h>
@@ -151,6 +156,9 @@ list_declare(devperms_partners);
 static int qemu_perm_count;
 static struct perms_ qemu_perms[MAX_QEMU_PERM + 1];
 
+    /* cleared whenever one of the tables changes */
+static int perm_table_valid;
+
 int add_devperms_partners(const char *name, mode_t perm, unsigned int uid,
                         unsigned int gid, unsigned short prefix) {
     int size;
@@ -169,12 +177,14 @@ int add_devperms_partners(const char *name, mode_t perm, unsigned int uid,
     node->dp.prefix = prefix;
 
     list_add_tail(&devperms_partners, &node->plist);
+    perm_table_valid = 0;
     return 0;
 }
 
 void qemu_init(void) {
     qemu_perm_count = 0;
     memset(&qemu_perms, 0, sizeof(qemu_perms));
+    perm_table_valid = 0;
 }
 
 static int qemu_perm(const char* name, mode_t perm, unsigned int uid,
@@ -196,6 +206,7 @@ static int qemu_perm(const char* name, mode_t perm, unsigned int uid,
     qemu_perms[qemu_perm_count].prefix = prefix;
 
     qemu_perm_count++;
+    perm_table_valid = 0;
     return 0;
 }
 
@@ -213,63 +224,154 @@ void qemu_cmdline(const char* name, const char *value)
     }
 }
 
-static int get_device_perm_inner(struct perms_ *perms, const char *path,
-                                    unsigned *uid, unsigned *gid, mode_t *perm)
+/* The three permission tables are compiled into one hash of every name,
+** with the position of each entry in the order they used to be searched
+** in: qemu_perms, devperms, then the partners. A lookup hashes each
+** prefix of the path that some prefix entry is as long as, and the path
+** itself, so it costs one pass over the path whatever the number of
+** entries, and the earliest matching entry wins as before. The table is
+** rebuilt on the next lookup whenever an entry is added.
+*/
+
+#define PERM_BUCKETS   256
+#define PERM_LEN_MAX   128      /* longer prefixes are checked at any length */
+
+struct perm_entry {
+    struct perm_entry *next;
+    const struct perms_ *dp;
+    unsigned hash;
+    unsigned len;
+    unsigned rank;
+};
+
+static struct perm_entry *perm_buckets[PERM_BUCKETS];
+static struct perm_entry *perm_entries;
+static unsigned char perm_prefix_len[PERM_LEN_MAX];
+static int perm_long_prefix;
+
+static unsigned perm_hash(unsigned hash, char c)
+{
+    return hash * 31 + (unsigned char) c;
+}
+
+static int perm_count(void)
+{
+    struct listnode *node;
+    int count = qemu_perm_count + sizeof(devperms) / sizeof(devperms[0]);
+
+    list_for_each(node, &devperms_partners)
+        count++;
+    return count;
+}
+
+static void perm_add(const struct perms_ *dp, unsigned rank)
+{
+    struct perm_entry *e = &perm_entries[rank];
+    struct perm_entry **pe;
+    const char *p;
+
+    e->dp = dp;
+    e->rank = rank;
+    e->hash = 0;
+    for(p = dp->name; *p; p++)
+        e->hash = perm_hash(e->hash, *p);
+    e->len = p - dp->name;
+
+    if(dp->prefix) {
+        if(e->len < PERM_LEN_MAX)
+            perm_prefix_len[e->len] = 1;
+        else
+            perm_long_prefix = 1;
+    }
+
+        /* keep each chain in rank order */
+    pe = &perm_buckets[e->hash % PERM_BUCKETS];
+    while(*pe)
+        pe = &(*pe)->next;
+    e->next = 0;
+    *pe = e;
+}
+
+static int perm_table_build(void)
 {
+    struct listnode *node;
+    unsigned rank = 0;
     int i;
-    for(i = 0; perms[i].name; i++) {
 
-        if(perms[i].prefix) {
-            if(strncmp(path, perms[i].name, strlen(perms[i].name)))
+    free(perm_entries);
+    perm_entries = malloc(perm_count() * sizeof(struct perm_entry));
+    if(perm_entries == 0)
+        return -1;
+
+    memset(perm_buckets, 0, sizeof(perm_buckets));
+    memset(perm_prefix_len, 0, sizeof(perm_prefix_len));
+    perm_long_prefix = 0;
+
+    for(i = 0; qemu_perms[i].name; i++)
+        perm_add(&qemu_perms[i], rank++);
+    for(i = 0; devperms[i].name; i++)
+        perm_add(&devperms[i], rank++);
+    list_for_each(node, &devperms_partners) {
+        struct perm_node *perm_node = node_to_item(node, struct perm_node, plist);
+        perm_add(&perm_node->dp, rank++);
+    }
+
+    perm_table_valid = 1;
+    return 0;
+}
+
+static const struct perms_ *perm_lookup(const char *path)
+{
+    const struct perm_entry *best = 0;
+    const struct perm_entry *e;
+    unsigned hash = 0;
+    unsigned len;
+
+    for(len = 1; path[len - 1]; len++) {
+        int last = path[len] == 0;
+
+        hash = perm_hash(hash, path[len - 1]);
+        if(!last && !perm_long_prefix && (len >= PERM_LEN_MAX ||
+                                          !perm_prefix_len[len]))
+            continue;
+
+        for(e = perm_buckets[hash % PERM_BUCKETS]; e; e = e->next) {
+            if(best && e->rank > best->rank)
+                break;
+            if(e->hash != hash || e->len != len)
+                continue;
+            if(!e->dp->prefix && !last)
                 continue;
-        } else {
-            if(strcmp(path, perms[i].name))
+            if(memcmp(path, e->dp->name, len))
                 continue;
+            best = e;
+            break;
         }
-        *uid = perms[i].uid;
-        *gid = perms[i].gid;
-        *perm = perms[i].perm;
-        return 0;
     }
-    return -1;
+    return best ? best->dp : 0;
 }
 
 /* First checks for emulator specific permissions specified in /proc/cmdline. */
 static mode_t get_device_perm(const char *path, unsigned *uid, unsigned *gid)
 {
-    mode_t perm;
+    const struct perms_ *dp;
 
-    if (get_device_perm_inner(qemu_perms, path, uid, gid, &perm) == 0) {
-        return perm;
-    } else if (get_device_perm_inner(devperms, path, uid, gid, &perm) == 0) {
-        return perm;
+    if(!perm_table_valid && perm_table_build() < 0) {
+        ERROR("out of memory for device permissions\n");
+        dp = 0;
     } else {
-        struct listnode *node;
-        struct perm_node *perm_node;
-        struct perms_ *dp;
-
-        /* Check partners list. */
-        list_for_each(node, &devperms_partners) {
-            perm_node = node_to_item(node, struct perm_node, plist);
-            dp = &perm_node->dp;
+        dp = perm_lookup(path);
+    }
 
-            if (dp->prefix) {
-                if (strncmp(path, dp->name, strlen(dp->name)))
-                    continue;
-            } else {
-                if (strcmp(path, dp->name))
-                    continue;
-            }
-            /* Found perm in partner list. */
-            *uid = dp->uid;
-            *gid = dp->gid;
-            return dp->perm;
-        }
-        /* Default if nothing found. */
-        *uid = 0;
-        *gid = 0;
-        return 0600;
+    if(dp) {
+        *uid = dp->uid;
+        *gid = dp->gid;
+        return dp->perm;
     }
+        /* Default if nothing found. */
+    *uid = 0;
+    *gid = 0;
+    return 0600;
 }
 
 static void make_device(const char *path, int block, int major, int minor)
@@ -279,11 +381,8 @@ static void make_device(const char *path, int block, int major, int minor)
     mode_t mode;
     dev_t dev;
 
-    if(major > 255 || minor > 255)
-        return;
-
     mode = get_device_perm(path, &uid, &gid) | (block ? S_IFBLK : S_IFCHR);
-    dev = (major << 8) | minor;
+    dev = makedev(major, minor);
     mknod(path, mode, dev);
     chown(path, uid, gid);
 }
@@ -461,33 +560,28 @@ out:
     return ret;
 }
 
+/* runs in a child forked while the coldboot walkers may hold the malloc
+** lock, so nothing here may allocate */
 static void process_firmware_event(struct uevent *uevent)
 {
-    char *root, *loading, *data, *file;
-    int l, loading_fd, data_fd, fw_fd;
+    char root[PATH_MAX], loading[PATH_MAX], data[PATH_MAX], file[PATH_MAX];
+    int loading_fd, data_fd, fw_fd;
 
     log_event_print("firmware event { '%s', '%s' }\n",
                     uevent->path, uevent->firmware);
 
-    l = asprintf(&root, SYSFS_PREFIX"%s/", uevent->path);
-    if (l == -1)
+    if(snprintf(root, sizeof(root), SYSFS_PREFIX"%s/",
+                uevent->path) >= (int) sizeof(root) ||
+       snprintf(loading, sizeof(loading), "%sloading",
+                root) >= (int) sizeof(loading) ||
+       snprintf(data, sizeof(data), "%sdata", root) >= (int) sizeof(data) ||
+       snprintf(file, sizeof(file), FIRMWARE_DIR"/%s",
+                uevent->firmware) >= (int) sizeof(file))
         return;
 
-    l = asprintf(&loading, "%sloading", root);
-    if (l == -1)
-        goto root_free_out;
-
-    l = asprintf(&data, "%sdata", root);
-    if (l == -1)
-        goto loading_free_out;
-
-    l = asprintf(&file, FIRMWARE_DIR"/%s", uevent->firmware);
-    if (l == -1)
-        goto data_free_out;
-
     loading_fd = open(loading, O_WRONLY);
     if(loading_fd < 0)
-        goto file_free_out;
+        return;
 
     data_fd = open(data, O_WRONLY);
     if(data_fd < 0)
@@ -507,14 +601,6 @@ data_close_out:
     close(data_fd);
 loading_close_out:
     close(loading_fd);
-file_free_out:
-    free(file);
-data_free_out:
-    free(data);
-loading_free_out:
-    free(loading);
-root_free_out:
-    free(root);
 }
 
 static void handle_firmware_event(struct uevent *uevent)
@@ -527,34 +613,91 @@ static void handle_firmware_event(struct uevent *uevent)
     if(strcmp(uevent->action, "add"))
         return;
 
-    /* we fork, to avoid making large memory allocations in init proper */
+    /* we fork, to avoid making large memory allocations in init proper.
+    ** the child uses _exit() so that it doesn't run atexit handlers or
+    ** flush stdio, whose locks a coldboot walker may have held. */
     pid = fork();
     if (!pid) {
         process_firmware_event(uevent);
-        exit(EXIT_SUCCESS);
+        _exit(EXIT_SUCCESS);
     }
 }
 
 #define UEVENT_MSG_LEN  1024
-void handle_device_fd(int fd)
+#define UEVENT_BATCH    32
+
+/* the same layout as the kernel's struct mmsghdr */
+struct uevent_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned msg_len;
+};
+
+static char uevent_msgs[UEVENT_BATCH][UEVENT_MSG_LEN+2];
+static int uevent_lens[UEVENT_BATCH];
+static int no_recvmmsg;
+
+/* receives up to UEVENT_BATCH pending events with a single recvmmsg()
+** where the kernel has it, returns how many, or <= 0 once drained. */
+static int recv_uevents(int fd)
+{
+#ifdef __NR_recvmmsg
+    struct uevent_mmsghdr hdrs[UEVENT_BATCH];
+    struct iovec iovs[UEVENT_BATCH];
+    int i, n;
+
+    if(!no_recvmmsg) {
+        memset(hdrs, 0, sizeof(hdrs));
+        for(i = 0; i < UEVENT_BATCH; i++) {
+            iovs[i].iov_base = uevent_msgs[i];
+            iovs[i].iov_len = UEVENT_MSG_LEN;
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = syscall(__NR_recvmmsg, fd, hdrs, UEVENT_BATCH, 0, NULL);
+        if(n >= 0 || errno != ENOSYS) {
+            for(i = 0; i < n; i++)
+                uevent_lens[i] = hdrs[i].msg_len;
+            return n;
+        }
+        no_recvmmsg = 1;
+    }
+#endif
+    uevent_lens[0] = recv(fd, uevent_msgs[0], UEVENT_MSG_LEN, 0);
+    return uevent_lens[0] > 0 ? 1 : uevent_lens[0];
+}
+
+static void handle_uevent_msg(char *msg, int n)
 {
-    char msg[UEVENT_MSG_LEN+2];
-    int n;
+    struct uevent uevent;
 
-    while((n = recv(fd, msg, UEVENT_MSG_LEN, 0)) > 0) {
-        struct uevent uevent;
+    if(n >= UEVENT_MSG_LEN)   /* overflow -- discard */
+        return;
 
-        if(n == UEVENT_MSG_LEN)   /* overflow -- discard */
-            continue;
+    msg[n] = '\0';
+    msg[n+1] = '\0';
 
-        msg[n] = '\0';
-        msg[n+1] = '\0';
+    parse_event(msg, &uevent);
 
-        parse_event(msg, &uevent);
+    handle_device_event(&uevent);
+    handle_firmware_event(&uevent);
+}
+
+/* handles every pending event, returns -1 if the socket overflowed and
+** some were lost. */
+static int drain_uevents(int fd)
+{
+    int n, i;
 
-        handle_device_event(&uevent);
-        handle_firmware_event(&uevent);
+    while((n = recv_uevents(fd)) > 0) {
+        for(i = 0; i < n; i++)
+            handle_uevent_msg(uevent_msgs[i], uevent_lens[i]);
     }
+    return (n < 0 && errno == ENOBUFS) ? -1 : 0;
+}
+
+void handle_device_fd(int fd)
+{
+    drain_uevents(fd);
 }
 
 /* Coldboot walks parts of the /sys tree and pokes the uevent files
@@ -609,6 +752,328 @@ static void coldboot(int event_fd, const char *path)
     }
 }
 
+/* The parallel coldboot splits the walk among COLDBOOT_WALKERS threads
+** which only poke uevent files, while init's main thread drains the
+** socket in batches and creates the nodes, as it does after boot.
+**
+** Each walker keeps the directories it still has to visit on its own
+** stack and takes work from the others once it runs out; the roots
+** all start on the first one. Directories
+** are counted per subtree, so the time each subtree took is known when
+** its count drops to zero.
+**
+** Each walker may only have COLDBOOT_INFLIGHT uevents queued on the
+** socket that the main thread hasn't drained yet. The kernel queues an
+** event before write() returns, so once a drain finds the socket empty,
+** every write counted before it started has been handled (or filtered
+** out by the kernel). Should the socket still overflow, events are lost
+** and the pass fails; device_init() then walks the tree again the
+** serial way.
+*/
+
+#define COLDBOOT_WALKERS  4
+#define COLDBOOT_INFLIGHT 64
+#define COLDBOOT_RCVBUF   (1024*1024)
+#define COLDBOOT_POLL_MS  10
+
+struct coldboot_dir {
+    struct coldboot_dir *next;
+    int root;
+    char path[1];
+};
+
+struct coldboot_walker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct coldboot_dir *dirs;
+};
+
+struct coldboot_root {
+    const char *path;
+    int pending;        /* directories queued or being walked */
+    int dirs;
+    int uevents;
+    long usecs;
+};
+
+static struct coldboot_root coldboot_roots[] = {
+    { "/sys/class" },
+    { "/sys/block" },
+    { "/sys/devices" },
+};
+#define COLDBOOT_ROOTS (sizeof(coldboot_roots) / sizeof(coldboot_roots[0]))
+
+static struct coldboot_walker walkers[COLDBOOT_WALKERS];
+static int walker_count;
+
+    /* protects everything below and the counts of the roots */
+static pthread_mutex_t coldboot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t coldboot_cond = PTHREAD_COND_INITIALIZER;
+static int coldboot_queued;     /* directories on the walkers' stacks */
+static int coldboot_pending;    /* ... plus the ones being walked */
+static int coldboot_written;    /* uevents poked */
+static int coldboot_drained;    /* ... whose events were handled */
+static int coldboot_overflow;
+static pthread_cond_t coldboot_drain_cond = PTHREAD_COND_INITIALIZER;
+static int coldboot_done_fd = -1;
+static struct timeval coldboot_start;
+
+static long usecs_since(struct timeval *start)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return (tv.tv_sec - start->tv_sec) * 1000000L + (tv.tv_usec - start->tv_usec);
+}
+
+static int coldboot_push(struct coldboot_walker *w, int root, const char *path)
+{
+    struct coldboot_dir *dir;
+
+    dir = malloc(sizeof(*dir) + strlen(path));
+    if(dir == 0)
+        return -1;
+    dir->root = root;
+    strcpy(dir->path, path);
+
+    pthread_mutex_lock(&w->lock);
+    dir->next = w->dirs;
+    w->dirs = dir;
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_mutex_lock(&coldboot_lock);
+    coldboot_queued++;
+    coldboot_pending++;
+    coldboot_roots[root].pending++;
+    pthread_cond_signal(&coldboot_cond);
+    pthread_mutex_unlock(&coldboot_lock);
+    return 0;
+}
+
+static struct coldboot_dir *coldboot_pop(struct coldboot_walker *w)
+{
+    struct coldboot_dir *dir;
+
+    pthread_mutex_lock(&w->lock);
+    dir = w->dirs;
+    if(dir)
+        w->dirs = dir->next;
+    pthread_mutex_unlock(&w->lock);
+    return dir;
+}
+
+/* returns the next directory for walker n, or 0 once the walk is over */
+static struct coldboot_dir *coldboot_next(int n)
+{
+    struct coldboot_dir *dir;
+    int i;
+
+    for(;;) {
+        for(i = 0; i < walker_count; i++) {
+            dir = coldboot_pop(&walkers[(n + i) % walker_count]);
+            if(dir) {
+                pthread_mutex_lock(&coldboot_lock);
+                coldboot_queued--;
+                pthread_mutex_unlock(&coldboot_lock);
+                return dir;
+            }
+        }
+
+        pthread_mutex_lock(&coldboot_lock);
+        while(coldboot_queued == 0 && coldboot_pending > 0)
+            pthread_cond_wait(&coldboot_cond, &coldboot_lock);
+        if(coldboot_pending == 0) {
+            pthread_mutex_unlock(&coldboot_lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&coldboot_lock);
+    }
+}
+
+static void coldboot_finish(struct coldboot_dir *dir, int dirs, int uevents)
+{
+    struct coldboot_root *root = &coldboot_roots[dir->root];
+
+    pthread_mutex_lock(&coldboot_lock);
+    root->dirs += dirs;
+    root->uevents += uevents;
+    if(--root->pending == 0)
+        root->usecs = usecs_since(&coldboot_start);
+    if(--coldboot_pending == 0) {
+        pthread_cond_broadcast(&coldboot_cond);
+        write(coldboot_done_fd, "", 1);
+    }
+    pthread_mutex_unlock(&coldboot_lock);
+}
+
+/* waits until the walkers have few enough uevents queued, returns 0 once
+** the socket overflowed and poking more is pointless. */
+static int coldboot_throttle(void)
+{
+    int ok;
+
+    pthread_mutex_lock(&coldboot_lock);
+    while(!coldboot_overflow && coldboot_written - coldboot_drained >=
+          walker_count * COLDBOOT_INFLIGHT)
+        pthread_cond_wait(&coldboot_drain_cond, &coldboot_lock);
+    ok = !coldboot_overflow;
+    pthread_mutex_unlock(&coldboot_lock);
+    return ok;
+}
+
+static void coldboot_poked(void)
+{
+    pthread_mutex_lock(&coldboot_lock);
+    coldboot_written++;
+    pthread_mutex_unlock(&coldboot_lock);
+}
+
+static void *coldboot_walker(void *arg)
+{
+    int n = (int) (long) arg;
+    struct coldboot_walker *w = &walkers[n];
+    struct coldboot_dir *dir;
+    struct dirent *de;
+    char path[PATH_MAX];
+    DIR *d;
+    int fd, uevents;
+
+    while((dir = coldboot_next(n)) != 0) {
+        uevents = 0;
+        d = opendir(dir->path);
+        if(d) {
+            fd = -1;
+            if(coldboot_throttle())
+                fd = openat(dirfd(d), "uevent", O_WRONLY);
+            if(fd >= 0) {
+                if(write(fd, "add\n", 4) == 4) {
+                    coldboot_poked();
+                    uevents = 1;
+                }
+                close(fd);
+            }
+
+                /* after an overflow, just wind the walk down */
+            while(!coldboot_overflow && (de = readdir(d))) {
+                if(de->d_type != DT_DIR || de->d_name[0] == '.')
+                    continue;
+                if(snprintf(path, sizeof(path), "%s/%s", dir->path,
+                            de->d_name) >= (int) sizeof(path))
+                    continue;
+                coldboot_push(w, dir->root, path);
+            }
+            closedir(d);
+        }
+        coldboot_finish(dir, 1, uevents);
+        free(dir);
+    }
+    return 0;
+}
+
+static void coldboot_restore_rcvbuf(int event_fd, int old_sz)
+{
+        /* getsockopt() reports twice what setsockopt() was given */
+    old_sz /= 2;
+    if(old_sz > 0)
+        setsockopt(event_fd, SOL_SOCKET, SO_RCVBUFFORCE, &old_sz,
+                   sizeof(old_sz));
+}
+
+/* returns -1 if no walker could be started, or if uevents were lost */
+static int parallel_coldboot(int event_fd)
+{
+    struct pollfd ufds[2];
+    int done[2];
+    int sz = COLDBOOT_RCVBUF;
+    int old_sz = 0;
+    socklen_t len = sizeof(old_sz);
+    int written, overflow;
+    unsigned i;
+    char c;
+
+    if(pipe(done) < 0)
+        return -1;
+    coldboot_done_fd = done[1];
+
+        /* the walkers can poke much faster than we create nodes */
+    getsockopt(event_fd, SOL_SOCKET, SO_RCVBUF, &old_sz, &len);
+    setsockopt(event_fd, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz));
+
+    gettimeofday(&coldboot_start, 0);
+    for(i = 0; i < COLDBOOT_WALKERS; i++)
+        pthread_mutex_init(&walkers[i].lock, 0);
+    for(i = 0; i < COLDBOOT_ROOTS; i++)
+        coldboot_push(&walkers[0], i, coldboot_roots[i].path);
+
+    walker_count = COLDBOOT_WALKERS;
+    for(i = 0; i < COLDBOOT_WALKERS; i++) {
+        if(pthread_create(&walkers[i].thread, 0, coldboot_walker,
+                          (void*) (long) i)) {
+                /* the ones that did start share the work */
+            pthread_mutex_lock(&coldboot_lock);
+            walker_count = i;
+            pthread_mutex_unlock(&coldboot_lock);
+            break;
+        }
+    }
+    if(walker_count == 0) {
+        struct coldboot_dir *dir;
+        while((dir = coldboot_pop(&walkers[0])) != 0)
+            free(dir);
+        close(done[0]);
+        close(done[1]);
+        coldboot_restore_rcvbuf(event_fd, old_sz);
+        return -1;
+    }
+
+    ufds[0].fd = event_fd;
+    ufds[0].events = POLLIN;
+    ufds[1].fd = done[0];
+    ufds[1].events = POLLIN;
+    for(;;) {
+        pthread_mutex_lock(&coldboot_lock);
+        written = coldboot_written;
+        pthread_mutex_unlock(&coldboot_lock);
+
+            /* the timeout also accounts for the writes the kernel
+            ** filtered out, which never wake us up */
+        ufds[0].revents = ufds[1].revents = 0;
+        overflow = poll(ufds, 2, COLDBOOT_POLL_MS) < 0 && errno != EINTR;
+        if(drain_uevents(event_fd) < 0)
+            overflow = 1;
+
+        pthread_mutex_lock(&coldboot_lock);
+        coldboot_drained = written;
+        if(overflow)
+            coldboot_overflow = 1;
+        pthread_cond_broadcast(&coldboot_drain_cond);
+        pthread_mutex_unlock(&coldboot_lock);
+
+            /* the last uevent was queued before the walk ended */
+        if(overflow || (ufds[1].revents & POLLIN))
+            break;
+    }
+
+    for(i = 0; i < (unsigned) walker_count; i++)
+        pthread_join(walkers[i].thread, 0);
+    read(done[0], &c, 1);
+    close(done[0]);
+    close(done[1]);
+    coldboot_restore_rcvbuf(event_fd, old_sz);
+
+    if(coldboot_overflow) {
+        ERROR("coldboot: uevent socket overflowed, walking /sys again\n");
+        return -1;
+    }
+
+    for(i = 0; i < COLDBOOT_ROOTS; i++) {
+        INFO("coldboot %s: %d dirs, %d uevents, %ld uS\n",
+             coldboot_roots[i].path, coldboot_roots[i].dirs,
+             coldboot_roots[i].uevents, coldboot_roots[i].usecs);
+    }
+    return 0;
+}
+
 int device_init(void)
 {
     suseconds_t t0, t1;
@@ -622,9 +1087,11 @@ int device_init(void)
     fcntl(fd, F_SETFL, O_NONBLOCK);
 
     t0 = get_usecs();
-    coldboot(fd, "/sys/class");
-    coldboot(fd, "/sys/block");
-    coldboot(fd, "/sys/devices");
+    if(parallel_coldboot(fd) < 0) {
+        coldboot(fd, "/sys/class");
+        coldboot(fd, "/sys/block");
+        coldboot(fd, "/sys/devices");
+    }
     t1 = get_usecs();
 
     log_event_print("coldboot %ld uS\n", ((long) (t1 - t0)));
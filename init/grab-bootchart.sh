@@ -12,11 +12,13 @@ mkdir -p $TMPDIR
 LOGROOT=/data/bootchart
 TARBALL=bootchart.tgz
 
-FILES="header proc_stat.log proc_ps.log proc_diskstats.log kernel_pacct"
+FILES="header proc_stat.log proc_ps.log proc_diskstats.log kernel_pacct init_actions.log"
 
-for f in $FILES; do
+for f in header bootchart.bin kernel_pacct init_actions.log; do
     adb pull $LOGROOT/$f $TMPDIR/$f 2>&1 > /dev/null
 done
+# init samples into a binary log, convert it to the text logs
+bootchart_convert $TMPDIR/bootchart.bin $TMPDIR || exit 1
 (cd $TMPDIR && tar -czf $TARBALL $FILES)
 cp -f $TMPDIR/$TARBALL ./$TARBALL
 echo "look at $TARBALL"
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* helper threads for the parallel scheduling mode. they run the builtins
+** that may block for long, such as mount or insmod, and the forks of the
+** services a class_start starts, while init goes on with other actions.
+**
+** a job only touches what its submitter handed it; everything else, the
+** services, actions and properties, stays with init's thread, to which
+** finished jobs are returned through a pipe that the main loop polls.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "init.h"
+#include "helpers.h"
+
+#define HELPER_THREADS  4
+
+static pthread_mutex_t helper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t helper_cond = PTHREAD_COND_INITIALIZER;
+static struct helper_job *queue_head;
+static struct helper_job *queue_tail;
+
+static int done_fds[2] = { -1, -1 };
+static int pending;             /* only used by init's thread */
+
+static void *helper_thread(void *arg)
+{
+    struct helper_job *job;
+
+    for (;;) {
+        pthread_mutex_lock(&helper_lock);
+        while (queue_head == 0)
+            pthread_cond_wait(&helper_cond, &helper_lock);
+        job = queue_head;
+        queue_head = job->next;
+        if (queue_head == 0)
+            queue_tail = 0;
+        pthread_mutex_unlock(&helper_lock);
+
+        job->run(job);
+
+        while (write(done_fds[1], &job, sizeof(job)) < 0 && errno == EINTR)
+            ;
+    }
+    return 0;
+}
+
+/* starts the helpers, returns 0 if at least one could be */
+int helper_init(void)
+{
+    pthread_t thread;
+    int n, started = 0;
+
+    if (done_fds[0] >= 0)
+        return 0;
+
+    if (pipe(done_fds) < 0)
+        return -1;
+    fcntl(done_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(done_fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(done_fds[0], F_SETFL, O_NONBLOCK);
+
+    for (n = 0; n < HELPER_THREADS; n++) {
+        if (pthread_create(&thread, 0, helper_thread, 0) == 0)
+            started++;
+    }
+    if (started == 0) {
+        ERROR("cannot start helper threads\n");
+        close(done_fds[0]);
+        close(done_fds[1]);
+        done_fds[0] = done_fds[1] = -1;
+        return -1;
+    }
+    INFO("started %d helper threads\n", started);
+    return 0;
+}
+
+/* the fd to poll for finished jobs, -1 without helpers */
+int helper_fd(void)
+{
+    return done_fds[0];
+}
+
+/* returns -1 if there are no helpers, in which case the caller runs the
+** job itself */
+int helper_submit(struct helper_job *job)
+{
+    if (done_fds[0] < 0)
+        return -1;
+
+    job->next = 0;
+    pthread_mutex_lock(&helper_lock);
+    if (queue_tail)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    pthread_cond_signal(&helper_cond);
+    pthread_mutex_unlock(&helper_lock);
+
+    pending++;
+    return 0;
+}
+
+int helper_pending(void)
+{
+    return pending;
+}
+
+/* runs done() for every finished job, waiting for one first if block */
+void helper_complete(int block)
+{
+    struct helper_job *job;
+    struct pollfd ufd;
+
+    if (done_fds[0] < 0 || pending == 0)
+        return;
+
+    if (block) {
+        ufd.fd = done_fds[0];
+        ufd.events = POLLIN;
+        while (poll(&ufd, 1, -1) < 0 && errno == EINTR)
+            ;
+    }
+
+    while (read(done_fds[0], &job, sizeof(job)) == sizeof(job)) {
+        pending--;
+        job->done(job);
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_HELPERS_H
+#define _INIT_HELPERS_H
+
+/* a job runs on one of the helper threads, then its done() runs back
+** on init's thread from helper_complete(). */
+struct helper_job {
+    struct helper_job *next;
+    void (*run)(struct helper_job *job);
+    void (*done)(struct helper_job *job);
+};
+
+extern int helper_init(void);
+extern int helper_fd(void);
+extern int helper_submit(struct helper_job *job);
+extern int helper_pending(void);
+extern void helper_complete(int block);
+
+#endif	/* _INIT_HELPERS_H */
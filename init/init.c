@@ -45,11 +45,12 @@
 #include "init.h"
 #include "property_service.h"
 #include "bootchart.h"
+#include "helpers.h"
 
 static int property_triggers_enabled = 0;
 
 #if BOOTCHART
-static int   bootchart_count;
+static int   bootchart_period;
 #endif
 
 static char console[32];
@@ -101,6 +102,51 @@ int add_environment(const char *key, const char *val)
     return 1;
 }
 
+/* child_env_size - bytes needed for the variables service_exec() adds
+ * to the environment of svc: its setenv lines, its sockets and the
+ * property workspace */
+static size_t child_env_size(struct service *svc)
+{
+    struct svcenvinfo *ei;
+    struct socketinfo *si;
+    size_t size = sizeof("ANDROID_PROPERTY_WORKSPACE=") + 2 * 11 + 1;
+
+    for (ei = svc->envvars; ei; ei = ei->next)
+        size += strlen(ei->name) + strlen(ei->value) + 2;
+    for (si = svc->sockets; si; si = si->next)
+        size += sizeof(ANDROID_SOCKET_ENV_PREFIX) + strlen(si->name) + 12;
+    return size;
+}
+
+/* add_child_environment - add "key=value" to the environment of a child
+ * about to exec, without malloc: the child may have been forked by a
+ * helper thread while another thread held the malloc lock. the entries
+ * go into a buffer of child_env_size() bytes allocated before the fork */
+static char *child_env;
+static size_t child_env_left;
+
+static int add_child_environment(struct service *svc, const char *key,
+                                 const char *val)
+{
+    int n;
+    size_t len = strlen(key) + strlen(val) + 2;
+
+    for (n = 0; n < 31; n++) {
+        if (!ENV[n]) {
+            if (len > child_env_left)
+                break;
+            snprintf(child_env, len, "%s=%s", key, val);
+            ENV[n] = child_env;
+            child_env += len;
+            child_env_left -= len;
+            return 0;
+        }
+    }
+
+    ERROR("no room for %s in the environment of '%s'\n", key, svc->name);
+    return 1;
+}
+
 static void zap_stdio(void)
 {
     int fd;
@@ -141,7 +187,7 @@ static time_t gettime(void)
     return ts.tv_sec;
 }
 
-static void publish_socket(const char *name, int fd)
+static void publish_socket(struct service *svc, const char *name, int fd)
 {
     char key[64] = ANDROID_SOCKET_ENV_PREFIX;
     char val[64];
@@ -150,18 +196,200 @@ static void publish_socket(const char *name, int fd)
             name,
             sizeof(key) - sizeof(ANDROID_SOCKET_ENV_PREFIX));
     snprintf(val, sizeof(val), "%d", fd);
-    add_environment(key, val);
+    add_child_environment(svc, key, val);
 
     /* make sure we don't close-on-exec */
     fcntl(fd, F_SETFD, 0);
 }
 
+/* runs in the child of a service start, does not return */
+static void service_exec(struct service *svc, const char *dynamic_args,
+                         int needs_console, char *env, size_t env_size)
+{
+    struct socketinfo *si;
+    struct svcenvinfo *ei;
+    char tmp[32];
+    int fd, sz;
+    int n;
+
+    child_env = env;
+    child_env_left = env_size;
+
+    get_property_workspace(&fd, &sz);
+    sprintf(tmp, "%d,%d", dup(fd), sz);
+    add_child_environment(svc, "ANDROID_PROPERTY_WORKSPACE", tmp);
+
+    for (ei = svc->envvars; ei; ei = ei->next)
+        add_child_environment(svc, ei->name, ei->value);
+
+    for (si = svc->sockets; si; si = si->next) {
+        int s = create_socket(si->name,
+                              !strcmp(si->type, "dgram") ? 
+                              SOCK_DGRAM : SOCK_STREAM,
+                              si->perm, si->uid, si->gid);
+        if (s >= 0) {
+            publish_socket(svc, si->name, s);
+        }
+    }
+
+    if (needs_console) {
+        setsid();
+        open_console();
+    } else {
+        zap_stdio();
+    }
+
+#if 0
+    for (n = 0; svc->args[n]; n++) {
+        INFO("args[%d] = '%s'\n", n, svc->args[n]);
+    }
+    for (n = 0; ENV[n]; n++) {
+        INFO("env[%d] = '%s'\n", n, ENV[n]);
+    }
+#endif
+
+    setpgid(0, getpid());
+
+/* as requested, set our gid, supplemental gids, and uid */
+    if (svc->gid) {
+        setgid(svc->gid);
+    }
+    if (svc->nr_supp_gids) {
+        setgroups(svc->nr_supp_gids, svc->supp_gids);
+    }
+    if (svc->uid) {
+        setuid(svc->uid);
+    }
+
+    if (!dynamic_args)
+        execve(svc->args[0], (char**) svc->args, (char**) ENV);
+    else {
+        char *arg_ptrs[SVC_MAXARGS+1];
+        int arg_idx = svc->nargs;
+        char *tmp = strdup(dynamic_args);
+        char *next = tmp;
+        char *bword;
+
+        /* Copy the static arguments */
+        memcpy(arg_ptrs, svc->args, (svc->nargs * sizeof(char *)));
+
+        while((bword = strsep(&next, " "))) {
+            arg_ptrs[arg_idx++] = bword;
+            if (arg_idx == SVC_MAXARGS)
+                break;
+        }
+        arg_ptrs[arg_idx] = '\0';
+        execve(svc->args[0], (char**) arg_ptrs, (char**) ENV);
+    }
+    _exit(127);
+}
+
+/* services of a class_start may be forked by the helper threads, in
+ * which case they are SVC_STARTING until the fork returns; exits of
+ * children we do not know the pid of yet are kept until then */
+static int concurrent_starts;
+
+#define EARLY_EXITS_MAX 16
+static pid_t early_exits[EARLY_EXITS_MAX];
+static int early_exit_count;
+
+struct start_job {
+    struct helper_job job;
+    struct service *svc;
+    int needs_console;
+    char *env;
+    size_t env_size;
+    pid_t pid;
+};
+
+static void service_exited(struct service *svc, pid_t pid);
+
+void service_start_concurrently(int enable)
+{
+    concurrent_starts = enable;
+}
+
+static void run_start_job(struct helper_job *job)
+{
+    struct start_job *sj = (struct start_job *) job;
+
+    sj->pid = fork();
+    if (sj->pid == 0)
+        service_exec(sj->svc, NULL, sj->needs_console, sj->env, sj->env_size);
+}
+
+static void start_job_done(struct helper_job *job)
+{
+    struct start_job *sj = (struct start_job *) job;
+    struct service *svc = sj->svc;
+    pid_t pid = sj->pid;
+    int n;
+
+    free(sj->env);
+    free(sj);
+    svc->flags &= (~SVC_STARTING);
+
+    if (pid < 0) {
+        ERROR("failed to start '%s'\n", svc->name);
+        svc->flags &= (~SVC_RUNNING);
+        return;
+    }
+
+    svc->time_started = gettime();
+    service_set_pid(svc, pid);
+
+        /* stopped while it was being forked */
+    if (!(svc->flags & SVC_RUNNING)) {
+        NOTICE("service '%s' is being killed\n", svc->name);
+        if (kill(-pid, SIGTERM) < 0)
+            kill(pid, SIGTERM);
+        svc->flags |= SVC_RUNNING;
+        notify_service_state(svc->name, "stopping");
+    } else {
+        notify_service_state(svc->name, "running");
+    }
+
+    for (n = 0; n < early_exit_count; n++) {
+        if (early_exits[n] == pid) {
+            early_exits[n] = early_exits[--early_exit_count];
+            service_exited(svc, pid);
+            break;
+        }
+    }
+}
+
+static int service_start_job(struct service *svc, int needs_console)
+{
+    struct start_job *sj = calloc(1, sizeof(*sj));
+
+    if (!sj)
+        return -1;
+    sj->env_size = child_env_size(svc);
+    sj->env = malloc(sj->env_size);
+    if (!sj->env) {
+        free(sj);
+        return -1;
+    }
+    sj->job.run = run_start_job;
+    sj->job.done = start_job_done;
+    sj->svc = svc;
+    sj->needs_console = needs_console;
+    if (helper_submit(&sj->job) < 0) {
+        free(sj->env);
+        free(sj);
+        return -1;
+    }
+    svc->flags |= SVC_STARTING | SVC_RUNNING;
+    return 0;
+}
+
 void service_start(struct service *svc, const char *dynamic_args)
 {
     struct stat s;
     pid_t pid;
     int needs_console;
-    int n;
+    size_t env_size;
+    char *env;
 
         /* starting a service removes it from the disabled
          * state and immediately takes it out of the restarting
@@ -179,6 +407,12 @@ void service_start(struct service *svc, const char *dynamic_args)
         return;
     }
 
+        /* stopped and started again before its fork returned */
+    if (svc->flags & SVC_STARTING) {
+        svc->flags |= SVC_RUNNING;
+        return;
+    }
+
     needs_console = (svc->flags & SVC_CONSOLE) ? 1 : 0;
     if (needs_console && (!have_console)) {
         ERROR("service '%s' requires console\n", svc->name);
@@ -201,91 +435,32 @@ void service_start(struct service *svc, const char *dynamic_args)
 
     NOTICE("starting '%s'\n", svc->name);
 
-    pid = fork();
-
-    if (pid == 0) {
-        struct socketinfo *si;
-        struct svcenvinfo *ei;
-        char tmp[32];
-        int fd, sz;
-
-        get_property_workspace(&fd, &sz);
-        sprintf(tmp, "%d,%d", dup(fd), sz);
-        add_environment("ANDROID_PROPERTY_WORKSPACE", tmp);
-
-        for (ei = svc->envvars; ei; ei = ei->next)
-            add_environment(ei->name, ei->value);
-
-        for (si = svc->sockets; si; si = si->next) {
-            int s = create_socket(si->name,
-                                  !strcmp(si->type, "dgram") ? 
-                                  SOCK_DGRAM : SOCK_STREAM,
-                                  si->perm, si->uid, si->gid);
-            if (s >= 0) {
-                publish_socket(si->name, s);
-            }
-        }
-
-        if (needs_console) {
-            setsid();
-            open_console();
-        } else {
-            zap_stdio();
-        }
-
-#if 0
-        for (n = 0; svc->args[n]; n++) {
-            INFO("args[%d] = '%s'\n", n, svc->args[n]);
-        }
-        for (n = 0; ENV[n]; n++) {
-            INFO("env[%d] = '%s'\n", n, ENV[n]);
-        }
-#endif
+    if (concurrent_starts && !dynamic_args &&
+        service_start_job(svc, needs_console) == 0)
+        return;
 
-        setpgid(0, getpid());
+    env_size = child_env_size(svc);
+    env = malloc(env_size);
+    if (!env) {
+        ERROR("failed to start '%s'\n", svc->name);
+        return;
+    }
 
-    /* as requested, set our gid, supplemental gids, and uid */
-        if (svc->gid) {
-            setgid(svc->gid);
-        }
-        if (svc->nr_supp_gids) {
-            setgroups(svc->nr_supp_gids, svc->supp_gids);
-        }
-        if (svc->uid) {
-            setuid(svc->uid);
-        }
+    pid = fork();
 
-        if (!dynamic_args)
-            execve(svc->args[0], (char**) svc->args, (char**) ENV);
-        else {
-            char *arg_ptrs[SVC_MAXARGS+1];
-            int arg_idx = svc->nargs;
-            char *tmp = strdup(dynamic_args);
-            char *next = tmp;
-            char *bword;
-
-            /* Copy the static arguments */
-            memcpy(arg_ptrs, svc->args, (svc->nargs * sizeof(char *)));
-
-            while((bword = strsep(&next, " "))) {
-                arg_ptrs[arg_idx++] = bword;
-                if (arg_idx == SVC_MAXARGS)
-                    break;
-            }
-            arg_ptrs[arg_idx] = '\0';
-            execve(svc->args[0], (char**) arg_ptrs, (char**) ENV);
-        }
-        _exit(127);
+    if (pid == 0) {
+        service_exec(svc, dynamic_args, needs_console, env, env_size);
     }
+    free(env);
 
     if (pid < 0) {
         ERROR("failed to start '%s'\n", svc->name);
-        svc->pid = 0;
+        service_set_pid(svc, 0);
         return;
     }
 
     svc->time_started = gettime();
-    svc->pid = pid;
+    service_set_pid(svc, pid);
     svc->flags |= SVC_RUNNING;
 
     notify_service_state(svc->name, "running");
@@ -320,6 +495,17 @@ void property_changed(const char *name, const char *value)
     }
 }
 
+void properties_changed(const char **names, const char **values, int count)
+{
+    int n;
+
+    if (property_triggers_enabled) {
+        for (n = 0; n < count; n++)
+            queue_property_triggers(names[n], values[n]);
+        drain_action_queue();
+    }
+}
+
 #define CRITICAL_CRASH_THRESHOLD    4       /* if we crash >4 times ... */
 #define CRITICAL_CRASH_WINDOW       (4*60)  /* ... in 4 minutes, goto recovery*/
 
@@ -328,10 +514,6 @@ static int wait_for_one_process(int block)
     pid_t pid;
     int status;
     struct service *svc;
-    struct socketinfo *si;
-    time_t now;
-    struct listnode *node;
-    struct command *cmd;
 
     while ( (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) == -1 && errno == EINTR );
     if (pid <= 0) return -1;
@@ -339,10 +521,25 @@ static int wait_for_one_process(int block)
 
     svc = service_find_by_pid(pid);
     if (!svc) {
+        if (helper_pending() && early_exit_count < EARLY_EXITS_MAX) {
+            early_exits[early_exit_count++] = pid;
+            return 0;
+        }
         ERROR("untracked pid %d exited\n", pid);
         return 0;
     }
 
+    service_exited(svc, pid);
+    return 0;
+}
+
+static void service_exited(struct service *svc, pid_t pid)
+{
+    struct socketinfo *si;
+    time_t now;
+    struct listnode *node;
+    struct command *cmd;
+
     NOTICE("process '%s', pid %d exited\n", svc->name, pid);
 
     if (!(svc->flags & SVC_ONESHOT)) {
@@ -357,7 +554,7 @@ static int wait_for_one_process(int block)
         unlink(tmp);
     }
 
-    svc->pid = 0;
+    service_set_pid(svc, 0);
     svc->flags &= (~SVC_RUNNING);
 
         /* oneshot processes go into the disabled state on exit */
@@ -368,7 +565,7 @@ static int wait_for_one_process(int block)
         /* disabled processes do not get restarted automatically */
     if (svc->flags & SVC_DISABLED) {
         notify_service_state(svc->name, "stopped");
-        return 0;
+        return;
     }
 
     now = gettime();
@@ -381,7 +578,7 @@ static int wait_for_one_process(int block)
                 sync();
                 __reboot(LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2,
                          LINUX_REBOOT_CMD_RESTART2, "recovery");
-                return 0;
+                return;
             }
         } else {
             svc->time_crashed = now;
@@ -396,7 +593,6 @@ static int wait_for_one_process(int block)
     }
     svc->flags |= SVC_RESTARTING;
     notify_service_state(svc->name, "restarting");
-    return 0;
 }
 
 static void restart_service_if_needed(struct service *svc)
@@ -665,6 +861,179 @@ static void get_hardware_name(void)
     }
 }
 
+static long long gettime_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void action_started(struct action *act)
+{
+    INFO("processing action %p (%s)\n", act, act->name);
+    act->time_started = gettime_us();
+}
+
+static void action_finished(struct action *act)
+{
+    act->time_finished = gettime_us();
+    act->flags |= ACTION_DONE;
+    INFO("action '%s' took %lld us\n", act->name,
+         act->time_finished - act->time_started);
+#if BOOTCHART
+    bootchart_action(act->name, act->time_started, act->time_finished);
+#endif
+}
+
+/* in the parallel mode, set by "sched parallel", the queue is drained
+ * in the order of the "after" and "needs" of each action, and commands
+ * such as mount or insmod run on helper threads while other actions
+ * go on. actions that declare neither still run in order, alone. */
+static int sched_parallel;
+static int actions_running;
+static int drain_depth;
+
+struct command_job {
+    struct helper_job job;
+    struct action *act;
+    struct command *cmd;
+    int ret;
+};
+
+static void run_action(struct action *act);
+
+int set_parallel_scheduling(int enable)
+{
+    if (enable) {
+            /* read /proc/mtd now, mounts may race for it on helpers */
+        mtd_name_to_number("");
+        if (helper_init() < 0)
+            return -1;
+    }
+    sched_parallel = enable;
+    return 0;
+}
+
+static struct command *next_command(struct action *act, struct command *cmd)
+{
+    struct listnode *node = cmd ? cmd->clist.next : act->commands.next;
+
+    if (node == &act->commands)
+        return 0;
+    return node_to_item(node, struct command, clist);
+}
+
+static void run_command_job(struct helper_job *job)
+{
+    struct command_job *cj = (struct command_job *) job;
+
+    cj->ret = cj->cmd->func(cj->cmd->nargs, cj->cmd->args);
+}
+
+static void command_job_done(struct helper_job *job)
+{
+    struct command_job *cj = (struct command_job *) job;
+    struct action *act = cj->act;
+
+    INFO("command '%s' r=%d\n", cj->cmd->args[0], cj->ret);
+    free(cj);
+    act->flags &= (~ACTION_WAITING);
+    run_action(act);
+}
+
+static int start_command_job(struct action *act, struct command *cmd)
+{
+    struct command_job *cj = calloc(1, sizeof(*cj));
+
+    if (!cj)
+        return -1;
+    cj->job.run = run_command_job;
+    cj->job.done = command_job_done;
+    cj->act = act;
+    cj->cmd = cmd;
+    if (helper_submit(&cj->job) < 0) {
+        free(cj);
+        return -1;
+    }
+    act->flags |= ACTION_WAITING;
+    return 0;
+}
+
+/* runs the commands of a started action from act->current on, until one
+ * of them is handed to a helper or the action is finished */
+static void run_action(struct action *act)
+{
+    struct command *cmd;
+    int ret;
+
+    while ((cmd = act->current)) {
+        act->current = next_command(act, cmd);
+        if (cmd->async && start_command_job(act, cmd) == 0)
+            return;
+        ret = cmd->func(cmd->nargs, cmd->args);
+        INFO("command '%s' r=%d\n", cmd->args[0], ret);
+    }
+
+    act->flags &= (~ACTION_RUNNING);
+    actions_running--;
+    action_finished(act);
+    if (act->flags & ACTION_REQUEUE) {
+        act->flags &= (~ACTION_REQUEUE);
+        action_add_queue_tail(act);
+    }
+}
+
+static void start_action(struct action *act)
+{
+    act->flags |= ACTION_RUNNING;
+    actions_running++;
+    action_started(act);
+    act->current = next_command(act, 0);
+    run_action(act);
+}
+
+static void drain_action_queue_parallel(void)
+{
+    struct action *act;
+
+    drain_depth++;
+    for (;;) {
+        while ((act = action_next_ready(actions_running))) {
+            action_remove_queue(act);
+            start_action(act);
+        }
+
+            /* a command of an action that is still running triggered
+             * this drain, the outer one waits for what is left */
+        if (drain_depth > 1)
+            break;
+        if (actions_running == 0 && action_queue_empty())
+            break;
+
+        if (helper_pending()) {
+            helper_complete(1);
+        } else if (actions_running == 0) {
+            act = action_remove_queue_head();
+            ERROR("cannot meet the dependencies of action '%s', running it\n",
+                  act->name);
+            start_action(act);
+        } else {
+            break;
+        }
+    }
+    drain_depth--;
+}
+
+/* returns finished helper jobs to the actions and services waiting for
+ * them, from the main loop */
+static void complete_helper_jobs(void)
+{
+    drain_depth++;
+    helper_complete(0);
+    drain_depth--;
+}
+
 static void drain_action_queue(void)
 {
     struct listnode *node;
@@ -672,13 +1041,19 @@ static void drain_action_queue(void)
     struct action *act;
     int ret;
 
+    if (sched_parallel) {
+        drain_action_queue_parallel();
+        return;
+    }
+
     while ((act = action_remove_queue_head())) {
-        INFO("processing action %p (%s)\n", act, act->name);
+        action_started(act);
         list_for_each(node, &act->commands) {
             cmd = node_to_item(node, struct command, clist);
             ret = cmd->func(cmd->nargs, cmd->args);
             INFO("command '%s' r=%d\n", cmd->args[0], ret);
         }
+        action_finished(act);
     }
 }
 
@@ -795,7 +1170,7 @@ int main(int argc, char **argv)
     int fd;
     struct sigaction act;
     char tmp[PROP_VALUE_MAX];
-    struct pollfd ufds[4];
+    struct pollfd ufds[5];
     char *tmpdev;
     char* debuggable;
 
@@ -965,36 +1340,38 @@ int main(int argc, char **argv)
     ufds[1].events = POLLIN;
     ufds[2].fd = signal_recv_fd;
     ufds[2].events = POLLIN;
-    fd_count = 3;
-
+    ufds[3].fd = -1;
+    ufds[3].events = 0;
+    ufds[3].revents = 0;
     if (keychord_fd > 0) {
         ufds[3].fd = keychord_fd;
         ufds[3].events = POLLIN;
-        fd_count++;
-    } else {
-        ufds[3].events = 0;
-        ufds[3].revents = 0;
     }
+        /* finished helper jobs, once "sched parallel" started them */
+    ufds[4].events = POLLIN;
+    fd_count = 5;
 
 #if BOOTCHART
-    bootchart_count = bootchart_init();
-    if (bootchart_count < 0) {
+    bootchart_period = bootchart_init();
+    if (bootchart_period < 0) {
         ERROR("bootcharting init failure\n");
-    } else if (bootchart_count > 0) {
-        NOTICE("bootcharting started (period=%d ms)\n", bootchart_count*BOOTCHART_POLLING_MS);
+        bootchart_period = 0;
+    } else if (bootchart_period > 0) {
+        NOTICE("bootcharting started (period=%d ms)\n", bootchart_period);
     } else {
         NOTICE("bootcharting ignored\n");
     }
 #endif
 
     for(;;) {
-        int nr, i, timeout = -1;
+        int nr, i, timeout = -1, sync_timeout;
 
         for (i = 0; i < fd_count; i++)
             ufds[i].revents = 0;
 
         drain_action_queue();
         restart_processes();
+        ufds[4].fd = helper_fd();
 
         if (process_needs_restart) {
             timeout = (process_needs_restart - gettime()) * 1000;
@@ -1002,13 +1379,19 @@ int main(int argc, char **argv)
                 timeout = 0;
         }
 
+        /* changes to persistent properties are flushed to disk together */
+        sync_timeout = persistent_properties_sync();
+        if (sync_timeout >= 0 && (timeout < 0 || timeout > sync_timeout))
+            timeout = sync_timeout;
+
 #if BOOTCHART
-        if (bootchart_count > 0) {
-            if (timeout < 0 || timeout > BOOTCHART_POLLING_MS)
-                timeout = BOOTCHART_POLLING_MS;
-            if (bootchart_step() < 0 || --bootchart_count == 0) {
+        if (bootchart_period > 0) {
+            int next = bootchart_step();
+            if (next < 0) {
                 bootchart_finish();
-                bootchart_count = 0;
+                bootchart_period = 0;
+            } else if (timeout < 0 || timeout > next) {
+                timeout = next;
             }
         }
 #endif
@@ -1031,6 +1414,8 @@ int main(int argc, char **argv)
             handle_property_set_fd(property_set_fd);
         if (ufds[3].revents == POLLIN)
             handle_keychord(keychord_fd);
+        if (ufds[4].revents == POLLIN)
+            complete_helper_jobs();
     }
 
     return 0;
@@ -73,6 +73,7 @@ struct command
     struct listnode clist;
 
     int (*func)(int nargs, char **args);
+    int async;      /* may run on a helper thread */
     int nargs;
     char *args[1];
 };
@@ -82,7 +83,8 @@ struct action {
     struct listnode alist;
         /* node in the queue of pending actions */
     struct listnode qlist;
-        /* node in list of actions for a trigger */
+        /* node in the hash bucket of its trigger, or for
+         * "property:" triggers of its property name */
     struct listnode tlist;
 
     unsigned hash;
@@ -90,8 +92,25 @@ struct action {
     
     struct listnode commands;
     struct command *current;
+
+        /* "on <trigger> after <trigger> needs <trigger>", only
+         * honored when scheduling in parallel */
+    char **after;
+    int nafter;
+    char **needs;
+    int nneeds;
+
+    unsigned flags;
+    long long time_started;     /* in us, of the last run */
+    long long time_finished;
 };
 
+#define ACTION_QUEUED   0x01  /* on the action queue */
+#define ACTION_RUNNING  0x02  /* started by the parallel scheduler */
+#define ACTION_WAITING  0x04  /* one of its commands is on a helper */
+#define ACTION_REQUEUE  0x08  /* triggered again while running */
+#define ACTION_DONE     0x10  /* ran to completion at least once */
+
 struct socketinfo {
     struct socketinfo *next;
     const char *name;
@@ -113,6 +132,7 @@ struct svcenvinfo {
 #define SVC_RESTARTING  0x08  /* waiting to restart */
 #define SVC_CONSOLE     0x10  /* requires console */
 #define SVC_CRITICAL    0x20  /* will reboot into recovery if keeps crashing */
+#define SVC_STARTING    0x40  /* being forked by a helper thread */
 
 #define NR_SVC_SUPP_GIDS 6    /* six supplementary groups */
 
@@ -121,6 +141,9 @@ struct svcenvinfo {
 struct service {
         /* list of all services */
     struct listnode slist;
+        /* hash buckets by name, and by pid while running */
+    struct listnode nlist;
+    struct listnode plist;
 
     const char *name;
     const char *classname;
@@ -155,6 +178,7 @@ int parse_config_file(const char *fn);
 
 struct service *service_find_by_name(const char *name);
 struct service *service_find_by_pid(pid_t pid);
+void service_set_pid(struct service *svc, pid_t pid);
 struct service *service_find_by_keychord(int keychord_id);
 void service_for_each(void (*func)(struct service *svc));
 void service_for_each_class(const char *classname,
@@ -164,9 +188,16 @@ void service_for_each_flags(unsigned matchflags,
 void service_stop(struct service *svc);
 void service_start(struct service *svc, const char *dynamic_args);
 void property_changed(const char *name, const char *value);
+void properties_changed(const char **names, const char **values, int count);
 
 struct action *action_remove_queue_head(void);
 void action_add_queue_tail(struct action *act);
+void action_add_queue_head(struct action *act);
+void action_remove_queue(struct action *act);
+struct action *action_next_ready(int running);
+int action_queue_empty(void);
+int set_parallel_scheduling(int enable);
+void service_start_concurrently(int enable);
 void action_for_each_trigger(const char *trigger,
                              void (*func)(struct action *act));
 void queue_property_triggers(const char *name, const char *value);
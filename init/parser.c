@@ -17,6 +17,18 @@ static list_declare(service_list);
 static list_declare(action_list);
 static list_declare(action_queue);
 
+    /* "property:<name>=<value>" actions, hashed by <name>, and all
+     * other actions, hashed by their trigger */
+#define PROP_TRIGGER_BUCKETS 64
+static struct listnode prop_triggers[PROP_TRIGGER_BUCKETS];
+#define TRIGGER_BUCKETS 32
+static struct listnode triggers[TRIGGER_BUCKETS];
+
+    /* services hashed by name, and the running ones by pid */
+#define SERVICE_BUCKETS 64
+static struct listnode services_by_name[SERVICE_BUCKETS];
+static struct listnode services_by_pid[SERVICE_BUCKETS];
+
 #define RAW(x...) log_write(6, x)
 
 void DUMP(void)
@@ -101,6 +113,7 @@ void parse_error(struct parse_state *state, const char *fmt, ...)
 #define SECTION 0x01
 #define COMMAND 0x02
 #define OPTION  0x04
+#define ASYNC   0x08  /* a command that may run on a helper thread */
 
 #include "keywords.h"
 
@@ -175,6 +188,7 @@ int lookup_keyword(const char *s)
         if (!strcmp(s, "estart")) return K_restart;
         break;
     case 's':
+        if (!strcmp(s, "ched")) return K_sched;
         if (!strcmp(s, "ervice")) return K_service;
         if (!strcmp(s, "etenv")) return K_setenv;
         if (!strcmp(s, "etkey")) return K_setkey;
@@ -415,12 +429,33 @@ static int valid_name(const char *name)
     return 1;
 }
 
+static unsigned name_hash(const char *name, int len)
+{
+    unsigned hash = 0;
+    while (len-- > 0)
+        hash = hash * 31 + (unsigned char) *name++;
+    return hash;
+}
+
+static struct listnode *hash_bucket(struct listnode *table, int size,
+                                    unsigned hash)
+{
+    struct listnode *bucket = &table[hash % size];
+    if (bucket->next == 0)
+        list_init(bucket);
+    return bucket;
+}
+
 struct service *service_find_by_name(const char *name)
 {
     struct listnode *node;
+    struct listnode *bucket;
     struct service *svc;
-    list_for_each(node, &service_list) {
-        svc = node_to_item(node, struct service, slist);
+
+    bucket = hash_bucket(services_by_name, SERVICE_BUCKETS,
+                         name_hash(name, strlen(name)));
+    list_for_each(node, bucket) {
+        svc = node_to_item(node, struct service, nlist);
         if (!strcmp(svc->name, name)) {
             return svc;
         }
@@ -431,9 +466,14 @@ struct service *service_find_by_name(const char *name)
 struct service *service_find_by_pid(pid_t pid)
 {
     struct listnode *node;
+    struct listnode *bucket;
     struct service *svc;
-    list_for_each(node, &service_list) {
-        svc = node_to_item(node, struct service, slist);
+
+    if (pid <= 0)
+        return 0;
+    bucket = hash_bucket(services_by_pid, SERVICE_BUCKETS, pid);
+    list_for_each(node, bucket) {
+        svc = node_to_item(node, struct service, plist);
         if (svc->pid == pid) {
             return svc;
         }
@@ -441,6 +481,16 @@ struct service *service_find_by_pid(pid_t pid)
     return 0;
 }
 
+void service_set_pid(struct service *svc, pid_t pid)
+{
+    if (svc->pid > 0)
+        list_remove(&svc->plist);
+    svc->pid = pid;
+    if (pid > 0)
+        list_add_tail(hash_bucket(services_by_pid, SERVICE_BUCKETS, pid),
+                      &svc->plist);
+}
+
 struct service *service_find_by_keychord(int keychord_id)
 {
     struct listnode *node;
@@ -494,24 +544,51 @@ void action_for_each_trigger(const char *trigger,
                              void (*func)(struct action *act))
 {
     struct listnode *node;
+    struct listnode *bucket;
     struct action *act;
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        if (!strcmp(act->name, trigger)) {
+    unsigned hash = name_hash(trigger, strlen(trigger));
+
+    bucket = hash_bucket(triggers, TRIGGER_BUCKETS, hash);
+    list_for_each(node, bucket) {
+        act = node_to_item(node, struct action, tlist);
+        if (act->hash == hash && !strcmp(act->name, trigger)) {
             func(act);
         }
     }
 }
 
+static void index_trigger(struct action *act)
+{
+    act->hash = name_hash(act->name, strlen(act->name));
+    list_add_tail(hash_bucket(triggers, TRIGGER_BUCKETS, act->hash),
+                  &act->tlist);
+}
+
+static void index_property_trigger(struct action *act)
+{
+    const char *name = act->name + strlen("property:");
+    const char *equals = strchr(name, '=');
+
+    if (!equals)
+        return;
+    act->hash = name_hash(name, equals - name);
+    list_add_tail(hash_bucket(prop_triggers, PROP_TRIGGER_BUCKETS, act->hash),
+                  &act->tlist);
+}
+
 void queue_property_triggers(const char *name, const char *value)
 {
     struct listnode *node;
+    struct listnode *bucket;
     struct action *act;
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        if (!strncmp(act->name, "property:", strlen("property:"))) {
+    int name_length = strlen(name);
+    unsigned hash = name_hash(name, name_length);
+
+    bucket = hash_bucket(prop_triggers, PROP_TRIGGER_BUCKETS, hash);
+    list_for_each(node, bucket) {
+        act = node_to_item(node, struct action, tlist);
+        if (act->hash == hash) {
             const char *test = act->name + strlen("property:");
-            int name_length = strlen(name);
             
             if (!strncmp(name, test, name_length) && 
                     test[name_length] == '=' &&
@@ -556,7 +633,35 @@ void queue_all_property_triggers()
 
 void action_add_queue_tail(struct action *act)
 {
+        /* the parallel scheduler takes actions off the queue while they
+         * run, so one triggered again meanwhile runs again once done */
+    if (act->flags & ACTION_QUEUED)
+        return;
+    if (act->flags & ACTION_RUNNING) {
+        act->flags |= ACTION_REQUEUE;
+        return;
+    }
     list_add_tail(&action_queue, &act->qlist);
+    act->flags |= ACTION_QUEUED;
+}
+
+void action_add_queue_head(struct action *act)
+{
+    if (act->flags & (ACTION_QUEUED | ACTION_RUNNING))
+        return;
+    list_add_tail(action_queue.next, &act->qlist);
+    act->flags |= ACTION_QUEUED;
+}
+
+void action_remove_queue(struct action *act)
+{
+    list_remove(&act->qlist);
+    act->flags &= ~ACTION_QUEUED;
+}
+
+int action_queue_empty(void)
+{
+    return list_empty(&action_queue);
 }
 
 struct action *action_remove_queue_head(void)
@@ -566,11 +671,96 @@ struct action *action_remove_queue_head(void)
     } else {
         struct listnode *node = list_head(&action_queue);
         struct action *act = node_to_item(node, struct action, qlist);
-        list_remove(node);
+        action_remove_queue(act);
         return act;
     }
 }
 
+/* ORs together the flags of every action on a trigger but self,
+ * or returns -1 if no action has that trigger */
+static int trigger_flags(const char *trigger, struct action *self)
+{
+    struct listnode *node;
+    struct listnode *bucket;
+    struct action *act;
+    const char *name = trigger;
+    int len = strlen(trigger);
+    unsigned hash;
+    int flags = -1;
+
+    if (!strncmp(trigger, "property:", strlen("property:"))) {
+        const char *equals;
+
+        name += strlen("property:");
+        equals = strchr(name, '=');
+        if (!equals)
+            return -1;
+        hash = name_hash(name, equals - name);
+        bucket = hash_bucket(prop_triggers, PROP_TRIGGER_BUCKETS, hash);
+    } else {
+        hash = name_hash(name, len);
+        bucket = hash_bucket(triggers, TRIGGER_BUCKETS, hash);
+    }
+
+    list_for_each(node, bucket) {
+        act = node_to_item(node, struct action, tlist);
+        if (act->hash != hash || strcmp(act->name, trigger))
+            continue;
+        if (flags < 0)
+            flags = 0;
+        if (act != self)
+            flags |= act->flags;
+    }
+    return flags;
+}
+
+static int action_ready(struct action *act, int first, int running)
+{
+    int flags;
+    int n;
+
+        /* an action that declares nothing waits for everything queued
+         * before it, as it would when actions are run one by one */
+    if (!act->nafter && !act->nneeds)
+        return first && running == 0;
+
+    for (n = 0; n < act->nafter; n++) {
+        flags = trigger_flags(act->after[n], act);
+        if (flags > 0 && (flags & (ACTION_QUEUED | ACTION_RUNNING)))
+            return 0;
+    }
+    for (n = 0; n < act->nneeds; n++) {
+        flags = trigger_flags(act->needs[n], act);
+        if (flags < 0)
+            continue;
+        if (flags & (ACTION_QUEUED | ACTION_RUNNING))
+            return 0;
+        if (!(flags & ACTION_DONE) &&
+                strncmp(act->needs[n], "property:", strlen("property:"))) {
+                /* pull in what we need ahead of everything else; property
+                 * triggers only run when the property is set */
+            action_for_each_trigger(act->needs[n], action_add_queue_head);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the first queued action whose dependencies are met, given how many
+ * actions are still running, or 0 if none can start yet */
+struct action *action_next_ready(int running)
+{
+    struct listnode *node;
+    struct action *act;
+
+    list_for_each(node, &action_queue) {
+        act = node_to_item(node, struct action, qlist);
+        if (action_ready(act, node == list_head(&action_queue), running))
+            return act;
+    }
+    return 0;
+}
+
 static void *parse_service(struct parse_state *state, int nargs, char **args)
 {
     struct service *svc;
@@ -603,6 +793,9 @@ static void *parse_service(struct parse_state *state, int nargs, char **args)
     svc->onrestart.name = "onrestart";
     list_init(&svc->onrestart.commands);
     list_add_tail(&service_list, &svc->slist);
+    list_add_tail(hash_bucket(services_by_name, SERVICE_BUCKETS,
+                              name_hash(svc->name, strlen(svc->name))),
+                  &svc->nlist);
     return svc;
 }
 
@@ -745,6 +938,36 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
     }
 }
 
+/* "after <trigger>" and "needs <trigger>" pairs following the trigger */
+static int parse_action_deps(struct parse_state *state, struct action *act,
+                             int nargs, char **args)
+{
+    int n;
+
+    act->after = malloc(sizeof(char*) * nargs / 2);
+    act->needs = malloc(sizeof(char*) * nargs / 2);
+    if (!act->after || !act->needs) {
+        parse_error(state, "out of memory\n");
+        goto fail;
+    }
+    for (n = 0; n < nargs; n += 2) {
+        if (!strcmp(args[n], "after")) {
+            act->after[act->nafter++] = args[n + 1];
+        } else if (!strcmp(args[n], "needs")) {
+            act->needs[act->nneeds++] = args[n + 1];
+        } else {
+            parse_error(state, "invalid action parameter '%s'\n", args[n]);
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    free(act->after);
+    free(act->needs);
+    return -1;
+}
+
 static void *parse_action(struct parse_state *state, int nargs, char **args)
 {
     struct action *act;
@@ -752,15 +975,22 @@ static void *parse_action(struct parse_state *state, int nargs, char **args)
         parse_error(state, "actions must have a trigger\n");
         return 0;
     }
-    if (nargs > 2) {
-        parse_error(state, "actions may not have extra parameters\n");
+    if (nargs % 2) {
+        parse_error(state, "actions may only have 'after' or 'needs' parameters\n");
         return 0;
     }
     act = calloc(1, sizeof(*act));
     act->name = args[1];
+    if (nargs > 2 && parse_action_deps(state, act, nargs - 2, args + 2)) {
+        free(act);
+        return 0;
+    }
     list_init(&act->commands);
     list_add_tail(&action_list, &act->alist);
-        /* XXX add to hash */
+    if (!strncmp(act->name, "property:", strlen("property:")))
+        index_property_trigger(act);
+    else
+        index_trigger(act);
     return act;
 }
 
@@ -789,6 +1019,7 @@ static void parse_line_action(struct parse_state* state, int nargs, char **args)
     }
     cmd = malloc(sizeof(*cmd) + sizeof(char*) * nargs);
     cmd->func = kw_func(kw);
+    cmd->async = kw_is(kw, ASYNC) ? 1 : 0;
     cmd->nargs = nargs;
     memcpy(cmd->args, args, sizeof(char*) * nargs);
     list_add_tail(&act->commands, &cmd->clist);
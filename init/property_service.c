@@ -24,18 +24,22 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <stddef.h>
+#include <time.h>
 
 #include <cutils/misc.h>
 #include <cutils/sockets.h>
 #include <cutils/ashmem.h>
+#include <cutils/atomic.h>
 
-#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
-#include <sys/_system_properties.h>
+#include <private/property_index.h>
 
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <sys/mman.h>
 #include <sys/atomics.h>
@@ -121,15 +125,10 @@ out:
     return -1;
 }
 
-/* (8 header words + 247 toc words) = 1020 bytes */
-/* 1024 bytes header and toc + 247 prop_infos @ 128 bytes = 32640 bytes */
-
-#define PA_COUNT_MAX  247
-#define PA_INFO_START 1024
-#define PA_SIZE       32768
+/* see private/property_index.h for the layout of the area */
 
 static workspace pa_workspace;
-static prop_info *pa_info_array;
+static prop_index *pa_index;
 
 extern prop_area *__system_property_area__;
 
@@ -137,7 +136,7 @@ static int init_property_area(void)
 {
     prop_area *pa;
 
-    if(pa_info_array)
+    if(pa_index)
         return -1;
 
     if(init_workspace(&pa_workspace, PA_SIZE))
@@ -145,13 +144,17 @@ static int init_property_area(void)
 
     fcntl(pa_workspace.fd, F_SETFD, FD_CLOEXEC);
 
-    pa_info_array = (void*) (((char*) pa_workspace.data) + PA_INFO_START);
-
     pa = pa_workspace.data;
     memset(pa, 0, PA_SIZE);
     pa->magic = PROP_AREA_MAGIC;
     pa->version = PROP_AREA_VERSION;
 
+    pa_index = (void*) (((char*) pa_workspace.data) + PA_INDEX_START);
+    pa_index->magic = PROP_INDEX_MAGIC;
+    pa_index->version = PROP_INDEX_VERSION;
+    pa_index->buckets = PA_INDEX_BUCKETS;
+    pa->reserved[PA_RESERVED_INDEX] = PROP_INDEX_MAGIC;
+
         /* plug into the lib property services */
     __system_property_area__ = pa;
 
@@ -166,6 +169,114 @@ static void update_prop_info(prop_info *pi, const char *value, unsigned len)
     __futex_wake(&pi->serial, INT32_MAX);
 }
 
+static prop_info *find_property(const char *name)
+{
+    return prop_index_find(__system_property_area__, pa_index, name);
+}
+
+/* publish a new, fully written prop_info to lock-free readers */
+static void index_property(prop_info *pi)
+{
+    prop_area *pa = __system_property_area__;
+    unsigned mask = pa_index->buckets - 1;
+    unsigned n = prop_index_hash(pi->name) & mask;
+
+    while(pa_index->slot[n] != 0)
+        n = (n + 1) & mask;
+
+    android_atomic_write(((char*) pi) - ((char*) pa),
+                         (volatile int32_t*) &pa_index->slot[n]);
+    android_atomic_write(pa_index->count + 1,
+                         (volatile int32_t*) &pa_index->count);
+}
+
+/* between property_batch_begin() and property_batch_end(), the area
+** serial is bumped and its waiters woken only once, and triggers run
+** once per changed property, with its final value, at the end.
+*/
+static int batch_depth;
+static int batch_dirty;
+static const char **batch_names;
+static const char **batch_values;
+static int batch_count;
+static int batch_alloc;
+
+void property_batch_begin(void)
+{
+    batch_depth++;
+}
+
+void property_batch_end(void)
+{
+    prop_area *pa = __system_property_area__;
+    const char **names = batch_names;
+    const char **values = batch_values;
+    int count = batch_count;
+
+    if(--batch_depth > 0)
+        return;
+
+    if(batch_dirty) {
+        batch_dirty = 0;
+        pa->serial++;
+        __futex_wake(&pa->serial, INT32_MAX);
+    }
+
+        /* triggers may set properties again, start a fresh list */
+    batch_names = batch_values = 0;
+    batch_count = batch_alloc = 0;
+
+    if(count > 0)
+        properties_changed(names, values, count);
+    free(names);
+    free(values);
+}
+
+static void area_changed(void)
+{
+    prop_area *pa = __system_property_area__;
+
+    if(batch_depth) {
+        batch_dirty = 1;
+        return;
+    }
+    pa->serial++;
+    __futex_wake(&pa->serial, INT32_MAX);
+}
+
+/* the name and value of a prop_info stay put, so a batch only needs to
+** remember which properties changed */
+static void note_changed(prop_info *pi)
+{
+    int n;
+
+    if(!batch_depth) {
+        property_changed(pi->name, pi->value);
+        return;
+    }
+
+    for(n = 0; n < batch_count; n++) {
+        if(batch_names[n] == pi->name)
+            return;
+    }
+    if(batch_count == batch_alloc) {
+        int alloc = batch_alloc ? batch_alloc * 2 : 32;
+        const char **names = realloc(batch_names, alloc * sizeof(char*));
+        const char **values = names ? realloc(batch_values, alloc * sizeof(char*)) : 0;
+        if(names) batch_names = names;
+        if(values) batch_values = values;
+        if(values == 0) {
+                /* run its triggers right away instead */
+            property_changed(pi->name, pi->value);
+            return;
+        }
+        batch_alloc = alloc;
+    }
+    batch_names[batch_count] = pi->name;
+    batch_values[batch_count] = pi->value;
+    batch_count++;
+}
+
 static int property_write(prop_info *pi, const char *value)
 {
     int valuelen = strlen(value);
@@ -228,7 +339,7 @@ const char* property_get(const char *name)
 
     if(strlen(name) >= PROP_NAME_MAX) return 0;
 
-    pi = (prop_info*) __system_property_find(name);
+    pi = find_property(name);
 
     if(pi != 0) {
         return pi->value;
@@ -237,26 +348,230 @@ const char* property_get(const char *name)
     }
 }
 
+/* persistent properties live in a single append-only log: a header,
+** then one record per persist.* change. a record is a persist_record
+** followed by the name and the value, without terminators, and is
+** checksummed so that a write torn by a power loss is dropped at the
+** next boot, along with anything after it. the last record of a name
+** wins. changes are fsync'ed together, PERSIST_SYNC_DELAY ms after the
+** first one, and the log is rewritten with only the current values of the
+** properties it holds once it grows to more than twice their size.
+*/
+#define PERSISTENT_PROPERTY_LOG   PERSISTENT_PROPERTY_DIR "/persistent_properties"
+#define PERSISTENT_PROPERTY_TEMP  PERSISTENT_PROPERTY_DIR "/.temp"
+
+#define PERSIST_LOG_MAGIC    0x474c5050   /* "PPLG" */
+#define PERSIST_LOG_VERSION  1
+#define PERSIST_SYNC_DELAY   500
+#define PERSIST_COMPACT_MIN  (16 * 1024)
+
+typedef struct {
+    unsigned magic;
+    unsigned version;
+} persist_header;
+
+typedef struct {
+    unsigned short namelen;
+    unsigned short valuelen;
+    unsigned crc;
+} persist_record;
+
+static int persist_fd = -1;
+static unsigned persist_size;       /* bytes in the log */
+static unsigned persist_live;       /* bytes of the log once compacted */
+static long long persist_sync_at;   /* when to fsync, 0 if clean */
+
+/* one bit per property, in order of creation, set for the persist.*
+** properties that came from the log or were set at runtime. only those
+** go into a compacted log: defaults from the build files must keep
+** following the build. */
+static unsigned char persist_owned[(PA_COUNT_MAX + PA_OVERFLOW_MAX + 7) / 8];
+
+static unsigned persist_nth(const prop_info *pi)
+{
+    unsigned off = ((const char *) pi) - ((const char *) __system_property_area__);
+
+    if(off < PA_OVERFLOW_START)
+        return (off - PA_INFO_START) / sizeof(prop_info);
+    return PA_COUNT_MAX + (off - PA_OVERFLOW_START) / sizeof(prop_info);
+}
+
+static void persist_own(const prop_info *pi)
+{
+    unsigned n = persist_nth(pi);
+
+    persist_owned[n / 8] |= 1 << (n % 8);
+}
+
+static void persist_own_name(const char *name)
+{
+    prop_info *pi = find_property(name);
+
+    if(pi)
+        persist_own(pi);
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static unsigned crc32_update(unsigned crc, const void *data, unsigned len)
+{
+    const unsigned char *p = data;
+    int k;
+
+    while(len--) {
+        crc ^= *p++;
+        for(k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+static unsigned persist_crc(const persist_record *r, const char *name,
+                            const char *value)
+{
+    unsigned crc = ~0U;
+
+    crc = crc32_update(crc, r, offsetof(persist_record, crc));
+    crc = crc32_update(crc, name, r->namelen);
+    crc = crc32_update(crc, value, r->valuelen);
+    return ~crc;
+}
+
+/* encodes a record into buf, which must hold sizeof(persist_record)
+** + PROP_NAME_MAX + PROP_VALUE_MAX bytes, and returns its length */
+static unsigned persist_encode(char *buf, const char *name, const char *value)
+{
+    persist_record r;
+
+    r.namelen = strlen(name);
+    r.valuelen = strlen(value);
+    r.crc = persist_crc(&r, name, value);
+
+    memcpy(buf, &r, sizeof(r));
+    memcpy(buf + sizeof(r), name, r.namelen);
+    memcpy(buf + sizeof(r) + r.namelen, value, r.valuelen);
+    return sizeof(r) + r.namelen + r.valuelen;
+}
+
+/* writes the current value of the persist.* properties that belong in
+** the log into buf, if not 0, and returns its length. buf must hold persist_snapshot(0) bytes. */
+static unsigned persist_snapshot(char *buf)
+{
+    prop_area *pa = __system_property_area__;
+    char rec[sizeof(persist_record) + PROP_NAME_MAX + PROP_VALUE_MAX];
+    unsigned count = pa_index->count;
+    unsigned n, size = sizeof(persist_header);
+    persist_header hdr;
+
+    if(buf) {
+        hdr.magic = PERSIST_LOG_MAGIC;
+        hdr.version = PERSIST_LOG_VERSION;
+        memcpy(buf, &hdr, sizeof(hdr));
+    }
+
+    for(n = 0; n < count; n++) {
+        prop_info *pi = prop_index_nth(pa, n);
+        if(!(persist_owned[n / 8] & (1 << (n % 8))))
+            continue;
+        size += persist_encode(buf ? buf + size : rec, pi->name, pi->value);
+    }
+    return size;
+}
+
+/* rewrites the log with only the current values, replacing the old one
+** with a rename so that either of them is complete at any time */
+static int persist_compact(void)
+{
+    char *buf;
+    unsigned len;
+    int fd, dirfd;
+
+    len = persist_snapshot(0);
+    buf = malloc(len);
+    if(buf == 0)
+        return -1;
+    persist_snapshot(buf);
+
+    fd = open(PERSISTENT_PROPERTY_TEMP, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0600);
+    if(fd < 0) {
+        ERROR("Unable to create persistent property log %s errno: %d\n",
+              PERSISTENT_PROPERTY_TEMP, errno);
+        free(buf);
+        return -1;
+    }
+    if(write(fd, buf, len) != (int) len || fsync(fd) ||
+       rename(PERSISTENT_PROPERTY_TEMP, PERSISTENT_PROPERTY_LOG)) {
+        ERROR("Unable to write persistent property log errno: %d\n", errno);
+        close(fd);
+        unlink(PERSISTENT_PROPERTY_TEMP);
+        free(buf);
+        return -1;
+    }
+    free(buf);
+
+        /* make the rename itself durable */
+    dirfd = open(PERSISTENT_PROPERTY_DIR, O_RDONLY);
+    if(dirfd >= 0) {
+        fsync(dirfd);
+        close(dirfd);
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if(persist_fd >= 0)
+        close(persist_fd);
+    persist_fd = fd;
+    persist_size = persist_live = len;
+    persist_sync_at = 0;
+    return 0;
+}
+
 static void write_peristent_property(const char *name, const char *value)
 {
-    const char *tempPath = PERSISTENT_PROPERTY_DIR "/.temp";
-    char path[PATH_MAX];
-    int fd, length;
+    char buf[sizeof(persist_record) + PROP_NAME_MAX + PROP_VALUE_MAX];
+    unsigned len;
 
-    snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, name);
+    if(persist_fd < 0) {
+            /* no log yet, or /data was not ready when we booted */
+        persist_compact();
+        return;
+    }
 
-    fd = open(tempPath, O_WRONLY|O_CREAT|O_TRUNC, 0600);
-    if (fd < 0) {
-        ERROR("Unable to write persistent property to temp file %s errno: %d\n", tempPath, errno);
-        return;   
+    len = persist_encode(buf, name, value);
+    if(write(persist_fd, buf, len) != (int) len) {
+        ERROR("Unable to append persistent property %s errno: %d\n", name, errno);
+            /* a partial record would hide every later one */
+        persist_compact();
+        return;
     }
-    write(fd, value, strlen(value));
-    close(fd);
+    persist_size += len;
+    if(persist_sync_at == 0)
+        persist_sync_at = now_ms() + PERSIST_SYNC_DELAY;
+}
+
+int persistent_properties_sync(void)
+{
+    long long now;
 
-    if (rename(tempPath, path)) {
-        unlink(tempPath);
-        ERROR("Unable to rename persistent property file %s to %s\n", tempPath, path);
+    if(persist_sync_at == 0)
+        return -1;
+    now = now_ms();
+    if(now < persist_sync_at)
+        return persist_sync_at - now;
+
+    if(persist_size > PERSIST_COMPACT_MIN && persist_size > 2 * persist_live) {
+        if(persist_compact() == 0)
+            return -1;
     }
+    if(fsync(persist_fd))
+        ERROR("Unable to sync persistent property log errno: %d\n", errno);
+    persist_sync_at = 0;
+    return -1;
 }
 
 int property_set(const char *name, const char *value)
@@ -271,31 +586,31 @@ int property_set(const char *name, const char *value)
     if(valuelen >= PROP_VALUE_MAX) return -1;
     if(namelen < 1) return -1;
 
-    pi = (prop_info*) __system_property_find(name);
+    pi = find_property(name);
 
     if(pi != 0) {
         /* ro.* properties may NEVER be modified once set */
         if(!strncmp(name, "ro.", 3)) return -1;
 
-        pa = __system_property_area__;
         update_prop_info(pi, value, valuelen);
-        pa->serial++;
-        __futex_wake(&pa->serial, INT32_MAX);
+        area_changed();
     } else {
         pa = __system_property_area__;
-        if(pa->count == PA_COUNT_MAX) return -1;
+        if(pa_index->count == PA_COUNT_MAX + PA_OVERFLOW_MAX) return -1;
 
-        pi = pa_info_array + pa->count;
+        pi = prop_index_nth(pa, pa_index->count);
         pi->serial = (valuelen << 24);
         memcpy(pi->name, name, namelen + 1);
         memcpy(pi->value, value, valuelen + 1);
 
-        pa->toc[pa->count] =
-            (namelen << 24) | (((unsigned) pi) - ((unsigned) pa));
-
-        pa->count++;
-        pa->serial++;
-        __futex_wake(&pa->serial, INT32_MAX);
+            /* the first PA_COUNT_MAX are also visible to the libc lookup */
+        if(pa->count < PA_COUNT_MAX) {
+            pa->toc[pa->count] =
+                (namelen << 24) | (((unsigned) pi) - ((unsigned) pa));
+            pa->count++;
+        }
+        index_property(pi);
+        area_changed();
     }
     /* If name starts with "net." treat as a DNS property. */
     if (strncmp("net.", name, strlen("net.")) == 0)  {
@@ -314,9 +629,10 @@ int property_set(const char *name, const char *value)
          * Don't write properties to disk until after we have read all default properties
          * to prevent them from being overwritten by default values.
          */
+        persist_own(pi);
         write_peristent_property(name, value);
     }
-    property_changed(name, value);
+    note_changed(pi);
     return 0;
 }
 
@@ -328,19 +644,51 @@ static int property_list(void (*propfn)(const char *key, const char *value, void
     const prop_info *pi;
     unsigned n;
 
-    for(n = 0; (pi = __system_property_find_nth(n)); n++) {
+    for(n = 0; n < pa_index->count; n++) {
+        pi = prop_index_nth(__system_property_area__, n);
         __system_property_read(pi, name, value);
         propfn(name, value, cookie);
     }
     return 0;
 }
 
+static void handle_property_msg(prop_msg *msg, struct ucred *cr)
+{
+    switch(msg->cmd) {
+    case PROP_MSG_SETPROP:
+    case PROP_MSG_SETPROPS:
+        msg->name[PROP_NAME_MAX-1] = 0;
+        msg->value[PROP_VALUE_MAX-1] = 0;
+
+        if(memcmp(msg->name,"ctl.",4) == 0) {
+            if (check_control_perms(msg->value, cr->uid)) {
+                handle_control_message((char*) msg->name + 4, (char*) msg->value);
+            } else {
+                ERROR("sys_prop: Unable to %s service ctl [%s] uid: %d pid:%d\n",
+                        msg->name + 4, msg->value, cr->uid, cr->pid);
+            }
+        } else {
+            if (check_perms(msg->name, cr->uid)) {
+                property_set((char*) msg->name, (char*) msg->value);
+            } else {
+                ERROR("sys_prop: permission denied uid:%d  name:%s\n",
+                      cr->uid, msg->name);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
 void handle_property_set_fd(int fd)
 {
-    prop_msg msg;
+    static prop_msg msgs[PROP_BATCH_MAX];
+    struct timeval tv = { 2, 0 };
     int s;
     int r;
-    int res;
+    int n, count;
     struct ucred cr;
     struct sockaddr_un addr;
     socklen_t addr_size = sizeof(addr);
@@ -357,39 +705,31 @@ void handle_property_set_fd(int fd)
         return;
     }
 
-    r = recv(s, &msg, sizeof(msg), 0);
-    close(s);
+    r = recv(s, &msgs[0], sizeof(prop_msg), 0);
     if(r != sizeof(prop_msg)) {
+        close(s);
         ERROR("sys_prop: mis-match msg size recieved: %d expected: %d\n",
               r, sizeof(prop_msg));
         return;
     }
 
-    switch(msg.cmd) {
-    case PROP_MSG_SETPROP:
-        msg.name[PROP_NAME_MAX-1] = 0;
-        msg.value[PROP_VALUE_MAX-1] = 0;
-
-        if(memcmp(msg.name,"ctl.",4) == 0) {
-            if (check_control_perms(msg.value, cr.uid)) {
-                handle_control_message((char*) msg.name + 4, (char*) msg.value);
-            } else {
-                ERROR("sys_prop: Unable to %s service ctl [%s] uid: %d pid:%d\n",
-                        msg.name + 4, msg.value, cr.uid, cr.pid);
-            }
-        } else {
-            if (check_perms(msg.name, cr.uid)) {
-                property_set((char*) msg.name, (char*) msg.value);
-            } else {
-                ERROR("sys_prop: permission denied uid:%d  name:%s\n",
-                      cr.uid, msg.name);
-            }
+        /* the rest of a batch, until the client closes its end; don't
+        ** let a stuck client hold up init for long */
+    count = 1;
+    if(msgs[0].cmd == PROP_MSG_SETPROPS) {
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while(count < PROP_BATCH_MAX) {
+            r = recv(s, &msgs[count], sizeof(prop_msg), MSG_WAITALL);
+            if(r != sizeof(prop_msg)) break;
+            count++;
         }
-        break;
-
-    default:
-        break;
     }
+    close(s);
+
+    property_batch_begin();
+    for(n = 0; n < count; n++)
+        handle_property_msg(&msgs[n], &cr);
+    property_batch_end();
 }
 
 void get_property_workspace(int *fd, int *sz)
@@ -402,6 +742,7 @@ static void load_properties(char *data)
 {
     char *key, *value, *eol, *sol, *tmp;
 
+    property_batch_begin();
     sol = data;
     while((eol = strchr(sol, '\n'))) {
         key = sol;
@@ -423,6 +764,7 @@ static void load_properties(char *data)
 
         property_set(key, value);
     }
+    property_batch_end();
 }
 
 static void load_properties_from_file(const char *fn)
@@ -438,43 +780,142 @@ static void load_properties_from_file(const char *fn)
     }
 }
 
-static void load_persistent_properties()
+/* the pre-log layout, one file per property. only read when there is
+** no log yet, which is then created from it. */
+static void load_persistent_property_files(DIR *dir)
 {
-    DIR* dir = opendir(PERSISTENT_PROPERTY_DIR);
     struct dirent*  entry;
     char path[PATH_MAX];
     char value[PROP_VALUE_MAX];
     int fd, length;
 
-    if (dir) {
-        while ((entry = readdir(dir)) != NULL) {
-            if (strncmp("persist.", entry->d_name, strlen("persist.")))
-                continue;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist.")))
+            continue;
 #if HAVE_DIRENT_D_TYPE
-            if (entry->d_type != DT_REG)
-                continue;
+        if (entry->d_type != DT_REG)
+            continue;
 #endif
-            /* open the file and read the property value */
-            snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, entry->d_name);
-            fd = open(path, O_RDONLY);
-            if (fd >= 0) {
-                length = read(fd, value, sizeof(value) - 1);
-                if (length >= 0) {
-                    value[length] = 0;
-                    property_set(entry->d_name, value);
-                } else {
-                    ERROR("Unable to read persistent property file %s errno: %d\n", path, errno);
-                }
-                close(fd);
+        /* open the file and read the property value */
+        snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, entry->d_name);
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            length = read(fd, value, sizeof(value) - 1);
+            if (length >= 0) {
+                value[length] = 0;
+                property_set(entry->d_name, value);
+                persist_own_name(entry->d_name);
             } else {
-                ERROR("Unable to open persistent property file %s errno: %d\n", path, errno);
+                ERROR("Unable to read persistent property file %s errno: %d\n", path, errno);
             }
+            close(fd);
+        } else {
+            ERROR("Unable to open persistent property file %s errno: %d\n", path, errno);
+        }
+    }
+}
+
+static void remove_persistent_property_files(DIR *dir)
+{
+    struct dirent*  entry;
+    char path[PATH_MAX];
+
+    rewinddir(dir);
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp("persist.", entry->d_name, strlen("persist.")))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, entry->d_name);
+        unlink(path);
+    }
+}
+
+/* replays the log and returns the length of its valid part */
+static unsigned replay_persistent_log(const char *data, unsigned size)
+{
+    const persist_header *hdr = (const persist_header *) data;
+    char name[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+    unsigned off;
+
+    if(size < sizeof(*hdr) || hdr->magic != PERSIST_LOG_MAGIC ||
+       hdr->version != PERSIST_LOG_VERSION)
+        return 0;
+
+    off = sizeof(*hdr);
+    while(size - off >= sizeof(persist_record)) {
+        persist_record r;
+        const char *p = data + off + sizeof(r);
+
+        memcpy(&r, data + off, sizeof(r));
+        if(r.namelen >= PROP_NAME_MAX || r.valuelen >= PROP_VALUE_MAX ||
+           size - off - sizeof(r) < (unsigned) r.namelen + r.valuelen ||
+           r.crc != persist_crc(&r, p, p + r.namelen))
+            break;
+
+        memcpy(name, p, r.namelen);
+        name[r.namelen] = 0;
+        memcpy(value, p + r.namelen, r.valuelen);
+        value[r.valuelen] = 0;
+        if(strncmp("persist.", name, strlen("persist.")))
+            break;
+        property_set(name, value);
+        persist_own_name(name);
+
+        off += sizeof(r) + r.namelen + r.valuelen;
+    }
+    return off;
+}
+
+static void load_persistent_properties()
+{
+    struct stat st;
+    void *data;
+    unsigned valid;
+    DIR *dir;
+    int fd;
+
+    property_batch_begin();
+
+    fd = open(PERSISTENT_PROPERTY_LOG, O_RDWR|O_APPEND);
+    if(fd < 0) {
+        dir = opendir(PERSISTENT_PROPERTY_DIR);
+        if(dir) {
+            load_persistent_property_files(dir);
+            if(persist_compact() == 0)
+                remove_persistent_property_files(dir);
+            closedir(dir);
+        } else {
+            ERROR("Unable to open persistent property directory %s errno: %d\n", PERSISTENT_PROPERTY_DIR, errno);
         }
-        closedir(dir);
+        goto done;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    valid = 0;
+    if(fstat(fd, &st))
+        st.st_size = 0;
+    if(st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            valid = replay_persistent_log(data, st.st_size);
+            munmap(data, st.st_size);
+        }
+    }
+
+    persist_fd = fd;
+    persist_size = valid;
+    if(valid < (unsigned) st.st_size || valid == 0) {
+        if(valid < (unsigned) st.st_size)
+            ERROR("Dropping %u bytes of persistent property log\n",
+                  (unsigned) st.st_size - valid);
+            /* write the good part back before anything is appended */
+        persist_compact();
     } else {
-        ERROR("Unable to open persistent property directory %s errno: %d\n", PERSISTENT_PROPERTY_DIR, errno);
+        persist_live = persist_snapshot(0);
     }
-    
+
+done:
+    property_batch_end();
     persistent_properties_loaded = 1;
 }
 
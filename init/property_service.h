@@ -24,5 +24,8 @@ extern int start_property_service(void);
 void get_property_workspace(int *fd, int *sz);
 extern const char* property_get(const char *name);
 extern int property_set(const char *name, const char *value);
+extern void property_batch_begin(void);
+extern void property_batch_end(void);
+extern int persistent_properties_sync(void);
 
 #endif	/* _INIT_PROPERTY_H */
@@ -0,0 +1 @@
+include $(all-subdir-makefiles)
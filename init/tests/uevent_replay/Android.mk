@@ -0,0 +1,18 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	uevent_replay.c \
+	replay_init.c \
+	replay_vold.c \
+	../../../vold/misc.c
+
+LOCAL_C_INCLUDES := $(KERNEL_HEADERS)
+
+LOCAL_SHARED_LIBRARIES := libcutils
+
+LOCAL_MODULE:= uevent_replay
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UEVENT_REPLAY_H
+#define _UEVENT_REPLAY_H
+
+#include <stddef.h>
+
+/* counted by the allocation wrappers of both parsers */
+extern unsigned long replay_allocs;
+extern unsigned long replay_frees;
+
+void *replay_malloc(size_t size);
+void *replay_calloc(size_t count, size_t size);
+void *replay_realloc(void *ptr, size_t size);
+char *replay_strdup(const char *s);
+void replay_free(void *ptr);
+
+/* a parser source included after this header, and after every system
+** header it uses, has its allocations counted */
+#ifdef REPLAY_COUNT_ALLOCS
+#define malloc(n)       replay_malloc(n)
+#define calloc(n, s)    replay_calloc(n, s)
+#define realloc(p, n)   replay_realloc(p, n)
+#define strdup(s)       replay_strdup(s)
+#define free(p)         replay_free(p)
+#endif
+
+/* init's device manager, creating nodes under root instead of /dev */
+void replay_init_setup(const char *root);
+void replay_init_event(int fd);
+
+/* vold's uevent listener, with its block layer kept in memory */
+void replay_vold_event(int fd);
+
+#endif
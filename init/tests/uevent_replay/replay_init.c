@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* init's devices.c, built with its node creation redirected to a
+** scratch tree and its allocations counted. firmware requests are
+** parsed but never forked for.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/poll.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <private/android_filesystem_config.h>
+#include <asm/page.h>
+
+static char scratch_root[PATH_MAX];
+
+static const char *scratch_path(const char *path, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s%s", scratch_root, path);
+    return buf;
+}
+
+static int replay_mkdir(const char *path, mode_t mode)
+{
+    char buf[PATH_MAX];
+    return mkdir(scratch_path(path, buf, sizeof(buf)), mode);
+}
+
+static int replay_mknod(const char *path, mode_t mode, dev_t dev)
+{
+    char buf[PATH_MAX];
+    int fd;
+
+    scratch_path(path, buf, sizeof(buf));
+    if (mknod(buf, mode, dev) == 0 || errno != EPERM)
+        return 0;
+
+        /* not root: leave a plain file in its place */
+    fd = open(buf, O_WRONLY | O_CREAT, mode & 07777);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+static int replay_chown(const char *path, uid_t uid, gid_t gid)
+{
+    char buf[PATH_MAX];
+    chown(scratch_path(path, buf, sizeof(buf)), uid, gid);
+    return 0;
+}
+
+static int replay_unlink(const char *path)
+{
+    char buf[PATH_MAX];
+    return unlink(scratch_path(path, buf, sizeof(buf)));
+}
+
+#define REPLAY_COUNT_ALLOCS
+#include "replay.h"
+
+#define mkdir(p, m)         replay_mkdir(p, m)
+#define mknod(p, m, d)      replay_mknod(p, m, d)
+#define chown(p, u, g)      replay_chown(p, u, g)
+#define unlink(p)           replay_unlink(p)
+#define fork()              (-1)
+
+#include "../../devices.c"
+
+void log_write(int level, const char *fmt, ...)
+{
+}
+
+void list_add_tail(struct listnode *head, struct listnode *item)
+{
+    item->next = head;
+    item->prev = head->prev;
+    head->prev->next = item;
+    head->prev = item;
+}
+
+void replay_init_setup(const char *root)
+{
+    strncpy(scratch_root, root, sizeof(scratch_root) - 1);
+    mkdir("/dev", 0755);
+}
+
+void replay_init_event(int fd)
+{
+    handle_device_fd(fd);
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* vold's uevent.c and media.c, built with their allocations counted.
+** the block devices are only tracked in memory, the volume manager
+** accepts every disk and lets every ejected device go right away, so
+** that no replayed event ever touches a real device.
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define REPLAY_COUNT_ALLOCS
+#include "replay.h"
+
+#include "../../../vold/uevent.c"
+#include "../../../vold/media.c"
+
+static blkdev_list_t *blkdevs;
+
+blkdev_t *blkdev_create(blkdev_t *disk, char *devpath, int major, int minor,
+                        struct media *media, char *type)
+{
+    blkdev_list_t *entry;
+    blkdev_t *blk;
+
+    if (!(blk = calloc(1, sizeof(blkdev_t))))
+        return NULL;
+    if (!(entry = malloc(sizeof(blkdev_list_t)))) {
+        free(blk);
+        return NULL;
+    }
+
+    blk->devpath = strdup(devpath);
+    blk->media = media;
+    blk->major = major;
+    blk->minor = minor;
+    blk->type = !strcmp(type, "disk") ? blkdev_disk : blkdev_partition;
+    blk->disk = disk ? disk : blk;
+
+    entry->dev = blk;
+    entry->next = blkdevs;
+    blkdevs = entry;
+    return blk;
+}
+
+blkdev_t *blkdev_lookup_by_devno(int maj, int min)
+{
+    blkdev_list_t *entry;
+
+    for (entry = blkdevs; entry; entry = entry->next) {
+        if (entry->dev->major == maj && entry->dev->minor == min)
+            return entry->dev;
+    }
+    return NULL;
+}
+
+void blkdev_destroy(blkdev_t *blk)
+{
+    blkdev_list_t **pe;
+
+    for (pe = &blkdevs; *pe; pe = &(*pe)->next) {
+        if ((*pe)->dev == blk) {
+            blkdev_list_t *entry = *pe;
+            *pe = entry->next;
+            free(entry);
+            break;
+        }
+    }
+    free(blk->devpath);
+    free(blk);
+}
+
+int blkdev_refresh(blkdev_t *blk)
+{
+    return 0;
+}
+
+int blkdev_get_num_pending_partitions(blkdev_t *blk)
+{
+    return 0;
+}
+
+int volmgr_consider_disk(blkdev_t *dev)
+{
+    return 0;
+}
+
+int volmgr_notify_eject(blkdev_t *dev, void (* cb) (blkdev_t *))
+{
+    cb(dev);
+    return 0;
+}
+
+int volmgr_enable_ums(boolean enable)
+{
+    return 0;
+}
+
+int volmgr_safe_mode(boolean enable)
+{
+    return 0;
+}
+
+void ums_hostconnected_set(boolean connected)
+{
+}
+
+int send_msg(char *message)
+{
+    return 0;
+}
+
+int send_msg_with_data(char *message, char *data)
+{
+    return 0;
+}
+
+void replay_vold_event(int fd)
+{
+    process_uevent_message(fd);
+}
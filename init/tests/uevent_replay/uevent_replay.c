@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* records NETLINK_KOBJECT_UEVENT streams and replays them, as fast as
+** they are handled, through the uevent parsers of init and vold.
+**
+**   uevent_replay record <file> [seconds]
+**   uevent_replay synth <file> <luns>
+**   uevent_replay replay <file> [init|vold|both] [repeat] [scratch dir]
+**
+** a recording is a header followed by one record per event, each made
+** of the time since the start of the recording in microseconds, the
+** length of the event and the event as the kernel sent it. "synth"
+** writes the events of a USB hub with <luns> disks of two partitions
+** plugged in and removed again, for storms without the hardware.
+**
+** for each parser, replay prints the events handled per second, the
+** allocations made per event and the median and 99th percentile time
+** from an event being queued on the socket to its handler returning.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+
+#include "replay.h"
+
+#define RECORD_MAGIC    0x52564555  /* "UEVR" */
+#define RECORD_VERSION  1
+#define EVENT_MAX       (64 * 1024)
+
+struct record_header {
+    unsigned magic;
+    unsigned version;
+};
+
+struct record {
+    unsigned usecs;
+    unsigned len;
+};
+
+unsigned long replay_allocs;
+unsigned long replay_frees;
+
+void *replay_malloc(size_t size)
+{
+    replay_allocs++;
+    return malloc(size);
+}
+
+void *replay_calloc(size_t count, size_t size)
+{
+    replay_allocs++;
+    return calloc(count, size);
+}
+
+void *replay_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        replay_allocs++;
+    return realloc(ptr, size);
+}
+
+char *replay_strdup(const char *s)
+{
+    replay_allocs++;
+    return strdup(s);
+}
+
+void replay_free(void *ptr)
+{
+    if (ptr)
+        replay_frees++;
+    free(ptr);
+}
+
+static void panic(const char *msg)
+{
+    fprintf(stderr, "uevent_replay: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int write_record(FILE *f, unsigned usecs, const char *data, unsigned len)
+{
+    struct record r;
+
+    r.usecs = usecs;
+    r.len = len;
+    if (fwrite(&r, sizeof(r), 1, f) != 1 || fwrite(data, len, 1, f) != 1)
+        return -1;
+    return 0;
+}
+
+static FILE *create_recording(const char *fn)
+{
+    struct record_header hdr;
+    FILE *f;
+
+    f = fopen(fn, "wb");
+    if (f == NULL)
+        panic("cannot create recording");
+    hdr.magic = RECORD_MAGIC;
+    hdr.version = RECORD_VERSION;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        panic("cannot write recording");
+    return f;
+}
+
+static volatile int stop;
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static int do_record(const char *fn, int seconds)
+{
+    struct sockaddr_nl addr;
+    int sz = 1024 * 1024;
+    char *buf;
+    long long start;
+    int s, n, count = 0;
+    FILE *f;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = getpid();
+    addr.nl_groups = 0xffffffff;
+
+    s = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+    if (s < 0)
+        panic("cannot open uevent socket");
+    setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz));
+    if (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        panic("cannot bind uevent socket");
+
+    buf = malloc(EVENT_MAX);
+    f = create_recording(fn);
+
+    signal(SIGINT, on_signal);
+    signal(SIGALRM, on_signal);
+    if (seconds > 0)
+        alarm(seconds);
+
+    fprintf(stderr, "recording to %s, interrupt to stop\n", fn);
+    start = now_ns();
+    while (!stop) {
+        n = recv(s, buf, EVENT_MAX, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            panic("cannot receive uevent");
+        }
+        if (write_record(f, (now_ns() - start) / 1000, buf, n) < 0)
+            panic("cannot write recording");
+        count++;
+    }
+
+    fclose(f);
+    fprintf(stderr, "recorded %d events\n", count);
+    return 0;
+}
+
+static void synth_event(FILE *f, int seq, const char *action,
+                        const char *path, const char *subsystem,
+                        const char *devtype, int major, int minor)
+{
+    char buf[1024];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%s@%s", action, path) + 1;
+    len += snprintf(buf + len, sizeof(buf) - len, "ACTION=%s", action) + 1;
+    len += snprintf(buf + len, sizeof(buf) - len, "DEVPATH=%s", path) + 1;
+    len += snprintf(buf + len, sizeof(buf) - len, "SUBSYSTEM=%s", subsystem) + 1;
+    if (devtype) {
+        len += snprintf(buf + len, sizeof(buf) - len, "MAJOR=%d", major) + 1;
+        len += snprintf(buf + len, sizeof(buf) - len, "MINOR=%d", minor) + 1;
+        len += snprintf(buf + len, sizeof(buf) - len, "DEVTYPE=%s", devtype) + 1;
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, "SEQNUM=%d", seq) + 1;
+
+    if (write_record(f, 0, buf, len) < 0)
+        panic("cannot write recording");
+}
+
+static int do_synth(const char *fn, int luns)
+{
+    static const char *actions[] = { "add", "remove" };
+    char scsi[256], disk[256], part[256];
+    int i, p, a, seq = 0;
+    FILE *f;
+
+    f = create_recording(fn);
+    for (a = 0; a < 2; a++) {
+        for (i = 0; i < luns; i++) {
+            snprintf(scsi, sizeof(scsi),
+                     "/devices/platform/musb_hdrc/usb1/1-1/1-1:1.0/host%d/target%d:0:0/%d:0:0:0",
+                     i, i, i);
+            snprintf(disk, sizeof(disk), "%s/block/sd%c%c", scsi,
+                     'a' + i / 26, 'a' + i % 26);
+            if (a == 0)
+                synth_event(f, seq++, actions[a], scsi, "scsi", NULL, 0, 0);
+            synth_event(f, seq++, actions[a], disk, "block", "disk", 8, i * 16);
+            for (p = 1; p <= 2; p++) {
+                snprintf(part, sizeof(part), "%s/sd%c%c%d", disk,
+                         'a' + i / 26, 'a' + i % 26, p);
+                synth_event(f, seq++, actions[a], part, "block", "partition",
+                            8, i * 16 + p);
+            }
+            if (a == 1)
+                synth_event(f, seq++, actions[a], scsi, "scsi", NULL, 0, 0);
+        }
+    }
+    fclose(f);
+    fprintf(stderr, "wrote %d events\n", seq);
+    return 0;
+}
+
+static char *load_recording(const char *fn, unsigned *size)
+{
+    struct record_header *hdr;
+    struct stat st;
+    char *data;
+    int fd;
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+        panic("cannot open recording");
+    data = malloc(st.st_size);
+    if (data == NULL || read(fd, data, st.st_size) != st.st_size)
+        panic("cannot read recording");
+    close(fd);
+
+    hdr = (struct record_header *) data;
+    if (st.st_size < (off_t) sizeof(*hdr) || hdr->magic != RECORD_MAGIC ||
+        hdr->version != RECORD_VERSION) {
+        fprintf(stderr, "uevent_replay: %s is not a recording\n", fn);
+        exit(1);
+    }
+    *size = st.st_size;
+    return data;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return (x > y) - (x < y);
+}
+
+static void replay(const char *name, void (*handle)(int fd), int nonblock,
+                   char *data, unsigned size, int repeat)
+{
+    struct record r;
+    long long *latencies;
+    long long start, total, t;
+    unsigned long allocs, frees;
+    unsigned off;
+    int sv[2], count, n, i;
+
+    count = 0;
+    for (off = sizeof(struct record_header); off + sizeof(r) <= size;
+         off += sizeof(r) + r.len) {
+        memcpy(&r, data + off, sizeof(r));
+        count++;
+    }
+    count *= repeat;
+    if (count == 0)
+        return;
+
+    latencies = malloc(count * sizeof(long long));
+    if (latencies == NULL)
+        panic("cannot allocate latencies");
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+        panic("cannot create socketpair");
+    if (nonblock)
+        fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    allocs = replay_allocs;
+    frees = replay_frees;
+    n = 0;
+    start = now_ns();
+    for (i = 0; i < repeat; i++) {
+        for (off = sizeof(struct record_header); off + sizeof(r) <= size;
+             off += sizeof(r) + r.len) {
+            memcpy(&r, data + off, sizeof(r));
+            if (off + sizeof(r) + r.len > size)
+                break;
+            t = now_ns();
+            if (send(sv[1], data + off + sizeof(r), r.len, 0) != (int) r.len)
+                panic("cannot queue event");
+            handle(sv[0]);
+            latencies[n++] = now_ns() - t;
+        }
+    }
+    total = now_ns() - start;
+
+    close(sv[0]);
+    close(sv[1]);
+
+    qsort(latencies, n, sizeof(long long), compare_ll);
+    printf("%s: %d events in %lld us, %lld events/s, %.2f allocs/event "
+           "(%ld not freed), p50 %lld ns, p99 %lld ns\n",
+           name, n, total / 1000, n * 1000000000LL / (total ? total : 1),
+           (double) (replay_allocs - allocs) / n,
+           (long) ((replay_allocs - allocs) - (replay_frees - frees)),
+           latencies[n / 2], latencies[n * 99 / 100]);
+    free(latencies);
+}
+
+static int do_replay(const char *fn, const char *which, int repeat,
+                     const char *scratch)
+{
+    unsigned size;
+    char *data;
+
+    data = load_recording(fn, &size);
+
+    if (strcmp(which, "vold")) {
+        if (mkdir(scratch, 0755) < 0 && errno != EEXIST)
+            panic("cannot create scratch directory");
+        replay_init_setup(scratch);
+        replay("init", replay_init_event, 1, data, size, repeat);
+    }
+    if (strcmp(which, "init"))
+        replay("vold", replay_vold_event, 0, data, size, repeat);
+
+    free(data);
+    return 0;
+}
+
+static int usage(void)
+{
+    fprintf(stderr, "usage: uevent_replay record <file> [seconds]\n"
+                    "       uevent_replay synth <file> <luns>\n"
+                    "       uevent_replay replay <file> [init|vold|both] "
+                    "[repeat] [scratch dir]\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+        return usage();
+
+    if (!strcmp(argv[1], "record"))
+        return do_record(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+    if (!strcmp(argv[1], "synth") && argc > 3)
+        return do_synth(argv[2], atoi(argv[3]));
+    if (!strcmp(argv[1], "replay"))
+        return do_replay(argv[2], argc > 3 ? argv[3] : "both",
+                         argc > 4 ? atoi(argv[4]) : 1,
+                         argc > 5 ? argv[5] : "/data/local/tmp/uevent_replay");
+    return usage();
+}
@@ -19,6 +19,7 @@ include $(CLEAR_VARS)
 commonSources := \
 	array.c \
 	hashmap.c \
+	hashmap2.c \
 	atomic.c \
         native_handle.c \
 	buffer.c \
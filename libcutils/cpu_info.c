@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 // we cache the serial number here.
 // this is also used as a fgets() line buffer when we are reading /proc/cpuinfo
@@ -81,3 +84,40 @@ extern const char* get_cpu_serial_number(void)
 
     return (serial_number[0] ? serial_number : NULL);
 }
+
+// the features are looked up once, racing threads find the same ones
+static uint32_t cpu_features = 0;
+static int cpu_features_known = 0;
+
+extern uint32_t get_cpu_features(void)
+{
+    if (!cpu_features_known)
+    {
+        uint32_t features = 0;
+#if defined(__i386__) || defined(__x86_64__)
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2))
+            features |= CPU_FEATURE_SSE2;
+#elif defined(__arm__)
+        // look for something like "Features        : swp half thumb neon"
+        char line[256];
+        FILE* file = fopen("/proc/cpuinfo", "r");
+        if (file)
+        {
+            while (fgets(line, sizeof(line), file) != NULL)
+            {
+                if (strncmp(line, "Features", 8) != 0)
+                    continue;
+                if (strstr(line, " neon"))
+                    features |= CPU_FEATURE_NEON;
+                break;
+            }
+            fclose(file);
+        }
+#endif
+        cpu_features = features;
+        cpu_features_known = 1;
+    }
+
+    return cpu_features;
+}
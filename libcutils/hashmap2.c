@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2007 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap2.h>
+#include <assert.h>
+#include <errno.h>
+#include <cutils/threads.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * The map is split into STRIPE_COUNT stripes, picked by the top bits of
+ * the hash. Each stripe is a linearly probed table of slots that hold the
+ * hash, key and value inline, so a lookup usually touches one cache line
+ * and never allocates, and has its own lock, so threads working on
+ * different keys rarely contend.
+ *
+ * When a stripe grows, its old table is kept and moved over a few slots
+ * at a time by the following writes, instead of all at once by the write
+ * that crossed the load factor. A key is only ever in one of the two.
+ */
+
+#define STRIPE_BITS 4
+#define STRIPE_COUNT (1 << STRIPE_BITS)
+#define MIN_CAPACITY 8
+#define MIGRATE_STEP 8
+#define CACHE_LINE 64
+
+/** Key of a slot whose entry was removed. */
+static char deletedKey;
+#define DELETED ((void*) &deletedKey)
+
+typedef struct Slot {
+    int hash;
+    void* key;      // NULL if the slot was never used
+    void* value;
+} Slot;
+
+typedef struct Table {
+    Slot* slots;
+    size_t capacity;    // power of 2, or 0
+    size_t used;        // live and deleted slots
+} Table;
+
+typedef struct StripeData {
+    mutex_t lock;
+    Table table;
+    Table old;          // being moved to table, if old.slots != NULL
+    size_t migrated;    // slots of old already moved
+    size_t size;
+} StripeData;
+
+/** Keeps the locks of different stripes on different cache lines. */
+typedef union Stripe {
+    StripeData s;
+    char pad[(sizeof(StripeData) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE];
+} Stripe;
+
+struct Hashmap2 {
+    Stripe stripes[STRIPE_COUNT];
+    size_t initialCapacity;     // per stripe
+    int (*hash)(void* key);
+    bool (*equals)(void* keyA, void* keyB);
+};
+
+Hashmap2* hashmap2Create(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    assert(hash != NULL);
+    assert(equals != NULL);
+
+    Hashmap2* map = calloc(1, sizeof(Hashmap2));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    // 0.75 load factor, spread over the stripes. Tables are allocated on
+    // first use.
+    size_t minimumCapacity = (initialCapacity / STRIPE_COUNT + 1) * 4 / 3;
+    map->initialCapacity = MIN_CAPACITY;
+    while (map->initialCapacity <= minimumCapacity) {
+        map->initialCapacity <<= 1;
+    }
+
+    map->hash = hash;
+    map->equals = equals;
+
+    int i;
+    for (i = 0; i < STRIPE_COUNT; i++) {
+        mutex_init(&map->stripes[i].s.lock);
+    }
+    return map;
+}
+
+void hashmap2Free(Hashmap2* map) {
+    int i;
+    for (i = 0; i < STRIPE_COUNT; i++) {
+        StripeData* stripe = &map->stripes[i].s;
+        free(stripe->table.slots);
+        free(stripe->old.slots);
+        mutex_destroy(&stripe->lock);
+    }
+    free(map);
+}
+
+/**
+ * Hashes the given key, with the same secondary hash as Hashmap.
+ */
+static inline int hashKey(Hashmap2* map, void* key) {
+    int h = map->hash(key);
+
+    h += ~(h << 9);
+    h ^= (((unsigned int) h) >> 14);
+    h += (h << 4);
+    h ^= (((unsigned int) h) >> 10);
+
+    return h;
+}
+
+static inline StripeData* stripeFor(Hashmap2* map, int hash) {
+    return &map->stripes[((unsigned int) hash) >> (32 - STRIPE_BITS)].s;
+}
+
+/**
+ * Returns the slot holding key, or NULL.
+ */
+static Slot* findInTable(Table* table, void* key, int hash,
+        bool (*equals)(void*, void*)) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    size_t mask = table->capacity - 1;
+    size_t index = ((size_t) hash) & mask;
+    while (true) {
+        Slot* slot = &table->slots[index];
+        if (slot->key == NULL) {
+            return NULL;
+        }
+        if (slot->hash == hash && slot->key != DELETED
+                && (slot->key == key || equals(slot->key, key))) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static Slot* find(Hashmap2* map, StripeData* stripe, void* key, int hash) {
+    Slot* slot = findInTable(&stripe->table, key, hash, map->equals);
+    if (slot == NULL && stripe->old.slots != NULL) {
+        slot = findInTable(&stripe->old, key, hash, map->equals);
+    }
+    return slot;
+}
+
+/**
+ * Takes a free slot for a key that is known not to be in the table,
+ * which must have room for it.
+ */
+static Slot* insertInTable(Table* table, void* key, int hash, void* value) {
+    size_t mask = table->capacity - 1;
+    size_t index = ((size_t) hash) & mask;
+    while (table->slots[index].key != NULL) {
+        index = (index + 1) & mask;
+    }
+    Slot* slot = &table->slots[index];
+    slot->hash = hash;
+    slot->key = key;
+    slot->value = value;
+    table->used++;
+    return slot;
+}
+
+/**
+ * Moves up to count slots of the old table over.
+ */
+static void migrate(StripeData* stripe, size_t count) {
+    Table* old = &stripe->old;
+    if (old->slots == NULL) {
+        return;
+    }
+    while (count > 0 && stripe->migrated < old->capacity) {
+        Slot* slot = &old->slots[stripe->migrated++];
+        if (slot->key != NULL && slot->key != DELETED) {
+            insertInTable(&stripe->table, slot->key, slot->hash, slot->value);
+            slot->key = DELETED;
+            count--;
+        }
+    }
+    if (stripe->migrated == old->capacity) {
+        free(old->slots);
+        old->slots = NULL;
+        old->capacity = 0;
+        old->used = 0;
+    }
+}
+
+/**
+ * Makes room for one more entry. Returns false if memory allocation fails.
+ */
+static bool ensureCapacity(Hashmap2* map, StripeData* stripe) {
+    Table* table = &stripe->table;
+    if (table->capacity != 0 && table->used + 1 <= table->capacity * 3 / 4) {
+        return true;
+    }
+
+    // A resize still in progress is finished first.
+    migrate(stripe, (size_t) -1);
+
+    // Sized for the live entries only, which also drops deleted slots:
+    // a 0.5 load factor once everything is moved over.
+    size_t capacity = map->initialCapacity;
+    while (capacity < (stripe->size + 1) * 2) {
+        capacity <<= 1;
+    }
+    Slot* slots = calloc(capacity, sizeof(Slot));
+    if (slots == NULL) {
+        return false;
+    }
+
+    stripe->old = *table;
+    stripe->migrated = 0;
+    table->slots = slots;
+    table->capacity = capacity;
+    table->used = 0;
+    return true;
+}
+
+static void removeSlot(StripeData* stripe, Slot* slot) {
+    slot->key = DELETED;
+    slot->value = NULL;
+    stripe->size--;
+}
+
+void* hashmap2Put(Hashmap2* map, void* key, void* value) {
+    int hash = hashKey(map, key);
+    StripeData* stripe = stripeFor(map, hash);
+
+    mutex_lock(&stripe->lock);
+    migrate(stripe, MIGRATE_STEP);
+
+    // Replace existing entry.
+    Slot* slot = find(map, stripe, key, hash);
+    if (slot != NULL) {
+        void* oldValue = slot->value;
+        slot->value = value;
+        mutex_unlock(&stripe->lock);
+        return oldValue;
+    }
+
+    // Add a new entry.
+    if (!ensureCapacity(map, stripe)) {
+        mutex_unlock(&stripe->lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+    insertInTable(&stripe->table, key, hash, value);
+    stripe->size++;
+    mutex_unlock(&stripe->lock);
+    return NULL;
+}
+
+void* hashmap2Get(Hashmap2* map, void* key) {
+    int hash = hashKey(map, key);
+    StripeData* stripe = stripeFor(map, hash);
+
+    mutex_lock(&stripe->lock);
+    Slot* slot = find(map, stripe, key, hash);
+    void* value = slot != NULL ? slot->value : NULL;
+    mutex_unlock(&stripe->lock);
+    return value;
+}
+
+bool hashmap2ContainsKey(Hashmap2* map, void* key) {
+    int hash = hashKey(map, key);
+    StripeData* stripe = stripeFor(map, hash);
+
+    mutex_lock(&stripe->lock);
+    bool found = find(map, stripe, key, hash) != NULL;
+    mutex_unlock(&stripe->lock);
+    return found;
+}
+
+void* hashmap2Memoize(Hashmap2* map, void* key,
+        void* (*initialValue)(void* key, void* context), void* context) {
+    int hash = hashKey(map, key);
+    StripeData* stripe = stripeFor(map, hash);
+    void* value;
+
+    mutex_lock(&stripe->lock);
+    migrate(stripe, MIGRATE_STEP);
+
+    // Return existing value.
+    Slot* slot = find(map, stripe, key, hash);
+    if (slot != NULL) {
+        value = slot->value;
+        mutex_unlock(&stripe->lock);
+        return value;
+    }
+
+    // Add a new entry.
+    if (!ensureCapacity(map, stripe)) {
+        mutex_unlock(&stripe->lock);
+        errno = ENOMEM;
+        return NULL;
+    }
+    value = initialValue(key, context);
+    insertInTable(&stripe->table, key, hash, value);
+    stripe->size++;
+    mutex_unlock(&stripe->lock);
+    return value;
+}
+
+void* hashmap2Remove(Hashmap2* map, void* key) {
+    int hash = hashKey(map, key);
+    StripeData* stripe = stripeFor(map, hash);
+    void* value = NULL;
+
+    mutex_lock(&stripe->lock);
+    migrate(stripe, MIGRATE_STEP);
+    Slot* slot = find(map, stripe, key, hash);
+    if (slot != NULL) {
+        value = slot->value;
+        removeSlot(stripe, slot);
+    }
+    mutex_unlock(&stripe->lock);
+    return value;
+}
+
+size_t hashmap2Size(Hashmap2* map) {
+    size_t size = 0;
+    int i;
+    for (i = 0; i < STRIPE_COUNT; i++) {
+        size += map->stripes[i].s.size;
+    }
+    return size;
+}
+
+static bool forEachInTable(Table* table,
+        bool (*callback)(void* key, void* value, void* context),
+        void* context) {
+    size_t i;
+    for (i = 0; i < table->capacity; i++) {
+        Slot* slot = &table->slots[i];
+        if (slot->key != NULL && slot->key != DELETED) {
+            if (!callback(slot->key, slot->value, context)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void hashmap2ForEach(Hashmap2* map,
+        bool (*callback)(void* key, void* value, void* context),
+        void* context) {
+    int i;
+    for (i = 0; i < STRIPE_COUNT; i++) {
+        StripeData* stripe = &map->stripes[i].s;
+
+        mutex_lock(&stripe->lock);
+        bool more = forEachInTable(&stripe->table, callback, context)
+                && forEachInTable(&stripe->old, callback, context);
+        mutex_unlock(&stripe->lock);
+        if (!more) {
+            return;
+        }
+    }
+}
+
+size_t hashmap2CurrentCapacity(Hashmap2* map) {
+    size_t capacity = 0;
+    int i;
+    for (i = 0; i < STRIPE_COUNT; i++) {
+        StripeData* stripe = &map->stripes[i].s;
+
+        mutex_lock(&stripe->lock);
+        capacity += stripe->table.capacity * 3 / 4;
+        mutex_unlock(&stripe->lock);
+    }
+    return capacity;
+}
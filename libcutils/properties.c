@@ -28,11 +28,14 @@
 
 #ifdef HAVE_LIBC_SYSTEM_PROPERTIES
 
-#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
-#include <sys/_system_properties.h>
+#include <private/property_index.h>
 
-static int send_prop_msg(prop_msg *msg)
+extern prop_area *__system_property_area__;
+
+static int send_prop_msgs(prop_msg *msgs, int count)
 {
+    const char *p = (const char*) msgs;
+    int len = count * sizeof(prop_msg);
     int s;
     int r;
     
@@ -41,19 +44,23 @@ static int send_prop_msg(prop_msg *msg)
                             SOCK_STREAM);
     if(s < 0) return -1;
     
-    while((r = send(s, msg, sizeof(prop_msg), 0)) < 0) {
-        if((errno == EINTR) || (errno == EAGAIN)) continue;
-        break;
-    }
-
-    if(r == sizeof(prop_msg)) {
-        r = 0;
-    } else {
-        r = -1;
+    while(len > 0) {
+        r = send(s, p, len, 0);
+        if(r < 0) {
+            if((errno == EINTR) || (errno == EAGAIN)) continue;
+            break;
+        }
+        p += r;
+        len -= r;
     }
 
     close(s);
-    return r;
+    return (len == 0) ? 0 : -1;
+}
+
+static int send_prop_msg(prop_msg *msg)
+{
+    return send_prop_msgs(msg, 1);
 }
 
 int property_set(const char *key, const char *value)
@@ -74,11 +81,42 @@ int property_set(const char *key, const char *value)
     return send_prop_msg(&msg);
 }
 
+int property_set_batch(const char **keys, const char **values, int count)
+{
+    prop_msg msgs[PROPERTY_BATCH_MAX];
+    int n;
+
+    if(count <= 0 || count > PROPERTY_BATCH_MAX) return -1;
+
+    for(n = 0; n < count; n++) {
+        const char *value = values[n] ? values[n] : "";
+
+        if(keys[n] == 0) return -1;
+        if(strlen(keys[n]) >= PROP_NAME_MAX) return -1;
+        if(strlen(value) >= PROP_VALUE_MAX) return -1;
+
+        msgs[n].cmd = (n == 0) ? PROP_MSG_SETPROPS : PROP_MSG_SETPROP;
+        strcpy((char*) msgs[n].name, keys[n]);
+        strcpy((char*) msgs[n].value, value);
+    }
+
+    return send_prop_msgs(msgs, count);
+}
+
 int property_get(const char *key, char *value, const char *default_value)
 {
+    prop_area *pa = __system_property_area__;
+    prop_index *idx = prop_area_index(pa);
     int len;
 
-    len = __system_property_get(key, value);
+    if(idx != 0) {
+            /* hashed lookup, the libc one scans the whole toc */
+        const prop_info *pi = prop_index_find(pa, idx, key);
+        char name[PROP_NAME_MAX];
+        len = pi ? __system_property_read(pi, name, value) : 0;
+    } else {
+        len = __system_property_get(key, value);
+    }
     if(len > 0) {
         return len;
     }
@@ -97,7 +135,19 @@ int property_list(void (*propfn)(const char *key, const char *value, void *cooki
     char value[PROP_VALUE_MAX];
     const prop_info *pi;
     unsigned n;
+    prop_area *pa = __system_property_area__;
+    prop_index *idx = prop_area_index(pa);
     
+    if(idx != 0) {
+            /* the libc only sees the first PA_COUNT_MAX */
+        for(n = 0; n < idx->count; n++) {
+            pi = prop_index_nth(pa, n);
+            __system_property_read(pi, name, value);
+            propfn(name, value, cookie);
+        }
+        return 0;
+    }
+
     for(n = 0; (pi = __system_property_find_nth(n)); n++) {
         __system_property_read(pi, name, value);
         propfn(name, value, cookie);
@@ -366,3 +416,17 @@ int property_list(void (*propfn)(const char *key, const char *value, void *cooki
 }
 
 #endif
+
+#ifndef HAVE_LIBC_SYSTEM_PROPERTIES
+int property_set_batch(const char **keys, const char **values, int count)
+{
+    int n;
+
+    if(count <= 0 || count > PROPERTY_BATCH_MAX) return -1;
+
+    for(n = 0; n < count; n++) {
+        if(property_set(keys[n], values[n]) < 0) return -1;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,216 @@
+/* a simple benchmark comparing Hashmap and Hashmap2.
+ *
+ * it first times single-threaded puts, gets of present and absent keys
+ * and removes of int keys, then has several threads hit a shared map
+ * with a mix of gets and updates, the way mq.c's peer tables are used:
+ * the Hashmap under hashmapLock(), Hashmap2 without any lock of its own.
+ *
+ * build it on the host, for example:
+ *   gcc -O2 -I../include -include ../include/arch/linux-x86/AndroidConfig.h \
+ *       test_hashmap.c hashmap.c hashmap2.c -lpthread -o test_hashmap
+ *
+ * usage: test_hashmap [keys] [threads] [ops per thread]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/hashmap.h>
+#include <cutils/hashmap2.h>
+
+static int         key_count = 100000;
+static int         thread_count = 4;
+static int         op_count = 1000000;
+static int*        keys;
+static int*        absent_keys;
+
+static long long
+now_ns( void )
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+check( int  ok, const char*  what )
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        exit(1);
+    }
+}
+
+/* the two maps behind one set of function pointers */
+typedef struct {
+    const char*  name;
+    void*        (*create)( void );
+    void         (*destroy)( void*  map );
+    void*        (*put)( void*  map, void*  key, void*  value );
+    void*        (*get)( void*  map, void*  key );
+    void*        (*remove)( void*  map, void*  key );
+    size_t       (*size)( void*  map );
+    int          locked;
+} MapOps;
+
+static void*  hm_create( void ) { return hashmapCreate(10, hashmapIntHash, hashmapIntEquals); }
+static void   hm_destroy( void*  m ) { hashmapFree(m); }
+static void*  hm_put( void*  m, void*  k, void*  v ) { return hashmapPut(m, k, v); }
+static void*  hm_get( void*  m, void*  k ) { return hashmapGet(m, k); }
+static void*  hm_remove( void*  m, void*  k ) { return hashmapRemove(m, k); }
+static size_t hm_size( void*  m ) { return hashmapSize(m); }
+
+static void*  hm2_create( void ) { return hashmap2Create(10, hashmapIntHash, hashmapIntEquals); }
+static void   hm2_destroy( void*  m ) { hashmap2Free(m); }
+static void*  hm2_put( void*  m, void*  k, void*  v ) { return hashmap2Put(m, k, v); }
+static void*  hm2_get( void*  m, void*  k ) { return hashmap2Get(m, k); }
+static void*  hm2_remove( void*  m, void*  k ) { return hashmap2Remove(m, k); }
+static size_t hm2_size( void*  m ) { return hashmap2Size(m); }
+
+static const MapOps  maps[] = {
+    { "Hashmap",  hm_create,  hm_destroy,  hm_put,  hm_get,  hm_remove,  hm_size,  1 },
+    { "Hashmap2", hm2_create, hm2_destroy, hm2_put, hm2_get, hm2_remove, hm2_size, 0 },
+};
+
+static void
+report( const char*  map, const char*  what, int  count, long long  ns )
+{
+    printf("%-9s %-16s %8.1f ns/op\n", map, what, (double)ns / count);
+}
+
+static void
+bench_single( const MapOps*  ops )
+{
+    void*      map = ops->create();
+    long long  start;
+    int        i;
+
+    check(map != NULL, "create");
+
+    start = now_ns();
+    for (i = 0; i < key_count; i++)
+        ops->put(map, &keys[i], &keys[i]);
+    report(ops->name, "put", key_count, now_ns() - start);
+    check(ops->size(map) == (size_t)key_count, "size after put");
+
+    start = now_ns();
+    for (i = 0; i < key_count; i++)
+        check(ops->get(map, &keys[i]) == &keys[i], "get");
+    report(ops->name, "get", key_count, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < key_count; i++)
+        check(ops->get(map, &absent_keys[i]) == NULL, "get absent");
+    report(ops->name, "get absent", key_count, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < key_count; i += 2)
+        check(ops->remove(map, &keys[i]) == &keys[i], "remove");
+    report(ops->name, "remove", key_count / 2, now_ns() - start);
+    for (i = 0; i < key_count; i++)
+        check(ops->get(map, &keys[i]) == ((i & 1) ? &keys[i] : NULL), "get after remove");
+    check(ops->size(map) == (size_t)(key_count / 2), "size after remove");
+
+    ops->destroy(map);
+}
+
+typedef struct {
+    const MapOps*  ops;
+    void*          map;
+    unsigned       seed;
+} Worker;
+
+/* 90% gets, 5% puts and 5% removes of random keys */
+static void*
+worker_thread( void*  arg )
+{
+    Worker*         w = arg;
+    const MapOps*   ops = w->ops;
+    unsigned        seed = w->seed;
+    int             i;
+
+    for (i = 0; i < op_count; i++) {
+        int*  key;
+        int   r;
+
+        seed = seed * 1103515245 + 12345;
+        r    = (seed >> 8) % 100;
+        key  = &keys[(seed >> 4) % key_count];
+
+        if (ops->locked)
+            hashmapLock(w->map);
+        if (r < 90)
+            ops->get(w->map, key);
+        else if (r < 95)
+            ops->put(w->map, key, key);
+        else
+            ops->remove(w->map, key);
+        if (ops->locked)
+            hashmapUnlock(w->map);
+    }
+    return NULL;
+}
+
+static void
+bench_threads( const MapOps*  ops, int  threads )
+{
+    pthread_t*  tids = calloc(threads, sizeof(pthread_t));
+    Worker*     workers = calloc(threads, sizeof(Worker));
+    void*       map = ops->create();
+    long long   start;
+    char        what[32];
+    int         i;
+
+    check(tids != NULL && workers != NULL && map != NULL, "allocate");
+    for (i = 0; i < key_count; i++)
+        ops->put(map, &keys[i], &keys[i]);
+
+    start = now_ns();
+    for (i = 0; i < threads; i++) {
+        workers[i].ops  = ops;
+        workers[i].map  = map;
+        workers[i].seed = i * 7919 + 1;
+        check(pthread_create(&tids[i], NULL, worker_thread, &workers[i]) == 0,
+              "pthread_create");
+    }
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    snprintf(what, sizeof(what), "mixed x%d", threads);
+    report(ops->name, what, op_count * threads, now_ns() - start);
+
+    ops->destroy(map);
+    free(workers);
+    free(tids);
+}
+
+int  main( int  argc, char**  argv )
+{
+    int  i, m;
+
+    if (argc > 1)
+        key_count = atoi(argv[1]);
+    if (argc > 2)
+        thread_count = atoi(argv[2]);
+    if (argc > 3)
+        op_count = atoi(argv[3]);
+
+    keys = calloc(key_count, sizeof(int));
+    absent_keys = calloc(key_count, sizeof(int));
+    check(keys != NULL && absent_keys != NULL, "allocate keys");
+    for (i = 0; i < key_count; i++) {
+        keys[i] = i * 2;
+        absent_keys[i] = i * 2 + 1;
+    }
+
+    for (m = 0; m < 2; m++)
+        bench_single(&maps[m]);
+    for (m = 0; m < 2; m++) {
+        bench_threads(&maps[m], 1);
+        if (thread_count > 1)
+            bench_threads(&maps[m], thread_count);
+    }
+    return 0;
+}
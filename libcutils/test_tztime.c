@@ -0,0 +1,153 @@
+/* a simple benchmark of localtime_tz and mktime_tz.
+ *
+ * it first checks a few conversions against the C library, then times
+ * single-threaded calls cycling through a number of zones, the way log
+ * formatting and calendar code call them once per record, then has
+ * several threads do the same at once.
+ *
+ * build it on the host, for example:
+ *   gcc -O2 -fwrapv -I../include -include ../include/arch/linux-x86/AndroidConfig.h \
+ *       test_tztime.c tztime.c -lpthread -o test_tztime
+ *
+ * usage: test_tztime [zones] [threads] [calls per thread]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cutils/tztime.h>
+
+static const char*  all_zones[] = {
+    "America/Los_Angeles", "America/New_York", "Europe/London",
+    "Europe/Paris", "Asia/Tokyo", "Australia/Sydney", "UTC",
+    "America/Sao_Paulo", "Asia/Kolkata", "Africa/Cairo",
+};
+#define  MAX_ZONES  (int)(sizeof(all_zones)/sizeof(all_zones[0]))
+
+static int          zone_count = 4;
+static int          thread_count = 4;
+static int          call_count = 1000000;
+
+static long long
+now_ns( void )
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+check( int  ok, const char*  what )
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        exit(1);
+    }
+}
+
+static void
+report( const char*  what, int  count, long long  ns )
+{
+    printf("%-20s %8.1f ns/call %10.0f calls/s\n", what,
+           (double)ns / count, count * 1e9 / ns);
+}
+
+/* compares with the C library, which reads the same zoneinfo files */
+static void
+check_zones( void )
+{
+    static const time_t  times[] = { 0, 1000000000, 1215000000, 1230000000, 2000000000 };
+    int  z, i;
+
+    for (z = 0; z < zone_count; z++) {
+        setenv("TZ", all_zones[z], 1);
+        tzset();
+        for (i = 0; i < (int)(sizeof(times)/sizeof(times[0])); i++) {
+            struct tm  mine, theirs;
+            time_t     t = times[i];
+
+            localtime_tz(&t, &mine, all_zones[z]);
+            localtime_r(&t, &theirs);
+            check(mine.tm_hour == theirs.tm_hour && mine.tm_mday == theirs.tm_mday &&
+                  mine.tm_isdst == theirs.tm_isdst, all_zones[z]);
+            check(mktime_tz(&mine, all_zones[z]) == t, "mktime_tz");
+        }
+    }
+}
+
+static void
+bench_single( void )
+{
+    struct tm  tm;
+    time_t     t = 1230000000;
+    long long  start;
+    int        i;
+
+    start = now_ns();
+    for (i = 0; i < call_count; i++, t += 61)
+        localtime_tz(&t, &tm, all_zones[i % zone_count]);
+    report("localtime_tz", call_count, now_ns() - start);
+
+    start = now_ns();
+    for (i = 0; i < call_count; i++) {
+        tm.tm_min++;
+        mktime_tz(&tm, all_zones[i % zone_count]);
+    }
+    report("mktime_tz", call_count, now_ns() - start);
+}
+
+static void*
+worker_thread( void*  arg )
+{
+    struct tm  tm;
+    time_t     t = 1230000000 + (long)arg * 3600;
+    int        i;
+
+    for (i = 0; i < call_count; i++, t += 61)
+        localtime_tz(&t, &tm, all_zones[(i + (long)arg) % zone_count]);
+    return NULL;
+}
+
+static void
+bench_threads( int  threads )
+{
+    pthread_t*  tids = calloc(threads, sizeof(pthread_t));
+    long long   start;
+    char        what[32];
+    long        i;
+
+    check(tids != NULL, "allocate");
+    start = now_ns();
+    for (i = 0; i < threads; i++)
+        check(pthread_create(&tids[i], NULL, worker_thread, (void*)i) == 0,
+              "pthread_create");
+    for (i = 0; i < threads; i++)
+        pthread_join(tids[i], NULL);
+
+    snprintf(what, sizeof(what), "localtime_tz x%d", threads);
+    report(what, call_count * threads, now_ns() - start);
+    free(tids);
+}
+
+int  main( int  argc, char**  argv )
+{
+    if (argc > 1)
+        zone_count = atoi(argv[1]);
+    if (argc > 2)
+        thread_count = atoi(argv[2]);
+    if (argc > 3)
+        call_count = atoi(argv[3]);
+    if (zone_count < 1)
+        zone_count = 1;
+    if (zone_count > MAX_ZONES)
+        zone_count = MAX_ZONES;
+
+    check_zones();
+    bench_single();
+    bench_threads(1);
+    if (thread_count > 1)
+        bench_threads(thread_count);
+    return 0;
+}
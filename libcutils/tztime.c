@@ -22,6 +22,9 @@ static char	elsieid[] = "@(#)localtime.c	8.3";
 #include "tzfile.h"
 #include "fcntl.h"
 #include "float.h"	/* for FLT_MAX and DBL_MAX */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cutils/threads.h>
 
 #ifndef TZ_ABBR_MAX_LEN
 #define TZ_ABBR_MAX_LEN	16
@@ -189,6 +192,10 @@ static int		tzload P((const char * name, struct state * sp,
 				int doextend));
 static int		tzload_uncached P((const char * name, struct state * sp,
 				int doextend));
+static int		tzload_data P((const char * buf, int nread,
+				struct state * sp, int doextend));
+static struct tzentry *	tzentry_acquire P((const char * name));
+static void		tzentry_release P((struct tzentry * e));
 static int		tzparse P((const char * name, struct state * sp,
 				int lastditch));
 
@@ -201,12 +208,34 @@ static struct state	gmtmem;
 #define gmtptr		(&gmtmem)
 #endif /* State Farm */
 
-#define CACHE_COUNT 4
-static char * g_cacheNames[CACHE_COUNT] = {0,0};
-static struct state	g_cacheStates[CACHE_COUNT];
-static int g_lastCache = 0;
-static struct state g_utc;
-unsigned char g_utcSet = 0;
+/*
+** Parsed zones are shared between threads. The cache holds a reference
+** to each entry it lists, most recently used first; localtime_tz and
+** mktime_tz borrow one more for the length of the call instead of
+** copying the whole state. An entry evicted while borrowed is freed by
+** whoever returns it last.
+*/
+struct tzentry {
+	struct tzentry *	next;
+	char *			name;
+	int			refs;
+	struct state		st;
+};
+
+#define CACHE_COUNT 16
+static mutex_t		g_cacheLock = MUTEX_INITIALIZER;
+static struct tzentry *	g_cache;
+
+/*
+** zoneinfo.idx and zoneinfo.dat are mapped once, on the first zone that
+** is not found as a file of its own, and stay mapped.
+*/
+static mutex_t		g_mapLock = MUTEX_INITIALIZER;
+static int		g_mapTried;
+static const char *	g_index;
+static size_t		g_indexSize;
+static const char *	g_data;
+static size_t		g_dataSize;
 
 
 #ifndef TZ_STRLEN_MAX
@@ -282,47 +311,188 @@ static int toint(unsigned char *s) {
     return (s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
 }
 
+static void
+tzentry_free(e)
+struct tzentry *	e;
+{
+	while (e != NULL) {
+		struct tzentry *	next = e->next;
+
+		free(e->name);
+		free(e);
+		e = next;
+	}
+}
+
+/*
+** Returns the cached entry for name with a reference taken, parsing the
+** zone first if needed, or NULL if it cannot be loaded.
+*/
+static struct tzentry *
+tzentry_acquire(name)
+const char *	name;
+{
+	register struct tzentry *	e;
+	register struct tzentry **	pp;
+	struct tzentry *		fresh;
+	struct tzentry *		dead;
+	int				n;
+
+	if (name == NULL)
+		name = TZDEFAULT;
+	mutex_lock(&g_cacheLock);
+	for (pp = &g_cache; (e = *pp) != NULL; pp = &e->next)
+		if (strcmp(e->name, name) == 0) {
+			*pp = e->next;
+			e->next = g_cache;
+			g_cache = e;
+			++e->refs;
+			mutex_unlock(&g_cacheLock);
+			return e;
+		}
+	mutex_unlock(&g_cacheLock);
+
+	/*
+	** Parse without the lock held, so that a slow load does not stall
+	** the threads using zones that are already cached.
+	*/
+	fresh = malloc(sizeof *fresh);
+	if (fresh == NULL)
+		return NULL;
+	fresh->next = NULL;
+	fresh->name = strdup(name);
+	if (fresh->name == NULL ||
+		tzload_uncached(name, &fresh->st, TRUE) != 0) {
+			tzentry_free(fresh);
+			return NULL;
+	}
+	fresh->refs = 2;	/* the cache's and the caller's */
+
+	mutex_lock(&g_cacheLock);
+	for (e = g_cache; e != NULL; e = e->next)
+		if (strcmp(e->name, name) == 0) {
+			/* another thread got there first */
+			++e->refs;
+			mutex_unlock(&g_cacheLock);
+			tzentry_free(fresh);
+			return e;
+		}
+	fresh->next = g_cache;
+	g_cache = fresh;
+	dead = NULL;
+	for (n = 0, pp = &g_cache; *pp != NULL && n < CACHE_COUNT; ++n)
+		pp = &(*pp)->next;
+	while ((e = *pp) != NULL) {
+		*pp = e->next;
+		if (--e->refs == 0) {
+			e->next = dead;
+			dead = e;
+		}
+	}
+	mutex_unlock(&g_cacheLock);
+	tzentry_free(dead);
+	return fresh;
+}
+
+static void
+tzentry_release(e)
+struct tzentry *	e;
+{
+	int	refs;
+
+	mutex_lock(&g_cacheLock);
+	refs = --e->refs;
+	mutex_unlock(&g_cacheLock);
+	if (refs == 0) {
+		e->next = NULL;
+		tzentry_free(e);
+	}
+}
+
+/*
+** For the callers that need a private copy. Cached states are extended
+** with the POSIX rule at the end of the file, and parsing that rule can
+** load TZDEFRULES without extension, which must not go through the cache
+** or it would recurse.
+*/
 static int
 tzload(const char *name, struct state * const sp, const int doextend)
 {
-    if (name) {
-        int i, err;
-        if (0 == strcmp(name, "UTC")) {
-            if (!g_utcSet) {
-                tzload_uncached(name, &g_utc, 1);
-                g_utcSet = 1;
-            }
-            //printf("tzload: utc\n");
-            *sp = g_utc;
-            return 0;
-        }
-        for (i=0; i<CACHE_COUNT; i++) {
-            if (g_cacheNames[i] && 0 == strcmp(name, g_cacheNames[i])) {
-                *sp = g_cacheStates[i];
-                //printf("tzload: hit: %s\n", name);
-                return 0;
-            }
-        }
-        //printf("tzload: miss: %s\n", name);
-        g_lastCache++;
-        if (g_lastCache >= CACHE_COUNT) {
-            g_lastCache = 0;
-        }
-        i = g_lastCache;
-        if (g_cacheNames[i]) {
-            free(g_cacheNames[i]);
-        }
-        err = tzload_uncached(name, &(g_cacheStates[i]), 1);
-        if (err == 0) {
-            g_cacheNames[i] = strdup(name);
-            *sp = g_cacheStates[i];
-            return 0;
-        } else {
-            g_cacheNames[i] = NULL;
-            return err;
-        }
-    }
-    return tzload_uncached(name, sp, doextend);
+	struct tzentry *	e;
+
+	if (!doextend)
+		return tzload_uncached(name, sp, doextend);
+	e = tzentry_acquire(name);
+	if (e == NULL)
+		return -1;
+	*sp = e->st;
+	tzentry_release(e);
+	return 0;
+}
+
+static const char *
+map_file(name, sizep)
+const char *	name;
+size_t *	sizep;
+{
+	struct stat	st;
+	void *		p;
+	int		fid;
+
+	if ((fid = open(name, OPEN_MODE)) == -1)
+		return NULL;
+	if (fstat(fid, &st) != 0 || st.st_size <= 0) {
+		close(fid);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fid, 0);
+	close(fid);
+	if (p == MAP_FAILED)
+		return NULL;
+	*sizep = st.st_size;
+	return p;
+}
+
+/*
+** Finds a zone in the bundled zoneinfo.dat through zoneinfo.idx, a list
+** of READLEN entries: a NUL-padded name then big-endian offset, length
+** and an unused field.
+*/
+static const char *
+find_bundled(name, lenp)
+const char *	name;
+int *		lenp;
+{
+	const char *	entry;
+	size_t		namelen = strlen(name);
+
+	if (namelen > NAMELEN)
+		return NULL;
+	mutex_lock(&g_mapLock);
+	if (!g_mapTried) {
+		g_index = map_file(INDEXFILE, &g_indexSize);
+		g_data = map_file(DATAFILE, &g_dataSize);
+		g_mapTried = TRUE;
+	}
+	mutex_unlock(&g_mapLock);
+	if (g_index == NULL || g_data == NULL)
+		return NULL;
+
+	for (entry = g_index; entry + READLEN <= g_index + g_indexSize;
+		entry += READLEN) {
+		unsigned int	off, len;
+
+		if (memcmp(entry, name, namelen) != 0 ||
+			(namelen < NAMELEN && entry[namelen] != '\0'))
+				continue;
+		off = toint((unsigned char *) entry + NAMELEN);
+		len = toint((unsigned char *) entry + NAMELEN + INTLEN);
+		if (off > g_dataSize || len > g_dataSize - off)
+			return NULL;
+		*lenp = len;
+		return g_data + off;
+	}
+	return NULL;
 }
 
 static int
@@ -332,17 +502,10 @@ register struct state * const	sp;
 register const int		doextend;
 {
 	register const char *		p;
-	register int			i;
-	register int			fid;
-	register int			stored;
-	register int			nread;
-	union {
-		struct tzhead	tzhead;
-		char		buf[2 * sizeof(struct tzhead) +
-					2 * sizeof *sp +
-					4 * TZ_MAX_TIMES];
-	} u;
-    int                     toread = sizeof u.buf;
+	const char *			buf;
+	size_t				size;
+	int				nread;
+	int				result;
 
 	if (name == NULL && (name = TZDEFAULT) == NULL)
 		return -1;
@@ -378,57 +541,49 @@ register const int		doextend;
 		}
 		if (doaccess && access(name, R_OK) != 0)
 			return -1;
-		if ((fid = open(name, OPEN_MODE)) == -1) {
-            char buf[READLEN];
-            char name[NAMELEN + 1];
-            int fidix = open(INDEXFILE, OPEN_MODE);
-            int off = -1;
-
-            if (fidix < 0) {
-                return -1;
-            }
-
-            while (read(fidix, buf, sizeof(buf)) == sizeof(buf)) {
-                memcpy(name, buf, NAMELEN);
-                name[NAMELEN] = '\0';
-
-                if (strcmp(name, origname) == 0) {
-                    off = toint((unsigned char *) buf + NAMELEN);
-                    toread = toint((unsigned char *) buf + NAMELEN + INTLEN);
-                    break;
-                }
-            }
-
-            close(fidix);
-
-            if (off < 0)
-                return -1;
-
-            fid = open(DATAFILE, OPEN_MODE);
-
-            if (fid < 0) {
-                return -1;
-            }
-
-            if (lseek(fid, off, SEEK_SET) < 0) {
-                return -1;
-            }
-        }
+		if ((buf = map_file(name, &size)) != NULL) {
+			nread = size > INT_MAX ? INT_MAX : (int) size;
+			result = tzload_data(buf, nread, sp, doextend);
+			munmap((void *) buf, size);
+			return result;
+		}
+		if ((buf = find_bundled(origname, &nread)) == NULL ||
+			nread <= 0)
+				return -1;
 	}
-	nread = read(fid, u.buf, toread);
-	if (close(fid) < 0 || nread <= 0)
-		return -1;
+	return tzload_data(buf, nread, sp, doextend);
+}
+
+/*
+** Parses a compiled zone from the nread bytes at buf, which are only
+** read: they may be a shared mapping.
+*/
+static int
+tzload_data(buf, nread, sp, doextend)
+register const char *		buf;
+register int			nread;
+register struct state * const	sp;
+register const int		doextend;
+{
+	register const char *		p;
+	register int			i;
+	register int			stored;
+	const struct tzhead *		tzhp;
+
 	for (stored = 4; stored <= 8; stored *= 2) {
 		int		ttisstdcnt;
 		int		ttisgmtcnt;
 
-		ttisstdcnt = (int) detzcode(u.tzhead.tzh_ttisstdcnt);
-		ttisgmtcnt = (int) detzcode(u.tzhead.tzh_ttisgmtcnt);
-		sp->leapcnt = (int) detzcode(u.tzhead.tzh_leapcnt);
-		sp->timecnt = (int) detzcode(u.tzhead.tzh_timecnt);
-		sp->typecnt = (int) detzcode(u.tzhead.tzh_typecnt);
-		sp->charcnt = (int) detzcode(u.tzhead.tzh_charcnt);
-		p = u.tzhead.tzh_charcnt + sizeof u.tzhead.tzh_charcnt;
+		if (nread < (int) sizeof *tzhp)
+			return -1;
+		tzhp = (const struct tzhead *) buf;
+		ttisstdcnt = (int) detzcode(tzhp->tzh_ttisstdcnt);
+		ttisgmtcnt = (int) detzcode(tzhp->tzh_ttisgmtcnt);
+		sp->leapcnt = (int) detzcode(tzhp->tzh_leapcnt);
+		sp->timecnt = (int) detzcode(tzhp->tzh_timecnt);
+		sp->typecnt = (int) detzcode(tzhp->tzh_typecnt);
+		sp->charcnt = (int) detzcode(tzhp->tzh_charcnt);
+		p = tzhp->tzh_charcnt + sizeof tzhp->tzh_charcnt;
 		if (sp->leapcnt < 0 || sp->leapcnt > TZ_MAX_LEAPS ||
 			sp->typecnt <= 0 || sp->typecnt > TZ_MAX_TYPES ||
 			sp->timecnt < 0 || sp->timecnt > TZ_MAX_TIMES ||
@@ -436,7 +591,7 @@ register const int		doextend;
 			(ttisstdcnt != sp->typecnt && ttisstdcnt != 0) ||
 			(ttisgmtcnt != sp->typecnt && ttisgmtcnt != 0))
 				return -1;
-		if (nread - (p - u.buf) <
+		if (nread - (p - buf) <
 			sp->timecnt * stored +		/* ats */
 			sp->timecnt +			/* types */
 			sp->typecnt * 6 +		/* ttinfos */
@@ -538,11 +693,10 @@ register const int		doextend;
 		/*
 		** If this is an old file, we're done.
 		*/
-		if (u.tzhead.tzh_version[0] == '\0')
+		if (tzhp->tzh_version[0] == '\0')
 			break;
-		nread -= p - u.buf;
-		for (i = 0; i < nread; ++i)
-			u.buf[i] = p[i];
+		nread -= p - buf;
+		buf = p;
 		/*
 		** If this is a narrow integer time_t system, we're done.
 		*/
@@ -550,13 +704,16 @@ register const int		doextend;
 			break;
 	}
 	if (doextend && nread > 2 &&
-		u.buf[0] == '\n' && u.buf[nread - 1] == '\n' &&
+		nread - 2 <= TZ_STRLEN_MAX &&
+		buf[0] == '\n' && buf[nread - 1] == '\n' &&
 		sp->typecnt + 2 <= TZ_MAX_TYPES) {
 			struct state	ts;
 			register int	result;
+			char		tzstr[TZ_STRLEN_MAX + 1];
 
-			u.buf[nread - 1] = '\0';
-			result = tzparse(&u.buf[1], &ts, FALSE);
+			(void) memcpy(tzstr, &buf[1], nread - 2);
+			tzstr[nread - 2] = '\0';
+			result = tzparse(tzstr, &ts, FALSE);
 			if (result == 0 && ts.typecnt == 2 &&
 				sp->charcnt + ts.charcnt <= TZ_MAX_CHARS) {
 					for (i = 0; i < 2; ++i)
@@ -586,12 +743,15 @@ register const int		doextend;
 	}
 	i = 2 * YEARSPERREPEAT;
 	sp->goback = sp->goahead = sp->timecnt > i;
-	sp->goback &= sp->types[i] == sp->types[0] &&
-		differ_by_repeat(sp->ats[i], sp->ats[0]);
-	sp->goahead &=
-		sp->types[sp->timecnt - 1] == sp->types[sp->timecnt - 1 - i] &&
-		differ_by_repeat(sp->ats[sp->timecnt - 1],
-			 sp->ats[sp->timecnt - 1 - i]);
+	if (sp->timecnt > i) {
+		sp->goback &= sp->types[i] == sp->types[0] &&
+			differ_by_repeat(sp->ats[i], sp->ats[0]);
+		sp->goahead &=
+			sp->types[sp->timecnt - 1] ==
+				sp->types[sp->timecnt - 1 - i] &&
+			differ_by_repeat(sp->ats[sp->timecnt - 1],
+				 sp->ats[sp->timecnt - 1 - i]);
+	}
 	return 0;
 }
 
@@ -1266,13 +1426,16 @@ const time_t * const	timep;
 void
 localtime_tz(const time_t * const timep, struct tm * tmp, const char* tz)
 {
-    struct state st;
-    if (tzload(tz, &st, TRUE) != 0) {
+    struct tzentry *e = tzentry_acquire(tz);
+    if (e != NULL) {
+        localsub(timep, 0L, tmp, &e->st);
+        tzentry_release(e);
+    } else {
         // not sure what's best here, but for now, we fall back to gmt
+        struct state st;
         gmtload(&st);
+        localsub(timep, 0L, tmp, &st);
     }
-
-	localsub(timep, 0L, tmp, &st);
 }
 
 /*
@@ -1906,10 +2069,16 @@ const struct state *	sp;
 time_t
 mktime_tz(struct tm * const	tmp, char const * tz)
 {
-    struct state st;
-    if (tzload(tz, &st, TRUE) != 0) {
+    struct tzentry *e = tzentry_acquire(tz);
+    time_t t;
+    if (e != NULL) {
+        t = time1(tmp, localsub, 0L, &e->st);
+        tzentry_release(e);
+    } else {
         // not sure what's best here, but for now, we fall back to gmt
+        struct state st;
         gmtload(&st);
+        t = time1(tmp, localsub, 0L, &st);
     }
-	return time1(tmp, localsub, 0L, &st);
+    return t;
 }
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <signal.h>
 
 #include <cutils/logger.h>
 #include <cutils/logd.h>
@@ -132,34 +133,418 @@ static int __write_to_log_init(log_id_t log_id, struct iovec *vec, size_t nr)
     return write_to_log(log_id, vec, nr);
 }
 
+/*
+ * Tags whose messages go to the radio log, looked up in a small open
+ * addressing table built on first use rather than with a strcmp per tag.
+ */
+static const char *radio_tags[] = {
+    "HTC_RIL", "RILJ", "RILB", "RILC", "RILD", "RIL",
+    "AT", "GSM", "STK", "CDMA", "PHONE", "SMS",
+};
+
+#define RADIO_TAG_SLOTS 32  /* a power of 2, over twice the tag count */
+
+static const char *radio_tag_table[RADIO_TAG_SLOTS];
+#ifdef HAVE_PTHREADS
+static pthread_once_t radio_tag_once = PTHREAD_ONCE_INIT;
+#else
+static int radio_tag_init_done;
+#endif
+
+/* FNV-1a, computed along with the length so the tag is scanned once */
+static unsigned int tag_hash(const char *tag, size_t *len)
+{
+    const char *p = tag;
+    unsigned int h = 2166136261u;
+
+    while (*p)
+        h = (h ^ (unsigned char)*p++) * 16777619u;
+    *len = p - tag;
+    return h;
+}
+
+static void radio_tag_init(void)
+{
+    size_t i, len;
+
+    for (i = 0; i < sizeof(radio_tags) / sizeof(radio_tags[0]); i++) {
+        unsigned int slot = tag_hash(radio_tags[i], &len);
+        while (radio_tag_table[slot % RADIO_TAG_SLOTS] != NULL)
+            slot++;
+        radio_tag_table[slot % RADIO_TAG_SLOTS] = radio_tags[i];
+    }
+}
+
+/* returns the log for tag, and its length */
+static log_id_t log_id_for_tag(const char *tag, size_t *len)
+{
+    unsigned int slot = tag_hash(tag, len);
+    const char *candidate;
+
+#ifdef HAVE_PTHREADS
+    pthread_once(&radio_tag_once, radio_tag_init);
+#else
+    if (!radio_tag_init_done) {
+        radio_tag_init();
+        radio_tag_init_done = 1;
+    }
+#endif
+    /* XXX: This needs to go! */
+    while ((candidate = radio_tag_table[slot % RADIO_TAG_SLOTS]) != NULL) {
+        if (!strcmp(candidate, tag))
+            return LOG_ID_RADIO;
+        slot++;
+    }
+    return LOG_ID_MAIN;
+}
+
+#ifdef HAVE_PTHREADS
+/*
+ * Buffered mode.
+ *
+ * Each thread that logs gets a buffer of pending entries, each stored as
+ * a BufferedEntry header followed by the payload the kernel expects:
+ * priority, tag and message, the last two NUL-terminated. A record with
+ * the same log, priority and tag as the entry before it is appended to
+ * that entry's message after a newline instead of making a new entry:
+ * the logger driver turns every writev into a single entry, and logcat
+ * prints each line of a multi-line message with its own prefix, so this
+ * is where the syscalls are saved.
+ *
+ * A buffer is written out when it is full, when a record at or above the
+ * flush priority comes in, when its thread exits, at exit() and fork(),
+ * and every flush period by a helper thread. Entries written by that
+ * thread carry its tid and the time of the write.
+ */
+typedef struct {
+    uint16_t len;       /* of the payload that follows */
+    uint8_t  log_id;
+    uint8_t  pad;
+} BufferedEntry;
+
+typedef struct LogBuffer {
+    struct LogBuffer *next;     /* in log_buffers */
+    pthread_mutex_t lock;
+    size_t size;
+    size_t used;
+    size_t last;                /* offset of the last entry, if used > 0 */
+    char data[0];
+} LogBuffer;
+
+static volatile int log_buffered;
+static size_t log_buffer_size;
+static int log_flush_ms;
+static int log_flush_prio;
+
+/* protects the fields below, and the settings above when changed */
+static pthread_mutex_t log_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_buffer_cond = PTHREAD_COND_INITIALIZER;
+static LogBuffer *log_buffers;
+static pthread_key_t log_buffer_key;
+static volatile int log_buffer_key_created;
+static int log_flusher_running;
+
+static void log_buffer_flush_locked(LogBuffer *b)
+{
+    size_t off = 0;
+
+    while (off < b->used) {
+        BufferedEntry e;
+        struct iovec vec[3];
+        char *payload;
+        size_t taglen;
+
+        memcpy(&e, b->data + off, sizeof(e));
+        payload = b->data + off + sizeof(e);
+        taglen = strlen(payload + 1) + 1;
+
+        vec[0].iov_base = payload;
+        vec[0].iov_len  = 1;
+        vec[1].iov_base = payload + 1;
+        vec[1].iov_len  = taglen;
+        vec[2].iov_base = payload + 1 + taglen;
+        vec[2].iov_len  = e.len - 1 - taglen;
+        write_to_log((log_id_t)e.log_id, vec, 3);
+
+        off += sizeof(e) + e.len;
+    }
+    b->used = 0;
+}
+
+static void log_buffer_flush_all(void)
+{
+    LogBuffer *b;
+
+    pthread_mutex_lock(&log_buffer_lock);
+    for (b = log_buffers; b != NULL; b = b->next) {
+        pthread_mutex_lock(&b->lock);
+        log_buffer_flush_locked(b);
+        pthread_mutex_unlock(&b->lock);
+    }
+    pthread_mutex_unlock(&log_buffer_lock);
+}
+
+static void log_buffer_destroy(void *arg)
+{
+    LogBuffer *b = arg;
+    LogBuffer **pb;
+
+    pthread_mutex_lock(&log_buffer_lock);
+    for (pb = &log_buffers; *pb != NULL; pb = &(*pb)->next) {
+        if (*pb == b) {
+            *pb = b->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&log_buffer_lock);
+
+    pthread_mutex_lock(&b->lock);
+    log_buffer_flush_locked(b);
+    pthread_mutex_unlock(&b->lock);
+    pthread_mutex_destroy(&b->lock);
+    free(b);
+}
+
+static void *log_flusher(void *arg)
+{
+    sigset_t mask;
+
+    /* leave the process' signals to its own threads */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    for (;;) {
+        int ms;
+
+        pthread_mutex_lock(&log_buffer_lock);
+        while (!log_buffered)
+            pthread_cond_wait(&log_buffer_cond, &log_buffer_lock);
+        ms = log_flush_ms;
+        pthread_mutex_unlock(&log_buffer_lock);
+
+        usleep(ms * 1000);
+        log_buffer_flush_all();
+    }
+    return NULL;
+}
+
+/* nothing buffered before a fork may be written twice */
+static void log_buffer_prepare_fork(void)
+{
+    LogBuffer *b;
+
+    pthread_mutex_lock(&log_buffer_lock);
+    for (b = log_buffers; b != NULL; b = b->next) {
+        pthread_mutex_lock(&b->lock);
+        log_buffer_flush_locked(b);
+    }
+}
+
+static void log_buffer_parent_fork(void)
+{
+    LogBuffer *b;
+
+    for (b = log_buffers; b != NULL; b = b->next)
+        pthread_mutex_unlock(&b->lock);
+    pthread_mutex_unlock(&log_buffer_lock);
+}
+
+/* the flusher does not survive the fork: the child logs unbuffered */
+static void log_buffer_child_fork(void)
+{
+    log_buffered = 0;
+    log_flusher_running = 0;
+    log_buffer_parent_fork();
+}
+
+/*
+ * Buffers a record from the calling thread. Returns what the writev would
+ * have, or -2 if buffered mode is off and the record must be written now.
+ */
+static int log_buffer_write(log_id_t log_id, char prio,
+                            const char *tag, size_t taglen,
+                            const char *msg, size_t msglen)
+{
+    LogBuffer *b = pthread_getspecific(log_buffer_key);
+    size_t needed;
+
+    if (!log_buffered) {
+        /* buffered mode was just turned off */
+        if (b != NULL && b->used > 0) {
+            pthread_mutex_lock(&b->lock);
+            log_buffer_flush_locked(b);
+            pthread_mutex_unlock(&b->lock);
+        }
+        return -2;
+    }
+
+    if (b == NULL) {
+        b = malloc(sizeof(LogBuffer) + log_buffer_size);
+        if (b == NULL)
+            return -2;
+        pthread_mutex_init(&b->lock, NULL);
+        b->size = log_buffer_size;
+        b->used = 0;
+        b->last = 0;
+        pthread_setspecific(log_buffer_key, b);
+
+        pthread_mutex_lock(&log_buffer_lock);
+        b->next = log_buffers;
+        log_buffers = b;
+        pthread_mutex_unlock(&log_buffer_lock);
+    }
+
+    pthread_mutex_lock(&b->lock);
+
+    if (b->used > 0) {
+        BufferedEntry e;
+        char *payload = b->data + b->last + sizeof(e);
+
+        memcpy(&e, b->data + b->last, sizeof(e));
+        if (e.log_id == log_id && payload[0] == prio &&
+                !memcmp(payload + 1, tag, taglen)) {
+            /* the message ends at the NUL before the end of the entry,
+             * keep its own final newline if it has one */
+            char *end = payload + e.len - 1;
+            size_t extra = msglen;
+
+            if (end > payload + 1 + taglen && end[-1] == '\n')
+                extra--;
+            if (e.len + extra <= LOGGER_ENTRY_MAX_PAYLOAD &&
+                    b->used + extra <= b->size) {
+                if (extra == msglen)
+                    *end++ = '\n';
+                memcpy(end, msg, msglen);
+                e.len += extra;
+                memcpy(b->data + b->last, &e, sizeof(e));
+                b->used += extra;
+                goto added;
+            }
+        }
+    }
+
+    needed = sizeof(BufferedEntry) + 1 + taglen + msglen;
+    if (b->used + needed > b->size)
+        log_buffer_flush_locked(b);
+    if (needed > b->size || 1 + taglen + msglen > LOGGER_ENTRY_MAX_PAYLOAD) {
+        /* too big to keep: let the kernel truncate it as usual */
+        struct iovec vec[3];
+        int ret;
+
+        vec[0].iov_base = &prio;
+        vec[0].iov_len  = 1;
+        vec[1].iov_base = (void *) tag;
+        vec[1].iov_len  = taglen;
+        vec[2].iov_base = (void *) msg;
+        vec[2].iov_len  = msglen;
+        ret = write_to_log(log_id, vec, 3);
+        pthread_mutex_unlock(&b->lock);
+        return ret;
+    } else {
+        BufferedEntry e;
+        char *payload = b->data + b->used + sizeof(e);
+
+        e.len = 1 + taglen + msglen;
+        e.log_id = (uint8_t)log_id;
+        e.pad = 0;
+        memcpy(b->data + b->used, &e, sizeof(e));
+        payload[0] = prio;
+        memcpy(payload + 1, tag, taglen);
+        memcpy(payload + 1 + taglen, msg, msglen);
+        b->last = b->used;
+        b->used += needed;
+    }
+
+added:
+    if (prio >= log_flush_prio)
+        log_buffer_flush_locked(b);
+    pthread_mutex_unlock(&b->lock);
+    return 1 + taglen + msglen;
+}
+#endif /* HAVE_PTHREADS */
+
+int __android_log_set_buffered(size_t size, int flush_ms, int flush_prio)
+{
+#ifdef HAVE_PTHREADS
+    int ret = 0;
+
+    pthread_mutex_lock(&log_buffer_lock);
+    if (size == 0) {
+        log_buffered = 0;
+    } else {
+        if (!log_buffer_key_created) {
+            if (pthread_key_create(&log_buffer_key, log_buffer_destroy) != 0) {
+                pthread_mutex_unlock(&log_buffer_lock);
+                return -1;
+            }
+            atexit(log_buffer_flush_all);
+            pthread_atfork(log_buffer_prepare_fork, log_buffer_parent_fork,
+                           log_buffer_child_fork);
+            log_buffer_key_created = 1;
+        }
+        if (!log_flusher_running) {
+            pthread_t thread;
+            pthread_attr_t attr;
+
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&thread, &attr, log_flusher, NULL) == 0)
+                log_flusher_running = 1;
+            else
+                ret = -1;
+            pthread_attr_destroy(&attr);
+        }
+        if (ret == 0) {
+            log_buffer_size = size;
+            log_flush_ms = flush_ms > 0 ? flush_ms : 1;
+            log_flush_prio = flush_prio;
+            log_buffered = 1;
+            pthread_cond_signal(&log_buffer_cond);
+        }
+    }
+    pthread_mutex_unlock(&log_buffer_lock);
+
+    if (!log_buffered)
+        __android_log_flush();
+    return ret;
+#else
+    return size == 0 ? 0 : -1;
+#endif
+}
+
+void __android_log_flush(void)
+{
+#ifdef HAVE_PTHREADS
+    if (log_buffer_key_created)
+        log_buffer_flush_all();
+#endif
+}
+
 int __android_log_write(int prio, const char *tag, const char *msg)
 {
     struct iovec vec[3];
-    log_id_t log_id = LOG_ID_MAIN;
+    log_id_t log_id;
     char prioc = (char)prio;
+    size_t taglen;
 
     if (!tag)
         tag = "";
 
-    /* XXX: This needs to go! */
-    if (!strcmp(tag, "HTC_RIL") ||
-        !strcmp(tag, "RILJ") ||
-        !strcmp(tag, "RILB") ||
-        !strcmp(tag, "RILC") ||
-        !strcmp(tag, "RILD") ||
-        !strcmp(tag, "RIL") ||
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS"))
-            log_id = LOG_ID_RADIO;
+    log_id = log_id_for_tag(tag, &taglen);
+
+#ifdef HAVE_PTHREADS
+    if (log_buffer_key_created) {
+        int ret = log_buffer_write(log_id, prioc, tag, taglen + 1,
+                                   msg, strlen(msg) + 1);
+        if (ret != -2)
+            return ret;
+    }
+#endif
 
     vec[0].iov_base   = &prioc;
     vec[0].iov_len    = 1;
     vec[1].iov_base   = (void *) tag;
-    vec[1].iov_len    = strlen(tag) + 1;
+    vec[1].iov_len    = taglen + 1;
     vec[2].iov_base   = (void *) msg;
     vec[2].iov_len    = strlen(msg) + 1;
 
@@ -33,15 +33,43 @@
 typedef struct FilterInfo_t {
     char *mTag;
     android_LogPriority mPri;
+    unsigned int mHash;
     struct FilterInfo_t *p_next;
+    struct FilterInfo_t *p_hashNext;    /* in the same filterTable bucket */
 } FilterInfo;
 
+/* a power of 2 */
+#define FILTER_TABLE_SIZE 64
+
 struct AndroidLogFormat_t {
     android_LogPriority global_pri;
     FilterInfo *filters;
     AndroidLogPrintFormat format;
+
+    /* filters again, hashed by tag, the most recent rule first */
+    FilterInfo *filterTable[FILTER_TABLE_SIZE];
+
+    /* the formatted date of the last entry, which only changes once a
+     * second in a busy log */
+    time_t timeSec;
+    int timeValid;
+    char timeBuf[32];
+
+    /* output not yet written, see android_log_setOutputBuffer() */
+    char *outBuf;
+    size_t outSize;
+    size_t outUsed;
 };
 
+static unsigned int tagHash(const char *tag)
+{
+    unsigned int h = 2166136261u;
+
+    while (*tag)
+        h = (h ^ (unsigned char)*tag++) * 16777619u;
+    return h;
+}
+
 static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
 {
     FilterInfo *p_ret;
@@ -49,6 +77,7 @@ static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
     p_ret = (FilterInfo *)calloc(1, sizeof(FilterInfo));
     p_ret->mTag = strdup(tag);
     p_ret->mPri = pri;
+    p_ret->mHash = tagHash(tag);
 
     return p_ret;
 }
@@ -123,12 +152,19 @@ static android_LogPriority filterPriForTag(
         AndroidLogFormat *p_format, const char *tag)
 {
     FilterInfo *p_curFilter;
+    unsigned int hash;
 
-    for (p_curFilter = p_format->filters
+    if (p_format->filters == NULL) {
+        return p_format->global_pri;
+    }
+
+    hash = tagHash(tag);
+
+    for (p_curFilter = p_format->filterTable[hash & (FILTER_TABLE_SIZE - 1)]
             ; p_curFilter != NULL
-            ; p_curFilter = p_curFilter->p_next
+            ; p_curFilter = p_curFilter->p_hashNext
     ) {
-        if (0 == strcmp(tag, p_curFilter->mTag)) {
+        if (p_curFilter->mHash == hash && 0 == strcmp(tag, p_curFilter->mTag)) {
             if (p_curFilter->mPri == ANDROID_LOG_DEFAULT) {
                 return p_format->global_pri;
             } else {
@@ -192,6 +228,7 @@ void android_log_format_free(AndroidLogFormat *p_format)
         free(p_info_old);
     }
 
+    free(p_format->outBuf);
     free(p_format);
 }
 
@@ -282,10 +319,15 @@ int android_log_addFilterRule(AndroidLogFormat *p_format,
 #endif /*HAVE_STRNDUP*/
 
         FilterInfo *p_fi = filterinfo_new(tagName, pri);
+        FilterInfo **p_bucket;
         free(tagName);
 
         p_fi->p_next = p_format->filters;
         p_format->filters = p_fi;
+
+        p_bucket = &p_format->filterTable[p_fi->mHash & (FILTER_TABLE_SIZE - 1)];
+        p_fi->p_hashNext = *p_bucket;
+        *p_bucket = p_fi;
     }
 
     return 0;
@@ -668,7 +710,7 @@ char *android_log_formatLogLine (
     struct tm tmBuf;
 #endif
     struct tm* ptm;
-    char timeBuf[32];
+    const char *timeBuf;
     char headerBuf[128];
     char prefixBuf[128], suffixBuf[128];
     char priChar;
@@ -686,13 +728,19 @@ char *android_log_formatLogLine (
      * in the time stamp.  Don't use forward slashes, parenthesis,
      * brackets, asterisks, or other special chars here.
      */
+    if (!p_format->timeValid || p_format->timeSec != entry->tv_sec) {
 #if defined(HAVE_LOCALTIME_R)
-    ptm = localtime_r(&(entry->tv_sec), &tmBuf);
+        ptm = localtime_r(&(entry->tv_sec), &tmBuf);
 #else
-    ptm = localtime(&(entry->tv_sec));
+        ptm = localtime(&(entry->tv_sec));
 #endif
-    //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
-    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+        //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
+        strftime(p_format->timeBuf, sizeof(p_format->timeBuf),
+                "%m-%d %H:%M:%S", ptm);
+        p_format->timeSec = entry->tv_sec;
+        p_format->timeValid = 1;
+    }
+    timeBuf = p_format->timeBuf;
 
     /*
      * Construct a buffer containing the log header and log message.
@@ -835,11 +883,77 @@ char *android_log_formatLogLine (
     return ret;
 }
 
+static int writeFully(int fd, const char *buf, size_t len)
+{
+    int ret;
+
+    do {
+        ret = write(fd, buf, len);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+        return 0;
+    }
+
+    if (((size_t)ret) < len) {
+        fprintf(stderr, "+++ LOG: write partial (%d of %d)\n", ret,
+                (int)len);
+    }
+
+    return ret;
+}
+
 /**
- * Either print or do not print log line, based on filter
+ * Sets the size of the output buffer that android_log_filterAndPrintLogLine
+ * collects lines in, or 0 to write every line as it comes.
+ *
+ * Returns 0 on success and -1 on malloc error
+ */
+int android_log_setOutputBuffer(AndroidLogFormat *p_format, size_t size)
+{
+    char *buf = NULL;
+
+    if (size > 0) {
+        buf = (char *)malloc(size);
+        if (buf == NULL) {
+            return -1;
+        }
+    }
+
+    free(p_format->outBuf);
+    p_format->outBuf = buf;
+    p_format->outSize = size;
+    p_format->outUsed = 0;
+    return 0;
+}
+
+/**
+ * Writes the lines collected in the output buffer to fd
  *
  * Returns count bytes written
  */
+int android_log_flushOutputBuffer(AndroidLogFormat *p_format, int fd)
+{
+    int ret;
+
+    if (p_format->outUsed == 0) {
+        return 0;
+    }
+
+    ret = writeFully(fd, p_format->outBuf, p_format->outUsed);
+    p_format->outUsed = 0;
+    return ret;
+}
+
+/**
+ * Either print or do not print log line, based on filter
+ *
+ * With an output buffer, the line is formatted straight into it and only
+ * written once the buffer is full.
+ *
+ * Returns count bytes written, or taken into the output buffer
+ */
 
 int android_log_filterAndPrintLogLine(
     AndroidLogFormat *p_format,
@@ -856,29 +970,42 @@ int android_log_filterAndPrintLogLine(
         return 0;
     }
 
+    if (p_format->outSize > 0) {
+        char *tail = p_format->outBuf + p_format->outUsed;
+
+        /* formatLogLine needs room for its terminating NUL */
+        outBuffer = android_log_formatLogLine(p_format, tail,
+                p_format->outSize - p_format->outUsed, entry, &totalLen);
+
+        if (!outBuffer)
+            return -1;
+
+        if (outBuffer == tail) {
+            p_format->outUsed += totalLen;
+            return totalLen;
+        }
+
+        /* did not fit: make room, or write big lines on their own */
+        android_log_flushOutputBuffer(p_format, fd);
+        if (totalLen < p_format->outSize) {
+            memcpy(p_format->outBuf, outBuffer, totalLen);
+            p_format->outUsed = totalLen;
+            free(outBuffer);
+            return totalLen;
+        }
+        ret = writeFully(fd, outBuffer, totalLen);
+        free(outBuffer);
+        return ret;
+    }
+
     outBuffer = android_log_formatLogLine(p_format, defaultBuffer,
             sizeof(defaultBuffer), entry, &totalLen);
 
     if (!outBuffer)
         return -1;
 
-    do {
-        ret = write(fd, outBuffer, totalLen);
-    } while (ret < 0 && errno == EINTR);
-
-    if (ret < 0) {
-        fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
-        ret = 0;
-        goto done;
-    }
-
-    if (((size_t)ret) < totalLen) {
-        fprintf(stderr, "+++ LOG: write partial (%d of %d)\n", ret,
-                (int)totalLen);
-        goto done;
-    }
+    ret = writeFully(fd, outBuffer, totalLen);
 
-done:
     if (outBuffer != defaultBuffer) {
         free(outBuffer);
     }
@@ -12,6 +12,34 @@ LOCAL_MODULE := libpixelflinger_armv6
 include $(BUILD_STATIC_LIBRARY)
 endif
 
+#
+# SIMD scanlines, only used when cpu_info says the CPU has them
+#
+
+# The NEON kernels haven't been built or checked against the C shortcuts
+# on hardware yet, set PIXELFLINGER_NEON to true to try them.
+PIXELFLINGER_NEON ?= false
+
+PIXELFLINGER_SIMD :=
+ifeq ($(TARGET_ARCH),arm)
+ifeq ($(ARCH_ARM_HAVE_NEON)-$(PIXELFLINGER_NEON),true-true)
+include $(CLEAR_VARS)
+LOCAL_ARM_NEON := true
+LOCAL_SRC_FILES := scanline_neon.cpp
+LOCAL_MODULE := libpixelflinger_neon
+include $(BUILD_STATIC_LIBRARY)
+PIXELFLINGER_SIMD := libpixelflinger_neon
+endif
+endif
+ifneq ($(filter x86 x86_64,$(TARGET_ARCH)),)
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := -msse2
+LOCAL_SRC_FILES := scanline_sse2.cpp
+LOCAL_MODULE := libpixelflinger_sse2
+include $(BUILD_STATIC_LIBRARY)
+PIXELFLINGER_SIMD := libpixelflinger_sse2
+endif
+
 #
 # C/C++ and ARMv5 objects
 #
@@ -54,6 +82,17 @@ PIXELFLINGER_SRC_FILES:= \
     codeflinger-ppc/texturing.cpp \
     codeflinger-ppc/disassem.c
 endif
+ifeq ($(TARGET_ARCH),x86_64)
+PIXELFLINGER_SRC_FILES:= \
+    codeflinger/ARMAssemblerInterface.cpp \
+    codeflinger/ARMAssemblerProxy.cpp \
+    codeflinger/X86_64Assembler.cpp \
+    codeflinger/CodeCache.cpp \
+    codeflinger/GGLAssembler.cpp \
+    codeflinger/load_store.cpp \
+    codeflinger/blending.cpp \
+    codeflinger/texturing.cpp
+endif
 
 PIXELFLINGER_SRC_FILES += \
 	tinyutils/SharedBuffer.cpp \
@@ -66,7 +105,8 @@ PIXELFLINGER_SRC_FILES += \
 	format.cpp \
 	clear.cpp \
 	raster.cpp \
-	buffer.cpp
+	buffer.cpp \
+	bands.cpp
 
 ifeq ($(TARGET_ARCH),arm)
 PIXELFLINGER_SRC_FILES += t32cb16blend.S
@@ -77,6 +117,10 @@ ifeq ($(TARGET_ARCH),arm)
 PIXELFLINGER_CFLAGS += -fstrict-aliasing -fomit-frame-pointer
 endif
 
+ifeq ($(PIXELFLINGER_SIMD),libpixelflinger_neon)
+PIXELFLINGER_CFLAGS += -DWITH_NEON
+endif
+
 LOCAL_SHARED_LIBRARIES := libcutils
 
 ifneq ($(TARGET_ARCH),arm)
@@ -86,6 +130,13 @@ ifneq ($(TARGET_ARCH),arm)
 LOCAL_SHARED_LIBRARIES += libutils
 endif
 
+# dladdr(), to tell the code cache files of other builds apart
+ifeq ($(TARGET_SIMULATOR),true)
+LOCAL_LDLIBS += -ldl
+else
+LOCAL_SHARED_LIBRARIES += libdl
+endif
+
 #
 # Shared library
 #
@@ -102,6 +153,7 @@ endif
 ifeq ($(TARGET_ARCH),arm)
 LOCAL_WHOLE_STATIC_LIBRARIES := libpixelflinger_armv6
 endif
+LOCAL_WHOLE_STATIC_LIBRARIES += $(PIXELFLINGER_SIMD)
 include $(BUILD_SHARED_LIBRARY)
 
 #
@@ -115,6 +167,7 @@ LOCAL_CFLAGS := $(PIXELFLINGER_CFLAGS)
 ifeq ($(TARGET_ARCH),arm)
 LOCAL_WHOLE_STATIC_LIBRARIES := libpixelflinger_armv6
 endif
+LOCAL_WHOLE_STATIC_LIBRARIES += $(PIXELFLINGER_SIMD)
 include $(BUILD_STATIC_LIBRARY)
 
 
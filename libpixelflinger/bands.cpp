@@ -0,0 +1,197 @@
+/* libs/pixelflinger/bands.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "pixelflinger"
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <cutils/log.h>
+
+#include "bands.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// never more threads than this, including the caller's
+static const int BANDS_MAX_THREADS = 4;
+
+// primitives smaller than this aren't worth waking up the workers
+static const int32_t BANDS_MIN_PIXELS = 64*1024;
+
+// no band shorter than this, so the cloning and setup stay cheap
+static const int32_t BANDS_MIN_ROWS = 16;
+
+// a few more bands than threads, so that the threads whose bands cover
+// less of a triangle can take another one
+static const int BANDS_PER_THREAD = 2;
+
+struct band_job_t {
+    context_t*      c;
+    band_func_t     band;
+    void*           cookie;
+    bool            clone;
+    int32_t         top;
+    int32_t         bottom;
+    int32_t         rows;       // in each band, the last one may have fewer
+    int             count;
+    int             next;       // next band to rasterize, under gLock
+    int             done;       // bands rasterized, under gLock
+};
+
+static pthread_once_t gOnce = PTHREAD_ONCE_INIT;
+static int gWorkers;
+
+// only one job at a time, the others rasterize on their own thread
+static pthread_mutex_t gBusy = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gDone = PTHREAD_COND_INITIALIZER;
+static band_job_t* gJob;
+
+// ----------------------------------------------------------------------------
+
+static void run_band(band_job_t* job, int i)
+{
+    const int32_t top = job->top + i*job->rows;
+    int32_t bottom = top + job->rows;
+    if (bottom > job->bottom)
+        bottom = job->bottom;
+
+    if (job->clone) {
+        context_t clone;
+        memcpy(&clone, job->c, sizeof(context_t));
+        job->band(&clone, top, bottom, job->cookie);
+    } else {
+        job->band(job->c, top, bottom, job->cookie);
+    }
+}
+
+// takes bands from the current job until there are none left,
+// called and returns with gLock held
+static void run_bands(band_job_t* job)
+{
+    while (job->next < job->count) {
+        const int i = job->next++;
+        pthread_mutex_unlock(&gLock);
+        run_band(job, i);
+        pthread_mutex_lock(&gLock);
+        // the job can't go away before it's done
+        if (++job->done == job->count) {
+            pthread_cond_signal(&gDone);
+        }
+    }
+}
+
+static void* worker(void*)
+{
+    pthread_mutex_lock(&gLock);
+    for (;;) {
+        band_job_t* job = gJob;
+        if (job && job->next < job->count) {
+            run_bands(job);
+        } else {
+            pthread_cond_wait(&gWork, &gLock);
+        }
+    }
+    return 0;
+}
+
+static void init_workers()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > BANDS_MAX_THREADS)
+        cpus = BANDS_MAX_THREADS;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (long i=1 ; i<cpus ; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, worker, 0) != 0) {
+            LOGW("couldn't start rasterizer thread %ld of %ld", i, cpus-1);
+            break;
+        }
+        gWorkers++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// ----------------------------------------------------------------------------
+
+bool ggl_bands(context_t* c, int32_t top, int32_t bottom, int32_t width,
+        band_func_t band, void* cookie, bool clone)
+{
+    if (ggl_likely(!(c->state.enables & GGL_ENABLE_MULTITHREAD)))
+        return false;
+
+    const int32_t rows = bottom - top;
+    if (rows < 2*BANDS_MIN_ROWS || rows*width < BANDS_MIN_PIXELS)
+        return false;
+
+    pthread_once(&gOnce, init_workers);
+    if (!gWorkers)
+        return false;
+
+    if (pthread_mutex_trylock(&gBusy) != 0)
+        return false;
+
+    band_job_t job;
+    job.c = c;
+    job.band = band;
+    job.cookie = cookie;
+    job.clone = clone;
+    job.top = top;
+    job.bottom = bottom;
+    job.count = (gWorkers + 1) * BANDS_PER_THREAD;
+    if (job.count > rows / BANDS_MIN_ROWS)
+        job.count = rows / BANDS_MIN_ROWS;
+    job.rows = (rows + job.count - 1) / job.count;
+    job.count = (rows + job.rows - 1) / job.rows;
+    job.next = 0;
+    job.done = 0;
+
+    pthread_mutex_lock(&gLock);
+    gJob = &job;
+    pthread_cond_broadcast(&gWork);
+    run_bands(&job);
+    while (job.done < job.count) {
+        pthread_cond_wait(&gDone, &gLock);
+    }
+    gJob = 0;
+    pthread_mutex_unlock(&gLock);
+
+    pthread_mutex_unlock(&gBusy);
+    return true;
+}
+
+void ggl_bands_init_y(context_t* c, int32_t y0, int32_t y)
+{
+    // init_y(y) alone could round the texture coordinates differently
+    c->init_y(c, y0);
+    while (y0 < y) {
+        c->step_y(c);
+        y0++;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,47 @@
+/* libs/pixelflinger/bands.h
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef ANDROID_BANDS_H
+#define ANDROID_BANDS_H
+
+#include <private/pixelflinger/ggl_context.h>
+
+namespace android {
+
+// rasterizes the scanlines [top, bottom) of a primitive
+typedef void (*band_func_t)(context_t* c,
+        int32_t top, int32_t bottom, void* cookie);
+
+// When GGL_ENABLE_MULTITHREAD is set and the primitive is big enough, splits
+// the scanlines [top, bottom) in horizontal bands and rasterizes them on a
+// pool of worker threads, returning once they are all done.
+// If 'clone' is set, each band gets its own copy of the context, so it can
+// init_y() and step_y() without disturbing the others; otherwise the bands
+// share 'c' and must not write to it.
+// Returns false, without calling band(), if the caller should rasterize the
+// primitive itself.
+bool ggl_bands(context_t* c, int32_t top, int32_t bottom, int32_t width,
+        band_func_t band, void* cookie, bool clone);
+
+// sets up c's iterators for scanline 'y' of a primitive starting at
+// scanline 'y0', exactly as init_y(y0) followed by step_y()s would
+void ggl_bands_init_y(context_t* c, int32_t y0, int32_t y);
+
+}; // namespace android
+
+#endif // ANDROID_BANDS_H
@@ -19,6 +19,7 @@
 
 #include "clear.h"
 #include "buffer.h"
+#include "bands.h"
 
 namespace android {
 
@@ -85,6 +86,27 @@ static void memset2d(context_t* c, const surface_t& s, uint32_t packed,
     }    
 }
 
+struct clear_bands_t {
+    GGLbitfield mask;
+    uint32_t    l;
+    uint32_t    w;
+};
+
+static void clear_band(context_t* c, int32_t top, int32_t bottom, void* cookie)
+{
+    const clear_bands_t* bands = (const clear_bands_t*)cookie;
+    const uint32_t l = bands->l;
+    const uint32_t w = bands->w;
+    if (bands->mask & GGL_COLOR_BUFFER_BIT) {
+        memset2d(c, c->state.buffers.color, c->state.clear.colorPacked,
+                l, top, w, bottom - top);
+    }
+    if (bands->mask & GGL_DEPTH_BUFFER_BIT) {
+        memset2d(c, c->state.buffers.depth, c->state.clear.depthPacked,
+                l, top, w, bottom - top);
+    }
+}
+
 static inline GGLfixed fixedToZ(GGLfixed z) {
     return GGLfixed(((int64_t(z) << 16) - z) >> 16);
 }
@@ -127,8 +149,6 @@ static void ggl_clear(void* con, GGLbitfield mask)
 
             c->state.clear.colorPacked = GGL_HOST_TO_RGBA(colorPacked);
         }
-        const uint32_t packed = c->state.clear.colorPacked;
-        memset2d(c, c->state.buffers.color, packed, l, t, w, h);
     }
     if (mask & GGL_DEPTH_BUFFER_BIT) {
         if (c->state.clear.dirty & GGL_DEPTH_BUFFER_BIT) {
@@ -136,8 +156,11 @@ static void ggl_clear(void* con, GGLbitfield mask)
             uint32_t depth = fixedToZ(c->state.clear.depth);
             c->state.clear.depthPacked = (depth<<16)|depth;
         }
-        const uint32_t packed = c->state.clear.depthPacked;
-        memset2d(c, c->state.buffers.depth, packed, l, t, w, h);
+    }
+
+    const clear_bands_t bands = { mask, l, w };
+    if (!ggl_bands(c, t, t + h, w, clear_band, (void*)&bands, false)) {
+        clear_band(c, t, t + h, (void*)&bands);
     }
 
     // XXX: do stencil buffer
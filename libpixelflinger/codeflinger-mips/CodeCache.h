@@ -23,7 +23,8 @@
 #include <pthread.h>
 #include <sys/types.h>
 
-#include <utils/KeyedVector.h>
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
 
 #include "tinyutils/smartpointer.h"
 
@@ -31,10 +32,28 @@ namespace android {
 
 // ----------------------------------------------------------------------------
 
+// one-at-a-time hash of a key's bytes, keys are plain old data
+template <typename T>
+inline uint32_t hash_type(const T& key)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&key);
+    uint32_t h = 0;
+    for (size_t i=0 ; i<sizeof(T) ; i++) {
+        h += p[i];
+        h += h << 10;
+        h ^= h >> 6;
+    }
+    h += h << 3;
+    h ^= h >> 11;
+    h += h << 15;
+    return h;
+}
+
 class AssemblyKeyBase {
 public:
     virtual ~AssemblyKeyBase() { }
     virtual int compare_type(const AssemblyKeyBase& key) const = 0;
+    virtual uint32_t hash() const = 0;
 };
 
 template  <typename T>
@@ -46,6 +65,9 @@ public:
         const T& rhs = static_cast<const AssemblyKey&>(key).mKey;
         return android::compare_type(mKey, rhs);
     }
+    virtual uint32_t hash() const {
+        return android::hash_type(mKey);
+    }
 private:
     T mKey;
 };
@@ -56,12 +78,16 @@ class Assembly
 {
 public:
                 Assembly(size_t size);
+                // wraps code that lives elsewhere, in a mapped file for
+                // instance, and isn't freed with the Assembly
+                Assembly(uint32_t* base, size_t size);
     virtual     ~Assembly();
 
     ssize_t     size() const;
     uint32_t*   base() const;
     void	setBase(uint32_t* newbase);
     uint32_t*   membase() const;
+    ssize_t     codeSize() const;   // bytes of code from base()
     ssize_t     resize(size_t size);
 
     // protocol for sp<>
@@ -74,6 +100,7 @@ private:
             uint32_t*   mMemBase;	// base of allocation
             uint32_t*   mBase;		// where the code actually starts
             ssize_t     mSize;
+            bool        mOwner;
 };
 
 // ----------------------------------------------------------------------------
@@ -81,55 +108,79 @@ private:
 class CodeCache
 {
 public:
+    struct stats_t {
+        uint32_t    hits;
+        uint32_t    misses;
+        uint32_t    evictions;
+        uint32_t    compiles;
+        int64_t     compileTime;    // ns, spent generating the cached code
+        uint32_t    count;
+        uint32_t    size;
+        uint32_t    budget;
+    };
+
 // pretty simple cache API...
                 CodeCache(size_t size);
                 ~CodeCache();
     
+            // doesn't block, so it can be called while another thread
+            // is caching or evicting
             sp<Assembly>        lookup(const AssemblyKeyBase& key) const;
 
+            // compileTime is negative for code that wasn't generated by
+            // this process, loaded from a file for instance
             int                 cache(  const AssemblyKeyBase& key,
-                                        const sp<Assembly>& assembly);
+                                        const sp<Assembly>& assembly,
+                                        int64_t compileTime = 0);
+
+            // evicts what doesn't fit in the new budget right away
+            void                setBudget(size_t size);
+
+            void                getStats(stats_t* stats) const;
+
+            // calls func() on every cached assembly, with mLock held
+            void                forEach(void (*func)(const sp<Assembly>&,
+                                        void* cookie), void* cookie) const;
 
 private:
     // nothing to see here...
-    struct cache_entry_t {
-        inline cache_entry_t() { }
-        inline cache_entry_t(const sp<Assembly>& a, int64_t w)
-                : entry(a), when(w) { }
-        sp<Assembly>            entry;
-        mutable int64_t         when;
-    };
+    enum { BUCKETS = 256 };
 
-    class key_t {
-        friend int compare_type(
-            const key_value_pair_t<key_t, cache_entry_t>&,
-            const key_value_pair_t<key_t, cache_entry_t>&);
-        const AssemblyKeyBase* mKey;
-    public:
-        key_t() { };
-        key_t(const AssemblyKeyBase& k) : mKey(&k)  { }
+    struct cache_entry_t {
+        // hash chain, walked by lookup() without mLock
+        cache_entry_t* volatile     next;
+        // LRU list, most recently cached first, under mLock
+        cache_entry_t*              newer;
+        cache_entry_t*              older;
+        const AssemblyKeyBase*      key;
+        sp<Assembly>                entry;
+        ssize_t                     size;
+        uint32_t                    hash;
+        // set by lookup(), gives the entry a second chance when it
+        // reaches the end of the LRU list
+        mutable volatile int32_t    referenced;
     };
 
-    mutable pthread_mutex_t             mLock;
-    mutable int64_t                     mWhen;
-    size_t                              mCacheSize;
-    size_t                              mCacheInUse;
-    KeyedVector<key_t, cache_entry_t>   mCacheData;
-
-    friend int compare_type(
-        const key_value_pair_t<key_t, cache_entry_t>&,
-        const key_value_pair_t<key_t, cache_entry_t>&);
+    void    evict();
+    void    reclaim();
+
+    mutable pthread_mutex_t     mLock;
+    cache_entry_t* volatile     mBuckets[BUCKETS];
+    cache_entry_t*              mNewest;
+    cache_entry_t*              mOldest;
+    // evicted entries lookup() may still be looking at
+    cache_entry_t*              mRetired;
+    mutable volatile int32_t    mReaders;
+    size_t                      mCacheSize;
+    size_t                      mCacheInUse;
+    mutable volatile int32_t    mHits;
+    mutable volatile int32_t    mMisses;
+    uint32_t                    mEvictions;
+    uint32_t                    mCompiles;
+    int64_t                     mCompileTime;
+    uint32_t                    mEntries;
 };
 
-// KeyedVector uses compare_type(), which is more efficient, than
-// just using operator < ()
-inline int compare_type(
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& lhs,
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& rhs)
-{
-    return lhs.key.mKey->compare_type(*(rhs.key.mKey));
-}
-
 // ----------------------------------------------------------------------------
 
 }; // namespace android
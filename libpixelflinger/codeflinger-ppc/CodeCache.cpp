@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
@@ -36,7 +37,7 @@ namespace android {
 // ----------------------------------------------------------------------------
 
 Assembly::Assembly(size_t size)
-    : mCount(1), mSize(0)
+    : mCount(0), mSize(0), mOwner(true)
 {
     mBase = (uint32_t*)malloc(size);
     if (mBase) {
@@ -44,9 +45,16 @@ Assembly::Assembly(size_t size)
     }
 }
 
+Assembly::Assembly(uint32_t* base, size_t size)
+    : mCount(0), mBase(base), mSize(size), mOwner(false)
+{
+}
+
 Assembly::~Assembly()
 {
-    free(mBase);
+    if (mOwner) {
+        free(mBase);
+    }
 }
 
 void Assembly::incStrong(const void*) const
@@ -72,6 +80,11 @@ uint32_t* Assembly::base() const
     return mBase;
 }
 
+ssize_t Assembly::codeSize() const
+{
+    return size();
+}
+
 void Assembly::setBase(uint32_t* newbase)
 {
     mBase = newbase;
@@ -87,27 +100,50 @@ ssize_t Assembly::resize(size_t newSize)
 // ----------------------------------------------------------------------------
 
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mNewest(0), mOldest(0), mRetired(0), mReaders(0),
+      mCacheSize(size), mCacheInUse(0), mHits(0), mMisses(0),
+      mEvictions(0), mCompiles(0), mCompileTime(0), mEntries(0)
 {
     pthread_mutex_init(&mLock, 0);
+    memset((void*)mBuckets, 0, sizeof(mBuckets));
 }
 
 CodeCache::~CodeCache()
 {
+    cache_entry_t* e = mNewest;
+    while (e) {
+        cache_entry_t* older = e->older;
+        delete e;
+        e = older;
+    }
+    while (mRetired) {
+        cache_entry_t* next = mRetired->older;
+        delete mRetired;
+        mRetired = next;
+    }
     pthread_mutex_destroy(&mLock);
 }
 
 sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
 {
-    pthread_mutex_lock(&mLock);
+    // While mReaders isn't zero, evicted entries are retired rather than
+    // deleted, so the chain stays walkable under our feet.
+    android_atomic_inc(&mReaders);
     sp<Assembly> r;
-    ssize_t index = mCacheData.indexOfKey(key_t(keyBase));
-    if (index >= 0) {
-        const cache_entry_t& e = mCacheData.valueAt(index);
-        e.when = mWhen++;
-        r = e.entry;
+    const uint32_t hash = keyBase.hash();
+    const cache_entry_t* e = mBuckets[hash % BUCKETS];
+    while (e) {
+        if (e->hash == hash && !e->key->compare_type(keyBase)) {
+            if (!e->referenced) {
+                e->referenced = 1;
+            }
+            r = e->entry;
+            break;
+        }
+        e = e->next;
     }
-    pthread_mutex_unlock(&mLock);
+    android_atomic_dec(&mReaders);
+    android_atomic_inc(r != 0 ? &mHits : &mMisses);
     return r;
 }
 
@@ -135,42 +171,148 @@ static inline void ppc_cacheflush(unsigned long base, long size)
 }
 
 int CodeCache::cache(  const AssemblyKeyBase& keyBase,
-                            const sp<Assembly>& assembly)
+                            const sp<Assembly>& assembly,
+                            int64_t compileTime)
 {
     pthread_mutex_lock(&mLock);
 
-    const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
-        // evict the LRU
-        size_t lru = 0;
-        size_t count = mCacheData.size();
-        for (size_t i=0 ; i<count ; i++) {
-            const cache_entry_t& e = mCacheData.valueAt(i);
-            if (e.when < mCacheData.valueAt(lru).when) {
-                lru = i;
-            }
+    if (compileTime >= 0) {
+        mCompiles++;
+        mCompileTime += compileTime;
+    }
+
+    const uint32_t hash = keyBase.hash();
+    cache_entry_t* volatile* bucket = &mBuckets[hash % BUCKETS];
+    bool found = false;
+    for (const cache_entry_t* e = *bucket ; e ; e = e->next) {
+        if (e->hash == hash && !e->key->compare_type(keyBase)) {
+            // another thread generated the same code first
+            found = true;
+            break;
         }
-        const cache_entry_t& e = mCacheData.valueAt(lru);
-	LOGI("evict %ld", e.entry->size());
-        mCacheInUse -= e.entry->size();
-        mCacheData.removeItemsAt(lru);
     }
 
-    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
-    if (err >= 0) {
+    const ssize_t assemblySize = assembly->size();
+    if (!found && size_t(assemblySize) <= mCacheSize) {
+        while (mCacheInUse + assemblySize > mCacheSize) {
+            evict();
+        }
+        cache_entry_t* e = new cache_entry_t;
+        e->key = &keyBase;
+        e->entry = assembly;
+        e->size = assemblySize;
+        e->hash = hash;
+        e->newer = 0;
+        e->older = mNewest;
+        if (mNewest)    mNewest->newer = e;
+        else            mOldest = e;
+        mNewest = e;
+        e->next = *bucket;
+        // the atomic write completes the entry before lookup() can see it
+        android_atomic_write(0, &e->referenced);
+        *bucket = e;
         mCacheInUse += assemblySize;
-        mWhen++;
-        // synchronize caches...
-        const long base = long(assembly->base());
-        const long bytes = long(assembly->size());
-        ppc_cacheflush(base, bytes);
-	err = 0;
+        mEntries++;
     }
+    reclaim();
+
+    // synchronize caches...
+    const long base = long(assembly->base());
+    const long bytes = long(assembly->size());
+    ppc_cacheflush(base, bytes);
+    int err = NO_ERROR;
 
     pthread_mutex_unlock(&mLock);
     return err;
 }
 
+void CodeCache::setBudget(size_t size)
+{
+    pthread_mutex_lock(&mLock);
+    mCacheSize = size;
+    while (mCacheInUse > mCacheSize) {
+        evict();
+    }
+    reclaim();
+    pthread_mutex_unlock(&mLock);
+}
+
+void CodeCache::getStats(stats_t* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    stats->hits = mHits;
+    stats->misses = mMisses;
+    stats->evictions = mEvictions;
+    stats->compiles = mCompiles;
+    stats->compileTime = mCompileTime;
+    stats->count = mEntries;
+    stats->size = mCacheInUse;
+    stats->budget = mCacheSize;
+    pthread_mutex_unlock(&mLock);
+}
+
+void CodeCache::forEach(void (*func)(const sp<Assembly>&, void* cookie),
+        void* cookie) const
+{
+    pthread_mutex_lock(&mLock);
+    for (const cache_entry_t* e = mNewest ; e ; e = e->older) {
+        func(e->entry, cookie);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+// Evicts the least recently used entry, approximately: lookup() can't
+// reorder the list without mLock, so it only marks the entries it hits,
+// and those go back to the front instead of being evicted (CLOCK).
+// Called with mLock held and a non empty cache.
+void CodeCache::evict()
+{
+    cache_entry_t* e = mOldest;
+    while (e->referenced && e->newer) {
+        e->referenced = 0;
+        mOldest = e->newer;
+        mOldest->older = 0;
+        e->newer = 0;
+        e->older = mNewest;
+        mNewest->newer = e;
+        mNewest = e;
+        e = mOldest;
+    }
+
+    mOldest = e->newer;
+    if (mOldest)    mOldest->older = 0;
+    else            mNewest = 0;
+
+    // unlink it from its hash chain, leaving e->next alone for the
+    // lookups that are looking at it right now
+    cache_entry_t* volatile* p = &mBuckets[e->hash % BUCKETS];
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+
+    e->older = mRetired;
+    mRetired = e;
+    mCacheInUse -= e->size;
+    mEntries--;
+    mEvictions++;
+}
+
+// Deletes the retired entries once no lookup() can be looking at them.
+// Called with mLock held.
+void CodeCache::reclaim()
+{
+    // the atomic op orders the unlinking before reading mReaders, a
+    // lookup() that starts after this can't find the retired entries
+    if (!mRetired || android_atomic_or(0, &mReaders) != 0)
+        return;
+    while (mRetired) {
+        cache_entry_t* next = mRetired->older;
+        delete mRetired;
+        mRetired = next;
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 }; // namespace android
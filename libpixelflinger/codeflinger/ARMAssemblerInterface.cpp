@@ -168,6 +168,30 @@ uint32_t ARMAssemblerInterface::reg_post(int Rm)
     return (((uint32_t(Rm)>>31)^1)<<23) | (abs(Rm)&0xF);
 }
 
+// pointers...
+
+void ARMAssemblerInterface::ADDR_LDR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    LDR(cc, Rd, Rn, offset);
+}
+
+void ARMAssemblerInterface::ADDR_STR(int cc, int Rd, int Rn, uint32_t offset)
+{
+    STR(cc, Rd, Rn, offset);
+}
+
+void ARMAssemblerInterface::ADDR_ADD(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    dataProcessing(opADD, cc, s, Rd, Rn, Op2);
+}
+
+void ARMAssemblerInterface::ADDR_SUB(int cc, int s,
+        int Rd, int Rn, uint32_t Op2)
+{
+    dataProcessing(opSUB, cc, s, Rd, Rn, Op2);
+}
+
 
 }; // namespace android
 
@@ -203,6 +203,23 @@ public:
     virtual void SMLAW(int cc, int y,
                 int Rd, int Rm, int Rs, int Rn) = 0;
 
+    // -----------------------------------------------------------------------
+    // pointers...
+    // -----------------------------------------------------------------------
+
+    // registers holding an address are as wide as a pointer, which is wider
+    // than 32 bits on some targets. Loads and stores of pointers, and
+    // arithmetic on them, go through these (Op2 is a 32-bit signed offset).
+    // They are plain LDR, STR, ADD and SUB by default.
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
     // -----------------------------------------------------------------------
     // convenience...
     // -----------------------------------------------------------------------
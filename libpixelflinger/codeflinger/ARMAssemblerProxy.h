@@ -114,6 +114,15 @@ public:
     virtual void SMLAW(int cc, int y,
                 int Rd, int Rm, int Rs, int Rn);
 
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
 private:
     ARMAssemblerInterface*  mTarget;
 };
@@ -0,0 +1,1554 @@
+/* libs/pixelflinger/codeflinger/X86_64Assembler.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#define LOG_TAG "X86_64Assembler"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include <private/pixelflinger/ggl_context.h>
+
+#include "codeflinger/X86_64Assembler.h"
+#include "codeflinger/CodeCache.h"
+
+// ----------------------------------------------------------------------------
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+// x86-64 registers
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    XR8, XR9, XR10, XR11, XR12, XR13, XR14, XR15
+};
+
+// rcx holds shift counts, and whatever needs a register for a moment
+static const int TMP = RCX;
+
+// where the ARM registers live. R0 (the context) comes in rdi, the
+// registers GGLAssembler allocates first are the ones we needn't save.
+static const int8_t sRegisters[16] = {
+    RDI, RSI, RDX, RAX, XR10, XR11, RBX, RBP,
+    XR12, XR13, XR14, XR15, XR8, RSP, XR9, -1
+};
+
+// the registers a function must preserve, in the order we push them
+static const int8_t sCalleeSaved[6] = {
+    RBX, RBP, XR12, XR13, XR14, XR15
+};
+
+// x86 condition codes of the ARM ones. The x86 carry is the opposite of
+// ARM's, which is what a SUB or CMP leaves in it.
+static const uint8_t sConditions[14] = {
+    0x4, 0x5, 0x3, 0x2, 0x8, 0x9, 0x0, 0x1,     // EQ NE CS CC MI PL VS VC
+    0x7, 0x6, 0xD, 0xC, 0xF, 0xE                // HI LS GE LT GT LE
+};
+
+enum {
+    X86_NE = 0x5, X86_GE = 0xD, X86_LE = 0xE, X86_JMP = -1
+};
+
+// /digit of the group 1 ALU, shift and F7 opcodes
+enum { xADD, xOR, xADC, xSBB, xAND, xSUB, xXOR, xCMP };
+enum { xROL, xROR, xRCL, xRCR, xSHL, xSHR, xSAL, xSAR };
+enum { xTEST, xNOT = 2, xNEG };
+
+#if 0
+#pragma mark -
+#pragma mark X86_64Assembler...
+#endif
+
+X86_64Assembler::X86_64Assembler(const sp<Assembly>& assembly)
+    :   ARMAssemblerInterface(),
+        mAssembly(assembly),
+        mCode(0), mCodeSize(0), mCodeCapacity(0),
+        mTranslated(false)
+{
+    mBase = assembly->base();
+    mDuration = ggl_system_time();
+}
+
+X86_64Assembler::~X86_64Assembler()
+{
+    free(mCode);
+}
+
+uint32_t* X86_64Assembler::base() const
+{
+    return mBase;
+}
+
+uint32_t* X86_64Assembler::pc() const
+{
+    return (uint32_t*)((uint8_t*)mBase + mCodeSize);
+}
+
+void X86_64Assembler::reset()
+{
+    mBase = mAssembly->base();
+    mCodeSize = 0;
+    mTranslated = false;
+    mInsns.clear();
+    mOffsets.clear();
+    mBranchTargets.clear();
+    mLabels.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+void X86_64Assembler::disassemble(const char* name)
+{
+    static const char* const names[] = {
+        0, 0, "prolog", "epilog",
+        0, "ADDR_ADD", "ADDR_SUB",
+        "MLA", "MUL", "UMULL", "UMUAL", "SMULL", "SMUAL",
+        "B", "BL", "B", "BL", "BX",
+        "LDR", "LDRB", "STR", "STRB",
+        "LDRH", "LDRSB", "LDRSH", "STRH",
+        "ADDR_LDR", "ADDR_STR", "PLD",
+        "LDM", "STM", "SWP", "SWPB",
+        "CLZ", "QADD", "QDADD", "QSUB", "QDSUB",
+        "SMUL", "SMULW", "SMLA", "SMLAL", "SMLAW"
+    };
+    static const char* const opcodes[] = {
+        "AND", "EOR", "SUB", "RSB", "ADD", "ADC", "SBC", "RSC",
+        "TST", "TEQ", "CMP", "CMN", "ORR", "MOV", "BIC", "MVN"
+    };
+    static const char* const conditions[] = {
+        "EQ", "NE", "CS", "CC", "MI", "PL", "VS", "VC",
+        "HI", "LS", "GE", "LT", "GT", "LE", "", "NV"
+    };
+
+    if (!mTranslated && translate() != NO_ERROR) {
+        return;
+    }
+    if (name) {
+        printf("%s:\n", name);
+    }
+    const uint8_t* code = (const uint8_t*)base();
+    const size_t count = mInsns.size();
+    for (size_t i=0 ; i<count ; i++) {
+        const insn_t& insn = mInsns[i];
+        if (insn.what == I_LABEL) {
+            printf("%s:\n", insn.label);
+            continue;
+        }
+        if (insn.what == I_COMMENT) {
+            printf("; %s\n", insn.label);
+            continue;
+        }
+        char mnemonic[16];
+        snprintf(mnemonic, sizeof(mnemonic), "%s%s%s",
+                insn.what == I_DP ? opcodes[insn.opcode] : names[insn.what],
+                conditions[insn.cc], insn.s ? "S" : "");
+        printf("%p:    %-12s", code + mOffsets[i], mnemonic);
+        for (int o=mOffsets[i] ; o<mOffsets[i+1] ; o++) {
+            printf(" %02x", code[o]);
+        }
+        if (insn.what == I_B || insn.what == I_BL) {
+            printf("    %s", insn.label);
+        }
+        printf("\n");
+    }
+}
+
+void X86_64Assembler::comment(const char* string)
+{
+    record(I_COMMENT, AL, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().label = string;
+}
+
+void X86_64Assembler::label(const char* theLabel)
+{
+    record(I_LABEL, AL, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().label = theLabel;
+}
+
+void X86_64Assembler::B(int cc, const char* label)
+{
+    record(I_B, cc, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().label = label;
+}
+
+void X86_64Assembler::BL(int cc, const char* label)
+{
+    record(I_BL, cc, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().label = label;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Prolog/Epilog & Generate...
+#endif
+
+void X86_64Assembler::prolog()
+{
+    record(I_PROLOG, AL, 0, 0, -1, -1, -1, -1, 0);
+}
+
+void X86_64Assembler::epilog(uint32_t touched)
+{
+    // we know better which registers need saving, once we've seen them all
+    record(I_EPILOG, AL, 0, 0, -1, -1, -1, -1, touched);
+}
+
+int X86_64Assembler::generate(const char* name)
+{
+    if (!mTranslated) {
+        int err = translate();
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+
+    // x86 needs no cache flush
+    const int64_t duration = ggl_system_time() - mDuration;
+    const char * const format = "generated %s (%d bytes) at [%p:%p] in %lld ns\n";
+    LOGI(format, name, int(mCodeSize), base(), pc(), (long long)duration);
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.pf.disasm", value, "0");
+    if (atoi(value) != 0) {
+        printf(format, name, int(mCodeSize), base(), pc(), (long long)duration);
+        disassemble(name);
+    }
+
+    return NO_ERROR;
+}
+
+uint32_t* X86_64Assembler::pcForLabel(const char* label)
+{
+    if (!mTranslated && translate() != NO_ERROR) {
+        return 0;
+    }
+    ssize_t index = mLabels.indexOfKey(label);
+    if (index < 0) {
+        return 0;
+    }
+    return (uint32_t*)((uint8_t*)mBase + mLabels.valueAt(index));
+}
+
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark Recording...
+#endif
+
+void X86_64Assembler::record(int what, int cc, int s, int opcode,
+        int r0, int r1, int r2, int r3, uint32_t arg)
+{
+    insn_t i;
+    i.what = what;
+    i.cc = cc;
+    i.s = s;
+    i.opcode = opcode;
+    i.r[0] = r0;
+    i.r[1] = r1;
+    i.r[2] = r2;
+    i.r[3] = r3;
+    i.arg = arg;
+    i.label = 0;
+    i.target = 0;
+    mInsns.add(i);
+    mTranslated = false;
+}
+
+// GGLAssembler sometimes works on a component the format doesn't have,
+// with register -1. On ARM that register spills into the condition field,
+// which becomes NV, and the instruction never runs.
+static inline int never(int cc, int r0, int r1=0, int r2=0, int r3=0)
+{
+    return (r0|r1|r2|r3) < 0 ? int(ARMAssemblerInterface::NV) : cc;
+}
+
+void X86_64Assembler::dataProcessing(int opcode, int cc,
+        int s, int Rd, int Rn, uint32_t Op2)
+{
+    record(I_DP, never(cc, Rd, Rn), s, opcode, Rd, Rn, -1, -1, Op2);
+}
+
+void X86_64Assembler::ADDR_ADD(int cc, int s, int Rd, int Rn, uint32_t Op2) {
+    record(I_ADDR_ADD, never(cc, Rd, Rn), s, 0, Rd, Rn, -1, -1, Op2);
+}
+void X86_64Assembler::ADDR_SUB(int cc, int s, int Rd, int Rn, uint32_t Op2) {
+    record(I_ADDR_SUB, never(cc, Rd, Rn), s, 0, Rd, Rn, -1, -1, Op2);
+}
+
+void X86_64Assembler::MLA(int cc, int s, int Rd, int Rm, int Rs, int Rn) {
+    record(I_MLA, never(cc, Rd, Rm, Rs, Rn), s, 0, Rd, Rm, Rs, Rn, 0);
+}
+void X86_64Assembler::MUL(int cc, int s, int Rd, int Rm, int Rs) {
+    record(I_MUL, never(cc, Rd, Rm, Rs), s, 0, Rd, Rm, Rs, -1, 0);
+}
+void X86_64Assembler::UMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    record(I_UMULL, never(cc, RdLo, RdHi, Rm, Rs), s, 0, RdLo, RdHi, Rm, Rs, 0);
+}
+void X86_64Assembler::UMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    record(I_UMUAL, never(cc, RdLo, RdHi, Rm, Rs), s, 0, RdLo, RdHi, Rm, Rs, 0);
+}
+void X86_64Assembler::SMULL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    record(I_SMULL, never(cc, RdLo, RdHi, Rm, Rs), s, 0, RdLo, RdHi, Rm, Rs, 0);
+}
+void X86_64Assembler::SMUAL(int cc, int s,
+        int RdLo, int RdHi, int Rm, int Rs) {
+    record(I_SMUAL, never(cc, RdLo, RdHi, Rm, Rs), s, 0, RdLo, RdHi, Rm, Rs, 0);
+}
+
+void X86_64Assembler::B(int cc, uint32_t* pc) {
+    record(I_B_PC, cc, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().target = pc;
+}
+void X86_64Assembler::BL(int cc, uint32_t* pc) {
+    record(I_BL_PC, cc, 0, 0, -1, -1, -1, -1, 0);
+    mInsns.editTop().target = pc;
+}
+void X86_64Assembler::BX(int cc, int Rn) {
+    record(I_BX, never(cc, Rn), 0, 0, Rn, -1, -1, -1, 0);
+}
+
+void X86_64Assembler::LDR(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_LDR, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::LDRB(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_LDRB, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::STR(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_STR, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::STRB(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_STRB, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::LDRH(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_LDRH, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::LDRSB(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_LDRSB, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::LDRSH(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_LDRSH, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::STRH(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_STRH, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::ADDR_LDR(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_ADDR_LDR, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+void X86_64Assembler::ADDR_STR(int cc, int Rd, int Rn, uint32_t offset) {
+    record(I_ADDR_STR, never(cc, Rd, Rn), 0, 0, Rd, Rn, -1, -1, offset);
+}
+
+void X86_64Assembler::LDM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list) {
+    record(I_LDM, cc, W, dir, Rn, -1, -1, -1, reg_list);
+}
+void X86_64Assembler::STM(int cc, int dir,
+        int Rn, int W, uint32_t reg_list) {
+    record(I_STM, cc, W, dir, Rn, -1, -1, -1, reg_list);
+}
+
+void X86_64Assembler::SWP(int cc, int Rn, int Rd, int Rm) {
+    record(I_SWP, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::SWPB(int cc, int Rn, int Rd, int Rm) {
+    record(I_SWPB, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::SWI(int cc, uint32_t comment) {
+    LOG_ALWAYS_FATAL("SWI(%d, %08x) cannot be translated", cc, comment);
+}
+
+void X86_64Assembler::PLD(int Rn, uint32_t offset) {
+    LOG_ALWAYS_FATAL_IF(!((offset&(1<<24)) && !(offset&(1<<21))),
+                        "PLD only P=1, W=0");
+    record(I_PLD, AL, 0, 0, -1, Rn, -1, -1, offset);
+}
+void X86_64Assembler::CLZ(int cc, int Rd, int Rm) {
+    record(I_CLZ, never(cc, Rd, Rm), 0, 0, Rd, Rm, -1, -1, 0);
+}
+void X86_64Assembler::QADD(int cc, int Rd, int Rm, int Rn) {
+    record(I_QADD, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::QDADD(int cc, int Rd, int Rm, int Rn) {
+    record(I_QDADD, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::QSUB(int cc, int Rd, int Rm, int Rn) {
+    record(I_QSUB, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::QDSUB(int cc, int Rd, int Rm, int Rn) {
+    record(I_QDSUB, never(cc, Rd, Rm, Rn), 0, 0, Rd, Rm, Rn, -1, 0);
+}
+void X86_64Assembler::SMUL(int cc, int xy, int Rd, int Rm, int Rs) {
+    record(I_SMUL, never(cc, Rd, Rm, Rs), 0, xy, Rd, Rm, Rs, -1, 0);
+}
+void X86_64Assembler::SMULW(int cc, int y, int Rd, int Rm, int Rs) {
+    record(I_SMULW, never(cc, Rd, Rm, Rs), 0, y, Rd, Rm, Rs, -1, 0);
+}
+void X86_64Assembler::SMLA(int cc, int xy, int Rd, int Rm, int Rs, int Rn) {
+    record(I_SMLA, never(cc, Rd, Rm, Rs, Rn), 0, xy, Rd, Rm, Rs, Rn, 0);
+}
+void X86_64Assembler::SMLAL(int cc, int xy,
+        int RdHi, int RdLo, int Rs, int Rm) {
+    record(I_SMLAL, never(cc, RdLo, RdHi, Rm, Rs),
+            0, xy, RdLo, RdHi, Rm, Rs, 0);
+}
+void X86_64Assembler::SMLAW(int cc, int y, int Rd, int Rm, int Rs, int Rn) {
+    record(I_SMLAW, never(cc, Rd, Rm, Rs, Rn), 0, y, Rd, Rm, Rs, Rn, 0);
+}
+
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark Analysis...
+#endif
+
+static uint32_t registersOfOperand2(uint32_t Op2)
+{
+    if (Op2 & (1<<25))
+        return 0;
+    uint32_t regs = 1 << (Op2 & 0xF);
+    if (Op2 & (1<<4))
+        regs |= 1 << ((Op2>>8) & 0xF);
+    return regs;
+}
+
+static bool isRRX(uint32_t Op2)
+{
+    return !(Op2 & ((1<<25)|(1<<4))) &&
+            ((Op2>>5)&3) == ARMAssemblerInterface::ROR && !((Op2>>7)&0x1F);
+}
+
+uint32_t X86_64Assembler::registersOf(const insn_t& i) const
+{
+    uint32_t regs = 0;
+    for (int k=0 ; k<4 ; k++) {
+        if (i.r[k] >= 0)
+            regs |= 1 << i.r[k];
+    }
+    switch (i.what) {
+    case I_DP:
+        regs = registersOfOperand2(i.arg);
+        if (i.opcode != opMOV && i.opcode != opMVN)
+            regs |= 1 << i.r[1];
+        if (i.opcode < opTST || i.opcode > opCMN)
+            regs |= 1 << i.r[0];
+        break;
+    case I_ADDR_ADD:
+    case I_ADDR_SUB:
+        regs |= registersOfOperand2(i.arg);
+        break;
+    case I_LDR: case I_LDRB: case I_STR: case I_STRB:
+    case I_ADDR_LDR: case I_ADDR_STR: case I_PLD:
+        if (i.arg & (1<<25))
+            regs |= 1 << (i.arg & 0xF);
+        break;
+    case I_LDRH: case I_LDRSB: case I_LDRSH: case I_STRH:
+        if (!(i.arg & (1<<22)))
+            regs |= 1 << (i.arg & 0xF);
+        break;
+    case I_LDM:
+    case I_STM:
+        regs |= i.arg;
+        break;
+    }
+    return regs;
+}
+
+bool X86_64Assembler::setsFlags(const insn_t& i) const
+{
+    switch (i.what) {
+    case I_DP:
+        return i.s || (i.opcode >= opTST && i.opcode <= opCMN);
+    case I_ADDR_ADD: case I_ADDR_SUB:
+    case I_MLA: case I_MUL:
+    case I_UMULL: case I_UMUAL: case I_SMULL: case I_SMUAL:
+        return i.s;
+    }
+    return false;
+}
+
+bool X86_64Assembler::readsFlags(const insn_t& i) const
+{
+    if (i.cc != AL && i.cc != NV)
+        return true;
+    if (i.what == I_DP) {
+        if (i.opcode == opADC || i.opcode == opSBC || i.opcode == opRSC)
+            return true;
+        return isRRX(i.arg);
+    }
+    return false;
+}
+
+// which instructions are followed by code that reads the flags,
+// so that we don't clobber them there.
+void X86_64Assembler::computeFlagsLiveness()
+{
+    const size_t count = mInsns.size();
+    KeyedVector<const char*, int> labels;
+    for (size_t i=0 ; i<count ; i++) {
+        if (mInsns[i].what == I_LABEL)
+            labels.add(mInsns[i].label, i);
+    }
+
+    Vector<uint8_t> liveIn;
+    mFlagsLive.clear();
+    liveIn.insertAt(0, 0, count + 1);
+    mFlagsLive.insertAt(0, 0, count);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (ssize_t i=count-1 ; i>=0 ; i--) {
+            const insn_t& insn = mInsns[i];
+            bool next = true;
+            int live = 0;
+            if (insn.what == I_B) {
+                ssize_t target = labels.indexOfKey(insn.label);
+                if (target >= 0)
+                    live = liveIn[labels.valueAt(target)];
+                next = (insn.cc != AL);
+            } else if (insn.what == I_EPILOG ||
+                    insn.what == I_B_PC || insn.what == I_BX) {
+                next = (insn.cc != AL);
+            }
+            if (next)
+                live |= liveIn[i+1];
+            mFlagsLive.editItemAt(i) = live;
+
+            const int in = readsFlags(insn) ||
+                    (live && !(setsFlags(insn) && insn.cc == AL));
+            if (liveIn[i] != in) {
+                liveIn.editItemAt(i) = in;
+                changed = true;
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark Translation...
+#endif
+
+int X86_64Assembler::translate()
+{
+    mCodeSize = 0;
+    mOffsets.clear();
+    mBranchTargets.clear();
+    mLabels.clear();
+
+    const size_t count = mInsns.size();
+
+    // which registers the program uses, one it doesn't can be our
+    // second temporary
+    uint32_t used = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        if (mInsns[i].cc != NV)
+            used |= registersOf(mInsns[i]);
+    }
+    static const int8_t spare[] = {
+        R11, R10, R9, R8, R7, R6, R5, R4, R14, R12, R3, R2, R1
+    };
+    mFree = -1;
+    for (size_t i=0 ; i<sizeof(spare) ; i++) {
+        if (!(used & (1<<spare[i]))) {
+            mFree = sRegisters[int(spare[i])];
+            break;
+        }
+    }
+    uint32_t x86used = 0;
+    for (int r=0 ; r<15 ; r++) {
+        if (used & (1<<r))
+            x86used |= 1 << sRegisters[r];
+    }
+    if (mFree >= 0)
+        x86used |= 1 << mFree;
+    mSaved = 0;
+    for (size_t i=0 ; i<sizeof(sCalleeSaved) ; i++) {
+        mSaved |= x86used & (1 << sCalleeSaved[i]);
+    }
+
+    computeFlagsLiveness();
+
+    mBorrowed = -1;
+    for (size_t i=0 ; i<count ; i++) {
+        const insn_t& insn = mInsns[i];
+        mOffsets.add(mCodeSize);
+        if (insn.what == I_LABEL) {
+            mLabels.add(insn.label, mCodeSize);
+            continue;
+        }
+        if (insn.what == I_COMMENT || insn.cc == NV) {
+            continue;
+        }
+
+        const uint32_t regs = registersOf(insn);
+        mInUse = (1<<TMP) | (1<<RSP);
+        for (int r=0 ; r<15 ; r++) {
+            if (regs & (1<<r))
+                mInUse |= 1 << sRegisters[r];
+        }
+        mClobbered = false;
+
+        // conditional instructions are branched around, except branches
+        int skip = -1;
+        if (insn.cc != AL && insn.what != I_B) {
+            skip = jcc8(sConditions[insn.cc ^ 1]);
+        }
+        const size_t body = mCodeSize;
+        const size_t branches = mBranchTargets.size();
+
+        translate(insn);
+        releaseTemporary();
+
+        if (mClobbered && mFlagsLive[i] && !setsFlags(insn)) {
+            // someone after us needs the flags we just trashed
+            emit8(0x9C);
+            memmove(mCode + body + 1, mCode + body, mCodeSize - body - 1);
+            mCode[body] = 0x9C;     // pushfq
+            emit8(0x9D);            // popfq
+            for (size_t b=branches ; b<mBranchTargets.size() ; b++) {
+                mBranchTargets.editItemAt(b).offset++;
+            }
+        }
+        if (skip >= 0) {
+            bind8(skip);
+        }
+    }
+    mOffsets.add(mCodeSize);
+
+    // fixup all the branches
+    size_t n = mBranchTargets.size();
+    while (n--) {
+        const branch_target_t& bt = mBranchTargets[n];
+        ssize_t index = mLabels.indexOfKey(bt.label);
+        if (index < 0) {
+            // GGLAssembler gave up half way, and asks for its labels
+            // anyways, see GGLAssembler::scanline()
+            return BAD_VALUE;
+        }
+        int32_t offset = mLabels.valueAt(index) - (bt.offset + 4);
+        memcpy(mCode + bt.offset, &offset, 4);
+    }
+
+    // the code doesn't depend on where it lives, copy it over
+    if (mAssembly->resize(mCodeSize) < 0) {
+        return NO_MEMORY;
+    }
+    mBase = mAssembly->base();
+    memcpy(mBase, mCode, mCodeSize);
+    mTranslated = true;
+    return NO_ERROR;
+}
+
+void X86_64Assembler::translate(const insn_t& i)
+{
+    switch (i.what) {
+    case I_PROLOG:
+        for (size_t k=0 ; k<sizeof(sCalleeSaved) ; k++) {
+            if (mSaved & (1 << sCalleeSaved[k]))
+                push(sCalleeSaved[k]);
+        }
+        break;
+    case I_EPILOG:
+        for (ssize_t k=sizeof(sCalleeSaved)-1 ; k>=0 ; k--) {
+            if (mSaved & (1 << sCalleeSaved[k]))
+                pop(sCalleeSaved[k]);
+        }
+        emit8(0xC3);    // ret
+        break;
+    case I_DP:
+        dataProcessing(i);
+        break;
+    case I_ADDR_ADD: case I_ADDR_SUB:
+        addressArithmetic(i);
+        break;
+    case I_MLA: case I_MUL:
+        multiply(i);
+        break;
+    case I_UMULL: case I_UMUAL: case I_SMULL: case I_SMUAL:
+        longMultiply(i);
+        break;
+    case I_SMUL: case I_SMULW: case I_SMLA: case I_SMLAL: case I_SMLAW:
+        halfwordMultiply(i);
+        break;
+    case I_QADD: case I_QDADD: case I_QSUB: case I_QDSUB:
+        saturatingArithmetic(i);
+        break;
+    case I_B: case I_BL: case I_B_PC: case I_BL_PC: case I_BX:
+        branch(i);
+        break;
+    case I_LDR: case I_LDRB: case I_STR: case I_STRB:
+    case I_LDRH: case I_LDRSB: case I_LDRSH: case I_STRH:
+    case I_ADDR_LDR: case I_ADDR_STR: case I_PLD:
+        dataTransfer(i);
+        break;
+    case I_LDM: case I_STM:
+        blockDataTransfer(i);
+        break;
+    case I_SWP:
+        mov(0, TMP, xreg(i.r[1]));
+        opRM(0x87, 0, TMP, mem_t(xreg(i.r[2])));        // xchg
+        mov(0, xreg(i.r[0]), TMP);
+        break;
+    case I_SWPB:
+        mov(0, TMP, xreg(i.r[1]));
+        opRM(0x86, 0, TMP, mem_t(xreg(i.r[2])));        // xchg
+        opRR(0x0FB6, 0, xreg(i.r[0]), TMP);             // movzx
+        break;
+    case I_CLZ: {
+        // 31 - bsr, which tells zero apart with ZF
+        opRR(0x0FBD, 0, TMP, xreg(i.r[1]));
+        mClobbered = true;
+        int nonzero = jcc8(X86_NE);
+        mov(0, TMP, operand_t(-1, 0xFFFFFFFF));
+        bind8(nonzero);
+        unary(xNEG, 0, TMP);
+        alu(xADD, 0, TMP, operand_t(-1, 31));
+        mov(0, xreg(i.r[0]), TMP);
+        break;
+    }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+int X86_64Assembler::xreg(int armReg) const
+{
+    LOG_ALWAYS_FATAL_IF(armReg < 0 || armReg >= PC,
+            "register r%d cannot be translated", armReg);
+    return sRegisters[armReg];
+}
+
+// a scratch register besides rcx, for the instruction being translated
+int X86_64Assembler::temporary()
+{
+    if (mFree >= 0)
+        return mFree;
+    if (mBorrowed >= 0)
+        return mBorrowed;
+    for (int r=0 ; r<16 ; r++) {
+        if (!(mInUse & (1<<r))) {
+            push(r);
+            mBorrowed = r;
+            return r;
+        }
+    }
+    LOG_ALWAYS_FATAL("out of registers");
+    return -1;
+}
+
+void X86_64Assembler::releaseTemporary()
+{
+    if (mBorrowed >= 0) {
+        pop(mBorrowed);
+        mBorrowed = -1;
+    }
+}
+
+// evaluates an operand 2, in rcx (or a temporary) if it needs shifting
+X86_64Assembler::operand_t X86_64Assembler::operand2(uint32_t Op2)
+{
+    if (Op2 & (1<<25)) {
+        const uint32_t rot = ((Op2>>8) & 0xF) * 2;
+        const uint32_t imm = Op2 & 0xFF;
+        return operand_t(-1, rot ? (imm>>rot) | (imm<<(32-rot)) : imm);
+    }
+
+    static const int shifts[4] = { xSHL, xSHR, xSAR, xROR };
+    const int Rm = xreg(Op2 & 0xF);
+    const int type = (Op2>>5) & 3;
+
+    if (Op2 & (1<<4)) {
+        // shift by register, ARM uses the whole bottom byte
+        const int t = temporary();
+        mov(0, TMP, xreg((Op2>>8) & 0xF));
+        opRR(0x0FB6, 0, TMP, TMP);                      // movzx ecx, cl
+        mov(0, t, Rm);
+        if (type != ROR) {
+            alu(xCMP, 0, TMP, operand_t(-1, 32));
+            int inRange = jcc8(0x2);                    // jb
+            if (type == ASR) {
+                mov(0, TMP, operand_t(-1, 31));
+            } else {
+                mov(0, t, operand_t(-1, 0));
+            }
+            bind8(inRange);
+        }
+        shift(shifts[type], 0, t, -1);
+        return operand_t(t);
+    }
+
+    const int amount = (Op2>>7) & 0x1F;
+    if (type == LSL && amount == 0)
+        return operand_t(Rm);
+
+    mov(0, TMP, Rm);
+    if (amount) {
+        shift(shifts[type], 0, TMP, amount);
+    } else if (type == LSR) {
+        mov(0, TMP, operand_t(-1, 0));                  // LSR #32
+    } else if (type == ASR) {
+        shift(xSAR, 0, TMP, 31);                        // ASR #32
+    } else {
+        emit8(0xF5);                                    // RRX: cmc
+        opRR(0xD1, 0, xRCR, TMP);                       // rcr ecx, 1
+        mClobbered = true;
+    }
+    return operand_t(TMP);
+}
+
+// MOV Rd, Rm LSL #n without touching the flags
+bool X86_64Assembler::shiftWithoutFlags(int d, uint32_t Op2)
+{
+    if ((Op2 & ((1<<25)|(1<<4))) || ((Op2>>5)&3) != LSL)
+        return false;
+    int amount = (Op2>>7) & 0x1F;
+    if (amount == 0 || amount > 9)
+        return false;
+    int r = xreg(Op2 & 0xF);
+    while (amount) {
+        const int k = amount < 3 ? amount : 3;
+        lea(0, d, k == 1 ? mem_t(r, r, 0, 0) : mem_t(-1, r, k, 0));
+        amount -= k;
+        r = d;
+    }
+    return true;
+}
+
+void X86_64Assembler::dataProcessing(const insn_t& i)
+{
+    const int opcode = i.opcode;
+    const int s = i.s;
+    const uint32_t Op2 = i.arg;
+    const bool simple = (Op2 & (1<<25)) ||
+            !(Op2 & ((1<<4) | (0x7F<<5)));  // immediate or Rm LSL #0
+    const bool keepFlags = !setsFlags(i);
+
+    if (opcode == opMOV || opcode == opMVN) {
+        const int d = xreg(i.r[0]);
+        if (opcode == opMOV && keepFlags && shiftWithoutFlags(d, Op2))
+            return;
+        if (!(Op2 & ((1<<25)|(1<<4))) && !isRRX(Op2) &&
+                xreg(Op2 & 0xF) != TMP) {
+            // shift in place
+            mov(0, d, xreg(Op2 & 0xF));
+            const int amount = (Op2>>7) & 0x1F;
+            switch ((Op2>>5) & 3) {
+            case LSL:
+                if (amount) shift(xSHL, 0, d, amount);
+                break;
+            case LSR:
+                if (amount) shift(xSHR, 0, d, amount);
+                else        mov(0, d, operand_t(-1, 0));
+                break;
+            case ASR:
+                shift(xSAR, 0, d, amount ? amount : 31);
+                break;
+            case ROR:
+                shift(xROR, 0, d, amount);
+                break;
+            }
+        } else {
+            const operand_t o = operand2(Op2);
+            if (o.reg < 0) {
+                mov(0, d, operand_t(-1, opcode==opMVN ? ~o.imm : o.imm));
+            } else {
+                mov(0, d, o);
+            }
+        }
+        if (opcode == opMVN && !(Op2 & (1<<25))) {
+            unary(xNOT, 0, d);
+        }
+        if (s) {
+            test(0, d, operand_t(d));
+        }
+        return;
+    }
+
+    const int n = xreg(i.r[1]);
+
+    if (opcode >= opTST && opcode <= opCMN) {
+        const operand_t o = operand2(Op2);
+        switch (opcode) {
+        case opTST:
+            test(0, n, o);
+            break;
+        case opCMP:
+            alu(xCMP, 0, n, o);
+            break;
+        case opTEQ:
+        case opCMN:
+            alu3(opcode == opTEQ ? xXOR : xADD, TMP, operand_t(n), o, 1);
+            if (opcode == opCMN)
+                emit8(0xF5);                            // cmc
+            break;
+        }
+        return;
+    }
+
+    const int d = xreg(i.r[0]);
+
+    // three operand forms that leave the flags alone
+    if (!s && (opcode == opADD || opcode == opSUB)) {
+        if (Op2 & (1<<25)) {
+            int32_t imm = operand2(Op2).imm;
+            lea(0, d, mem_t(n, opcode == opADD ? imm : -imm));
+            return;
+        }
+        const int amount = (Op2>>7) & 0x1F;
+        if (opcode == opADD && !(Op2 & (1<<4)) &&
+                ((Op2>>5)&3) == LSL && amount <= 3 &&
+                xreg(Op2 & 0xF) != RSP && (d != n || keepFlags)) {
+            lea(0, d, mem_t(n, xreg(Op2 & 0xF), amount, 0));
+            return;
+        }
+    }
+    if (!s && opcode == opRSB && Op2 == imm(0) && d == n) {
+        unary(xNEG, 0, d);
+        return;
+    }
+
+    // ADC, SBC and RSC read the carry, which a shift would destroy
+    const bool carry = (opcode == opADC || opcode == opSBC || opcode == opRSC);
+    if (carry && !simple)
+        emit8(0x9C);                                    // pushfq
+    operand_t o = operand2(Op2);
+    if (carry && !simple)
+        emit8(0x9D);                                    // popfq
+
+    switch (opcode) {
+    case opAND: alu3(xAND, d, operand_t(n), o, 1);      break;
+    case opEOR: alu3(xXOR, d, operand_t(n), o, 1);      break;
+    case opORR: alu3(xOR,  d, operand_t(n), o, 1);      break;
+    case opSUB: alu3(xSUB, d, operand_t(n), o, 0);      break;
+    case opRSB: alu3(xSUB, d, o, operand_t(n), 0);      break;
+    case opSBC: alu3(xSBB, d, operand_t(n), o, 0);      break;
+    case opRSC: alu3(xSBB, d, o, operand_t(n), 0);      break;
+    case opBIC:
+        if (o.reg < 0) {
+            o.imm = ~o.imm;
+        } else {
+            mov(0, TMP, o);
+            unary(xNOT, 0, TMP);
+            o = operand_t(TMP);
+        }
+        alu3(xAND, d, operand_t(n), o, 1);
+        break;
+    case opADD:
+        alu3(xADD, d, operand_t(n), o, 1);
+        if (s) emit8(0xF5);                             // cmc
+        break;
+    case opADC:
+        // our carry is inverted, ARM's goes in
+        alu3(xADC, d, operand_t(n), o, 1 | 2);
+        if (s) emit8(0xF5);
+        break;
+    }
+}
+
+void X86_64Assembler::addressArithmetic(const insn_t& i)
+{
+    const int d = xreg(i.r[0]);
+    const int n = xreg(i.r[1]);
+    const uint32_t Op2 = i.arg;
+    const bool sub = (i.what == I_ADDR_SUB);
+
+    // the offset is a signed 32-bit value, make it 64 bits
+    int scale = 0;
+    if (Op2 & (1<<25)) {
+        int32_t imm = operand2(Op2).imm;
+        if (!i.s) {
+            lea(1, d, mem_t(n, sub ? -imm : imm));
+            return;
+        }
+        mov(1, TMP, operand_t(-1, imm));
+    } else if (!(Op2 & (1<<4)) && ((Op2>>5)&3) == LSL &&
+            ((Op2>>7)&0x1F) <= 3) {
+        scale = (Op2>>7) & 0x1F;
+        opRR(0x63, 1, TMP, xreg(Op2 & 0xF));            // movsxd
+    } else {
+        opRR(0x63, 1, TMP, operand2(Op2).reg);
+    }
+
+    if (!i.s) {
+        if (sub) {
+            // -x == ~x + 1
+            unary(xNOT, 1, TMP);
+            lea(1, d, mem_t(n, TMP, scale, 1<<scale));
+        } else {
+            lea(1, d, mem_t(n, TMP, scale, 0));
+        }
+        return;
+    }
+    if (scale)
+        shift(xSHL, 1, TMP, scale);
+    mov(1, d, n);
+    alu(sub ? xSUB : xADD, 1, d, TMP);
+    if (!sub)
+        emit8(0xF5);                                    // cmc
+}
+
+void X86_64Assembler::multiply(const insn_t& i)
+{
+    const int d = xreg(i.r[0]);
+    const int m = xreg(i.r[1]);
+    const int s = xreg(i.r[2]);
+
+    if (i.what == I_MLA && xreg(i.r[3]) == d) {
+        mov(0, TMP, m);
+        opRR(0x0FAF, 0, TMP, s);                        // imul
+        alu(xADD, 0, d, TMP);
+        return;
+    }
+    if (d == m) {
+        opRR(0x0FAF, 0, d, s);
+    } else if (d == s) {
+        opRR(0x0FAF, 0, d, m);
+    } else {
+        mov(0, d, m);
+        opRR(0x0FAF, 0, d, s);
+    }
+    mClobbered = true;
+    if (i.what == I_MLA) {
+        alu(xADD, 0, d, xreg(i.r[3]));
+    } else if (i.s) {
+        test(0, d, operand_t(d));
+    }
+}
+
+void X86_64Assembler::longMultiply(const insn_t& i)
+{
+    const int lo = xreg(i.r[0]);
+    const int hi = xreg(i.r[1]);
+    const int m = xreg(i.r[2]);
+    const int s = xreg(i.r[3]);
+    const bool sign = (i.what == I_SMULL || i.what == I_SMUAL);
+    const int t = temporary();
+
+    if (sign) {
+        opRR(0x63, 1, TMP, m);                          // movsxd
+        opRR(0x63, 1, t, s);
+    } else {
+        mov(0, TMP, m);
+        mov(0, t, s);
+    }
+    opRR(0x0FAF, 1, TMP, t);                            // imul
+    mClobbered = true;
+    if (i.what == I_UMUAL || i.what == I_SMUAL) {
+        mov(0, t, lo);
+        alu(xADD, 1, TMP, t);
+        mov(0, t, hi);
+        shift(xSHL, 1, t, 32);
+        alu(xADD, 1, TMP, t);
+    }
+    mov(0, lo, TMP);
+    mov(1, t, TMP);
+    shift(xSHR, 1, t, 32);
+    mov(0, hi, t);
+    if (i.s) {
+        test(1, TMP, operand_t(TMP));
+    }
+}
+
+// d = the bottom or top half of s, sign extended to 32 or 64 bits
+void X86_64Assembler::halfword(int d, int s, int top, int w)
+{
+    if (!top) {
+        opRR(0x0FBF, w, d, s);                          // movsx
+        return;
+    }
+    mov(0, d, s);
+    shift(xSAR, 0, d, 16);
+    if (w)
+        opRR(0x63, 1, d, d);                            // movsxd
+}
+
+void X86_64Assembler::halfwordMultiply(const insn_t& i)
+{
+    const int x = (i.opcode >> 1) & 1;
+    const int y = (i.opcode >> 2) & 1;
+    const int d = xreg(i.r[0]);
+    const int m = xreg(i.r[1]);
+    const int s = xreg(i.r[2]);
+    mClobbered = true;
+
+    switch (i.what) {
+    case I_SMUL:
+        halfword(TMP, m, x, 0);
+        halfword(d, s, y, 0);
+        opRR(0x0FAF, 0, d, TMP);
+        break;
+    case I_SMULW:
+        opRR(0x63, 1, TMP, m);
+        halfword(d, s, y, 1);
+        opRR(0x0FAF, 1, TMP, d);
+        shift(xSAR, 1, TMP, 16);
+        mov(0, d, TMP);
+        break;
+    case I_SMLA: {
+        const int n = xreg(i.r[3]);
+        const int t = (d != n) ? d : temporary();
+        halfword(TMP, m, x, 0);
+        halfword(t, s, y, 0);
+        opRR(0x0FAF, 0, t, TMP);
+        alu(xADD, 0, d, t == d ? n : t);
+        break;
+    }
+    case I_SMLAW: {
+        const int n = xreg(i.r[3]);
+        const int t = (d != n) ? d : temporary();
+        opRR(0x63, 1, TMP, m);
+        halfword(t, s, y, 1);
+        opRR(0x0FAF, 1, TMP, t);
+        shift(xSAR, 1, TMP, 16);
+        if (t == d) {
+            lea(0, d, mem_t(TMP, n, 0, 0));
+        } else {
+            alu(xADD, 0, d, TMP);
+        }
+        break;
+    }
+    case I_SMLAL: {
+        // d is RdLo, m is RdHi, s is Rm and r[3] is Rs
+        const int lo = d;
+        const int hi = m;
+        const int t = temporary();
+        halfword(TMP, s, x, 0);
+        halfword(t, xreg(i.r[3]), y, 0);
+        opRR(0x0FAF, 0, TMP, t);
+        opRR(0x63, 1, TMP, TMP);
+        mov(0, t, lo);
+        alu(xADD, 1, TMP, t);
+        mov(0, t, hi);
+        shift(xSHL, 1, t, 32);
+        alu(xADD, 1, TMP, t);
+        mov(0, lo, TMP);
+        mov(1, t, TMP);
+        shift(xSHR, 1, t, 32);
+        mov(0, hi, t);
+        break;
+    }
+    }
+}
+
+// clamps the 64-bit r to a signed 32-bit value
+void X86_64Assembler::saturate(int r)
+{
+    alu(xCMP, 1, r, operand_t(-1, 0x7FFFFFFF));
+    int notAbove = jcc8(X86_LE);
+    mov(0, r, operand_t(-1, 0x7FFFFFFF));
+    int done = jcc8(X86_JMP);
+    bind8(notAbove);
+    alu(xCMP, 1, r, operand_t(-1, 0x80000000));
+    int notBelow = jcc8(X86_GE);
+    mov(1, r, operand_t(-1, 0x80000000));
+    bind8(done);
+    bind8(notBelow);
+}
+
+void X86_64Assembler::saturatingArithmetic(const insn_t& i)
+{
+    const int t = temporary();
+    opRR(0x63, 1, t, xreg(i.r[2]));                     // movsxd
+    if (i.what == I_QDADD || i.what == I_QDSUB) {
+        alu(xADD, 1, t, t);
+        saturate(t);
+    }
+    opRR(0x63, 1, TMP, xreg(i.r[1]));
+    alu((i.what == I_QADD || i.what == I_QDADD) ? xADD : xSUB, 1, TMP, t);
+    saturate(TMP);
+    mov(0, xreg(i.r[0]), TMP);
+}
+
+void X86_64Assembler::dataTransfer(const insn_t& i)
+{
+    const uint32_t offset = i.arg;
+    const bool half = (i.what >= I_LDRH && i.what <= I_STRH);
+    const bool reg = half ? !(offset & (1<<22)) : (offset & (1<<25));
+    const int P = (offset>>24) & 1;
+    const int U = (offset>>23) & 1;
+    const int W = (offset>>21) & 1;
+    const int base = xreg(i.r[1]);
+
+    // the stack holds 64-bit registers, so pointers can be spilled
+    const bool stack = (i.r[1] == SP);
+    const int wide = (i.what == I_ADDR_LDR || i.what == I_ADDR_STR ||
+            (stack && (i.what == I_LDR || i.what == I_STR)));
+
+    mem_t off(base);
+    if (!reg) {
+        int32_t imm = half ? (((offset>>4)&0xF0) | (offset&0xF))
+                           : (offset & 0xFFF);
+        if (stack)
+            imm *= 2;
+        off.disp = U ? imm : -imm;
+    } else {
+        // register offsets are signed
+        int scale = 0;
+        const int type = (offset>>5) & 3;
+        const int amount = (offset>>7) & 0x1F;
+        if (half || (type == LSL && amount <= 3)) {
+            if (!half)
+                scale = amount;
+            opRR(0x63, 1, TMP, xreg(offset & 0xF));     // movsxd
+        } else {
+            opRR(0x63, 1, TMP, operand2(offset & 0xFFF).reg);
+        }
+        off = mem_t(base, TMP, scale, 0);
+        if (!U) {
+            unary(xNOT, 1, TMP);
+            off.disp = 1<<scale;
+        }
+    }
+
+    mem_t addr(base);
+    if (P && !W) {
+        addr = off;
+    } else if (P) {
+        lea(1, base, off);
+    }
+
+    const int d = (i.what == I_PLD) ? 0 : xreg(i.r[0]);
+    switch (i.what) {
+    case I_LDR:
+    case I_ADDR_LDR:
+        opRM(0x8B, wide, d, addr);
+        break;
+    case I_STR:
+    case I_ADDR_STR:
+        opRM(0x89, wide, d, addr);
+        break;
+    case I_LDRB:    opRM(0x0FB6, 0, d, addr);           break;
+    case I_LDRSB:   opRM(0x0FBE, 0, d, addr);           break;
+    case I_LDRH:    opRM(0x0FB7, 0, d, addr);           break;
+    case I_LDRSH:   opRM(0x0FBF, 0, d, addr);           break;
+    case I_STRB:
+        opRM(0x88, 0, d, addr, d >= RSP && d <= RDI);
+        break;
+    case I_STRH:
+        emit8(0x66);
+        opRM(0x89, 0, d, addr);
+        break;
+    case I_PLD:
+        opRM(0x0F18, 0, 1, addr);                       // prefetcht0
+        break;
+    }
+
+    if (!P) {
+        lea(1, base, off);
+    }
+}
+
+void X86_64Assembler::blockDataTransfer(const insn_t& i)
+{   //                        ED FD EA FA      IB IA DB DA
+    static const uint8_t LP[8] = { 1, 0, 1, 0,      1, 0, 1, 0 };
+    static const uint8_t LU[8] = { 1, 1, 0, 0,      1, 1, 0, 0 };
+    //                        FA EA FD ED      IB IA DB DA
+    static const uint8_t SP_[8] = { 0, 1, 0, 1,      1, 0, 1, 0 };
+    static const uint8_t SU[8] = { 0, 0, 1, 1,      1, 1, 0, 0 };
+
+    const bool load = (i.what == I_LDM);
+    const int P = load ? LP[i.opcode] : SP_[i.opcode];
+    const int U = load ? LU[i.opcode] : SU[i.opcode];
+    const int W = i.s;
+    const uint32_t list = i.arg;
+    const int base = xreg(i.r[0]);
+    const int wide = (i.r[0] == SP);
+    const int slot = wide ? 8 : 4;
+
+    LOG_ALWAYS_FATAL_IF(list & LPC, "LDM/STM of pc cannot be translated");
+
+    int count = 0;
+    for (int r=0 ; r<16 ; r++) {
+        if (list & (1<<r))
+            count++;
+    }
+
+    // registers go in ascending order from the lowest address
+    int32_t disp;
+    if (U) {
+        disp = P ? slot : 0;
+    } else {
+        disp = P ? -count*slot : -count*slot + slot;
+        if (W) {
+            // move the base first, nothing lives below the stack pointer
+            lea(1, base, mem_t(base, -count*slot));
+            disp += count*slot;
+        }
+    }
+    for (int r=0 ; r<16 ; r++) {
+        if (list & (1<<r)) {
+            opRM(load ? 0x8B : 0x89, wide, xreg(r), mem_t(base, disp));
+            disp += slot;
+        }
+    }
+    if (W && U) {
+        lea(1, base, mem_t(base, count*slot));
+    }
+}
+
+void X86_64Assembler::branch(const insn_t& i)
+{
+    switch (i.what) {
+    case I_B:
+        if (i.cc == AL) {
+            emit8(0xE9);                                // jmp rel32
+        } else {
+            emit8(0x0F);                                // jcc rel32
+            emit8(0x80 | sConditions[i.cc]);
+        }
+        mBranchTargets.add(branch_target_t(i.label, mCodeSize));
+        emit32(0);
+        break;
+    case I_BL:
+        emit8(0xE8);                                    // call rel32
+        mBranchTargets.add(branch_target_t(i.label, mCodeSize));
+        emit32(0);
+        break;
+    case I_B_PC:
+    case I_BL_PC:
+        rex(1, 0, -1, TMP);
+        emit8(0xB8 | TMP);                              // mov rcx, imm64
+        emit64(uintptr_t(i.target));
+        opRR(0xFF, 0, i.what == I_B_PC ? 4 : 2, TMP);   // jmp/call rcx
+        break;
+    case I_BX:
+        if (i.r[0] == LR) {
+            // that's how ARM code returns
+            insn_t epilog = i;
+            epilog.what = I_EPILOG;
+            translate(epilog);
+        } else {
+            opRR(0xFF, 0, 4, xreg(i.r[0]));             // jmp reg
+        }
+        break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+#if 0
+#pragma mark -
+#pragma mark Encoding...
+#endif
+
+void X86_64Assembler::emit8(uint32_t b)
+{
+    if (mCodeSize == mCodeCapacity) {
+        mCodeCapacity = mCodeCapacity ? mCodeCapacity*2 : 4096;
+        mCode = (uint8_t*)realloc(mCode, mCodeCapacity);
+        LOG_ALWAYS_FATAL_IF(!mCode, "out of memory");
+    }
+    mCode[mCodeSize++] = uint8_t(b);
+}
+
+void X86_64Assembler::emit32(uint32_t v)
+{
+    for (int k=0 ; k<4 ; k++, v >>= 8)
+        emit8(v);
+}
+
+void X86_64Assembler::emit64(uint64_t v)
+{
+    emit32(uint32_t(v));
+    emit32(uint32_t(v >> 32));
+}
+
+void X86_64Assembler::rex(int w, int reg, int index, int base, int byteReg)
+{
+    const int r = (w ? 8 : 0) |
+            ((reg   > 0 && (reg   & 8)) ? 4 : 0) |
+            ((index > 0 && (index & 8)) ? 2 : 0) |
+            ((base  > 0 && (base  & 8)) ? 1 : 0);
+    if (r || byteReg)
+        emit8(0x40 | r);
+}
+
+void X86_64Assembler::opcode(int op)
+{
+    if (op > 0xFF)
+        emit8(op >> 8);
+    emit8(op);
+}
+
+void X86_64Assembler::opRR(int op, int w, int reg, int rm, int byteReg)
+{
+    rex(w, reg, -1, rm, byteReg);
+    opcode(op);
+    emit8(0xC0 | ((reg&7)<<3) | (rm&7));
+}
+
+void X86_64Assembler::opRM(int op, int w, int reg, const mem_t& m, int byteReg)
+{
+    LOG_ALWAYS_FATAL_IF(m.index == RSP, "rsp cannot be an index");
+    rex(w, reg, m.index, m.base, byteReg);
+    opcode(op);
+    const int r = (reg&7) << 3;
+    if (m.base < 0) {
+        // [index*scale + disp32]
+        emit8(0x04 | r);
+        emit8((m.scale<<6) | ((m.index&7)<<3) | 5);
+        emit32(m.disp);
+        return;
+    }
+    const int b = m.base & 7;
+    int mod = 2;
+    if (m.disp == 0 && b != 5)
+        mod = 0;
+    else if (m.disp >= -128 && m.disp < 128)
+        mod = 1;
+    if (m.index < 0 && b != 4) {
+        emit8((mod<<6) | r | b);
+    } else if (m.index < 0) {
+        emit8((mod<<6) | r | 4);
+        emit8((4<<3) | b);
+    } else {
+        emit8((mod<<6) | r | 4);
+        emit8((m.scale<<6) | ((m.index&7)<<3) | b);
+    }
+    if (mod == 1)
+        emit8(m.disp);
+    else if (mod == 2)
+        emit32(m.disp);
+}
+
+void X86_64Assembler::alu(int ext, int w, int d, const operand_t& o)
+{
+    if (o.reg >= 0) {
+        opRR((ext<<3) | 3, w, d, o.reg);
+    } else if (int32_t(o.imm) >= -128 && int32_t(o.imm) < 128) {
+        opRR(0x83, w, ext, d);
+        emit8(o.imm);
+    } else {
+        opRR(0x81, w, ext, d);
+        emit32(o.imm);
+    }
+    mClobbered = true;
+}
+
+// d = a op b, in two operand instructions. bit 0 of flags says the
+// operation commutes, bit 1 that our carry must be flipped right before.
+void X86_64Assembler::alu3(int ext, int d,
+        const operand_t& a, const operand_t& b, int flags)
+{
+    if (a.reg != d) {
+        if (b.reg == d && (flags & 1)) {
+            if (flags & 2) emit8(0xF5);
+            alu(ext, 0, d, a);
+            return;
+        }
+        if (b.reg == d) {
+            if (a.reg != TMP)
+                mov(0, TMP, a);
+            if (flags & 2) emit8(0xF5);
+            alu(ext, 0, TMP, b);
+            mov(0, d, TMP);
+            return;
+        }
+        mov(0, d, a);
+    }
+    if (flags & 2) emit8(0xF5);                         // cmc
+    alu(ext, 0, d, b);
+}
+
+void X86_64Assembler::shift(int ext, int w, int d, int amount)
+{
+    if (amount < 0) {
+        opRR(0xD3, w, ext, d);                          // by cl
+    } else {
+        opRR(0xC1, w, ext, d);
+        emit8(amount);
+    }
+    mClobbered = true;
+}
+
+void X86_64Assembler::mov(int w, int d, const operand_t& o)
+{
+    if (o.reg >= 0) {
+        if (o.reg != d)
+            opRR(0x8B, w, d, o.reg);
+    } else if (!w) {
+        rex(0, 0, -1, d);
+        emit8(0xB8 | (d&7));
+        emit32(o.imm);
+    } else {
+        opRR(0xC7, 1, 0, d);                            // sign extended
+        emit32(o.imm);
+    }
+}
+
+void X86_64Assembler::lea(int w, int d, const mem_t& m)
+{
+    opRM(0x8D, w, d, m);
+}
+
+void X86_64Assembler::unary(int ext, int w, int d)
+{
+    opRR(0xF7, w, ext, d);
+    if (ext != xNOT)
+        mClobbered = true;
+}
+
+void X86_64Assembler::test(int w, int a, const operand_t& o)
+{
+    if (o.reg >= 0) {
+        opRR(0x85, w, o.reg, a);
+    } else {
+        opRR(0xF7, w, xTEST, a);
+        emit32(o.imm);
+    }
+    mClobbered = true;
+}
+
+void X86_64Assembler::push(int r)
+{
+    rex(0, 0, -1, r);
+    emit8(0x50 | (r&7));
+}
+
+void X86_64Assembler::pop(int r)
+{
+    rex(0, 0, -1, r);
+    emit8(0x58 | (r&7));
+}
+
+// short forward jumps within one instruction, returns what bind8() needs
+int X86_64Assembler::jcc8(int cc)
+{
+    emit8(cc < 0 ? 0xEB : (0x70 | cc));
+    emit8(0);
+    return mCodeSize;
+}
+
+void X86_64Assembler::bind8(int at)
+{
+    const int offset = mCodeSize - at;
+    LOG_ALWAYS_FATAL_IF(offset > 127, "instruction too long (%d)", offset);
+    mCode[at-1] = uint8_t(offset);
+}
+
+}; // namespace android
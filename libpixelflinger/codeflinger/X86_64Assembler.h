@@ -0,0 +1,283 @@
+/* libs/pixelflinger/codeflinger/X86_64Assembler.h
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_X86_64ASSEMBLER_H
+#define ANDROID_X86_64ASSEMBLER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "tinyutils/Vector.h"
+#include "tinyutils/KeyedVector.h"
+#include "tinyutils/smartpointer.h"
+
+#include "codeflinger/ARMAssemblerInterface.h"
+#include "codeflinger/CodeCache.h"
+
+namespace android {
+
+// ----------------------------------------------------------------------------
+
+/*
+ * Builds x86-64 code from the ARM instructions GGLAssembler emits.
+ *
+ * Instructions are recorded as they come, and translated all at once by
+ * generate() (or by the first pcForLabel()), once every branch target and
+ * every register the program uses is known.
+ *
+ * ARM registers map onto x86-64 registers one for one, SP being the
+ * machine stack, and rcx is kept as a scratch. Data processing works on
+ * the low 32 bits; ADDR_* instructions work on whole 64-bit pointers.
+ * ARM condition codes are kept in the x86 flags, with the carry inverted
+ * so that HS/LO after a compare are jae/jb. Conditional instructions are
+ * branched around, and the flags are saved around instructions that
+ * clobber them while a later instruction still needs them.
+ *
+ * Logical instructions that set the flags don't compute the shifter
+ * carry, and leave V cleared, GGLAssembler never reads them.
+ */
+class X86_64Assembler : public ARMAssemblerInterface
+{
+public:
+                X86_64Assembler(const sp<Assembly>& assembly);
+    virtual     ~X86_64Assembler();
+
+    uint32_t*   base() const;
+    uint32_t*   pc() const;
+
+
+    void        disassemble(const char* name);
+
+    // ------------------------------------------------------------------------
+    // ARMAssemblerInterface...
+    // ------------------------------------------------------------------------
+
+    virtual void    reset();
+
+    virtual int     generate(const char* name);
+
+    virtual void    prolog();
+    virtual void    epilog(uint32_t touched);
+    virtual void    comment(const char* string);
+
+    virtual void    dataProcessing(int opcode, int cc, int s,
+                                int Rd, int Rn,
+                                uint32_t Op2);
+    virtual void MLA(int cc, int s,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void MUL(int cc, int s,
+                int Rd, int Rm, int Rs);
+    virtual void UMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void UMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMULL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+    virtual void SMUAL(int cc, int s,
+                int RdLo, int RdHi, int Rm, int Rs);
+
+    virtual void B(int cc, uint32_t* pc);
+    virtual void BL(int cc, uint32_t* pc);
+    virtual void BX(int cc, int Rn);
+    virtual void label(const char* theLabel);
+    virtual void B(int cc, const char* label);
+    virtual void BL(int cc, const char* label);
+
+    virtual uint32_t* pcForLabel(const char* label);
+
+    virtual void LDR (int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void LDRB(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void STR (int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void STRB(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void LDRH (int cc, int Rd,
+                int Rn, uint32_t offset = immed8_pre(0));
+    virtual void LDRSB(int cc, int Rd,
+                int Rn, uint32_t offset = immed8_pre(0));
+    virtual void LDRSH(int cc, int Rd,
+                int Rn, uint32_t offset = immed8_pre(0));
+    virtual void STRH (int cc, int Rd,
+                int Rn, uint32_t offset = immed8_pre(0));
+    virtual void LDM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+    virtual void STM(int cc, int dir,
+                int Rn, int W, uint32_t reg_list);
+
+    virtual void SWP(int cc, int Rn, int Rd, int Rm);
+    virtual void SWPB(int cc, int Rn, int Rd, int Rm);
+    virtual void SWI(int cc, uint32_t comment);
+
+    virtual void PLD(int Rn, uint32_t offset);
+    virtual void CLZ(int cc, int Rd, int Rm);
+    virtual void QADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QDADD(int cc, int Rd, int Rm, int Rn);
+    virtual void QSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void QDSUB(int cc, int Rd, int Rm, int Rn);
+    virtual void SMUL(int cc, int xy,
+                int Rd, int Rm, int Rs);
+    virtual void SMULW(int cc, int y,
+                int Rd, int Rm, int Rs);
+    virtual void SMLA(int cc, int xy,
+                int Rd, int Rm, int Rs, int Rn);
+    virtual void SMLAL(int cc, int xy,
+                int RdHi, int RdLo, int Rs, int Rm);
+    virtual void SMLAW(int cc, int y,
+                int Rd, int Rm, int Rs, int Rn);
+
+    virtual void ADDR_LDR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_STR(int cc, int Rd,
+                int Rn, uint32_t offset = immed12_pre(0));
+    virtual void ADDR_ADD(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+    virtual void ADDR_SUB(int cc, int s, int Rd,
+                int Rn, uint32_t Op2);
+
+private:
+                X86_64Assembler(const X86_64Assembler& rhs);
+                X86_64Assembler& operator = (const X86_64Assembler& rhs);
+
+    // what we record of each call
+    enum {
+        I_LABEL, I_COMMENT, I_PROLOG, I_EPILOG,
+        I_DP, I_ADDR_ADD, I_ADDR_SUB,
+        I_MLA, I_MUL, I_UMULL, I_UMUAL, I_SMULL, I_SMUAL,
+        I_B, I_BL, I_B_PC, I_BL_PC, I_BX,
+        I_LDR, I_LDRB, I_STR, I_STRB,
+        I_LDRH, I_LDRSB, I_LDRSH, I_STRH,
+        I_ADDR_LDR, I_ADDR_STR, I_PLD,
+        I_LDM, I_STM, I_SWP, I_SWPB,
+        I_CLZ, I_QADD, I_QDADD, I_QSUB, I_QDSUB,
+        I_SMUL, I_SMULW, I_SMLA, I_SMLAL, I_SMLAW
+    };
+
+    struct insn_t {
+        uint8_t     what;
+        uint8_t     cc;
+        uint8_t     s;
+        uint8_t     opcode;     // data processing, or xy, or LDM/STM dir
+        int8_t      r[4];
+        uint32_t    arg;        // Op2, offset, or register list
+        const char* label;      // label, comment or branch target
+        uint32_t*   target;     // B/BL to an address
+    };
+
+    // an operand of the x86 instructions below: a register or an immediate
+    struct operand_t {
+        inline operand_t(int r) : reg(r), imm(0) { }
+        inline operand_t(int r, uint32_t i) : reg(r), imm(i) { }
+        int         reg;        // -1 for an immediate
+        uint32_t    imm;
+    };
+
+    // [base + index*scale + disp], base or index may be -1
+    struct mem_t {
+        inline mem_t(int b, int32_t d=0)
+            : base(b), index(-1), scale(0), disp(d) { }
+        inline mem_t(int b, int i, int s, int32_t d)
+            : base(b), index(i), scale(s), disp(d) { }
+        int         base;
+        int         index;
+        int         scale;      // log2
+        int32_t     disp;
+    };
+
+    void        record(int what, int cc, int s, int opcode,
+                        int r0, int r1, int r2, int r3, uint32_t arg);
+    int         translate();
+    void        computeFlagsLiveness();
+    uint32_t    registersOf(const insn_t& i) const;
+    bool        setsFlags(const insn_t& i) const;
+    bool        readsFlags(const insn_t& i) const;
+
+    // translation of each kind of instruction
+    void        translate(const insn_t& i);
+    void        dataProcessing(const insn_t& i);
+    void        addressArithmetic(const insn_t& i);
+    void        multiply(const insn_t& i);
+    void        longMultiply(const insn_t& i);
+    void        halfwordMultiply(const insn_t& i);
+    void        saturatingArithmetic(const insn_t& i);
+    void        dataTransfer(const insn_t& i);
+    void        blockDataTransfer(const insn_t& i);
+    void        branch(const insn_t& i);
+
+    // operands
+    int         xreg(int armReg) const;
+    operand_t   operand2(uint32_t Op2);
+    bool        shiftWithoutFlags(int d, uint32_t Op2);
+    void        halfword(int d, int s, int top, int w);
+    void        saturate(int r);
+    int         temporary();
+    void        releaseTemporary();
+
+    // x86-64 encoding
+    void        emit8(uint32_t b);
+    void        emit32(uint32_t v);
+    void        emit64(uint64_t v);
+    void        rex(int w, int reg, int index, int base, int byteReg=0);
+    void        opcode(int op);
+    void        opRR(int op, int w, int reg, int rm, int byteReg=0);
+    void        opRM(int op, int w, int reg, const mem_t& m, int byteReg=0);
+    void        alu(int ext, int w, int d, const operand_t& o);
+    void        alu3(int ext, int d, const operand_t& a,
+                        const operand_t& b, int flags);
+    void        shift(int ext, int w, int d, int amount);
+    void        mov(int w, int d, const operand_t& o);
+    void        lea(int w, int d, const mem_t& m);
+    void        unary(int ext, int w, int d);
+    void        test(int w, int a, const operand_t& o);
+    void        push(int r);
+    void        pop(int r);
+    int         jcc8(int cc);
+    void        bind8(int at);
+
+    sp<Assembly>    mAssembly;
+    uint32_t*       mBase;
+    uint8_t*        mCode;
+    size_t          mCodeSize;
+    size_t          mCodeCapacity;
+    bool            mTranslated;
+    int64_t         mDuration;
+
+    Vector<insn_t>  mInsns;
+    Vector<int>     mOffsets;       // x86 offset of each instruction
+    Vector<uint8_t> mFlagsLive;     // flags needed after an instruction
+    uint32_t        mSaved;         // callee-saved x86 registers we use
+    int             mFree;          // an unused x86 register, or -1
+    uint32_t        mInUse;         // x86 registers of the instruction
+    int             mBorrowed;      // pushed for a temporary, or -1
+    bool            mClobbered;     // flags changed by the instruction
+
+    struct branch_target_t {
+        inline branch_target_t() : label(0), offset(0) { }
+        inline branch_target_t(const char* l, int o)
+            : label(l), offset(o) { }
+        const char* label;
+        int         offset;
+    };
+
+    Vector<branch_target_t>         mBranchTargets;
+    KeyedVector< const char*, int > mLabels;
+};
+
+}; // namespace android
+
+#endif //ANDROID_X86_64ASSEMBLER_H
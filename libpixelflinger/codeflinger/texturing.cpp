@@ -353,7 +353,7 @@ void GGLAssembler::init_textures(
             // merge base & offset
             CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].stride);
             SMLABB(AL, Rx, Ry, txPtr.reg, Rx);               // x+y*stride
-            CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].data);
+            CONTEXT_ADDR_LOAD(txPtr.reg, generated_vars.texture[i].data);
             base_offset(txPtr, txPtr, Rx);
         } else {
             Scratch scratches(registerFile());
@@ -609,7 +609,7 @@ void GGLAssembler::build_textures(  fragment_parts_t& parts,
             txPtr.setTo(texel.reg, tmu.bits);
             int stride = scratches.obtain();
             CONTEXT_LOAD(stride,    generated_vars.texture[i].stride);
-            CONTEXT_LOAD(txPtr.reg, generated_vars.texture[i].data);
+            CONTEXT_ADDR_LOAD(txPtr.reg, generated_vars.texture[i].data);
             SMLABB(AL, u, v, stride, u);    // u+v*stride 
             base_offset(txPtr, txPtr, u);
 
@@ -648,7 +648,7 @@ void GGLAssembler::build_iterate_texture_coordinates(
             (tmu.twrap == GGL_NEEDS_WRAP_11))
         { // 1:1 textures
             const pointer_t& txPtr = parts.coords[i].ptr;
-            ADD(AL, 0, txPtr.reg, txPtr.reg, imm(txPtr.size>>3));
+            ADDR_ADD(AL, 0, txPtr.reg, txPtr.reg, imm(txPtr.size>>3));
         } else {
             Scratch scratches(registerFile());
             int s = parts.coords[i].s.reg;
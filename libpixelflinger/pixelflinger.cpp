@@ -69,6 +69,7 @@ static void ggl_enable_point_aa_nice(context_t* c, int enable);
 static void ggl_enable_texture2d(context_t* c, int enable);
 static void ggl_enable_w_lerp(context_t* c, int enable);
 static void ggl_enable_fog(context_t* c, int enable);
+static void ggl_enable_multithread(context_t* c, int enable);
 
 static inline int min(int a, int b) CONST;
 static inline int min(int a, int b) {
@@ -171,6 +172,7 @@ static void enable_disable(context_t* c, GGLenum name, int en)
     case GGL_W_LERP:            ggl_enable_w_lerp(c, en);        break;
     case GGL_FOG:               ggl_enable_fog(c, en);           break;
     case GGL_POINT_SMOOTH_NICE: ggl_enable_point_aa_nice(c, en); break;
+    case GGL_MULTITHREAD:       ggl_enable_multithread(c, en);   break;
     }
 }
 
@@ -707,6 +709,13 @@ void ggl_enable_w_lerp(context_t* c, int enable)
     }
 }
 
+void ggl_enable_multithread(context_t* c, int enable)
+{
+    // doesn't change what the scanlines do, only how many run at once
+    if (enable) c->state.enables |= GGL_ENABLE_MULTITHREAD;
+    else        c->state.enables &= ~GGL_ENABLE_MULTITHREAD;
+}
+
 void ggl_enable_texture2d(context_t* c, int enable)
 {
     if (c->activeTMU->enable != enable) {
@@ -22,9 +22,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <cutils/memory.h>
 #include <cutils/log.h>
+#include <cutils/cpu_info.h>
 
 #include "buffer.h"
 #include "scanline.h"
@@ -35,6 +44,11 @@
 #include "codeflinger/ARMAssembler.h"
 //#include "codeflinger/ARMAssemblerOptimizer.h"
 #endif
+#if defined(__x86_64__)
+#include "codeflinger/CodeCache.h"
+#include "codeflinger/GGLAssembler.h"
+#include "codeflinger/X86_64Assembler.h"
+#endif
 #if defined(__mips__)
 #include "codeflinger-mips/CodeCache.h"
 #include "codeflinger-mips/GGLAssembler.h"
@@ -61,7 +75,8 @@
 #   define ANDROID_CODEGEN      ANDROID_CODEGEN_GENERATED
 #endif
 
-#if defined(__arm__) || defined(__mips__) || defined (__powerpc__)
+#if defined(__arm__) || defined(__mips__) || defined (__powerpc__) || \
+    defined(__x86_64__)
 #   define ANDROID_ARCH_CODEGEN  1
 #else
 #   define ANDROID_ARCH_CODEGEN  0
@@ -105,6 +120,29 @@ static void rect_memcpy(context_t* c, size_t yc);
 extern "C" void scanline_t32cb16blend_arm(uint16_t*, uint32_t*, size_t);
 extern "C" void scanline_t32cb16_arm(uint16_t *dst, uint32_t *src, size_t ct);
 
+#if defined(__i386__) || defined(__x86_64__)
+extern "C" void scanline_t32cb16_sse2(uint16_t*, const uint32_t*, size_t);
+extern "C" void scanline_t32cb16blend_sse2(uint16_t*, const uint32_t*, size_t);
+extern "C" void memset16_sse2(uint16_t*, uint16_t, size_t);
+extern "C" void memset32_sse2(uint32_t*, uint32_t, size_t);
+#endif
+#if defined(__arm__) && defined(WITH_NEON)
+extern "C" void scanline_t32cb16_neon(uint16_t*, const uint32_t*, size_t);
+extern "C" void scanline_t32cb16blend_neon(uint16_t*, const uint32_t*, size_t);
+extern "C" void memset16_neon(uint16_t*, uint16_t, size_t);
+extern "C" void memset32_neon(uint32_t*, uint32_t, size_t);
+#endif
+
+// vectorized versions of the shortcuts' inner loops, when the CPU has them.
+// They work on pixel counts, and handle any alignment.
+struct simd_kernels_t {
+    void    (*t32cb16)(uint16_t*, const uint32_t*, size_t);
+    void    (*t32cb16blend)(uint16_t*, const uint32_t*, size_t);
+    void    (*memset16)(uint16_t*, uint16_t, size_t);
+    void    (*memset32)(uint32_t*, uint32_t, size_t);
+};
+static simd_kernels_t gSimd;
+
 // ----------------------------------------------------------------------------
 
 struct shortcut_t {
@@ -122,6 +160,9 @@ static shortcut_t shortcuts[] = {
     { { { 0x03010104, 0x00000077, { 0x00000A01, 0x00000000 } },
         { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
         "565 fb, 8888 tx", scanline_t32cb16, init_y_noop  },  
+    { { { 0x03010104, 0x00000077, { 0x00000A02, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, x888 tx", scanline_t32cb16, init_y_noop  },
     { { { 0x00000000, 0x00000000, { 0x00000000, 0x00000000 } },
         { 0x00000000, 0x00000007, { 0x00000000, 0x00000000 } } },
         "(nop) alpha test", scanline_noop, init_y_noop },
@@ -160,9 +201,10 @@ static  const needs_filter_t fill16noblend = {
 // ----------------------------------------------------------------------------
 
 #if ANDROID_ARCH_CODEGEN
-#if defined(__mips__) || defined(__powerpc__)
+#if defined(__mips__) || defined(__powerpc__) || defined(__x86_64__)
 // Code on MIPS isn't that much bigger, I just wanted to cache more of
 // it since we are running more complex and larger systems.
+// x86-64 code is about twice the size of the ARM code it's built from.
 static CodeCache gCodeCache(24 * 1024);
 #else
 static CodeCache gCodeCache(12 * 1024);
@@ -170,20 +212,135 @@ static CodeCache gCodeCache(12 * 1024);
 
 class ScanlineAssembly : public Assembly {
     AssemblyKey<needs_t> mKey;
+    needs_t mNeeds;
 public:
     ScanlineAssembly(needs_t needs, size_t size)
-        : Assembly(size), mKey(needs) { }
+        : Assembly(size), mKey(needs), mNeeds(needs) { }
+    ScanlineAssembly(needs_t needs, uint32_t* base, size_t size)
+        : Assembly(base, size), mKey(needs), mNeeds(needs) { }
     const AssemblyKey<needs_t>& key() const { return mKey; }
+    const needs_t& needs() const { return mNeeds; }
+};
+
+// The generated code can be saved to a file and mapped back by other
+// processes, rather than generated again by each of them. It only depends
+// on the needs, everything else is found through the context.
+// The file is a header, a table of entries, and the code of each entry.
+
+enum {
+    CODECACHE_MAGIC     = 0x43434650,   // 'PFCC'
+    CODECACHE_FORMAT    = 1,
+    CODECACHE_ALIGN     = 16
+};
+
+struct codecache_header_t {
+    uint32_t    magic;
+    uint32_t    version;    // see codecache_version()
+    uint32_t    count;
+    uint32_t    size;       // of the whole file
 };
+
+struct codecache_entry_t {
+    needs_t     needs;
+    uint32_t    offset;     // from the start of the file
+    uint32_t    size;
+};
+
+static pthread_once_t gCodeCacheOnce = PTHREAD_ONCE_INIT;
+
+// identifies the code generator, a file written by any other one is ignored
+static uint32_t codecache_version()
+{
+    struct {
+        uint32_t    format;
+        uint32_t    context;
+        uint32_t    arch;
+        uint32_t    size;
+        uint32_t    mtime;
+    } v;
+    memset(&v, 0, sizeof(v));
+    v.format = CODECACHE_FORMAT;
+    // the code reads the context at fixed offsets
+    v.context = sizeof(context_t);
+#if defined(__arm__)
+    v.arch = 1;
+#elif defined(__mips__)
+    v.arch = 2;
+#elif defined(__powerpc__)
+    v.arch = 3;
+#elif defined(__x86_64__)
+    v.arch = 4;
+#endif
+    // a new build of the library can generate different code
+    Dl_info info;
+    struct stat st;
+    if (dladdr((void*)codecache_version, &info) && info.dli_fname &&
+            stat(info.dli_fname, &st) == 0) {
+        v.size = uint32_t(st.st_size);
+        v.mtime = uint32_t(st.st_mtime);
+    }
+    return hash_type(v);
+}
+
+static void codecache_collect(const sp<Assembly>& assembly, void* cookie)
+{
+    Vector< sp<ScanlineAssembly> >& list =
+            *(Vector< sp<ScanlineAssembly> >*)cookie;
+    // gCodeCache only holds scanlines
+    list.add(static_cast<ScanlineAssembly*>(assembly.get()));
+}
+
+static void load_system_code_cache()
+{
+    // not having one is the common case
+    if (access(GGL_CODE_CACHE_PATH, F_OK) == 0) {
+        gglLoadCodeCache(GGL_CODE_CACHE_PATH);
+    }
+}
 #endif
 
+// which pixel pipelines pick_scanline() may choose, see ggl_test_pipeline()
+enum {
+    PIPELINE_ANY,
+    PIPELINE_GENERATED,     // no hand-written shortcuts
+    PIPELINE_GENERIC        // neither shortcuts nor generated code
+};
+static int gPipeline = PIPELINE_ANY;
+
 // ----------------------------------------------------------------------------
 
+static void init_simd_kernels()
+{
+    // every context finds the same kernels, no need to lock
+    const uint32_t features = get_cpu_features();
+    (void)features;
+#if defined(__i386__) || defined(__x86_64__)
+    if (features & CPU_FEATURE_SSE2) {
+        gSimd.t32cb16       = scanline_t32cb16_sse2;
+        gSimd.t32cb16blend  = scanline_t32cb16blend_sse2;
+        gSimd.memset16      = memset16_sse2;
+        gSimd.memset32      = memset32_sse2;
+    }
+#endif
+#if defined(__arm__) && defined(WITH_NEON) && (BYTE_ORDER == LITTLE_ENDIAN)
+    if (features & CPU_FEATURE_NEON) {
+        gSimd.t32cb16       = scanline_t32cb16_neon;
+        gSimd.t32cb16blend  = scanline_t32cb16blend_neon;
+        gSimd.memset16      = memset16_neon;
+        gSimd.memset32      = memset32_neon;
+    }
+#endif
+}
+
 void ggl_init_scanline(context_t* c)
 {
     c->init_y = init_y;
     c->step_y = step_y__generic;
     c->scanline = scanline;
+    init_simd_kernels();
+#if ANDROID_ARCH_CODEGEN
+    pthread_once(&gCodeCacheOnce, load_system_code_cache);
+#endif
 }
 
 void ggl_uninit_scanline(context_t* c)
@@ -208,48 +365,58 @@ static void pick_scanline(context_t* c)
     c->scanline = scanline;
     return;
 #endif
+    if (ggl_unlikely(gPipeline == PIPELINE_GENERIC)) {
+        c->init_y = init_y;
+        c->step_y = step_y__generic;
+        c->scanline = scanline;
+        return;
+    }
+
     //printf("*** needs [%08lx:%08lx:%08lx:%08lx]\n",
     //    c->state.needs.n, c->state.needs.p,
     //    c->state.needs.t[0], c->state.needs.t[1]);
 
-    // first handle the special case that we cannot test with a filter
-    const uint32_t cb_format = GGL_READ_NEEDS(CB_FORMAT, c->state.needs.n);
-    if (GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0]) == cb_format) {
-        if (c->state.needs.match(noblend1to1)) {
-            // this will match regardless of dithering state, since both
-            // src and dest have the same format anyway, there is no dithering
-            // to be done.
-            const GGLFormat* f =
-                &(c->formats[GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0])]);
-            if ((f->components == GGL_RGB) ||
-                (f->components == GGL_RGBA) ||
-                (f->components == GGL_LUMINANCE) ||
-                (f->components == GGL_LUMINANCE_ALPHA))
-            {
-                // format must have all of RGB components
-                // (so the current color doesn't show through)
-                c->scanline = scanline_memcpy;
-                c->init_y = init_y_noop;
-                return;
+    if (gPipeline == PIPELINE_ANY) {
+        // first handle the special case that we cannot test with a filter
+        const uint32_t cb_format =
+                GGL_READ_NEEDS(CB_FORMAT, c->state.needs.n);
+        if (GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0]) == cb_format) {
+            if (c->state.needs.match(noblend1to1)) {
+                // this will match regardless of dithering state, since
+                // both src and dest have the same format anyway, there is
+                // no dithering to be done.
+                const GGLFormat* f = &(c->formats[
+                        GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0])]);
+                if ((f->components == GGL_RGB) ||
+                    (f->components == GGL_RGBA) ||
+                    (f->components == GGL_LUMINANCE) ||
+                    (f->components == GGL_LUMINANCE_ALPHA))
+                {
+                    // format must have all of RGB components
+                    // (so the current color doesn't show through)
+                    c->scanline = scanline_memcpy;
+                    c->init_y = init_y_noop;
+                    return;
+                }
             }
         }
-    }
 
-    if (c->state.needs.match(fill16noblend)) {
-        c->init_y = init_y_packed;
-        switch (c->formats[cb_format].size) {
-        case 1: c->scanline = scanline_memset8;  return;
-        case 2: c->scanline = scanline_memset16; return;
-        case 4: c->scanline = scanline_memset32; return;
+        if (c->state.needs.match(fill16noblend)) {
+            c->init_y = init_y_packed;
+            switch (c->formats[cb_format].size) {
+            case 1: c->scanline = scanline_memset8;  return;
+            case 2: c->scanline = scanline_memset16; return;
+            case 4: c->scanline = scanline_memset32; return;
+            }
         }
-    }
 
-    const int numFilters = sizeof(shortcuts)/sizeof(shortcut_t);
-    for (int i=0 ; i<numFilters ; i++) {
-        if (c->state.needs.match(shortcuts[i].filter)) {
-            c->scanline = shortcuts[i].scanline;
-            c->init_y = shortcuts[i].init_y;
-            return;
+        const int numFilters = sizeof(shortcuts)/sizeof(shortcut_t);
+        for (int i=0 ; i<numFilters ; i++) {
+            if (c->state.needs.match(shortcuts[i].filter)) {
+                c->scanline = shortcuts[i].scanline;
+                c->init_y = shortcuts[i].init_y;
+                return;
+            }
         }
     }
 
@@ -276,14 +443,18 @@ static void pick_scanline(context_t* c)
 #endif
 #if defined(__powerpc__)
         GGLAssembler assembler( new PPCAssembler(a) );
+#endif
+#if defined(__x86_64__)
+        GGLAssembler assembler( new X86_64Assembler(a) );
 #endif
         //GGLAssembler assembler(
         //        new ARMAssemblerOptimizer(new ARMAssembler(a)) );
         // generate the scanline code for the given needs
+        const int64_t start = ggl_system_time();
         int err = assembler.scanline(c->state.needs, c);
         if (ggl_likely(!err)) {
             // finally, cache this assembly
-            err = gCodeCache.cache(a->key(), a);
+            err = gCodeCache.cache(a->key(), a, ggl_system_time() - start);
         }
 	else {
             LOGE("error generating assembly. 0x%x", err);
@@ -335,14 +506,8 @@ static void blend_factor(context_t* c, pixel_t* r, uint32_t factor,
         const pixel_t* src, const pixel_t* dst);
 static void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv);
 
-#if ANDROID_ARCH_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
-
-// no need to compile the generic-pipeline, it can't be reached
-void scanline(context_t*)
-{
-}
-
-#else
+// the generic pipeline is compiled even when code is always generated,
+// ggl_test_pipeline() picks it to check the generated code against.
 
 void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv)
 {
@@ -810,8 +975,6 @@ discard:
 	}
 }
 
-#endif // ANDROID_ARCH_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
-
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -932,7 +1095,7 @@ void init_y(context_t* c, int32_t ys)
             gen.width   = t.surface.width;
             gen.height  = t.surface.height;
             gen.stride  = t.surface.stride;
-            gen.data    = int32_t(t.surface.data);
+            gen.data    = uintptr_t(t.surface.data);
             gen.dsdx = ti.dsdx;
             gen.dtdx = ti.dtdx;
         }
@@ -1299,7 +1462,12 @@ void scanline_t32cb16(context_t* c)
     int sR, sG, sB;
     uint32_t s, d;
 
-    if (ct==1 || uint32_t(dst)&2) {
+    if (gSimd.t32cb16) {
+        gSimd.t32cb16(dst, src, ct);
+        return;
+    }
+
+    if (ct==1 || uintptr_t(dst)&2) {
 last_one:
         s = GGL_RGBA_TO_HOST( *src++ );
         sR = (s >> (   3))&0x1F;
@@ -1348,6 +1516,11 @@ void scanline_t32cb16blend(context_t* c)
     const int32_t v = (c->state.texture[0].shade.it0>>16) + y;
     uint32_t *src = reinterpret_cast<uint32_t*>(tex->data)+(u+(tex->stride*v));
 
+    if (gSimd.t32cb16blend) {
+        gSimd.t32cb16blend(dst, src, ct);
+        return;
+    }
+
 #if ((ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && defined(__arm__))
     scanline_t32cb16blend_arm(dst, src, ct);
 #else
@@ -1414,6 +1587,10 @@ void scanline_memset16(context_t* c)
     surface_t* cb = &(c->state.buffers.color);
     uint16_t* dst = reinterpret_cast<uint16_t*>(cb->data) + (x+(cb->stride*y));
     uint32_t packed = c->packed;
+    if (gSimd.memset16) {
+        gSimd.memset16(dst, packed, ct);
+        return;
+    }
     android_memset16(dst, packed, ct*2);
 }
 
@@ -1425,6 +1602,10 @@ void scanline_memset32(context_t* c)
     surface_t* cb = &(c->state.buffers.color);
     uint32_t* dst = reinterpret_cast<uint32_t*>(cb->data) + (x+(cb->stride*y));
     uint32_t packed = GGL_HOST_TO_RGBA(c->packed);
+    if (gSimd.memset32) {
+        gSimd.memset32(dst, packed, ct);
+        return;
+    }
     android_memset32(dst, packed, ct*4);
 }
 
@@ -1499,6 +1680,163 @@ void rect_memcpy(context_t* c, size_t yc)
 }; // namespace android
 
 using namespace android;
+
+ssize_t gglGetCodeCacheStats(GGLCodeCacheStats* stats)
+{
+#if ANDROID_ARCH_CODEGEN
+    CodeCache::stats_t s;
+    gCodeCache.getStats(&s);
+    stats->hits = s.hits;
+    stats->misses = s.misses;
+    stats->evictions = s.evictions;
+    stats->compiles = s.compiles;
+    stats->compileTime = s.compileTime;
+    stats->count = s.count;
+    stats->size = s.size;
+    stats->budget = s.budget;
+    return NO_ERROR;
+#else
+    memset(stats, 0, sizeof(GGLCodeCacheStats));
+    return INVALID_OPERATION;
+#endif
+}
+
+ssize_t gglSetCodeCacheSize(size_t size)
+{
+#if ANDROID_ARCH_CODEGEN
+    gCodeCache.setBudget(size);
+    return NO_ERROR;
+#else
+    return INVALID_OPERATION;
+#endif
+}
+
+ssize_t gglLoadCodeCache(const char* path)
+{
+#if ANDROID_ARCH_CODEGEN
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const int err = errno;
+        close(fd);
+        return -err;
+    }
+    // the code in the file is executed as is, nobody but root or us
+    // may have written it
+    if (!S_ISREG(st.st_mode) ||
+            (st.st_uid != 0 && st.st_uid != geteuid()) ||
+            (st.st_mode & (S_IWGRP|S_IWOTH))) {
+        LOGE("refusing code cache %s, owned by uid %d, mode %o",
+                path, int(st.st_uid), int(st.st_mode & 07777));
+        close(fd);
+        return PERMISSION_DENIED;
+    }
+    if (size_t(st.st_size) < sizeof(codecache_header_t)) {
+        close(fd);
+        return BAD_VALUE;
+    }
+    const size_t size = st.st_size;
+    uint8_t* base = (uint8_t*)mmap(0, size, PROT_READ|PROT_EXEC,
+            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -errno;
+
+    const codecache_header_t& h = *(const codecache_header_t*)base;
+    const codecache_entry_t* entries =
+            (const codecache_entry_t*)(base + sizeof(codecache_header_t));
+    if (h.magic != CODECACHE_MAGIC || h.version != codecache_version() ||
+        h.size != size || h.count > (size - sizeof(codecache_header_t)) /
+                sizeof(codecache_entry_t)) {
+        LOGW("ignoring stale or corrupt code cache %s", path);
+        munmap(base, size);
+        return BAD_VALUE;
+    }
+    // the code can't overlap the header or the table
+    const size_t start = sizeof(codecache_header_t) +
+            h.count * sizeof(codecache_entry_t);
+    for (uint32_t i=0 ; i<h.count ; i++) {
+        const codecache_entry_t& e = entries[i];
+        if ((e.offset & (CODECACHE_ALIGN-1)) || !e.size ||
+                e.offset < start || e.offset > size ||
+                e.size > size - e.offset) {
+            LOGW("ignoring corrupt entry %u of code cache %s", i, path);
+            continue;
+        }
+        sp<ScanlineAssembly> a = new ScanlineAssembly(e.needs,
+                (uint32_t*)(base + e.offset), e.size);
+        gCodeCache.cache(a->key(), a, -1);
+    }
+    // the mapping stays for the life of the process, gCodeCache may
+    // evict an entry now and a context still be using it
+    return NO_ERROR;
+#else
+    return INVALID_OPERATION;
+#endif
+}
+
+ssize_t gglSaveCodeCache(const char* path)
+{
+#if ANDROID_ARCH_CODEGEN
+    Vector< sp<ScanlineAssembly> > list;
+    gCodeCache.forEach(codecache_collect, &list);
+
+    const size_t count = list.size();
+    codecache_header_t h;
+    h.magic = CODECACHE_MAGIC;
+    h.version = codecache_version();
+    h.count = count;
+    uint32_t offset = sizeof(codecache_header_t) +
+            count * sizeof(codecache_entry_t);
+    codecache_entry_t* entries = new codecache_entry_t[count];
+    for (size_t i=0 ; i<count ; i++) {
+        offset = (offset + CODECACHE_ALIGN-1) & ~(CODECACHE_ALIGN-1);
+        entries[i].needs = list[i]->needs();
+        entries[i].offset = offset;
+        entries[i].size = list[i]->codeSize();
+        offset += entries[i].size;
+    }
+    h.size = offset;
+
+    // other processes may be mapping the file, replace it in one go
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    // gglLoadCodeCache() refuses files others can write, whatever the umask
+    ssize_t err = NO_ERROR;
+    unlink(tmp);
+    const int fd = open(tmp, O_WRONLY|O_CREAT|O_EXCL, 0644);
+    FILE* f = fd >= 0 ? fdopen(fd, "wb") : 0;
+    if (fd >= 0 && !f)
+        close(fd);
+    if (f) {
+        static const uint8_t zeroes[CODECACHE_ALIGN] = { 0 };
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(entries, sizeof(codecache_entry_t), count, f);
+        for (size_t i=0 ; i<count ; i++) {
+            fwrite(zeroes, entries[i].offset - ftell(f), 1, f);
+            fwrite(list[i]->base(), entries[i].size, 1, f);
+        }
+        if (ferror(f))
+            err = -errno;
+        if (fclose(f) != 0 && err == NO_ERROR)
+            err = -errno;
+        if (err == NO_ERROR && rename(tmp, path) != 0)
+            err = -errno;
+        if (err != NO_ERROR)
+            unlink(tmp);
+    } else {
+        err = -errno;
+    }
+    delete [] entries;
+    LOGE_IF(err, "couldn't save code cache %s (%s)", path, strerror(-err));
+    return err;
+#else
+    return INVALID_OPERATION;
+#endif
+}
+
 extern "C" void ggl_test_codegen(uint32_t n, uint32_t p, uint32_t t0, uint32_t t1)
 {
 #if ANDROID_ARCH_CODEGEN
@@ -1516,6 +1854,8 @@ extern "C" void ggl_test_codegen(uint32_t n, uint32_t p, uint32_t t0, uint32_t t
     GGLAssembler assembler( new MIPSAssembler(a) );
 #elif defined(__powerpc__)
     GGLAssembler assembler( new PPCAssembler(a) );
+#elif defined(__x86_64__)
+    GGLAssembler assembler( new X86_64Assembler(a) );
 #else
 #error "No GGLAssember support for this architecture"
 #endif
@@ -1529,3 +1869,9 @@ extern "C" void ggl_test_codegen(uint32_t n, uint32_t p, uint32_t t0, uint32_t t
 #endif
 }
 
+extern "C" void ggl_test_pipeline(int pipeline)
+{
+    // 0: any, 1: generated code only, 2: generic code only.
+    // takes effect the next time a context picks its scanline.
+    gPipeline = pipeline;
+}
@@ -0,0 +1,144 @@
+/* libs/pixelflinger/scanline_neon.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// NEON versions of the scanline shortcuts of scanline.cpp, 8 pixels at a
+// time. They're meant to compute exactly what the C versions do, including
+// how the components overflow into each other when the source isn't
+// premultiplied, but haven't been checked against them on hardware yet, so
+// they're only built with PIXELFLINGER_NEON := true (see Android.mk).
+// scanline.cpp only calls them when get_cpu_features() has NEON.
+
+#if defined(__ARM_NEON__)
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <arm_neon.h>
+
+// ----------------------------------------------------------------------------
+
+static inline uint16_t t32cb16(uint32_t s)
+{
+    return uint16_t((((s >> 3) & 0x1F) << 11) |
+                    (((s >> 10) & 0x3F) << 5) |
+                    ((s >> 19) & 0x1F));
+}
+
+extern "C" void scanline_t32cb16_neon(uint16_t* dst, const uint32_t* src,
+        size_t ct)
+{
+    while (ct >= 8) {
+        // val[0..3] are the R, G, B and A bytes of the 8 pixels
+        const uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        uint16x8_t d = vshlq_n_u16(vmovl_u8(vshr_n_u8(s.val[0], 3)), 11);
+        d = vorrq_u16(d, vshlq_n_u16(vmovl_u8(vshr_n_u8(s.val[1], 2)), 5));
+        d = vorrq_u16(d, vmovl_u8(vshr_n_u8(s.val[2], 3)));
+        vst1q_u16(dst, d);
+        dst += 8;
+        src += 8;
+        ct -= 8;
+    }
+    while (ct--) {
+        *dst++ = t32cb16(*src++);
+    }
+}
+
+extern "C" void scanline_t32cb16blend_neon(uint16_t* dst,
+        const uint32_t* src, size_t ct)
+{
+    const uint16x8_t mask5 = vdupq_n_u16(0x1F);
+    const uint16x8_t mask6 = vdupq_n_u16(0x3F);
+    const uint16x8_t one = vdupq_n_u16(0x100);
+    while (ct >= 8) {
+        const uint8x8x4_t s = vld4_u8((const uint8_t*)src);
+        const uint16x8_t d = vld1q_u16(dst);
+
+        // transparent pixels, s == 0, come out as the destination
+        uint16x8_t sR = vmovl_u8(vshr_n_u8(s.val[0], 3));
+        uint16x8_t sG = vmovl_u8(vshr_n_u8(s.val[1], 2));
+        uint16x8_t sB = vmovl_u8(vshr_n_u8(s.val[2], 3));
+        const uint16x8_t sA = vmovl_u8(s.val[3]);
+        const uint16x8_t f = vsubq_u16(one,
+                vaddq_u16(sA, vshrq_n_u16(sA, 7)));
+
+        const uint16x8_t dR = vandq_u16(vshrq_n_u16(d, 11), mask5);
+        const uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), mask6);
+        const uint16x8_t dB = vandq_u16(d, mask5);
+        sR = vaddq_u16(sR, vshrq_n_u16(vmulq_u16(f, dR), 8));
+        sG = vaddq_u16(sG, vshrq_n_u16(vmulq_u16(f, dG), 8));
+        sB = vaddq_u16(sB, vshrq_n_u16(vmulq_u16(f, dB), 8));
+
+        uint16x8_t r = vshlq_n_u16(sR, 11);
+        r = vorrq_u16(r, vshlq_n_u16(sG, 5));
+        r = vorrq_u16(r, sB);
+        vst1q_u16(dst, r);
+        dst += 8;
+        src += 8;
+        ct -= 8;
+    }
+    while (ct--) {
+        uint32_t s = *src++;
+        if (!s) {
+            dst++;
+            continue;
+        }
+        uint16_t d = *dst;
+        int sR = (s >> (   3))&0x1F;
+        int sG = (s >> ( 8+2))&0x3F;
+        int sB = (s >> (16+3))&0x1F;
+        int sA = (s>>24);
+        int f = 0x100 - (sA + (sA>>7));
+        sR += (f*((d>>11)&0x1f))>>8;
+        sG += (f*((d>>5)&0x3f))>>8;
+        sB += (f*(d&0x1f))>>8;
+        *dst++ = uint16_t((sR<<11)|(sG<<5)|sB);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// 16 pixels per iteration
+extern "C" void memset16_neon(uint16_t* dst, uint16_t value, size_t ct)
+{
+    const uint16x8_t v = vdupq_n_u16(value);
+    while (ct >= 16) {
+        vst1q_u16(dst, v);
+        vst1q_u16(dst + 8, v);
+        dst += 16;
+        ct -= 16;
+    }
+    while (ct--) {
+        *dst++ = value;
+    }
+}
+
+extern "C" void memset32_neon(uint32_t* dst, uint32_t value, size_t ct)
+{
+    const uint32x4_t v = vdupq_n_u32(value);
+    while (ct >= 16) {
+        vst1q_u32(dst, v);
+        vst1q_u32(dst + 4, v);
+        vst1q_u32(dst + 8, v);
+        vst1q_u32(dst + 12, v);
+        dst += 16;
+        ct -= 16;
+    }
+    while (ct--) {
+        *dst++ = value;
+    }
+}
+
+#endif // __ARM_NEON__
@@ -0,0 +1,172 @@
+/* libs/pixelflinger/scanline_sse2.cpp
+**
+** Copyright 2006, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+// SSE2 versions of the scanline shortcuts of scanline.cpp, 8 pixels at a
+// time. They compute exactly what the C versions do, including how the
+// components overflow into each other when the source isn't premultiplied.
+// scanline.cpp only calls them when get_cpu_features() has SSE2.
+
+#if defined(__SSE2__)
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <emmintrin.h>
+
+// ----------------------------------------------------------------------------
+
+// the 8 RGBA_8888 pixels in lo and hi, as 16-bit lanes of one of their
+// components, (s >> shift) & mask
+static inline __m128i component(__m128i lo, __m128i hi, int shift, int mask)
+{
+    const __m128i m = _mm_set1_epi32(mask);
+    lo = _mm_and_si128(_mm_srli_epi32(lo, shift), m);
+    hi = _mm_and_si128(_mm_srli_epi32(hi, shift), m);
+    return _mm_packs_epi32(lo, hi);
+}
+
+static inline uint16_t t32cb16(uint32_t s)
+{
+    return uint16_t((((s >> 3) & 0x1F) << 11) |
+                    (((s >> 10) & 0x3F) << 5) |
+                    ((s >> 19) & 0x1F));
+}
+
+extern "C" void scanline_t32cb16_sse2(uint16_t* dst, const uint32_t* src,
+        size_t ct)
+{
+    const __m128i maskR = _mm_set1_epi32(0x1F << 3);
+    const __m128i maskG = _mm_set1_epi32(0x3F << 10);
+    const __m128i maskB = _mm_set1_epi32(0x1F << 19);
+    while (ct >= 8) {
+        __m128i s[2];
+        s[0] = _mm_loadu_si128((const __m128i*)src);
+        s[1] = _mm_loadu_si128((const __m128i*)(src + 4));
+        for (int i=0 ; i<2 ; i++) {
+            // the 565 pixel doesn't fit a signed 16 bits, sign extend it
+            // so that packing it doesn't saturate
+            __m128i d = _mm_slli_epi32(_mm_and_si128(s[i], maskR), 8+16);
+            d = _mm_or_si128(d,
+                    _mm_slli_epi32(_mm_and_si128(s[i], maskG), 16-5));
+            d = _mm_or_si128(d,
+                    _mm_srli_epi32(_mm_and_si128(s[i], maskB), 19-16));
+            s[i] = _mm_srai_epi32(d, 16);
+        }
+        _mm_storeu_si128((__m128i*)dst, _mm_packs_epi32(s[0], s[1]));
+        dst += 8;
+        src += 8;
+        ct -= 8;
+    }
+    while (ct--) {
+        *dst++ = t32cb16(*src++);
+    }
+}
+
+extern "C" void scanline_t32cb16blend_sse2(uint16_t* dst,
+        const uint32_t* src, size_t ct)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i one = _mm_set1_epi16(0x100);
+    while (ct >= 8) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)src);
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(src + 4));
+        const __m128i d = _mm_loadu_si128((const __m128i*)dst);
+
+        // transparent pixels, s == 0, come out as the destination
+        __m128i sR = component(lo, hi, 3, 0x1F);
+        __m128i sG = component(lo, hi, 8+2, 0x3F);
+        __m128i sB = component(lo, hi, 16+3, 0x1F);
+        const __m128i sA = component(lo, hi, 24, 0xFF);
+        const __m128i f = _mm_sub_epi16(one,
+                _mm_add_epi16(sA, _mm_srli_epi16(sA, 7)));
+
+        const __m128i dR = _mm_and_si128(_mm_srli_epi16(d, 11), mask5);
+        const __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), mask6);
+        const __m128i dB = _mm_and_si128(d, mask5);
+        sR = _mm_add_epi16(sR, _mm_srli_epi16(_mm_mullo_epi16(f, dR), 8));
+        sG = _mm_add_epi16(sG, _mm_srli_epi16(_mm_mullo_epi16(f, dG), 8));
+        sB = _mm_add_epi16(sB, _mm_srli_epi16(_mm_mullo_epi16(f, dB), 8));
+
+        __m128i r = _mm_slli_epi16(sR, 11);
+        r = _mm_or_si128(r, _mm_slli_epi16(sG, 5));
+        r = _mm_or_si128(r, sB);
+        _mm_storeu_si128((__m128i*)dst, r);
+        dst += 8;
+        src += 8;
+        ct -= 8;
+    }
+    while (ct--) {
+        uint32_t s = *src++;
+        if (!s) {
+            dst++;
+            continue;
+        }
+        uint16_t d = *dst;
+        int sR = (s >> (   3))&0x1F;
+        int sG = (s >> ( 8+2))&0x3F;
+        int sB = (s >> (16+3))&0x1F;
+        int sA = (s>>24);
+        int f = 0x100 - (sA + (sA>>7));
+        sR += (f*((d>>11)&0x1f))>>8;
+        sG += (f*((d>>5)&0x3f))>>8;
+        sB += (f*(d&0x1f))>>8;
+        *dst++ = uint16_t((sR<<11)|(sG<<5)|sB);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// 16 pixels per iteration, with aligned stores once dst is aligned
+extern "C" void memset16_sse2(uint16_t* dst, uint16_t value, size_t ct)
+{
+    while (ct && (uintptr_t(dst) & 15)) {
+        *dst++ = value;
+        ct--;
+    }
+    const __m128i v = _mm_set1_epi16(value);
+    while (ct >= 16) {
+        _mm_store_si128((__m128i*)dst, v);
+        _mm_store_si128((__m128i*)(dst + 8), v);
+        dst += 16;
+        ct -= 16;
+    }
+    while (ct--) {
+        *dst++ = value;
+    }
+}
+
+extern "C" void memset32_sse2(uint32_t* dst, uint32_t value, size_t ct)
+{
+    while (ct && (uintptr_t(dst) & 15)) {
+        *dst++ = value;
+        ct--;
+    }
+    const __m128i v = _mm_set1_epi32(value);
+    while (ct >= 16) {
+        _mm_store_si128((__m128i*)dst, v);
+        _mm_store_si128((__m128i*)(dst + 4), v);
+        _mm_store_si128((__m128i*)(dst + 8), v);
+        _mm_store_si128((__m128i*)(dst + 12), v);
+        dst += 16;
+        ct -= 16;
+    }
+    while (ct--) {
+        *dst++ = value;
+    }
+}
+
+#endif // __SSE2__
@@ -1,14 +1,378 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pixelflinger/pixelflinger.h>
 
 extern "C" void ggl_test_codegen(
         uint32_t n, uint32_t p, uint32_t t0, uint32_t t1);
+extern "C" void ggl_test_pipeline(int pipeline);
+
+// ----------------------------------------------------------------------------
+// draws the same random primitives with random state through the generated
+// pixel pipeline and through the generic one, and compares the pixels.
+//
+// By default only the state the two pipelines compute alike is used, within
+// one lsb for dithering: shading, dithering, depth test, logic ops, color
+// masks, a point sampled texture unit that replaces or modulates, an alpha
+// test against 0, 1/3 or 2/3 with dithering, and fog without it.
+//
+// With -a, everything else is thrown in too, and these are expected to
+// differ, because of what GGLAssembler generates or of the generic pipeline,
+// not of the backend:
+// - linear filtering weights, and two texture units, round differently;
+//   texels narrower than a byte modulate with different rounding, DECAL and
+//   ADD don't treat alpha alike, and the generic BLEND env reads the wrong
+//   component of the env color
+// - GGLAssembler approximates the blend factors, doesn't saturate
+//   ONE/ONE_MINUS_SRC_ALPHA and never wrote the ZERO/ZERO and ZERO/ONE cases,
+//   and the generic pipeline has no SRC_ALPHA_SATURATE
+// - the generated alpha test compares the upper bits of the reference, and
+//   undithered flat colors and replaced texels skip it
+// - fog with dithering rounds to within two lsb
+// - build_masking in GGLAssembler assumes the masked components of the
+//   source are zero, which a replaced texel isn't, and with every component
+//   masked the alpha test and the z-write are dropped
+// - logic ops turn any of the above into anything
+//
+// With -f, the generated code is loaded from and saved to a cache file, so
+// running it twice checks the code mapped back from the file.
+
+enum { PIPELINE_ANY, PIPELINE_GENERATED, PIPELINE_GENERIC };
+
+static const int W = 61;
+static const int H = 23;
+static const int STRIDE = 64;
+static const int TW = 16;
+static const int TH = 8;
+
+// luminance color buffers aren't in there, the generated pipeline doesn't
+// convert to luminance
+static const GGLenum colorFormats[] = {
+    GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBX_8888,
+    GGL_PIXEL_FORMAT_RGB_888,   GGL_PIXEL_FORMAT_RGB_565,
+    GGL_PIXEL_FORMAT_BGRA_8888, GGL_PIXEL_FORMAT_RGBA_5551,
+    GGL_PIXEL_FORMAT_RGBA_4444, GGL_PIXEL_FORMAT_A_8,
+    GGL_PIXEL_FORMAT_RGB_332
+};
+static const GGLenum textureFormats[] = {
+    GGL_PIXEL_FORMAT_RGBA_8888, GGL_PIXEL_FORMAT_RGBX_8888,
+    GGL_PIXEL_FORMAT_RGB_888,   GGL_PIXEL_FORMAT_RGB_565,
+    GGL_PIXEL_FORMAT_BGRA_8888, GGL_PIXEL_FORMAT_RGBA_5551,
+    GGL_PIXEL_FORMAT_RGBA_4444, GGL_PIXEL_FORMAT_A_8,
+    GGL_PIXEL_FORMAT_L_8,       GGL_PIXEL_FORMAT_LA_88,
+    GGL_PIXEL_FORMAT_RGB_332
+};
+static const GGLenum envModes[] = {
+    GGL_REPLACE, GGL_MODULATE, GGL_DECAL, GGL_BLEND, GGL_ADD
+};
+static const GGLenum srcFactors[] = {
+    GGL_ZERO, GGL_ONE, GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA,
+    GGL_DST_ALPHA, GGL_ONE_MINUS_DST_ALPHA, GGL_DST_COLOR,
+    GGL_ONE_MINUS_DST_COLOR, GGL_SRC_ALPHA_SATURATE
+};
+static const GGLenum dstFactors[] = {
+    GGL_ZERO, GGL_ONE, GGL_SRC_COLOR, GGL_ONE_MINUS_SRC_COLOR,
+    GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA,
+    GGL_DST_ALPHA, GGL_ONE_MINUS_DST_ALPHA
+};
+
+#define NELEM(a)    (sizeof(a)/sizeof(a[0]))
+
+static uint32_t gSeed;
+static bool gAll;
+
+static uint32_t random32()
+{
+    gSeed = gSeed * 1103515245 + 12345;
+    uint32_t hi = gSeed >> 16;
+    gSeed = gSeed * 1103515245 + 12345;
+    return (hi << 16) | (gSeed >> 16);
+}
+
+static int pick(int n)
+{
+    return random32() % n;
+}
+
+static void fill(uint8_t* data, size_t size)
+{
+    for (size_t i=0 ; i<size ; i++)
+        data[i] = random32() >> 24;
+}
+
+struct buffers_t {
+    uint8_t color[STRIDE*H*4];
+    uint8_t depth[STRIDE*H*2];
+    uint8_t texture[2][TW*TH*4];
+};
+
+// sets up c, with the random numbers starting at seed, and draws
+static void draw(GGLContext* c, buffers_t& b, uint32_t seed)
+{
+    gSeed = seed;
+    const GGLenum cbFormat = colorFormats[pick(NELEM(colorFormats))];
+
+    GGLSurface s;
+    memset(&s, 0, sizeof(s));
+    s.version = sizeof(s);
+    s.width = W;
+    s.height = H;
+    s.stride = STRIDE;
+    s.format = cbFormat;
+    s.data = b.color;
+    fill(b.color, sizeof(b.color));
+    c->colorBuffer(c, &s);
+
+    s.format = GGL_PIXEL_FORMAT_Z_16;
+    s.data = b.depth;
+    fill(b.depth, sizeof(b.depth));
+    c->depthBuffer(c, &s);
+
+    // by default one unit, point sampled, replacing or modulating
+    const int tmus = pick(4) ? (gAll && !pick(3) ? 2 : 1) : 0;
+    bool replaced = false, modulated = false;
+    for (int i=0 ; i<tmus ; i++) {
+        s.width = TW;
+        s.height = TH;
+        s.stride = TW;
+        s.format = textureFormats[pick(NELEM(textureFormats))];
+        GGLenum env = envModes[pick(NELEM(envModes))];
+        GGLenum filter = pick(2) ? GGL_LINEAR : GGL_NEAREST;
+        if (!gAll) {
+            // texels narrower than a byte modulate with different rounding
+            const GGLFormat& tf = gglGetPixelFormatTable()[s.format];
+            bool bytes = true;
+            for (int k=0 ; k<4 ; k++)
+                bytes &= (!tf.bits(k) || tf.bits(k) == 8);
+            if (env != GGL_MODULATE || !bytes)
+                env = GGL_REPLACE;
+            filter = GGL_NEAREST;
+        }
+        replaced |= (env == GGL_REPLACE);
+        modulated |= (env == GGL_MODULATE);
+        s.data = b.texture[i];
+        fill(b.texture[i], sizeof(b.texture[i]));
+        c->activeTexture(c, i);
+        c->bindTexture(c, &s);
+        c->enable(c, GGL_TEXTURE_2D);
+        c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, env);
+        GGLfixed envColor[4];
+        for (int k=0 ; k<4 ; k++)
+            envColor[k] = random32() & 0xFFFF;
+        c->texEnvxv(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_COLOR, envColor);
+        c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_MIN_FILTER, filter);
+        c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_MAG_FILTER, filter);
+        c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S,
+                pick(2) ? GGL_REPEAT : GGL_CLAMP_TO_EDGE);
+        c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T,
+                pick(2) ? GGL_REPEAT : GGL_CLAMP_TO_EDGE);
+        // s, dsdx, dsdy, t, dtdx, dtdy in 16.16
+        const int32_t grad[8] = {
+            int32_t(random32() % (TW<<17)) - (TW<<16),
+            int32_t(random32() % 0x20000) - 0x10000,
+            int32_t(random32() % 0x20000) - 0x10000,
+            int32_t(random32() % (TH<<17)) - (TH<<16),
+            int32_t(random32() % 0x20000) - 0x10000,
+            int32_t(random32() % 0x20000) - 0x10000,
+            0, 0
+        };
+        c->texCoordGradScale8xv(c, i, grad);
+    }
+
+    if (pick(2)) {
+        c->shadeModel(c, GGL_SMOOTH);
+        // r, drdx, drdy, ... in 8.16, kept within [0, 1] over the buffer
+        GGLcolor grad[12];
+        for (int k=0 ; k<4 ; k++) {
+            grad[k*3+1] = int32_t(random32() % 0x800) - 0x400;
+            grad[k*3+2] = int32_t(random32() % 0x800) - 0x400;
+            grad[k*3] = 0x10000 + int32_t(random32() % 0x60000) -
+                    grad[k*3+1]*W/2 - grad[k*3+2]*H/2;
+            const int32_t lo = 0x8000, hi = 0xFF0000;
+            int32_t v0 = grad[k*3];
+            int32_t v1 = v0 + grad[k*3+1]*W + grad[k*3+2]*H;
+            if (v0 < lo || v1 < lo || v0 > hi || v1 > hi) {
+                grad[k*3] = 0x800000;
+                grad[k*3+1] = grad[k*3+2] = 0;
+            }
+        }
+        c->colorGrad12xv(c, grad);
+    } else {
+        c->shadeModel(c, GGL_FLAT);
+        GGLclampx color[4];
+        for (int k=0 ; k<4 ; k++)
+            color[k] = random32() % 0x10001;
+        c->color4xv(c, color);
+    }
+
+    const bool dither = pick(2);
+    if (dither)
+        c->enable(c, GGL_DITHER);
+    else
+        c->disable(c, GGL_DITHER);
+
+    if (!pick(3) && gAll) {
+        c->enable(c, GGL_BLEND);
+        c->blendFunc(c, srcFactors[pick(NELEM(srcFactors))],
+                dstFactors[pick(NELEM(dstFactors))]);
+    }
+    // undithered flat colors and replaced texels take a path in the
+    // generated code that has no alpha test, and texels change the alpha's
+    // precision
+    const bool alpha = !pick(4) && (gAll || (dither && !tmus));
+    if (alpha) {
+        c->enable(c, GGL_ALPHA_TEST);
+        // the generated code compares the upper bits of the reference,
+        // 0, 1/3 and 2/3 are the ones where that's exact
+        const GGLenum func = GGL_NEVER + pick(8);
+        c->alphaFuncx(c, func, gAll ? random32() % 0x10001 : pick(3) * 21931);
+    }
+    if (!pick(4)) {
+        c->enable(c, GGL_DEPTH_TEST);
+        c->depthFunc(c, GGL_NEVER + pick(8));
+        c->depthMask(c, pick(2));
+        // z in 0.32, z-buffer in the upper 16 bits
+        const GGLfixed32 grad[3] = {
+            GGLfixed32(random32()),
+            int32_t(random32()) >> 10, int32_t(random32()) >> 10
+        };
+        c->zGrad3xv(c, grad);
+    }
+    // fog rounds to within two lsb of the generic pipeline's with dithering
+    // or modulated texels
+    const bool fog = !pick(4) && (gAll || (!dither && !modulated));
+    if (fog) {
+        c->enable(c, GGL_FOG);
+        const GGLclampx color[3] = {
+            GGLclampx(random32() % 0x10001),
+            GGLclampx(random32() % 0x10001),
+            GGLclampx(random32() % 0x10001)
+        };
+        c->fogColor3xv(c, color);
+        // fog factor in 16.16, within [0, 1] over the buffer: the generic
+        // pipeline doesn't clamp it
+        const GGLfixed d = 0x10000/(2*(W+H));
+        const GGLfixed grad[3] = {
+            GGLfixed(H*d + random32() % (0x10000 - (W+H)*d)), d, -d
+        };
+        c->fogGrad3xv(c, grad);
+    }
+    // a logic op turns the one lsb of dithering, and what fog and
+    // modulation leave below the color buffer's precision, into anything
+    if (!pick(6) && (gAll || (!dither && !fog && !modulated))) {
+        c->enable(c, GGL_COLOR_LOGIC_OP);
+        c->logicOp(c, GGL_CLEAR + pick(16));
+    }
+    // GGLAssembler's build_masking expects the masked components of the
+    // source to be zero, a replaced texel written as is isn't, and with
+    // every component masked it drops the alpha test and the z-write
+    if (!pick(6) && (gAll || (!replaced && !alpha))) {
+        c->colorMask(c, pick(2), pick(2), pick(2), pick(2));
+    }
 
+    for (int i=0 ; i<4 ; i++) {
+        const int l = pick(W);
+        const int t = pick(H);
+        c->recti(c, l, t, l + 1 + pick(W - l), t + 1 + pick(H - t));
+    }
+}
+
+static int compare(int count, uint32_t seed, int tolerance)
+{
+    static buffers_t generated, generic;
+    int failures = 0;
+    for (int i=0 ; i<count ; i++, seed++) {
+        GGLContext* c;
+
+        ggl_test_pipeline(PIPELINE_GENERATED);
+        gglInit(&c);
+        draw(c, generated, seed);
+        gglUninit(c);
+
+        ggl_test_pipeline(PIPELINE_GENERIC);
+        gglInit(&c);
+        draw(c, generic, seed);
+        gglUninit(c);
+
+        // the format is the first thing draw() picks, compare each
+        // component in units of its least significant bit
+        gSeed = seed;
+        const GGLFormat& f = gglGetPixelFormatTable()[
+                colorFormats[pick(NELEM(colorFormats))]];
+        int worst = 0, wx = 0, wy = 0;
+        for (int y=0 ; y<H ; y++) {
+            for (int x=0 ; x<W ; x++) {
+                const int o = (y*STRIDE + x) * f.size;
+                uint32_t a = 0, b = 0;
+                memcpy(&a, generated.color + o, f.size);
+                memcpy(&b, generic.color + o, f.size);
+                for (int k=0 ; k<4 ; k++) {
+                    if (!f.bits(k))
+                        continue;
+                    const int d = abs(int((a & f.mask(k)) >> f.c[k].l) -
+                            int((b & f.mask(k)) >> f.c[k].l));
+                    if (d > worst) {
+                        worst = d;
+                        wx = x;
+                        wy = y;
+                    }
+                }
+            }
+        }
+        if (worst > tolerance) {
+            printf("seed %u: pixel (%d, %d) differs by %d\n",
+                    seed, wx, wy, worst);
+            failures++;
+        } else if (memcmp(generated.depth, generic.depth,
+                    sizeof(generated.depth))) {
+            printf("seed %u: depth buffer differs\n", seed);
+            failures++;
+        }
+    }
+    ggl_test_pipeline(PIPELINE_ANY);
+    printf("%d of %d states differ\n", failures, count);
+    return failures ? 1 : 0;
+}
 
 int main(int argc, char** argv)
 {
+    if (argc >= 2 && !strcmp(argv[1], "-c")) {
+        int arg = 2;
+        if (argc > arg && !strcmp(argv[arg], "-a")) {
+            gAll = true;
+            arg++;
+        }
+        const char* cache = 0;
+        if (argc > arg+1 && !strcmp(argv[arg], "-f")) {
+            cache = argv[arg+1];
+            arg += 2;
+        }
+        int count = argc > arg ? atoi(argv[arg]) : 1000;
+        uint32_t seed = argc > arg+1 ? strtoul(argv[arg+1], 0, 0) : 1;
+        int tolerance = argc > arg+2 ? atoi(argv[arg+2]) : 1;
+        if (!cache)
+            return compare(count, seed, tolerance);
+
+        // runs the generated code the last run saved, when there is one
+        gglSetCodeCacheSize(1024*1024);
+        gglLoadCodeCache(cache);
+        const int err = compare(count, seed, tolerance);
+        GGLCodeCacheStats stats;
+        gglGetCodeCacheStats(&stats);
+        printf("%u scanlines cached, %u generated in %lld us\n",
+                stats.count, stats.compiles,
+                (long long)stats.compileTime / 1000);
+        gglSaveCodeCache(cache);
+        return err;
+    }
     if (argc != 2) {
         printf("usage: %s 00000117:03454504_00001501_00000000\n", argv[0]);
+        printf("       %s -c [-a] [-f cache] [states] [seed] [tolerance]\n",
+                argv[0]);
         return 0;
     }
     uint32_t n;
@@ -21,6 +21,7 @@
 
 #include "trap.h"
 #include "picker.h"
+#include "bands.h"
 
 #include <cutils/log.h>
 #include <cutils/memory.h>
@@ -45,6 +46,7 @@ static void aa_linex(void *con, const GGLcoord* v0, const GGLcoord* v1, GGLcoord
 
 static void recti_validate(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
 static void recti(void* c, GGLint l, GGLint t, GGLint r, GGLint b); 
+static void recti_band(context_t* c, int32_t top, int32_t bottom, void*);
 
 static void trianglex_validate(void*,
         const GGLcoord*, const GGLcoord*, const GGLcoord*);
@@ -435,11 +437,20 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
     if (xc>0 && yc>0) {
         c->iterators.xl = l;
         c->iterators.xr = r;
+        if (ggl_bands(c, t, b, xc, recti_band, &t, true))
+            return;
         c->init_y(c, t);
         c->rect(c, yc);
     }
 }
 
+void recti_band(context_t* c, int32_t top, int32_t bottom, void* cookie)
+{
+    // the rectangle starts at scanline *cookie
+    ggl_bands_init_y(c, *(GGLint*)cookie, top);
+    c->rect(c, bottom - top);
+}
+
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -757,22 +768,37 @@ triangle_sweep_edges( Edge*  left,
 }
 
 
-void trianglex_big(void* con,
-        const GGLcoord* v0, const GGLcoord* v1, const GGLcoord* v2)
+struct Triangle
 {
-    GGL_CONTEXT(c, con);
+  Edge     edges[3];
+  Edge*    left;
+  Edge*    right;
+  Edge*    other;
+  int32_t  y_top;
+  int32_t  y_bot;
+};
 
-    Edge edges[3];
+// sets up the edges of the part of the triangle between scanlines
+// top and bottom, returns false if it doesn't cross any of them
+static bool
+triangle_setup( Triangle*        tri,
+                const GGLcoord*  v0,
+                const GGLcoord*  v1,
+                const GGLcoord*  v2,
+                int32_t          top,
+                int32_t          bottom )
+{
+    Edge* edges = tri->edges;
 	int num_edges = 0;
-	int32_t ymin = TRI_FROM_INT(c->state.scissor.top)    + TRI_HALF;
-	int32_t ymax = TRI_FROM_INT(c->state.scissor.bottom) - TRI_HALF;
+	int32_t ymin = TRI_FROM_INT(top)    + TRI_HALF;
+	int32_t ymax = TRI_FROM_INT(bottom) - TRI_HALF;
 	    
 	edge_setup( edges, &num_edges, v0, v1, ymin, ymax );
 	edge_setup( edges, &num_edges, v0, v2, ymin, ymax );
 	edge_setup( edges, &num_edges, v1, v2, ymin, ymax );
 
     if (ggl_unlikely(num_edges<2))  // for really tiny triangles that don't
-		return;                     // cross any scanline centers
+		return false;               // cross any scanline centers
 
     Edge* left  = &edges[0];
     Edge* right = &edges[1];
@@ -792,7 +818,23 @@ void trianglex_big(void* con,
 		}
     }
 
-    c->init_y(c, y_top >> TRI_FRACTION_BITS);
+    tri->left  = left;
+    tri->right = right;
+    tri->other = other;
+    tri->y_top = y_top;
+    tri->y_bot = y_bot;
+    return true;
+}
+
+static void
+triangle_sweep( Triangle*   tri,
+                context_t*  c )
+{
+    Edge* left  = tri->left;
+    Edge* right = tri->right;
+    Edge* other = tri->other;
+    const int32_t y_top = tri->y_top;
+    const int32_t y_bot = tri->y_bot;
 
     int32_t y_mid = min(left->y_bot, right->y_bot);
     triangle_sweep_edges( left, right, y_top, y_mid, c );
@@ -808,6 +850,53 @@ void trianglex_big(void* con,
     }
 }
 
+struct TriangleBands
+{
+  const GGLcoord*  v[3];
+  int32_t          y_top;   // first scanline of the whole triangle
+};
+
+static void
+triangle_band( context_t* c, int32_t top, int32_t bottom, void* cookie )
+{
+    // each band is the triangle scissored to its scanlines
+    const TriangleBands* bands = (const TriangleBands*)cookie;
+    Triangle tri;
+    if (triangle_setup(&tri, bands->v[0], bands->v[1], bands->v[2],
+            top, bottom)) {
+        ggl_bands_init_y(c, bands->y_top, tri.y_top >> TRI_FRACTION_BITS);
+        triangle_sweep(&tri, c);
+    }
+}
+
+void trianglex_big(void* con,
+        const GGLcoord* v0, const GGLcoord* v1, const GGLcoord* v2)
+{
+    GGL_CONTEXT(c, con);
+
+    Triangle tri;
+    if (!triangle_setup(&tri, v0, v1, v2,
+            c->state.scissor.top, c->state.scissor.bottom))
+        return;
+
+    const int32_t top = tri.y_top >> TRI_FRACTION_BITS;
+    if (ggl_unlikely(c->state.enables & GGL_ENABLE_MULTITHREAD)) {
+        const int32_t bottom = (tri.y_bot >> TRI_FRACTION_BITS) + 1;
+        const int32_t xmin = max(min(v0[0], v1[0], v2[0]) >> TRI_FRACTION_BITS,
+                int32_t(c->state.scissor.left));
+        const int32_t xmax = min(max(v0[0], v1[0], v2[0]) >> TRI_FRACTION_BITS,
+                int32_t(c->state.scissor.right));
+        // about half of the bounding box is covered
+        const TriangleBands bands = { { v0, v1, v2 }, top };
+        if (ggl_bands(c, top, bottom, (xmax - xmin) / 2,
+                triangle_band, (void*)&bands, true))
+            return;
+    }
+
+    c->init_y(c, top);
+    triangle_sweep(&tri, c);
+}
+
 void aa_trianglex(void* con,
         const GGLcoord* a, const GGLcoord* b, const GGLcoord* c)
 {
@@ -16,13 +16,25 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 
 #define DEFAULT_LOG_ROTATE_SIZE_KBYTES 16
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
+/* formatted lines are written out this many bytes at a time, or when
+ * there is nothing left to read */
+#define OUTPUT_BUFFER_SIZE (16*1024)
+
+/* -b can be given this many times */
+#define MAX_LOG_DEVICES 8
+
+/* entries read ahead from each device, for merging */
+#define READ_AHEAD_BYTES (64*1024)
+
 static AndroidLogFormat * g_logformat;
 
 /* logd prefixes records with a length field */
@@ -40,7 +52,7 @@ static int g_logRotateSizeKBytes = 0;                   // 0 means "no log rotat
 static int g_maxRotatedLogs = DEFAULT_MAX_ROTATED_LOGS; // 0 means "unbounded"
 static int g_outFD = -1;
 static off_t g_outByteCount = 0;
-static int g_isBinary = 0;
+static int g_isBinary = 0;     // reading the events log, which needs the tag map
 static int g_printBinary = 0;
 
 static EventTagMap* g_eventTagMap = NULL;
@@ -59,6 +71,7 @@ static void rotateLogs()
         return;
     }
 
+    android_log_flushOutputBuffer(g_logformat, g_outFD);
     close(g_outFD);
 
     for (int i = g_maxRotatedLogs ; i > 0 ; i--) {
@@ -103,14 +116,27 @@ void printBinary(struct logger_entry *buf)
     } while (ret < 0 && errno == EINTR);
 }
 
-static void processBuffer(struct logger_entry *buf)
+/*
+ * A log device being read. Its entries are read ahead into buf, one after
+ * the other, each padded to 4 bytes, and printed from head up to tail.
+ */
+struct LogDevice {
+    char *path;
+    int isBinary;
+    int fd;
+    unsigned char *buf;
+    size_t head;
+    size_t tail;
+};
+
+static void processBuffer(struct logger_entry *buf, int isBinary)
 {
     int bytesWritten;
     int err;
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
 
-    if (g_isBinary) {
+    if (isBinary) {
         err = android_log_processBinaryLogBuffer(buf, &entry, g_eventTagMap,
                 binaryMsgBuf, sizeof(binaryMsgBuf));
         //printf(">>> pri=%d len=%d msg='%s'\n",
@@ -142,14 +168,30 @@ error:
     return;
 }
 
-static void readLogLines(int logfd)
+static inline struct logger_entry *headEntry(LogDevice *dev)
 {
-    while (1) {
-        unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1] __attribute__((aligned(4)));
-        struct logger_entry *entry = (struct logger_entry *) buf;
+    return (struct logger_entry *) (dev->buf + dev->head);
+}
+
+static inline size_t entrySpace(struct logger_entry *entry)
+{
+    /* with its terminating NUL, keeping the next one aligned */
+    return (sizeof(logger_entry) + entry->len + 1 + 3) & ~3;
+}
+
+/* the device's fd is non-blocking: reads until it runs dry, or the read
+ * ahead buffer is full. returns the number of entries read */
+static int fillDevice(LogDevice *dev)
+{
+    int count = 0;
+
+    dev->head = dev->tail = 0;
+    while (READ_AHEAD_BYTES - dev->tail >= LOGGER_ENTRY_MAX_LEN + 1) {
+        struct logger_entry *entry =
+                (struct logger_entry *) (dev->buf + dev->tail);
         int ret;
 
-        ret = read(logfd, entry, LOGGER_ENTRY_MAX_LEN);
+        ret = read(dev->fd, entry, LOGGER_ENTRY_MAX_LEN);
         if (ret < 0) {
             if (errno == EINTR)
                 continue;
@@ -166,15 +208,185 @@ static void readLogLines(int logfd)
         /* NOTE: driver guarantees we read exactly one full entry */
 
         entry->msg[entry->len] = '\0';
+        dev->tail += entrySpace(entry);
+        count++;
+    }
+    return count;
+}
 
-        if (g_printBinary) {
-            printBinary(entry);
-        } else {
-            (void) processBuffer(entry);
+static inline int entryBefore(LogDevice *a, LogDevice *b)
+{
+    struct logger_entry *ea = headEntry(a);
+    struct logger_entry *eb = headEntry(b);
+
+    return ea->sec < eb->sec || (ea->sec == eb->sec && ea->nsec < eb->nsec);
+}
+
+/* a binary heap of the devices with entries read ahead, by the time of
+ * their next entry */
+static void heapPush(LogDevice **heap, int *size, LogDevice *dev)
+{
+    int i = (*size)++;
+
+    while (i > 0 && entryBefore(dev, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = dev;
+}
+
+static LogDevice *heapPop(LogDevice **heap, int *size)
+{
+    LogDevice *top = heap[0];
+    LogDevice *last = heap[--(*size)];
+    int i = 0;
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= *size)
+            break;
+        if (child + 1 < *size && entryBefore(heap[child + 1], heap[child]))
+            child++;
+        if (!entryBefore(heap[child], last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * Prints the entries of all the devices merged in time order.
+ *
+ * The driver stamps entries as they are written, so entries still unread
+ * in a device are newer than everything read from any device before
+ * them. A device that runs out of entries read ahead is therefore read
+ * again before any entry newer than its last one is printed, and the
+ * devices that had run dry are read again along with it.
+ *
+ * When all of them are dry the output is flushed, then we either wait
+ * for more or return if dumping.
+ */
+static void readLogLines(LogDevice *devices, int count, int dump)
+{
+    LogDevice *heap[MAX_LOG_DEVICES];
+    int heapSize;
+    int i;
+
+    while (1) {
+        heapSize = 0;
+        for (i = 0; i < count; i++) {
+            if (fillDevice(&devices[i]) > 0)
+                heapPush(heap, &heapSize, &devices[i]);
+        }
+
+        while (heapSize > 0) {
+            LogDevice *dev = heapPop(heap, &heapSize);
+            struct logger_entry *entry = headEntry(dev);
+
+            if (g_printBinary) {
+                printBinary(entry);
+            } else {
+                (void) processBuffer(entry, dev->isBinary);
+            }
+
+            dev->head += entrySpace(entry);
+            if (dev->head < dev->tail) {
+                heapPush(heap, &heapSize, dev);
+                continue;
+            }
+
+            for (i = 0; i < count; i++) {
+                LogDevice *other = &devices[i];
+
+                if (other->head == other->tail && fillDevice(other) > 0)
+                    heapPush(heap, &heapSize, other);
+            }
+        }
+
+        android_log_flushOutputBuffer(g_logformat, g_outFD);
+        if (dump)
+            break;
+
+        struct pollfd pfds[MAX_LOG_DEVICES];
+
+        for (i = 0; i < count; i++) {
+            pfds[i].fd = devices[i].fd;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds, count, -1) < 0 && errno != EINTR) {
+            perror("logcat poll");
+            exit(EXIT_FAILURE);
         }
     }
 }
 
+/*
+ * Runs the entries of a log saved with -B through the usual filtering
+ * and formatting as fast as they go, and reports the rate on stderr.
+ */
+static void replayLogFile(const char *pathname)
+{
+    struct stat statbuf;
+    const unsigned char *data, *p, *end;
+    struct timespec start, stop;
+    int fd, entries = 0;
+    double seconds;
+
+    fd = open(pathname, O_RDONLY);
+    if (fd < 0 || fstat(fd, &statbuf) < 0) {
+        fprintf(stderr, "Unable to open '%s': %s\n", pathname, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (statbuf.st_size == 0) {
+        fprintf(stderr, "'%s' is empty\n", pathname);
+        exit(EXIT_FAILURE);
+    }
+    data = (const unsigned char *) mmap(NULL, statbuf.st_size, PROT_READ,
+            MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    p = data;
+    end = data + statbuf.st_size;
+    while (p < end) {
+        unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1] __attribute__((aligned(4)));
+        struct logger_entry *entry = (struct logger_entry *) buf;
+        size_t size;
+
+        if ((size_t)(end - p) < sizeof(logger_entry)) {
+            fprintf(stderr, "'%s': truncated entry\n", pathname);
+            break;
+        }
+        memcpy(entry, p, sizeof(logger_entry));
+        size = sizeof(logger_entry) + entry->len;
+        if (entry->len > LOGGER_ENTRY_MAX_PAYLOAD || (size_t)(end - p) < size) {
+            fprintf(stderr, "'%s': truncated entry\n", pathname);
+            break;
+        }
+        memcpy(entry, p, size);
+        entry->msg[entry->len] = '\0';
+
+        processBuffer(entry, g_isBinary);
+        p += size;
+        entries++;
+    }
+    android_log_flushOutputBuffer(g_logformat, g_outFD);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d lines in %.3fs: %.0f lines/s\n", entries, seconds,
+            seconds > 0 ? entries / seconds : 0);
+    munmap((void *) data, statbuf.st_size);
+}
+
 static int clearLog(int logfd)
 {
     return ioctl(logfd, LOGGER_FLUSH_LOG);
@@ -231,7 +443,10 @@ static void show_help(const char *cmd)
                     "  -g              get the size of the log's ring buffer and exit\n"
                     "  -b <buffer>     request alternate ring buffer\n"
                     "                  ('main' (default), 'radio', 'events')\n"
-                    "  -B              output the log in binary");
+                    "                  repeat to read several, merged by time\n"
+                    "  -B              output the log in binary\n"
+                    "  -R <file>       replay a log saved with -B instead of reading\n"
+                    "                  a ring buffer, and report lines/sec on stderr");
 
 
     fprintf(stderr,"\nfilterspecs are a series of \n"
@@ -277,14 +492,15 @@ extern "C" void logprint_run_tests(void);
 
 int main (int argc, char **argv)
 {
-    int logfd;
+    android::LogDevice devices[MAX_LOG_DEVICES];
+    int devCount = 0;
     int err;
     int hasSetLogFormat = 0;
     int clearLog = 0;
     int getLogSize = 0;
     int mode = O_RDONLY;
-    char *log_device = strdup("/dev/"LOGGER_LOG_MAIN);
     const char *forceFilters = NULL;
+    const char *replayFile = NULL;
 
     g_logformat = android_log_format_new();
 
@@ -301,7 +517,7 @@ int main (int argc, char **argv)
     for (;;) {
         int ret;
 
-        ret = getopt(argc, argv, "cdgsQf:r::n:v:b:B");
+        ret = getopt(argc, argv, "cdgsQf:r::n:v:b:BR:");
 
         if (ret < 0) {
             break;
@@ -326,20 +542,33 @@ int main (int argc, char **argv)
                 getLogSize = 1;
             break;
 
-            case 'b':
-                free(log_device);
-                log_device =
-                    (char*) malloc(strlen(LOG_FILE_DIR) + strlen(optarg) + 1);
-                strcpy(log_device, LOG_FILE_DIR);
-                strcat(log_device, optarg);
+            case 'b': {
+                char *path;
 
-                android::g_isBinary = (strcmp(optarg, "events") == 0);
+                if (devCount == MAX_LOG_DEVICES) {
+                    fprintf(stderr, "Too many -b options\n");
+                    exit(-1);
+                }
+                path = (char*) malloc(strlen(LOG_FILE_DIR) + strlen(optarg) + 1);
+                strcpy(path, LOG_FILE_DIR);
+                strcat(path, optarg);
+
+                devices[devCount].path = path;
+                devices[devCount].isBinary = (strcmp(optarg, "events") == 0);
+                if (devices[devCount].isBinary)
+                    android::g_isBinary = 1;
+                devCount++;
+            }
             break;
 
             case 'B':
                 android::g_printBinary = 1;
             break;
 
+            case 'R':
+                replayFile = optarg;
+            break;
+
             case 'f':
                 // redirect output to a file
 
@@ -470,6 +699,11 @@ int main (int argc, char **argv)
 
     android::setupOutput();
 
+    if (android_log_setOutputBuffer(g_logformat, OUTPUT_BUFFER_SIZE) < 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (hasSetLogFormat == 0) {
         const char* logFormat = getenv("ANDROID_PRINTF_LOG");
 
@@ -516,42 +750,72 @@ int main (int argc, char **argv)
         }
     }
 
-    logfd = open(log_device, mode);
-    if (logfd < 0) {
-        fprintf(stderr, "Unable to open log device '%s': %s\n",
-            log_device, strerror(errno));
-        exit(EXIT_FAILURE);
+    if (replayFile) {
+        if (android::g_isBinary)
+            android::g_eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
+        android::replayLogFile(replayFile);
+        return 0;
     }
 
-    if (clearLog) {
-        int ret;
-        ret = android::clearLog(logfd);
-        if (ret) {
-            perror("ioctl");
-            exit(EXIT_FAILURE);
-        }
-        return 0;
+    if (devCount == 0) {
+        devices[0].path = strdup("/dev/"LOGGER_LOG_MAIN);
+        devices[0].isBinary = 0;
+        devCount = 1;
     }
 
-    if (getLogSize) {
-        int size, readable;
+    for (int i = 0 ; i < devCount ; i++) {
+        android::LogDevice *dev = &devices[i];
 
-        size = android::getLogSize(logfd);
-        if (size < 0) {
-            perror("ioctl");
+        dev->fd = open(dev->path, mode | O_NONBLOCK);
+        if (dev->fd < 0) {
+            fprintf(stderr, "Unable to open log device '%s': %s\n",
+                dev->path, strerror(errno));
             exit(EXIT_FAILURE);
         }
 
-        readable = android::getLogReadableSize(logfd);
-        if (readable < 0) {
-            perror("ioctl");
+        if (clearLog) {
+            int ret;
+            ret = android::clearLog(dev->fd);
+            if (ret) {
+                perror("ioctl");
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+
+        if (getLogSize) {
+            int size, readable;
+
+            size = android::getLogSize(dev->fd);
+            if (size < 0) {
+                perror("ioctl");
+                exit(EXIT_FAILURE);
+            }
+
+            readable = android::getLogReadableSize(dev->fd);
+            if (readable < 0) {
+                perror("ioctl");
+                exit(EXIT_FAILURE);
+            }
+
+            if (devCount > 1)
+                printf("%s: ", dev->path);
+            printf("ring buffer is %dKb (%dKb consumed), "
+                   "max entry is %db, max payload is %db\n",
+                   size / 1024, readable / 1024,
+                   (int) LOGGER_ENTRY_MAX_LEN, (int) LOGGER_ENTRY_MAX_PAYLOAD);
+            continue;
+        }
+
+        dev->buf = (unsigned char *) malloc(READ_AHEAD_BYTES);
+        if (dev->buf == NULL) {
+            fprintf(stderr, "out of memory\n");
             exit(EXIT_FAILURE);
         }
+        dev->head = dev->tail = 0;
+    }
 
-        printf("ring buffer is %dKb (%dKb consumed), "
-               "max entry is %db, max payload is %db\n",
-               size / 1024, readable / 1024,
-               (int) LOGGER_ENTRY_MAX_LEN, (int) LOGGER_ENTRY_MAX_PAYLOAD);
+    if (clearLog || getLogSize) {
         return 0;
     }
 
@@ -562,7 +826,7 @@ int main (int argc, char **argv)
     if (android::g_isBinary)
         android::g_eventTagMap = android_openEventTagMap(EVENT_TAG_MAP_FILE);
 
-    android::readLogLines(logfd);
+    android::readLogLines(devices, devCount, mode & O_NONBLOCK);
 
     return 0;
 }